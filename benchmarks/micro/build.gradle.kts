@@ -11,6 +11,13 @@ android {
     defaultConfig {
         testInstrumentationRunner =
             "androidx.benchmark.junit4.AndroidBenchmarkRunner"
+
+        externalNativeBuild.cmake {
+            val depsDir = System.getenv("CPCAM_DEPS_TARGET_DIR")
+                ?: "${project.rootDir}/jni_deps/targets"
+
+            arguments += listOf("-DDEPS_TARGET_DIR='$depsDir'")
+        }
     }
 
     testBuildType = "release"
@@ -0,0 +1,106 @@
+#include <jni.h>
+
+extern "C" {
+#include <libavutil/pixdesc.h>
+}
+
+#include "stream/FrameIngest.h"
+
+// Amount of frames handled by single jni call, so jni overhead doesn't hide
+// per-frame cost
+constexpr int FRAMES_PER_CALL = 1024;
+
+struct FakeFrame {
+    uint8_t *data[8];
+    int linesize[8];
+};
+
+alignas(64) static uint8_t g_planes[3][64];
+static uint8_t *g_src[4] = {g_planes[0], g_planes[1], g_planes[2], nullptr};
+static int32_t g_src_stride[4] = {1920, 1920, 1920, 0};
+
+// State that previous FFmpegVideoStream kept after set_pixel_format()
+struct RuntimeStream {
+    AVPixelFormat pix_fmt;
+    int plane_count;
+};
+
+static AVPixelFormat as_av_pix_fmt(PixFmt fmt) {
+    switch (fmt) {
+        case PixFmt::YUV420P: return AV_PIX_FMT_YUV420P;
+        case PixFmt::YUV444P: return AV_PIX_FMT_YUV444P;
+        case PixFmt::NV12: return AV_PIX_FMT_NV12;
+        case PixFmt::NV21: return AV_PIX_FMT_NV21;
+        case PixFmt::RGBA: return AV_PIX_FMT_RGBA;
+        case PixFmt::RGB24: return AV_PIX_FMT_RGB24;
+        case PixFmt::Unknown: break;
+    }
+
+    return AV_PIX_FMT_NONE;
+}
+
+// Mirrors previous ingestion path: every source plane is copied, then plane
+// order and plane count reported by av_pix_fmt_count_planes() are applied on
+// every frame
+[[gnu::noinline]] static void runtime_ingest(const RuntimeStream &stream,
+                                             FakeFrame &out) {
+    FrameData data = {};
+
+    for (int i = 0; i < 3; i++) {
+        data.buff[i] = g_src[i];
+        data.buff_stride[i] = g_src_stride[i];
+    }
+
+    if (stream.pix_fmt == AV_PIX_FMT_NV21) {
+        data.buff[1] = data.buff[2];
+        data.buff_stride[1] = data.buff_stride[2];
+    }
+
+    for (int i = 0; i < stream.plane_count; i++) {
+        out.data[i] = data.buff[i];
+        out.linesize[i] = data.buff_stride[i];
+    }
+}
+
+[[gnu::noinline]] static void specialized_ingest(const FrameIngestOps *ops,
+                                                 FakeFrame &out) {
+    FrameData data = {};
+
+    ops->reorder_planes(g_src, g_src_stride, data);
+    ops->map_planes(data, out.data, out.linesize);
+}
+
+extern "C" {
+
+JNIEXPORT jlong JNICALL
+Java_com_rejeq_cpcam_microbenchmarks_FrameIngestBenchmark_runtimeIngest(
+    JNIEnv * /* env */, jobject /* obj */, jint pixFmt) {
+    RuntimeStream stream = {.pix_fmt = as_av_pix_fmt((PixFmt)pixFmt)};
+    stream.plane_count = av_pix_fmt_count_planes(stream.pix_fmt);
+
+    FakeFrame out = {};
+    jlong sum = 0;
+
+    for (int i = 0; i < FRAMES_PER_CALL; i++) {
+        runtime_ingest(stream, out);
+        sum += out.linesize[1];
+    }
+
+    return sum;
+}
+
+JNIEXPORT jlong JNICALL
+Java_com_rejeq_cpcam_microbenchmarks_FrameIngestBenchmark_specializedIngest(
+    JNIEnv * /* env */, jobject /* obj */, jint pixFmt) {
+    const FrameIngestOps *ops = get_frame_ingest_ops((PixFmt)pixFmt);
+    FakeFrame out = {};
+    jlong sum = 0;
+
+    for (int i = 0; i < FRAMES_PER_CALL; i++) {
+        specialized_ingest(ops, out);
+        sum += out.linesize[1];
+    }
+
+    return sum;
+}
+}
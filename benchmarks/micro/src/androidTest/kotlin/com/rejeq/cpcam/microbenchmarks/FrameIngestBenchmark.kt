@@ -0,0 +1,61 @@
+package com.rejeq.cpcam.microbenchmarks
+
+import androidx.benchmark.BlackHole
+import androidx.benchmark.ExperimentalBlackHoleApi
+import androidx.benchmark.junit4.BenchmarkRule
+import androidx.benchmark.junit4.measureRepeated
+import androidx.test.ext.junit.runners.AndroidJUnit4
+import org.junit.Rule
+import org.junit.Test
+import org.junit.runner.RunWith
+
+/**
+ * Compares per-frame plane handling overhead of the previous ingestion, that
+ * used plane count from av_pix_fmt_count_planes, with the one specialized per
+ * pixel format. Every iteration handles 1024 frames.
+ */
+@OptIn(ExperimentalBlackHoleApi::class)
+@RunWith(AndroidJUnit4::class)
+class FrameIngestBenchmark {
+    @get:Rule
+    val benchmarkRule = BenchmarkRule()
+
+    init {
+        System.loadLibrary("cpcam_bench_jni")
+    }
+
+    @Test
+    fun measureRuntimeNv21() {
+        benchmarkRule.measureRepeated {
+            BlackHole.consume(runtimeIngest(PIX_FMT_NV21))
+        }
+    }
+
+    @Test
+    fun measureSpecializedNv21() {
+        benchmarkRule.measureRepeated {
+            BlackHole.consume(specializedIngest(PIX_FMT_NV21))
+        }
+    }
+
+    @Test
+    fun measureRuntimeYuv420p() {
+        benchmarkRule.measureRepeated {
+            BlackHole.consume(runtimeIngest(PIX_FMT_YUV420P))
+        }
+    }
+
+    @Test
+    fun measureSpecializedYuv420p() {
+        benchmarkRule.measureRepeated {
+            BlackHole.consume(specializedIngest(PIX_FMT_YUV420P))
+        }
+    }
+
+    external fun runtimeIngest(pixFmt: Int): Long
+    external fun specializedIngest(pixFmt: Int): Long
+}
+
+// NOTE: Keep sync with jni PixFmt
+private const val PIX_FMT_YUV420P = 0
+private const val PIX_FMT_NV21 = 3
@@ -27,6 +27,7 @@ fun StreamProtocolProto?.fromDataStore() = when (this) {
     StreamProtocolProto.STREAM_PROTOCOL_RTP -> StreamProtocol.RTP
     StreamProtocolProto.STREAM_PROTOCOL_RTP_MPEGTS -> StreamProtocol.RTP_MPEGTS
     StreamProtocolProto.STREAM_PROTOCOL_HLS -> StreamProtocol.HLS
+    StreamProtocolProto.STREAM_PROTOCOL_LL_HLS -> StreamProtocol.LL_HLS
 }
 
 fun StreamProtocol.toDataStore() = when (this) {
@@ -37,6 +38,7 @@ fun StreamProtocol.toDataStore() = when (this) {
     StreamProtocol.RTP -> StreamProtocolProto.STREAM_PROTOCOL_RTP
     StreamProtocol.RTP_MPEGTS -> StreamProtocolProto.STREAM_PROTOCOL_RTP_MPEGTS
     StreamProtocol.HLS -> StreamProtocolProto.STREAM_PROTOCOL_HLS
+    StreamProtocol.LL_HLS -> StreamProtocolProto.STREAM_PROTOCOL_LL_HLS
 }
 
 fun VideoCodecProto?.fromDataStore() = when (this) {
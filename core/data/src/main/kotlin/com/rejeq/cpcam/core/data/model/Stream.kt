@@ -11,6 +11,7 @@ enum class StreamProtocol {
     RTP,
     RTP_MPEGTS,
     HLS,
+    LL_HLS,
 }
 
 /**
@@ -73,7 +73,8 @@ class ObsEndpoint @AssistedInject constructor(
     }
 
     companion object {
-        val supportedProtocols = StreamProtocol.entries
+        // Low-latency HLS is written only into local files
+        val supportedProtocols = StreamProtocol.entries - StreamProtocol.LL_HLS
     }
 }
 
@@ -2,3 +2,11 @@
 -keep class com.rejeq.cpcam.core.stream.jni.FFmpegVideoStreamJni { *; }
 -keep class com.rejeq.cpcam.core.stream.jni.FFmpegVideoConfig { *; }
 -keep class com.rejeq.cpcam.core.stream.jni.FFmpegPixFmt { *; }
+-keep class com.rejeq.cpcam.core.stream.jni.FFmpegCodecProbeResult { *; }
+-keep class com.rejeq.cpcam.core.stream.jni.TraceLogJni { *; }
+-keep class com.rejeq.cpcam.core.stream.jni.ThreadPolicyJni { *; }
+-keep class com.rejeq.cpcam.core.stream.jni.FFmpegReplayReport { *; }
+-keep class com.rejeq.cpcam.core.stream.jni.FFmpegTimestampStats { *; }
+-keep class com.rejeq.cpcam.core.stream.jni.FFmpegFrameRingJni { *; }
+-keep class com.rejeq.cpcam.core.stream.jni.NativeEventsJni { *; }
+-keep class com.rejeq.cpcam.core.stream.jni.FFmpegQualityStats { *; }
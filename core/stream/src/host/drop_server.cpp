@@ -0,0 +1,256 @@
+// Receives tcp:// output of the app and drops the connection periodically,
+// to check that the output reconnects without restarting the session.
+//
+// Usage: drop_server [host:]port [drop interval in seconds] [drop count]
+//
+// One connection is served at a time. Every connection is closed after the
+// interval, until drop count connections were dropped (0 drops forever).
+// For every connection it reports received bytes, recovery time (from the
+// drop to the first byte of the next connection) and whether the data
+// starts with a container header (MPEG-TS sync byte or FLV signature),
+// since the header must be written again on the new connection.
+//
+// Exits with non-zero code when the output didn't come back after a drop or
+// a reconnected stream didn't start with a header.
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+constexpr uint8_t TS_SYNC_BYTE = 0x47;
+
+// Output that isn't back within this time is considered failed
+constexpr int64_t RECOVERY_TIMEOUT_NS = 30'000'000'000LL;
+
+static volatile sig_atomic_t g_is_stopping = 0;
+
+static int64_t monotonic_ns() {
+    timespec ts{};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1'000'000'000LL + ts.tv_nsec;
+}
+
+static bool has_header(const uint8_t *data, int size) {
+    if (size >= 3 && memcmp(data, "FLV", 3) == 0) {
+        return true;
+    }
+
+    return size >= 1 && data[0] == TS_SYNC_BYTE;
+}
+
+static int open_tcp(const std::string &address) {
+    std::string host;
+    std::string port = address;
+
+    size_t colon = address.rfind(':');
+    if (colon != std::string::npos) {
+        host = address.substr(0, colon);
+        port = address.substr(colon + 1);
+    }
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(atoi(port.c_str()));
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (!host.empty() &&
+        inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1) {
+        fprintf(stderr, "Invalid host: %s\n", host.c_str());
+        return -1;
+    }
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int reuse = 1;
+    if (fd >= 0) {
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    }
+
+    if (fd < 0 || bind(fd, (sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(fd, 1) < 0) {
+        fprintf(stderr, "Unable to listen on %s: %s\n", address.c_str(),
+                strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+
+    return fd;
+}
+
+// Waits for fd to become readable, returns false on timeout or stop
+static bool wait_readable(int fd, int64_t deadline_ns) {
+    while (!g_is_stopping) {
+        int64_t left_ms = (deadline_ns - monotonic_ns()) / 1'000'000;
+        if (left_ms <= 0) {
+            return false;
+        }
+
+        pollfd pfd{.fd = fd, .events = POLLIN, .revents = 0};
+        int res = poll(&pfd, 1, (int)std::min<int64_t>(left_ms, 200));
+        if (res > 0) {
+            return true;
+        }
+
+        if (res < 0 && errno != EINTR) {
+            fprintf(stderr, "Unable to poll: %s\n", strerror(errno));
+            return false;
+        }
+    }
+
+    return false;
+}
+
+struct Connection {
+    int64_t bytes = 0;
+    // Time to the first byte since the previous drop, -1 for the first one
+    int64_t recovery_ns = -1;
+    bool has_header = false;
+    // Closed by the app instead of being dropped
+    bool is_closed_by_peer = false;
+};
+
+static Connection serve(int fd, int64_t drop_at_ns) {
+    Connection conn;
+    std::vector<uint8_t> buf(64 * 1024);
+
+    while (monotonic_ns() < drop_at_ns) {
+        if (!wait_readable(fd, drop_at_ns)) {
+            break;
+        }
+
+        ssize_t len = recv(fd, buf.data(), buf.size(), 0);
+        if (len == 0) {
+            conn.is_closed_by_peer = true;
+            break;
+        }
+
+        if (len < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            fprintf(stderr, "Unable to receive: %s\n", strerror(errno));
+            conn.is_closed_by_peer = true;
+            break;
+        }
+
+        if (conn.bytes == 0) {
+            conn.has_header = has_header(buf.data(), (int)len);
+        }
+        conn.bytes += len;
+    }
+
+    return conn;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr,
+                "Usage: %s [host:]port [drop interval in seconds] "
+                "[drop count]\n",
+                argv[0]);
+        return 1;
+    }
+
+    int interval_s = argc > 2 ? atoi(argv[2]) : 5;
+    int drop_count = argc > 3 ? atoi(argv[3]) : 0;
+
+    int listen_fd = open_tcp(argv[1]);
+    if (listen_fd < 0) {
+        return 1;
+    }
+
+    signal(SIGINT, [](int) { g_is_stopping = 1; });
+
+    int drops = 0;
+    int failures = 0;
+    int64_t dropped_at = 0;
+    std::vector<int64_t> recoveries;
+
+    while (!g_is_stopping && (drop_count == 0 || drops <= drop_count)) {
+        // Before the first connection the app may not be started yet
+        int64_t accept_deadline = dropped_at != 0
+                                      ? dropped_at + RECOVERY_TIMEOUT_NS
+                                      : INT64_MAX;
+        if (!wait_readable(listen_fd, accept_deadline)) {
+            if (!g_is_stopping) {
+                fprintf(stderr, "Output didn't reconnect within %lld s\n",
+                        (long long)(RECOVERY_TIMEOUT_NS / 1'000'000'000));
+                failures++;
+            }
+            break;
+        }
+
+        int fd = accept(listen_fd, nullptr, nullptr);
+        if (fd < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            fprintf(stderr, "Unable to accept: %s\n", strerror(errno));
+            break;
+        }
+
+        // The last allowed connection is kept until the app stops it
+        bool is_last = drop_count > 0 && drops == drop_count;
+        int64_t drop_at_ns = is_last ? INT64_MAX
+                                     : monotonic_ns() +
+                                           interval_s * 1'000'000'000LL;
+
+        // Recovery is measured to the first byte, not to accept
+        int64_t recovery_ns = -1;
+        if (wait_readable(fd, monotonic_ns() + RECOVERY_TIMEOUT_NS) &&
+            dropped_at != 0) {
+            recovery_ns = monotonic_ns() - dropped_at;
+            recoveries.push_back(recovery_ns);
+        }
+
+        Connection conn = serve(fd, drop_at_ns);
+        conn.recovery_ns = recovery_ns;
+        close(fd);
+
+        if (dropped_at != 0 && !conn.has_header) {
+            failures++;
+        }
+
+        printf("connection %d: %lld bytes, recovery %.1f ms, header %s%s\n",
+               drops, (long long)conn.bytes,
+               conn.recovery_ns < 0 ? 0.0 : (double)conn.recovery_ns / 1e6,
+               conn.has_header ? "yes" : "no",
+               conn.is_closed_by_peer ? ", closed by the app" : "");
+        fflush(stdout);
+
+        if (conn.is_closed_by_peer) {
+            break;
+        }
+
+        dropped_at = monotonic_ns();
+        drops++;
+    }
+
+    close(listen_fd);
+
+    if (!recoveries.empty()) {
+        std::sort(recoveries.begin(), recoveries.end());
+        printf("recovery after %zu drops: min %.1f ms, median %.1f ms, "
+               "max %.1f ms\n",
+               recoveries.size(), (double)recoveries.front() / 1e6,
+               (double)recoveries[recoveries.size() / 2] / 1e6,
+               (double)recoveries.back() / 1e6);
+    }
+
+    return failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,407 @@
+// Receives stream with embedded latency stamps and reports latency of every
+// pipeline stage.
+//
+// Usage: latency_probe <input> [report interval in seconds]
+//   input: file path, "-" for stdin, tcp://host:port[/path] (HTTP, e.g.
+//          output with serve:// url) or udp://[host]:port (listens)
+//
+// Stream may be MPEG-TS or raw elementary stream (H.264/HEVC/MJPEG).
+//
+// NOTE: Wall clocks of the device and this machine must be synchronized
+// (e.g. by NTP), otherwise only ingest -> encoded stage is meaningful.
+
+#include <algorithm>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <functional>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "stream/LatencyStamp.h"
+
+constexpr int TS_PACKET_SIZE = 188;
+constexpr uint8_t TS_SYNC_BYTE = 0x47;
+
+static volatile sig_atomic_t g_is_stopping = 0;
+
+static int64_t wall_ns() {
+    timespec ts{};
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec * 1'000'000'000LL + ts.tv_nsec;
+}
+
+struct Stage {
+    const char *name;
+    std::vector<double> values_ms;
+};
+
+class LatencyStats {
+   public:
+    void add(const LatencyStamp &stamp, int64_t received_wall) {
+        add_value(0, stamp.ingest_wall_ns - stamp.capture_wall_ns);
+        add_value(1, stamp.encoded_wall_ns - stamp.ingest_wall_ns);
+        add_value(2, received_wall - stamp.encoded_wall_ns);
+        add_value(3, received_wall - stamp.capture_wall_ns);
+        m_count++;
+    }
+
+    void report() {
+        if (m_count == 0) {
+            printf("No latency stamps received\n");
+            return;
+        }
+
+        printf("%d frames:\n", m_count);
+        printf("  %-20s %9s %9s %9s %9s\n", "stage (ms)", "p50", "p90", "p99",
+               "max");
+
+        for (Stage &stage : m_stages) {
+            auto &v = stage.values_ms;
+            std::sort(v.begin(), v.end());
+
+            printf("  %-20s %9.2f %9.2f %9.2f %9.2f\n", stage.name,
+                   percentile(v, 0.5), percentile(v, 0.9), percentile(v, 0.99),
+                   v.back());
+        }
+
+        fflush(stdout);
+    }
+
+    void reset() {
+        for (Stage &stage : m_stages) {
+            stage.values_ms.clear();
+        }
+        m_count = 0;
+    }
+
+   private:
+    void add_value(int stage, int64_t ns) {
+        m_stages[stage].values_ms.push_back((double)ns / 1e6);
+    }
+
+    static double percentile(const std::vector<double> &sorted, double p) {
+        size_t idx = (size_t)(p * (double)(sorted.size() - 1));
+        return sorted[idx];
+    }
+
+    Stage m_stages[4] = {
+        {"capture -> ingest", {}},
+        {"ingest -> encoded", {}},
+        {"encoded -> receive", {}},
+        {"capture -> receive", {}},
+    };
+    int m_count = 0;
+};
+
+using StampCallback =
+    std::function<void(const LatencyStamp &stamp, int64_t received_wall)>;
+
+// Finds stamps in the byte stream, which may be split at any position
+class StampScanner {
+   public:
+    explicit StampScanner(StampCallback on_stamp)
+        : m_on_stamp(std::move(on_stamp)) {}
+
+    void feed(const uint8_t *data, size_t size, int64_t received_wall) {
+        m_carry.insert(m_carry.end(), data, data + size);
+
+        size_t pos = 0;
+        size_t keep_from = 0;
+        while (true) {
+            auto it = std::search(m_carry.begin() + pos, m_carry.end(),
+                                  std::begin(LATENCY_STAMP_UUID),
+                                  std::end(LATENCY_STAMP_UUID));
+            if (it == m_carry.end()) {
+                // Uuid may be split between chunks
+                size_t tail = std::min(m_carry.size(),
+                                       sizeof(LATENCY_STAMP_UUID) - 1);
+                keep_from = std::max(pos, m_carry.size() - tail);
+                break;
+            }
+
+            size_t found = it - m_carry.begin();
+            size_t values = found + sizeof(LATENCY_STAMP_UUID);
+            if (m_carry.size() - values < LATENCY_STAMP_VALUES_SIZE) {
+                // Wait for the rest of the stamp
+                keep_from = found;
+                break;
+            }
+
+            LatencyStamp stamp{};
+            if (read_latency_stamp(m_carry.data() + values, stamp)) {
+                m_on_stamp(stamp, received_wall);
+            }
+
+            pos = values + LATENCY_STAMP_VALUES_SIZE;
+        }
+
+        m_carry.erase(m_carry.begin(), m_carry.begin() + keep_from);
+    }
+
+   private:
+    StampCallback m_on_stamp;
+    std::vector<uint8_t> m_carry;
+};
+
+// Scans payload of every PID separately, so stamps split between transport
+// packets are still found
+class TsDemuxer {
+   public:
+    explicit TsDemuxer(StampCallback on_stamp)
+        : m_on_stamp(std::move(on_stamp)) {}
+
+    void feed(const uint8_t *data, size_t size, int64_t received_wall) {
+        m_buffer.insert(m_buffer.end(), data, data + size);
+
+        size_t pos = 0;
+        while (m_buffer.size() - pos >= TS_PACKET_SIZE) {
+            if (m_buffer[pos] != TS_SYNC_BYTE) {
+                pos++;
+                continue;
+            }
+
+            parse_packet(m_buffer.data() + pos, received_wall);
+            pos += TS_PACKET_SIZE;
+        }
+
+        m_buffer.erase(m_buffer.begin(), m_buffer.begin() + pos);
+    }
+
+   private:
+    void parse_packet(const uint8_t *pkt, int64_t received_wall) {
+        int pid = ((pkt[1] & 0x1f) << 8) | pkt[2];
+        int adaptation = (pkt[3] >> 4) & 0x3;
+
+        int offset = 4;
+        if (adaptation & 0x2) {
+            offset += 1 + pkt[4];
+        }
+
+        if (!(adaptation & 0x1) || offset >= TS_PACKET_SIZE) {
+            return;
+        }
+
+        auto it = m_scanners.try_emplace(pid, m_on_stamp).first;
+        it->second.feed(pkt + offset, TS_PACKET_SIZE - offset, received_wall);
+    }
+
+    StampCallback m_on_stamp;
+    std::vector<uint8_t> m_buffer;
+    std::map<int, StampScanner> m_scanners;
+};
+
+static bool split_host_port(const std::string &address, std::string &host,
+                            std::string &port) {
+    size_t colon = address.rfind(':');
+    if (colon == std::string::npos) {
+        return false;
+    }
+
+    host = address.substr(0, colon);
+    port = address.substr(colon + 1);
+    return !port.empty();
+}
+
+static int open_tcp(const std::string &address) {
+    std::string path = "/";
+    std::string host_port = address;
+
+    size_t slash = address.find('/');
+    if (slash != std::string::npos) {
+        path = address.substr(slash);
+        host_port = address.substr(0, slash);
+    }
+
+    std::string host;
+    std::string port;
+    if (!split_host_port(host_port, host, port)) {
+        fprintf(stderr, "Invalid address: %s\n", address.c_str());
+        return -1;
+    }
+
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    addrinfo *res = nullptr;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &res) != 0) {
+        fprintf(stderr, "Unable to resolve %s\n", host.c_str());
+        return -1;
+    }
+
+    int fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    if (fd < 0 || connect(fd, res->ai_addr, res->ai_addrlen) < 0) {
+        fprintf(stderr, "Unable to connect to %s: %s\n", address.c_str(),
+                strerror(errno));
+        freeaddrinfo(res);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    freeaddrinfo(res);
+
+    std::string request = "GET " + path + " HTTP/1.0\r\nHost: " + host +
+                          "\r\n\r\n";
+    if (send(fd, request.data(), request.size(), MSG_NOSIGNAL) < 0) {
+        fprintf(stderr, "Unable to send request: %s\n", strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    // Skip response header
+    std::string header;
+    char c = 0;
+    while (header.find("\r\n\r\n") == std::string::npos) {
+        if (recv(fd, &c, 1, 0) != 1) {
+            fprintf(stderr, "Connection closed before response\n");
+            close(fd);
+            return -1;
+        }
+        header += c;
+    }
+
+    if (header.find(" 200 ") == std::string::npos) {
+        fprintf(stderr, "Unexpected response: %s", header.c_str());
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static int open_udp(const std::string &address) {
+    std::string host;
+    std::string port;
+    if (!split_host_port(address, host, port)) {
+        fprintf(stderr, "Invalid address: %s\n", address.c_str());
+        return -1;
+    }
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(atoi(port.c_str()));
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (!host.empty() &&
+        inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1) {
+        fprintf(stderr, "Invalid host: %s\n", host.c_str());
+        return -1;
+    }
+
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0 || bind(fd, (sockaddr *)&addr, sizeof(addr)) < 0) {
+        fprintf(stderr, "Unable to listen on %s: %s\n", address.c_str(),
+                strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+
+    return fd;
+}
+
+static int open_input(const std::string &input) {
+    if (input == "-") {
+        return STDIN_FILENO;
+    }
+
+    if (input.starts_with("tcp://")) {
+        return open_tcp(input.substr(6));
+    }
+
+    if (input.starts_with("udp://")) {
+        return open_udp(input.substr(6));
+    }
+
+    int fd = open(input.c_str(), O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Unable to open %s: %s\n", input.c_str(),
+                strerror(errno));
+    }
+    return fd;
+}
+
+static bool looks_like_ts(const uint8_t *data, size_t size) {
+    return size > TS_PACKET_SIZE && data[0] == TS_SYNC_BYTE &&
+           data[TS_PACKET_SIZE] == TS_SYNC_BYTE;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <input> [report interval in seconds]\n",
+                argv[0]);
+        return 1;
+    }
+
+    int interval_s = argc > 2 ? atoi(argv[2]) : 5;
+
+    int fd = open_input(argv[1]);
+    if (fd < 0) {
+        return 1;
+    }
+
+    signal(SIGINT, [](int) { g_is_stopping = 1; });
+
+    LatencyStats stats;
+    LatencyStats total;
+    auto on_stamp = [&](const LatencyStamp &stamp, int64_t received_wall) {
+        stats.add(stamp, received_wall);
+        total.add(stamp, received_wall);
+    };
+
+    StampScanner raw_scanner(on_stamp);
+    TsDemuxer ts_demuxer(on_stamp);
+
+    // Type is detected by the first read
+    int is_ts = -1;
+    int64_t last_report = wall_ns();
+
+    std::vector<uint8_t> buf(64 * 1024);
+    while (!g_is_stopping) {
+        ssize_t len = read(fd, buf.data(), buf.size());
+        if (len <= 0) {
+            break;
+        }
+
+        int64_t received = wall_ns();
+
+        if (is_ts < 0) {
+            is_ts = looks_like_ts(buf.data(), len);
+            printf("Input is %s\n", is_ts ? "MPEG-TS" : "elementary stream");
+        }
+
+        if (is_ts) {
+            ts_demuxer.feed(buf.data(), len, received);
+        } else {
+            raw_scanner.feed(buf.data(), len, received);
+        }
+
+        if (interval_s > 0 &&
+            received - last_report >= interval_s * 1'000'000'000LL) {
+            stats.report();
+            stats.reset();
+            last_report = received;
+        }
+    }
+
+    printf("Total ");
+    total.report();
+
+    if (fd != STDIN_FILENO) {
+        close(fd);
+    }
+    return 0;
+}
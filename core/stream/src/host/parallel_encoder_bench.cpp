@@ -0,0 +1,179 @@
+// Measures how encoding throughput of ParallelEncoder scales with the count
+// of encoder contexts, to check that frames are really encoded in parallel.
+//
+// Usage: parallel_encoder_bench [width] [height] [frames] [max contexts]
+//
+// Encodes the same synthetic clip with mjpeg on 1..N contexts as fast as
+// frames are accepted and reports throughput, speedup over one context and
+// efficiency (speedup divided by contexts). N defaults to the count of
+// engine workers.
+//
+// Exits with non-zero code when efficiency of any count drops below
+// MIN_EFFICIENCY, i.e. scaling isn't near-linear.
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavutil/frame.h>
+#include <libavutil/time.h>
+}
+
+#include "FFmpegUtils.h"
+#include "NativeEngine.h"
+#include "stream/ParallelEncoder.h"
+
+// Frames are generated once and reused, so generation isn't measured
+constexpr int CLIP_FRAMES = 8;
+
+constexpr double MIN_EFFICIENCY = 0.7;
+
+// Packet that isn't encoded within this time is considered lost
+constexpr int64_t RECEIVE_TIMEOUT_US = 10'000'000;
+
+// Fills frame with moving pattern, so every frame is encoded differently
+static void fill_synthetic(AVFrame *frame, int index) {
+    int plane_count = av_pix_fmt_count_planes((AVPixelFormat)frame->format);
+    for (int p = 0; p < plane_count; p++) {
+        int height = p == 0 ? frame->height : (frame->height + 1) / 2;
+        for (int y = 0; y < height; y++) {
+            uint8_t *row = frame->data[p] + (ptrdiff_t)y * frame->linesize[p];
+            for (int x = 0; x < frame->linesize[p]; x++) {
+                row[x] = (uint8_t)(x + y + index * 3 + ((x * y) ^ index));
+            }
+        }
+    }
+}
+
+// Returns encoded frames per second or negative value on failure
+static double run(const VideoConfig &config,
+                  const std::vector<AVFrame *> &clip, int frame_count,
+                  int contexts) {
+    EngineGroup group("bench");
+    ParallelEncoder *encoder =
+        ParallelEncoder::build(&group, config, 0, contexts);
+    if (!encoder) {
+        fprintf(stderr, "Unable to build encoder with %d contexts\n",
+                contexts);
+        return -1;
+    }
+
+    AVPacket *pkt = av_packet_alloc();
+    int64_t received = 0;
+    int64_t bytes = 0;
+    bool failure = false;
+
+    auto receive = [&]() {
+        int res = encoder->receive_packet(
+            pkt, av_gettime_relative() + RECEIVE_TIMEOUT_US);
+        if (res >= 0) {
+            received++;
+            bytes += pkt->size;
+            av_packet_unref(pkt);
+        } else if (res != AVERROR_EOF) {
+            failure = true;
+        }
+        return res;
+    };
+
+    int64_t start = av_gettime_relative();
+    for (int i = 0; i < frame_count && !failure; i++) {
+        AVFrame *frame = clip[i % clip.size()];
+        frame->pts = i;
+
+        int res = encoder->send_frame(frame);
+        while (res == AVERROR(EAGAIN) && !failure) {
+            // Oldest packet blocks the slot, so it's waited for
+            receive();
+            res = encoder->send_frame(frame);
+        }
+
+        if (res < 0) {
+            failure = true;
+        }
+    }
+
+    // Packets in flight are received before the time is taken
+    while (!failure && receive() != AVERROR_EOF) {
+    }
+
+    int64_t elapsed = av_gettime_relative() - start;
+
+    av_packet_free(&pkt);
+    delete encoder;
+
+    if (failure || received != frame_count || elapsed <= 0) {
+        fprintf(stderr, "Encoding with %d contexts failed\n", contexts);
+        return -1;
+    }
+
+    printf("  %lld bytes per frame\n", (long long)(bytes / received));
+    return received * 1'000'000.0 / (double)elapsed;
+}
+
+int main(int argc, char **argv) {
+    int width = argc > 1 ? atoi(argv[1]) : 1280;
+    int height = argc > 2 ? atoi(argv[2]) : 720;
+    int frame_count = argc > 3 ? atoi(argv[3]) : 300;
+    int max_contexts = argc > 4 ? atoi(argv[4]) : NativeEngine::worker_count();
+    max_contexts = std::clamp(max_contexts, 1, ParallelEncoder::MAX_WORKERS);
+
+    VideoConfig config{
+        .codec_name = "mjpeg",
+        .pix_fmt = PixFmt::YUV420P,
+        .bitrate = 20'000'000,
+        .framerate = 30,
+        .width = width,
+        .height = height,
+    };
+
+    std::vector<AVFrame *> clip;
+    for (int i = 0; i < CLIP_FRAMES; i++) {
+        AVFrame *frame = make_av_frame(width, height, AV_PIX_FMT_YUV420P);
+        if (!frame) {
+            fprintf(stderr, "Unable to allocate frame\n");
+            return 1;
+        }
+
+        fill_synthetic(frame, i);
+        clip.push_back(frame);
+    }
+
+    printf("Encoding %d frames of (%d, %d) on %d engine workers\n",
+           frame_count, width, height, NativeEngine::worker_count());
+
+    double base_fps = 0;
+    bool is_linear = true;
+    for (int contexts = 1; contexts <= max_contexts; contexts++) {
+        double fps = run(config, clip, frame_count, contexts);
+        if (fps < 0) {
+            return 1;
+        }
+
+        if (contexts == 1) {
+            base_fps = fps;
+        }
+
+        double speedup = fps / base_fps;
+        double efficiency = speedup / contexts;
+        is_linear = is_linear && efficiency >= MIN_EFFICIENCY;
+
+        printf("%d contexts: %.1f fps, speedup %.2fx, efficiency %.0f%%\n",
+               contexts, fps, speedup, efficiency * 100);
+    }
+
+    for (AVFrame *frame : clip) {
+        av_frame_free(&frame);
+    }
+
+    if (!is_linear) {
+        printf("Scaling is below %.0f%% efficiency\n", MIN_EFFICIENCY * 100);
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,203 @@
+// Checks that the steady-state encoding path takes picture and payload
+// buffers only from the pools: after warm-up no allocation of the smallest
+// payload size class (4 KiB) or bigger may happen.
+//
+// Usage: pooled_alloc_test [width] [height] [frames]
+//
+// Frames go through FramePool into an mjpeg encoder made by make_encoder(),
+// so packets are allocated by pooled_get_encode_buffer(), as in the app.
+// Allocations are counted by replacing malloc and friends of the process.
+// Small allocations (AVBufferRef structs made by ffmpeg for every
+// reference) are only reported.
+//
+// Exits with non-zero code when a big allocation happened after warm-up.
+
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavutil/frame.h>
+}
+
+#include "FFmpegUtils.h"
+#include "stream/FramePool.h"
+
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void *__libc_memalign(size_t alignment, size_t size);
+void __libc_free(void *ptr);
+}
+
+// Allocations of at least this size can only be pictures or payloads
+constexpr size_t BIG_ALLOC_SIZE = 4096;
+
+constexpr int WARMUP_FRAMES = 30;
+
+static std::atomic<bool> g_is_counting = false;
+static std::atomic<int64_t> g_small_allocs = 0;
+static std::atomic<int64_t> g_big_allocs = 0;
+static std::atomic<int64_t> g_big_bytes = 0;
+
+static void count_alloc(size_t size) {
+    if (!g_is_counting.load(std::memory_order_relaxed)) {
+        return;
+    }
+
+    if (size >= BIG_ALLOC_SIZE) {
+        g_big_allocs.fetch_add(1, std::memory_order_relaxed);
+        g_big_bytes.fetch_add((int64_t)size, std::memory_order_relaxed);
+    } else {
+        g_small_allocs.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+// Definitions of the executable take precedence over libc ones, so ffmpeg
+// libraries allocate through them as well
+extern "C" {
+void *malloc(size_t size) {
+    count_alloc(size);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+    count_alloc(count * size);
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    count_alloc(size);
+    return __libc_realloc(ptr, size);
+}
+
+void *memalign(size_t alignment, size_t size) {
+    count_alloc(size);
+    return __libc_memalign(alignment, size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+    count_alloc(size);
+    return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void **out, size_t alignment, size_t size) {
+    count_alloc(size);
+    void *ptr = __libc_memalign(alignment, size);
+    if (!ptr) {
+        return ENOMEM;
+    }
+
+    *out = ptr;
+    return 0;
+}
+
+void free(void *ptr) { __libc_free(ptr); }
+}
+
+// Fills frame with moving pattern, so packet sizes vary like in a real
+// stream
+static void fill_synthetic(AVFrame *frame, int index) {
+    int plane_count = av_pix_fmt_count_planes((AVPixelFormat)frame->format);
+    for (int p = 0; p < plane_count; p++) {
+        int height = p == 0 ? frame->height : (frame->height + 1) / 2;
+        for (int y = 0; y < height; y++) {
+            uint8_t *row = frame->data[p] + (ptrdiff_t)y * frame->linesize[p];
+            for (int x = 0; x < frame->linesize[p]; x++) {
+                row[x] = (uint8_t)(x + y + index * 3 + ((x * y) ^ index));
+            }
+        }
+    }
+}
+
+// Returns false on encoding failure
+static bool encode(AVCodecContext *cctx, FramePool &pool, AVFrame *frame,
+                   AVPacket *pkt, int index) {
+    if (!pool.get(frame, cctx->width, cctx->height, cctx->pix_fmt)) {
+        fprintf(stderr, "Unable to get frame from the pool\n");
+        return false;
+    }
+
+    fill_synthetic(frame, index);
+    frame->pts = index;
+
+    int res = avcodec_send_frame(cctx, frame);
+    av_frame_unref(frame);
+    if (res < 0) {
+        fprintf(stderr, "Unable to send frame: %d\n", res);
+        return false;
+    }
+
+    while ((res = avcodec_receive_packet(cctx, pkt)) >= 0) {
+        av_packet_unref(pkt);
+    }
+
+    return res == AVERROR(EAGAIN);
+}
+
+int main(int argc, char **argv) {
+    int width = argc > 1 ? atoi(argv[1]) : 1280;
+    int height = argc > 2 ? atoi(argv[2]) : 720;
+    int frame_count = argc > 3 ? atoi(argv[3]) : 300;
+
+    VideoConfig config{
+        .codec_name = "mjpeg",
+        .pix_fmt = PixFmt::YUV420P,
+        .bitrate = 20'000'000,
+        .framerate = 30,
+        .width = width,
+        .height = height,
+    };
+
+    AVCodecContext *cctx = make_encoder(config, 0);
+    if (!cctx) {
+        fprintf(stderr, "Unable to make encoder\n");
+        return 1;
+    }
+
+    int res = 1;
+    FramePool pool;
+    AVFrame *frame = av_frame_alloc();
+    AVPacket *pkt = av_packet_alloc();
+    if (!frame || !pkt) {
+        fprintf(stderr, "Unable to allocate frame\n");
+        goto end;
+    }
+
+    for (int i = 0; i < WARMUP_FRAMES; i++) {
+        if (!encode(cctx, pool, frame, pkt, i)) {
+            goto end;
+        }
+    }
+
+    g_is_counting = true;
+    for (int i = 0; i < frame_count; i++) {
+        if (!encode(cctx, pool, frame, pkt, WARMUP_FRAMES + i)) {
+            g_is_counting = false;
+            goto end;
+        }
+    }
+    g_is_counting = false;
+
+    printf("%d frames of (%d, %d): %lld big allocations (%lld bytes), "
+           "%.1f small allocations per frame\n",
+           frame_count, width, height, (long long)g_big_allocs.load(),
+           (long long)g_big_bytes.load(),
+           (double)g_small_allocs.load() / frame_count);
+
+    res = g_big_allocs.load() == 0 ? 0 : 1;
+    if (res != 0) {
+        printf("Pictures or payloads were allocated on the hot path\n");
+    }
+
+end:
+    av_packet_free(&pkt);
+    av_frame_free(&frame);
+    avcodec_free_context(&cctx);
+    return res;
+}
@@ -0,0 +1,278 @@
+// Receives udp:// or rtp:// output of the app and reports loss, jitter and
+// burstiness of the datagrams, e.g. to compare paced and unpaced sending.
+//
+// Usage: udp_receiver [host:]port [report interval in seconds]
+//
+// Datagrams may be RTP (any payload, RTCP is skipped) or raw MPEG-TS. Loss
+// is counted from RTP sequence numbers or from TS continuity counters.
+// Jitter is the RFC 3550 interarrival jitter of RTP with 90 kHz clock.
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+constexpr int TS_PACKET_SIZE = 188;
+constexpr uint8_t TS_SYNC_BYTE = 0x47;
+constexpr int TS_NULL_PID = 0x1FFF;
+
+constexpr int RTP_HEADER_SIZE = 12;
+constexpr int64_t RTP_CLOCK_RATE = 90'000;
+
+// Datagrams that arrive within this window are counted as one burst
+constexpr int64_t BURST_WINDOW_NS = 1'000'000;
+
+static volatile sig_atomic_t g_is_stopping = 0;
+
+static int64_t monotonic_ns() {
+    timespec ts{};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1'000'000'000LL + ts.tv_nsec;
+}
+
+static int64_t percentile(std::vector<int64_t> &sorted, double p) {
+    if (sorted.empty()) {
+        return 0;
+    }
+
+    return sorted[(size_t)(p * (double)(sorted.size() - 1))];
+}
+
+class ReceiveStats {
+   public:
+    void add(const uint8_t *data, int size, int64_t arrival_ns) {
+        if (size >= RTP_HEADER_SIZE && (data[0] >> 6) == 2) {
+            // RTCP shares version bits with RTP
+            if (data[1] >= 200 && data[1] <= 204) {
+                return;
+            }
+
+            add_rtp(data, arrival_ns);
+        } else if (size % TS_PACKET_SIZE == 0 && data[0] == TS_SYNC_BYTE) {
+            add_ts(data, size);
+        } else {
+            m_unknown++;
+        }
+
+        add_arrival(size, arrival_ns);
+    }
+
+    void report(double seconds) {
+        std::sort(m_gaps_ns.begin(), m_gaps_ns.end());
+
+        double mbps = (double)m_bytes * 8 / seconds / 1'000'000;
+        int64_t expected = m_datagrams + m_lost;
+        double loss = expected > 0 ? 100.0 * (double)m_lost / expected : 0;
+
+        printf("%lld datagrams, %.2f Mbit/s, lost: %lld (%.2f%%)",
+               (long long)m_datagrams, mbps, (long long)m_lost, loss);
+        if (m_has_rtp) {
+            printf(", jitter: %.2f ms, reordered: %lld", m_jitter * 1000.0 /
+                   RTP_CLOCK_RATE, (long long)m_reordered);
+        }
+        if (m_unknown > 0) {
+            printf(", unknown: %lld", (long long)m_unknown);
+        }
+        printf("\n");
+
+        printf("  gap (us) p50: %lld p99: %lld max: %lld, max burst: %d "
+               "datagrams per %lld ms\n",
+               (long long)percentile(m_gaps_ns, 0.5) / 1000,
+               (long long)percentile(m_gaps_ns, 0.99) / 1000,
+               m_gaps_ns.empty() ? 0LL : (long long)m_gaps_ns.back() / 1000,
+               m_max_burst, (long long)(BURST_WINDOW_NS / 1'000'000));
+        fflush(stdout);
+    }
+
+    // Sequence state is kept, so loss isn't counted twice between reports
+    void reset() {
+        m_datagrams = 0;
+        m_bytes = 0;
+        m_lost = 0;
+        m_reordered = 0;
+        m_unknown = 0;
+        m_gaps_ns.clear();
+        m_max_burst = 0;
+    }
+
+   private:
+    void add_rtp(const uint8_t *data, int64_t arrival_ns) {
+        uint16_t seq = (data[2] << 8) | data[3];
+        uint32_t ts = ((uint32_t)data[4] << 24) | ((uint32_t)data[5] << 16) |
+                      ((uint32_t)data[6] << 8) | data[7];
+
+        if (m_has_rtp) {
+            auto delta = (int16_t)(uint16_t)(seq - m_next_seq);
+            if (delta > 0) {
+                m_lost += delta;
+            } else if (delta < 0) {
+                // Late datagram was already counted as lost
+                m_reordered++;
+                m_lost = std::max<int64_t>(0, m_lost - 1);
+                return;
+            }
+
+            // RFC 3550 A.8, arrival is converted into the RTP clock
+            int64_t arrival = arrival_ns * RTP_CLOCK_RATE / 1'000'000'000;
+            int64_t transit = arrival - ts;
+            double d = (double)std::abs(transit - m_transit);
+            m_jitter += (d - m_jitter) / 16;
+            m_transit = transit;
+        } else {
+            m_transit = arrival_ns * RTP_CLOCK_RATE / 1'000'000'000 - ts;
+        }
+
+        m_has_rtp = true;
+        m_next_seq = seq + 1;
+    }
+
+    void add_ts(const uint8_t *data, int size) {
+        for (int off = 0; off < size; off += TS_PACKET_SIZE) {
+            const uint8_t *pkt = data + off;
+            int pid = ((pkt[1] & 0x1F) << 8) | pkt[2];
+            bool has_payload = pkt[3] & 0x10;
+            int cc = pkt[3] & 0x0F;
+
+            if (pid == TS_NULL_PID || !has_payload) {
+                continue;
+            }
+
+            auto it = m_next_cc.find(pid);
+            if (it != m_next_cc.end() && it->second != cc) {
+                m_lost += (cc - it->second + 16) % 16;
+            }
+
+            m_next_cc[pid] = (cc + 1) % 16;
+        }
+    }
+
+    void add_arrival(int size, int64_t arrival_ns) {
+        m_datagrams++;
+        m_bytes += size;
+
+        if (m_last_arrival_ns > 0) {
+            m_gaps_ns.push_back(arrival_ns - m_last_arrival_ns);
+        }
+        m_last_arrival_ns = arrival_ns;
+
+        m_window.push_back(arrival_ns);
+        while (arrival_ns - m_window.front() > BURST_WINDOW_NS) {
+            m_window.pop_front();
+        }
+        m_max_burst = std::max(m_max_burst, (int)m_window.size());
+    }
+
+    int64_t m_datagrams = 0;
+    int64_t m_bytes = 0;
+    int64_t m_lost = 0;
+    int64_t m_reordered = 0;
+    int64_t m_unknown = 0;
+
+    bool m_has_rtp = false;
+    uint16_t m_next_seq = 0;
+    int64_t m_transit = 0;
+    double m_jitter = 0;
+
+    std::map<int, int> m_next_cc;
+
+    int64_t m_last_arrival_ns = 0;
+    std::vector<int64_t> m_gaps_ns;
+    std::deque<int64_t> m_window;
+    int m_max_burst = 0;
+};
+
+static int open_udp(const std::string &address) {
+    std::string host;
+    std::string port = address;
+
+    size_t colon = address.rfind(':');
+    if (colon != std::string::npos) {
+        host = address.substr(0, colon);
+        port = address.substr(colon + 1);
+    }
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(atoi(port.c_str()));
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (!host.empty() &&
+        inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1) {
+        fprintf(stderr, "Invalid host: %s\n", host.c_str());
+        return -1;
+    }
+
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0 || bind(fd, (sockaddr *)&addr, sizeof(addr)) < 0) {
+        fprintf(stderr, "Unable to listen on %s: %s\n", address.c_str(),
+                strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+
+    // Bursts must not be lost in the receiver itself
+    int buf_size = 8 * 1024 * 1024;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &buf_size, sizeof(buf_size));
+
+    // Wakes up periodically to report even when nothing arrives
+    timeval timeout{.tv_sec = 1, .tv_usec = 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    return fd;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s [host:]port [report interval in seconds]\n",
+                argv[0]);
+        return 1;
+    }
+
+    int interval_s = argc > 2 ? atoi(argv[2]) : 5;
+
+    int fd = open_udp(argv[1]);
+    if (fd < 0) {
+        return 1;
+    }
+
+    signal(SIGINT, [](int) { g_is_stopping = 1; });
+
+    ReceiveStats stats;
+    int64_t last_report = monotonic_ns();
+
+    std::vector<uint8_t> buf(64 * 1024);
+    while (!g_is_stopping) {
+        ssize_t len = recv(fd, buf.data(), buf.size(), 0);
+        int64_t now = monotonic_ns();
+
+        if (len > 0) {
+            stats.add(buf.data(), (int)len, now);
+        } else if (len < 0 && errno != EAGAIN && errno != EINTR) {
+            fprintf(stderr, "Unable to receive: %s\n", strerror(errno));
+            break;
+        }
+
+        int64_t elapsed = now - last_report;
+        if (interval_s > 0 && elapsed >= interval_s * 1'000'000'000LL) {
+            stats.report((double)elapsed / 1'000'000'000);
+            stats.reset();
+            last_report = now;
+        }
+    }
+
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,176 @@
+#include "BufferPool.h"
+
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+extern "C" {
+#include <libavutil/error.h>
+#include <libavutil/mem.h>
+}
+
+#include "MemoryBudget.h"
+
+#define LOG_TAG "BufferPool"
+#include "Log.h"
+
+// Size classes from 4 KiB up to 16 MiB
+constexpr int MIN_SIZE_CLASS = 12;
+constexpr int MAX_SIZE_CLASS = 24;
+constexpr int SIZE_CLASS_COUNT = MAX_SIZE_CLASS - MIN_SIZE_CLASS + 1;
+
+// Released payloads above these limits are freed, so a burst of big packets
+// doesn't stay in the pools for the rest of the process
+constexpr size_t MAX_IDLE_PER_CLASS = 16;
+constexpr int64_t MAX_IDLE_BYTES = 16 * 1024 * 1024;
+
+// Payloads that aren't referenced, by size class. Classes live until the
+// process exits.
+struct SizeClass {
+    std::mutex lock;
+    std::vector<uint8_t *> idle;
+};
+
+static SizeClass g_size_classes[SIZE_CLASS_COUNT];
+
+// Bytes of idle payloads in all classes
+static std::atomic<int64_t> g_idle_bytes = 0;
+
+static int64_t class_bytes(int size_class) {
+    return (int64_t)1 << size_class;
+}
+
+// Must be called with locked class
+static void free_idle(SizeClass &cls, int size_class) {
+    for (uint8_t *data : cls.idle) {
+        av_free(data);
+    }
+
+    int64_t bytes = (int64_t)cls.idle.size() * class_bytes(size_class);
+    g_idle_bytes.fetch_sub(bytes, std::memory_order_relaxed);
+    MemoryBudget::release(bytes);
+    cls.idle.clear();
+}
+
+static void release_payload(void *opaque, uint8_t *data) {
+    int size_class = (int)(intptr_t)opaque;
+    SizeClass &cls = g_size_classes[size_class - MIN_SIZE_CLASS];
+
+    std::lock_guard<std::mutex> lock(cls.lock);
+
+    // Kept payloads are still accounted, so under pressure they are given
+    // back instead, together with the idle ones of the class
+    if (MemoryBudget::pressure() != MemoryPressure::None) {
+        free_idle(cls, size_class);
+        av_free(data);
+        MemoryBudget::release(class_bytes(size_class));
+        return;
+    }
+
+    int64_t bytes = class_bytes(size_class);
+    if (cls.idle.size() >= MAX_IDLE_PER_CLASS ||
+        g_idle_bytes.load(std::memory_order_relaxed) + bytes >
+            MAX_IDLE_BYTES) {
+        av_free(data);
+        MemoryBudget::release(bytes);
+        return;
+    }
+
+    g_idle_bytes.fetch_add(bytes, std::memory_order_relaxed);
+    cls.idle.push_back(data);
+}
+
+// Returns payload of the class that is accounted in MemoryBudget until it's
+// freed, nullptr when the hard limit is reached
+static uint8_t *take_payload(int size_class) {
+    SizeClass &cls = g_size_classes[size_class - MIN_SIZE_CLASS];
+    {
+        std::lock_guard<std::mutex> lock(cls.lock);
+        if (!cls.idle.empty()) {
+            uint8_t *data = cls.idle.back();
+            cls.idle.pop_back();
+            g_idle_bytes.fetch_sub(class_bytes(size_class),
+                                   std::memory_order_relaxed);
+            return data;
+        }
+    }
+
+    int64_t bytes = class_bytes(size_class);
+    if (!MemoryBudget::reserve(bytes)) {
+        // Idle payloads of other classes may be enough to fit
+        trim_buffer_pools();
+        if (!MemoryBudget::reserve(bytes)) {
+            return nullptr;
+        }
+    }
+
+    auto *data = (uint8_t *)av_malloc(bytes);
+    if (!data) {
+        LOG_ERROR("Unable to allocate payload of %lld bytes",
+                  (long long)bytes);
+        MemoryBudget::release(bytes);
+        return nullptr;
+    }
+
+    return data;
+}
+
+AVBufferRef *pooled_buffer_alloc(int size) {
+    if (size <= 0) {
+        return nullptr;
+    }
+
+    int size_class = std::bit_width((unsigned)size - 1);
+    if (size_class < MIN_SIZE_CLASS) {
+        size_class = MIN_SIZE_CLASS;
+    }
+
+    if (size_class > MAX_SIZE_CLASS) {
+        return budget_buffer_alloc(size);
+    }
+
+    uint8_t *data = take_payload(size_class);
+    if (!data) {
+        return nullptr;
+    }
+
+    // Class is passed as opaque, so release doesn't depend on
+    // AVBufferRef::size that may be changed by the owner
+    AVBufferRef *buf = av_buffer_create(data, size, release_payload,
+                                        (void *)(intptr_t)size_class, 0);
+    if (!buf) {
+        release_payload((void *)(intptr_t)size_class, data);
+        return nullptr;
+    }
+
+    return buf;
+}
+
+void trim_buffer_pools() {
+    for (int i = 0; i < SIZE_CLASS_COUNT; i++) {
+        std::lock_guard<std::mutex> lock(g_size_classes[i].lock);
+        free_idle(g_size_classes[i], MIN_SIZE_CLASS + i);
+    }
+}
+
+int pooled_get_encode_buffer(AVCodecContext *cctx, AVPacket *pkt, int flags) {
+    if (!(cctx->codec->capabilities & AV_CODEC_CAP_DR1)) {
+        return avcodec_default_get_encode_buffer(cctx, pkt, flags);
+    }
+
+    AVBufferRef *buf =
+        pooled_buffer_alloc(pkt->size + AV_INPUT_BUFFER_PADDING_SIZE);
+    if (!buf) {
+        LOG_TRACE("Unable to allocate packet buffer of %d bytes", pkt->size);
+        return AVERROR(ENOMEM);
+    }
+
+    memset(buf->data + pkt->size, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+
+    pkt->buf = buf;
+    pkt->data = buf->data;
+    return 0;
+}
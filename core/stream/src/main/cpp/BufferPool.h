@@ -0,0 +1,32 @@
+#pragma once
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavcodec/packet.h>
+#include <libavutil/buffer.h>
+}
+
+// Process wide pools for packet payloads, so steady-state streaming doesn't
+// go to the heap for every encoded frame. Packets themselves are allocated
+// once per stream and reused, so they aren't pooled.
+//
+// Payloads are accounted in MemoryBudget as long as they are held, idle
+// ones included. Every class keeps a limited amount of idle payloads, the
+// rest and everything released under memory pressure is freed.
+//
+// NOTE: Small AVBufferRef structs are still allocated by ffmpeg on every
+// reference, only payloads are recycled.
+
+// Returns buffer of exactly size bytes backed by the pool of the nearest
+// power of two size class. Buffers larger than the biggest class are
+// allocated directly. Returns nullptr on failure or when the hard limit is
+// reached even after the pools were trimmed.
+AVBufferRef *pooled_buffer_alloc(int size);
+
+// Frees payloads that aren't referenced
+void trim_buffer_pools();
+
+// AVCodecContext::get_encode_buffer that takes payloads from
+// pooled_buffer_alloc(). Encoders without AV_CODEC_CAP_DR1 use the default
+// allocator as required by ffmpeg.
+int pooled_get_encode_buffer(AVCodecContext *cctx, AVPacket *pkt, int flags);
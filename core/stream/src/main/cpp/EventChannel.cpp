@@ -0,0 +1,159 @@
+#include "EventChannel.h"
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+extern "C" {
+#include <libavutil/time.h>
+}
+
+#define LOG_TAG "EventChannel"
+#include "Log.h"
+
+// Bounded MPMC queue, every cell sequence tells whether it's free for the
+// producer at that position or filled for the consumer
+struct EventCell {
+    std::atomic<uint64_t> seq;
+    Event event;
+};
+
+struct EventQueue {
+    EventQueue() {
+        for (uint64_t i = 0; i < EventChannel::CAPACITY; i++) {
+            cells[i].seq.store(i, std::memory_order_relaxed);
+        }
+
+        fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (fd < 0) {
+            LOG_ERROR("Unable to create eventfd: %s", strerror(errno));
+        }
+    }
+
+    EventCell cells[EventChannel::CAPACITY];
+    std::atomic<uint64_t> enqueue_pos = 0;
+    std::atomic<uint64_t> dequeue_pos = 0;
+
+    std::atomic<int64_t> lost = 0;
+
+    // Set by the first producer after the consumer has woken up, so the
+    // eventfd is written once per batch instead of once per event
+    std::atomic<bool> is_signaled = false;
+    int fd = -1;
+};
+
+static EventQueue g_queue;
+
+static bool push(const Event &event) {
+    uint64_t pos = g_queue.enqueue_pos.load(std::memory_order_relaxed);
+    while (true) {
+        EventCell &cell = g_queue.cells[pos % EventChannel::CAPACITY];
+        uint64_t seq = cell.seq.load(std::memory_order_acquire);
+        auto diff = (int64_t)(seq - pos);
+
+        if (diff == 0) {
+            if (g_queue.enqueue_pos.compare_exchange_weak(
+                    pos, pos + 1, std::memory_order_relaxed)) {
+                cell.event = event;
+                // Sequentially consistent, so it can't pass is_signaled check
+                cell.seq.store(pos + 1);
+                return true;
+            }
+        } else if (diff < 0) {
+            return false;
+        } else {
+            pos = g_queue.enqueue_pos.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+static bool pop(Event *out) {
+    uint64_t pos = g_queue.dequeue_pos.load(std::memory_order_relaxed);
+    while (true) {
+        EventCell &cell = g_queue.cells[pos % EventChannel::CAPACITY];
+        uint64_t seq = cell.seq.load();
+        auto diff = (int64_t)(seq - (pos + 1));
+
+        if (diff == 0) {
+            if (g_queue.dequeue_pos.compare_exchange_weak(
+                    pos, pos + 1, std::memory_order_relaxed)) {
+                *out = cell.event;
+                cell.seq.store(pos + EventChannel::CAPACITY,
+                               std::memory_order_release);
+                return true;
+            }
+        } else if (diff < 0) {
+            return false;
+        } else {
+            pos = g_queue.dequeue_pos.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+static int drain(Event *out, int max_count) {
+    int count = 0;
+    while (count < max_count && pop(&out[count])) {
+        count++;
+    }
+
+    if (count < max_count && g_queue.lost.load() > 0) {
+        out[count++] = Event{
+            .type = EventType::EventsLost,
+            .code = 0,
+            .source = 0,
+            .value = g_queue.lost.exchange(0),
+            .time_us = av_gettime_relative(),
+        };
+    }
+
+    return count;
+}
+
+void EventChannel::post(EventType type, const void *source, int32_t code,
+                        int64_t value) {
+    Event event = {
+        .type = type,
+        .code = code,
+        .source = (int64_t)(intptr_t)source,
+        .value = value,
+        .time_us = av_gettime_relative(),
+    };
+
+    if (!push(event)) {
+        g_queue.lost.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    if (g_queue.fd >= 0 && !g_queue.is_signaled.exchange(true)) {
+        uint64_t one = 1;
+        if (write(g_queue.fd, &one, sizeof(one)) < 0) {
+            LOG_WARN("Unable to signal eventfd: %s", strerror(errno));
+        }
+    }
+}
+
+int EventChannel::poll(Event *out, int max_count, int timeout_ms) {
+    int count = drain(out, max_count);
+    if (count > 0 || g_queue.fd < 0) {
+        return count;
+    }
+
+    pollfd pfd = {.fd = g_queue.fd, .events = POLLIN, .revents = 0};
+    if (::poll(&pfd, 1, timeout_ms) <= 0) {
+        return 0;
+    }
+
+    uint64_t value = 0;
+    if (read(g_queue.fd, &value, sizeof(value)) < 0 && errno != EAGAIN) {
+        LOG_WARN("Unable to read eventfd: %s", strerror(errno));
+    }
+
+    // Events pushed before this store are drained below, later ones signal
+    // the eventfd again
+    g_queue.is_signaled.store(false);
+    return drain(out, max_count);
+}
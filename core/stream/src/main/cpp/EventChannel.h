@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdint>
+
+// NOTE: Keep sync with kotlin NativeEventType
+enum class EventType : int32_t {
+    // code: StreamError, value: AVERROR code or zero
+    Error = 0,
+    // code: CongestionReason, value: depends on the reason
+    Congestion = 1,
+    // value: pts of the keyframe in microseconds
+    KeyframeSent = 2,
+    // code: packets, value: bytes written since the previous tick
+    StatsTick = 3,
+    // value: events dropped because the queue was full
+    EventsLost = 4,
+    // code: luma SSIM in 1/10000, value: luma PSNR in millidecibels
+    QualitySample = 5,
+};
+
+// NOTE: Keep sync with kotlin NativeCongestionReason
+enum class CongestionReason : int32_t {
+    // Stream started shedding frames, value: MemoryPressure
+    MemoryPressure = 0,
+    // Paced udp sender queue is full, value: queued datagrams
+    PacerQueueFull = 1,
+    // Server client was dropped, value: its queued bytes
+    ClientQueueFull = 2,
+};
+
+struct Event {
+    EventType type;
+    int32_t code;
+    // Native handle of the stream or output that posted the event
+    int64_t source;
+    int64_t value;
+    // Posting time in av_gettime_relative units
+    int64_t time_us;
+};
+
+// Process wide queue of events that native code pushes to kotlin.
+//
+// Events are stored in a bounded lock-free queue, so posting never blocks
+// and can be done from the frame path. When the queue is full events are
+// counted and reported as a single EventsLost. Consumer sleeps on an
+// eventfd, which is signaled only when it may be sleeping, and takes all
+// queued events as one batch.
+class EventChannel {
+   public:
+    static void post(EventType type, const void *source, int32_t code,
+                     int64_t value = 0);
+
+    // Waits up to timeout_ms for events and moves at most max_count of them
+    // into out, returns their count. Negative timeout waits forever.
+    static int poll(Event *out, int max_count, int timeout_ms);
+
+    static constexpr int CAPACITY = 256;
+
+    // Stream posts StatsTick at this interval while packets are written
+    static constexpr int64_t STATS_TICK_US = 1'000'000;
+};
@@ -0,0 +1,34 @@
+#include <jni.h>
+
+#include "EventChannel.h"
+
+// NOTE: Keep sync with kotlin NativeEventsJni
+constexpr int EVENT_FIELDS = 5;
+constexpr int MAX_BATCH = 64;
+
+extern "C" {
+
+JNIEXPORT jlongArray JNICALL Java_com_rejeq_cpcam_core_stream_jni_NativeEventsJni_poll(
+    JNIEnv *env, jobject /* obj */, jint timeout_ms) {
+    Event events[MAX_BATCH];
+    int count = EventChannel::poll(events, MAX_BATCH, timeout_ms);
+
+    jlong fields[MAX_BATCH * EVENT_FIELDS];
+    for (int i = 0; i < count; i++) {
+        jlong *it = fields + i * EVENT_FIELDS;
+        it[0] = (jlong)events[i].type;
+        it[1] = events[i].source;
+        it[2] = events[i].code;
+        it[3] = events[i].value;
+        it[4] = events[i].time_us;
+    }
+
+    jlongArray out = env->NewLongArray(count * EVENT_FIELDS);
+    if (!out) {
+        return nullptr;
+    }
+
+    env->SetLongArrayRegion(out, 0, count * EVENT_FIELDS, fields);
+    return out;
+}
+}
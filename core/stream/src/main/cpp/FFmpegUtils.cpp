@@ -2,9 +2,21 @@
 
 #include <cassert>
 
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavutil/imgutils.h>
+}
+
+#include "BufferPool.h"
+#include "MemoryBudget.h"
+
 #define LOG_TAG "FFmpegUtils"
 #include "Log.h"
 
+// Same as av_frame_get_buffer() uses, so SIMD code of encoders and sws is
+// not penalized
+constexpr int FRAME_BUFFER_ALIGN = 64;
+
 std::array<char, AV_ERROR_MAX_STRING_SIZE> av_err_to_string(int err) {
     std::array<char, AV_ERROR_MAX_STRING_SIZE> out = {};
 
@@ -60,16 +72,91 @@ AVFrame *make_av_frame(int width, int height, int pix_fmt) {
         return nullptr;
     }
 
-    frame->format = pix_fmt;
-    frame->width = width;
-    frame->height = height;
+    auto format = (AVPixelFormat)pix_fmt;
+    int size = frame_buffer_size(width, height, format);
 
-    int ret = av_frame_get_buffer(frame, 0);
-    if (ret < 0) {
+    AVBufferRef *buf = size > 0 ? budget_buffer_alloc(size) : nullptr;
+    if (!buf || !attach_frame_buffer(frame, buf, width, height, format)) {
         LOG_ERROR("Unable to allocate frame data");
+        av_buffer_unref(&buf);
         av_frame_free(&frame);
         return nullptr;
     }
 
     return frame;
 }
+
+int frame_buffer_size(int width, int height, AVPixelFormat format) {
+    int size =
+        av_image_get_buffer_size(format, width, height, FRAME_BUFFER_ALIGN);
+    if (size < 0) {
+        return size;
+    }
+
+    // Encoders and sws may read past the last line
+    return size + AV_INPUT_BUFFER_PADDING_SIZE;
+}
+
+bool attach_frame_buffer(AVFrame *frame, AVBufferRef *buf, int width,
+                         int height, AVPixelFormat format) {
+    int res = av_image_fill_arrays(frame->data, frame->linesize, buf->data,
+                                   format, width, height, FRAME_BUFFER_ALIGN);
+    if (res < 0) {
+        LOG_ERROR("Unable to fill frame planes: %s",
+                  av_err_to_string(res).data());
+        return false;
+    }
+
+    frame->buf[0] = buf;
+    frame->extended_data = frame->data;
+    frame->width = width;
+    frame->height = height;
+    frame->format = format;
+    return true;
+}
+
+AVCodecContext *make_encoder(const VideoConfig &config, int flags) {
+    const char *codec_name = config.codec_name.c_str();
+    const AVCodec *codec = avcodec_find_encoder_by_name(codec_name);
+    if (!codec) {
+        LOG_ERROR("Unable to find '%s' encoder", codec_name);
+        return nullptr;
+    }
+
+    AVCodecContext *cctx = avcodec_alloc_context3(codec);
+    if (!cctx) {
+        LOG_ERROR("Unable to allocate codec context\n");
+        return nullptr;
+    }
+
+    cctx->codec_id = codec->id;
+    cctx->bit_rate = config.bitrate;
+    cctx->width = config.width;
+    cctx->height = config.height;
+    cctx->time_base = {1, config.framerate};
+    cctx->framerate = {config.framerate, 1};
+    cctx->pix_fmt = to_av_pix_fmt(config.pix_fmt);
+    cctx->flags |= flags;
+
+    // Camera yuv is full range. Also mjpeg refuses to open with limited
+    // range yuv unless strict_std_compliance is lowered to unofficial.
+    if (codec->id == AV_CODEC_ID_MJPEG) {
+        cctx->color_range = AVCOL_RANGE_JPEG;
+    }
+
+    cctx->get_encode_buffer = pooled_get_encode_buffer;
+
+    AVDictionary *options = nullptr;
+    av_dict_set(&options, "preset", "veryslow", 0);
+
+    int res = avcodec_open2(cctx, codec, &options);
+    av_dict_free(&options);
+    if (res < 0) {
+        LOG_ERROR("Unable to open video codec: %s",
+                  av_err_to_string(res).data());
+        avcodec_free_context(&cctx);
+        return nullptr;
+    }
+
+    return cctx;
+}
@@ -12,6 +12,7 @@ extern "C" {
 }
 
 #include "PixFmt.h"
+#include "VideoConfig.h"
 
 // Returns std::array since it uses stack allocation without copying
 std::array<char, AV_ERROR_MAX_STRING_SIZE> av_err_to_string(int err);
@@ -23,29 +24,34 @@ std::array<char, AV_TS_MAX_STRING_SIZE> av_ts_to_string(int64_t err);
 std::array<char, AV_TS_MAX_STRING_SIZE> av_ts_to_time_string(
     int64_t ts, AVRational *time_base);
 
-#define LOG_PACKET_INFO(octx, pkt)                                            \
-    do {                                                                      \
-        [[maybe_unused]] AVRational *time_base =                              \
-            &octx->streams[pkt->stream_index]->time_base;                     \
-                                                                              \
-        LOG_TRACE(                                                            \
-            "pts:%s "                                                         \
-            "pts_time:%s "                                                    \
-            "dts:%s "                                                         \
-            "dts_time:%s "                                                    \
-            "duration:%s "                                                    \
-            "duration_time:%s "                                               \
-            "stream_index:%d ",                                               \
-            av_ts_to_string(pkt->pts).data(),                                 \
-            av_ts_to_time_string(pkt->pts, time_base).data(),                 \
-            av_ts_to_string(pkt->dts).data(),                                 \
-            av_ts_to_time_string(pkt->dts, time_base).data(),                 \
-            av_ts_to_string(pkt->duration).data(),                            \
-            av_ts_to_time_string(pkt->duration, time_base).data(),            \
-            pkt->stream_index);                                               \
-    } while (0)
+// Arguments are kept raw, since trace records are formatted only on dump
+#define LOG_PACKET_INFO(time_base, pkt)                                      \
+    LOG_TRACE(                                                               \
+        "pts:%lld "                                                          \
+        "dts:%lld "                                                          \
+        "duration:%lld "                                                     \
+        "time_base:%d/%d "                                                   \
+        "stream_index:%d "                                                   \
+        "size:%d",                                                           \
+        (long long)pkt->pts, (long long)pkt->dts, (long long)pkt->duration,  \
+        time_base.num, time_base.den, pkt->stream_index, pkt->size)
 
 AVPixelFormat to_av_pix_fmt(PixFmt pix_fmt);
 PixFmt from_av_pix_fmt(AVPixelFormat pix_fmt);
 
+// Frame buffer is accounted in MemoryBudget, returns nullptr when the hard
+// limit is reached
 AVFrame *make_av_frame(int width, int height, int pix_fmt);
+
+// Size of the picture buffer with aligned lines and padding for SIMD readers,
+// negative on invalid geometry
+int frame_buffer_size(int width, int height, AVPixelFormat format);
+
+// Points frame planes into buf of frame_buffer_size() bytes and takes
+// ownership of it on success, returns false on failure
+bool attach_frame_buffer(AVFrame *frame, AVBufferRef *buf, int width,
+                         int height, AVPixelFormat format);
+
+// Allocates and opens encoder for the given config, extra AVCodecContext
+// flags (e.g. AV_CODEC_FLAG_GLOBAL_HEADER) are applied before opening
+AVCodecContext *make_encoder(const VideoConfig &config, int flags);
@@ -1,5 +1,6 @@
 #include "JniUtils.h"
 
+#include <atomic>
 #include <cassert>
 #include <jni.h>
 
@@ -13,6 +14,8 @@ extern "C" {
 
 static JavaVM *g_jvm = nullptr;
 
+static std::atomic<int> g_ffmpeg_log_level = AV_LOG_VERBOSE;
+
 JavaVM *get_jvm() {
     assert(g_jvm != nullptr);
     return g_jvm;
@@ -44,8 +47,20 @@ int to_android_log_level(int ffmpeg_level) {
     return -1;
 }
 
+void set_ffmpeg_log_level(int level) {
+    g_ffmpeg_log_level.store(level, std::memory_order_relaxed);
+}
+
 void log_callback(void * /* avcl */, int level, const char *fmt, va_list args) {
-    if (level > AV_LOG_VERBOSE) {
+    if (level > g_ffmpeg_log_level.load(std::memory_order_relaxed)) {
+        return;
+    }
+
+    if (level > AV_LOG_INFO) {
+        // Verbose messages are too frequent to be written into logcat
+        if (trace_is_enabled()) {
+            trace_record_text(LOG_PREFIX "ffmpeg", fmt, args);
+        }
         return;
     }
 
@@ -5,3 +5,7 @@
 
 JavaVM *get_jvm();
 std::string to_string(JNIEnv *env, jstring str);
+
+// Ffmpeg messages above the level (AV_LOG_*) are dropped before formatting.
+// Messages above AV_LOG_INFO are written only into the trace log.
+void set_ffmpeg_log_level(int level);
@@ -1,22 +1,49 @@
 #pragma once
 
+#include "TraceLog.h"
+
+#ifdef __ANDROID__
 #include <android/log.h>
+#else
+#include <cstdio>
+
+// Host builds have no logcat, so everything goes to stderr
+enum {
+    ANDROID_LOG_VERBOSE = 2,
+    ANDROID_LOG_DEBUG,
+    ANDROID_LOG_INFO,
+    ANDROID_LOG_WARN,
+    ANDROID_LOG_ERROR,
+    ANDROID_LOG_FATAL,
+    ANDROID_LOG_SILENT,
+};
+
+#define __android_log_print(level, tag, fmt, ...)            \
+    fprintf(stderr, "%d %s: " fmt "\n", level, tag __VA_OPT__(, ) __VA_ARGS__)
+#define __android_log_vprint(level, tag, fmt, args) \
+    (fprintf(stderr, "%d %s: ", level, tag), vfprintf(stderr, fmt, args))
+#endif
 
 #define LOG_PREFIX "jni_"
 #define _LOG_TAG LOG_PREFIX LOG_TAG
 
 #if 1
 
-#define LOG_ERROR(...) __android_log_print(ANDROID_LOG_ERROR, _LOG_TAG, __VA_ARGS__)
+#define LOG_ERROR(...)                                                \
+    do {                                                              \
+        __android_log_print(ANDROID_LOG_ERROR, _LOG_TAG, __VA_ARGS__); \
+        trace_dump_on_error();                                        \
+    } while (0)
 #define LOG_WARN(...) __android_log_print(ANDROID_LOG_WARN, _LOG_TAG, __VA_ARGS__)
 #define LOG_INFO(...) __android_log_print(ANDROID_LOG_INFO, _LOG_TAG, __VA_ARGS__)
 
+// Trace goes only to the in-memory ring, see TraceLog.h
+#define LOG_TRACE(...) trace_log(_LOG_TAG, __VA_ARGS__)
+
 #ifdef NDEBUG
 #define LOG_DEBUG(...) (void) 0
-#define LOG_TRACE(...) (void) 0
 #else
 #define LOG_DEBUG(...) __android_log_print(ANDROID_LOG_DEBUG, _LOG_TAG, __VA_ARGS__)
-#define LOG_TRACE(...) __android_log_print(ANDROID_LOG_VERBOSE, _LOG_TAG, __VA_ARGS__)
 #endif
 
 #else
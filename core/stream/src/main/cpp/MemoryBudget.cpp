@@ -0,0 +1,132 @@
+#include "MemoryBudget.h"
+
+#include <atomic>
+
+extern "C" {
+#include <libavutil/mem.h>
+}
+
+#define LOG_TAG "MemoryBudget"
+#include "Log.h"
+
+static std::atomic<int64_t> g_used_bytes = 0;
+static std::atomic<int64_t> g_peak_bytes = 0;
+
+static std::atomic<int64_t> g_soft_limit = 0;
+static std::atomic<int64_t> g_hard_limit = 0;
+
+// Refusals are logged once until usage drops below the soft limit
+static std::atomic<bool> g_is_refusing = false;
+
+static void update_peak(int64_t used) {
+    int64_t peak = g_peak_bytes.load(std::memory_order_relaxed);
+    while (used > peak &&
+           !g_peak_bytes.compare_exchange_weak(peak, used,
+                                               std::memory_order_relaxed)) {
+    }
+}
+
+bool MemoryBudget::reserve(int64_t bytes) {
+    int64_t hard_limit = g_hard_limit.load(std::memory_order_relaxed);
+    int64_t used = g_used_bytes.load(std::memory_order_relaxed);
+
+    while (true) {
+        if (hard_limit > 0 && used + bytes > hard_limit) {
+            if (!g_is_refusing.exchange(true)) {
+                LOG_WARN("Hard limit reached: %lld + %lld > %lld bytes",
+                         (long long)used, (long long)bytes,
+                         (long long)hard_limit);
+            }
+            return false;
+        }
+
+        if (g_used_bytes.compare_exchange_weak(used, used + bytes,
+                                               std::memory_order_relaxed)) {
+            break;
+        }
+    }
+
+    update_peak(used + bytes);
+    return true;
+}
+
+void MemoryBudget::release(int64_t bytes) {
+    int64_t used = g_used_bytes.fetch_sub(bytes, std::memory_order_relaxed) -
+                   bytes;
+
+    int64_t soft_limit = g_soft_limit.load(std::memory_order_relaxed);
+    if (soft_limit <= 0 || used < soft_limit) {
+        if (g_is_refusing.exchange(false)) {
+            LOG_INFO("Memory usage is back to normal: %lld bytes",
+                     (long long)used);
+        }
+    }
+}
+
+MemoryPressure MemoryBudget::pressure() {
+    int64_t used = g_used_bytes.load(std::memory_order_relaxed);
+    int64_t soft_limit = g_soft_limit.load(std::memory_order_relaxed);
+    int64_t hard_limit = g_hard_limit.load(std::memory_order_relaxed);
+
+    if (g_is_refusing.load(std::memory_order_relaxed) ||
+        (hard_limit > 0 && used >= hard_limit)) {
+        return MemoryPressure::Hard;
+    }
+
+    if (soft_limit > 0 && used >= soft_limit) {
+        return MemoryPressure::Soft;
+    }
+
+    return MemoryPressure::None;
+}
+
+int64_t MemoryBudget::used_bytes() {
+    return g_used_bytes.load(std::memory_order_relaxed);
+}
+
+int64_t MemoryBudget::peak_bytes() {
+    return g_peak_bytes.load(std::memory_order_relaxed);
+}
+
+void MemoryBudget::set_options(const MemoryBudgetOptions &options) {
+    LOG_INFO("Using soft limit: %lld, hard limit: %lld bytes",
+             (long long)options.soft_limit_bytes,
+             (long long)options.hard_limit_bytes);
+
+    if (options.hard_limit_bytes > 0 &&
+        options.soft_limit_bytes > options.hard_limit_bytes) {
+        LOG_WARN("Soft limit is above the hard limit");
+    }
+
+    g_soft_limit = options.soft_limit_bytes;
+    g_hard_limit = options.hard_limit_bytes;
+}
+
+static void free_budget_buffer(void *opaque, uint8_t *data) {
+    MemoryBudget::release((int64_t)(intptr_t)opaque);
+    av_free(data);
+}
+
+AVBufferRef *budget_buffer_alloc(size_t size) {
+    if (!MemoryBudget::reserve((int64_t)size)) {
+        return nullptr;
+    }
+
+    auto *data = (uint8_t *)av_malloc(size);
+    if (!data) {
+        MemoryBudget::release((int64_t)size);
+        return nullptr;
+    }
+
+    // Size is passed as opaque, so release doesn't depend on AVBufferRef::size
+    // that may be changed by the owner
+    AVBufferRef *buf = av_buffer_create(data, size, free_budget_buffer,
+                                        (void *)(intptr_t)size, 0);
+    if (!buf) {
+        av_free(data);
+        MemoryBudget::release((int64_t)size);
+        return nullptr;
+    }
+
+    return buf;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+extern "C" {
+#include <libavutil/buffer.h>
+}
+
+struct MemoryBudgetOptions {
+    // Streams shed frames and output queues are shortened above this limit,
+    // zero disables limit
+    int64_t soft_limit_bytes = 0;
+    // Allocations that would exceed this limit are refused, zero disables
+    // limit
+    int64_t hard_limit_bytes = 0;
+};
+
+enum class MemoryPressure {
+    None,
+    Soft,
+    Hard,
+};
+
+// Process wide accountant of native buffers: frame pools, packet payloads,
+// queued output chunks and sink buffers. Memory held inside of the encoders
+// and muxers isn't visible to it.
+class MemoryBudget {
+   public:
+    // Returns false when reservation would exceed the hard limit
+    static bool reserve(int64_t bytes);
+    static void release(int64_t bytes);
+
+    static MemoryPressure pressure();
+
+    static int64_t used_bytes();
+    static int64_t peak_bytes();
+
+    static void set_options(const MemoryBudgetOptions &options);
+};
+
+// av_buffer_alloc() that is accounted in MemoryBudget until the buffer is
+// freed, returns nullptr when the hard limit is reached. Can be used as
+// allocator of AVBufferPool.
+AVBufferRef *budget_buffer_alloc(size_t size);
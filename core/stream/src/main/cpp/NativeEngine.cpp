@@ -0,0 +1,301 @@
+#include "NativeEngine.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "ThreadPolicy.h"
+
+#define LOG_TAG "NativeEngine"
+#include "Log.h"
+
+struct QueuedTask {
+    NativeEngine::Task task;
+    EngineGroup *group = nullptr;
+    int64_t deadline_us = NativeEngine::NO_DEADLINE;
+    // Orders tasks with equal deadline by submission
+    uint64_t seq = 0;
+};
+
+struct WorkerQueue {
+    std::mutex lock;
+    std::vector<QueuedTask> tasks;
+};
+
+// Tasks without deadline, run in submission order
+struct BackgroundQueue {
+    std::mutex lock;
+    std::condition_variable cond;
+    std::deque<QueuedTask> tasks;
+};
+
+struct EngineState {
+    std::vector<std::unique_ptr<WorkerQueue>> queues;
+    std::vector<std::thread> workers;
+
+    BackgroundQueue background;
+    std::thread background_worker;
+
+    // Tasks in all queues
+    std::atomic<int> pending = 0;
+    std::mutex idle_lock;
+    std::condition_variable idle_cond;
+
+    std::atomic<uint64_t> next_seq = 0;
+    std::atomic<unsigned> next_queue = 0;
+};
+
+// Workers are never stopped, so the state lives until the process exits
+static EngineState *g_engine = nullptr;
+static std::once_flag g_engine_once;
+
+// Index of the queue owned by the current thread, -1 outside of workers
+static thread_local int t_worker_index = -1;
+
+static int64_t effective_deadline(const QueuedTask &task) {
+    return task.deadline_us +
+           task.group->running() * NativeEngine::FAIRNESS_PENALTY_US;
+}
+
+static bool is_before(const QueuedTask &a, const QueuedTask &b) {
+    int64_t a_deadline = effective_deadline(a);
+    int64_t b_deadline = effective_deadline(b);
+    if (a_deadline != b_deadline) {
+        return a_deadline < b_deadline;
+    }
+
+    return a.seq < b.seq;
+}
+
+// Must be called with locked queue, returns -1 when queue is empty
+static int best_task(const WorkerQueue &queue) {
+    int best = -1;
+    for (int i = 0; i < (int)queue.tasks.size(); i++) {
+        if (best < 0 || is_before(queue.tasks[i], queue.tasks[best])) {
+            best = i;
+        }
+    }
+
+    return best;
+}
+
+static bool peek(WorkerQueue &queue, QueuedTask *out) {
+    std::lock_guard<std::mutex> lock(queue.lock);
+    int best = best_task(queue);
+    if (best < 0) {
+        return false;
+    }
+
+    out->group = queue.tasks[best].group;
+    out->deadline_us = queue.tasks[best].deadline_us;
+    out->seq = queue.tasks[best].seq;
+    return true;
+}
+
+static bool take(WorkerQueue &queue, QueuedTask *out) {
+    std::lock_guard<std::mutex> lock(queue.lock);
+    int best = best_task(queue);
+    if (best < 0) {
+        return false;
+    }
+
+    // Order inside of the queue doesn't matter, tasks are always searched
+    *out = std::move(queue.tasks[best]);
+    queue.tasks[best] = std::move(queue.tasks.back());
+    queue.tasks.pop_back();
+
+    g_engine->pending.fetch_sub(1);
+    return true;
+}
+
+// Own queue is preferred, others are searched when it's empty
+static bool take_task(int index, QueuedTask *out) {
+    int count = (int)g_engine->queues.size();
+    WorkerQueue &own = *g_engine->queues[index];
+
+    QueuedTask best;
+    bool has_own = peek(own, &best);
+    if (has_own) {
+        return take(own, out);
+    }
+
+    int victim = -1;
+    for (int i = 1; i < count; i++) {
+        int other = (index + i) % count;
+
+        QueuedTask candidate;
+        if (!peek(*g_engine->queues[other], &candidate)) {
+            continue;
+        }
+
+        if ((!has_own && victim < 0) || is_before(candidate, best)) {
+            best = std::move(candidate);
+            victim = other;
+        }
+    }
+
+    if (victim >= 0 && take(*g_engine->queues[victim], out)) {
+        return true;
+    }
+
+    return take(own, out);
+}
+
+// Threads live as long as the process, so options changed after they
+// started are applied before the next task
+static void reapply_role(ThreadRole role, uint32_t &generation) {
+    uint32_t current = ThreadPolicy::generation();
+    if (current != generation) {
+        generation = current;
+        ThreadPolicy::apply(role);
+    }
+}
+
+void NativeEngine::worker_loop(int index) {
+    char name[16];
+    snprintf(name, sizeof(name), "cpcam-engine-%d", index);
+    uint32_t generation = ThreadPolicy::generation();
+    ThreadPolicy::apply(ThreadRole::Encoder, name);
+
+    t_worker_index = index;
+
+    while (true) {
+        QueuedTask task;
+        if (!take_task(index, &task)) {
+            std::unique_lock<std::mutex> lock(g_engine->idle_lock);
+            g_engine->idle_cond.wait(
+                lock, []() { return g_engine->pending.load() > 0; });
+            continue;
+        }
+
+        reapply_role(ThreadRole::Encoder, generation);
+
+        task.group->on_started();
+        task.task();
+        task.group->on_finished();
+    }
+}
+
+void NativeEngine::background_loop() {
+    uint32_t generation = ThreadPolicy::generation();
+    ThreadPolicy::apply(ThreadRole::Background, "cpcam-engine-bg");
+
+    BackgroundQueue &queue = g_engine->background;
+    while (true) {
+        QueuedTask task;
+        {
+            std::unique_lock<std::mutex> lock(queue.lock);
+            queue.cond.wait(lock, [&]() { return !queue.tasks.empty(); });
+
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+        }
+
+        reapply_role(ThreadRole::Background, generation);
+
+        task.group->on_started();
+        task.task();
+        task.group->on_finished();
+    }
+}
+
+void NativeEngine::start() {
+    int cores = (int)std::thread::hardware_concurrency();
+    int count = std::clamp(cores, 2, MAX_WORKERS);
+
+    g_engine = new EngineState();
+    for (int i = 0; i < count; i++) {
+        g_engine->queues.push_back(std::make_unique<WorkerQueue>());
+    }
+
+    // Queues must exist before any worker can steal from them
+    for (int i = 0; i < count; i++) {
+        g_engine->workers.emplace_back(worker_loop, i);
+    }
+
+    g_engine->background_worker = std::thread(background_loop);
+
+    LOG_INFO("Started %d workers for %d cores", count, cores);
+}
+
+void NativeEngine::submit(EngineGroup *group, int64_t deadline_us,
+                          Task task) {
+    std::call_once(g_engine_once, start);
+
+    group->on_queued();
+
+    if (deadline_us == NO_DEADLINE) {
+        BackgroundQueue &queue = g_engine->background;
+        std::lock_guard<std::mutex> lock(queue.lock);
+        queue.tasks.push_back(QueuedTask{
+            .task = std::move(task),
+            .group = group,
+            .deadline_us = deadline_us,
+            .seq = g_engine->next_seq.fetch_add(1),
+        });
+        queue.cond.notify_one();
+        return;
+    }
+
+    int index = t_worker_index;
+    if (index < 0) {
+        index = (int)(g_engine->next_queue.fetch_add(1) %
+                      g_engine->queues.size());
+    }
+
+    WorkerQueue &queue = *g_engine->queues[index];
+    {
+        std::lock_guard<std::mutex> lock(queue.lock);
+        queue.tasks.push_back(QueuedTask{
+            .task = std::move(task),
+            .group = group,
+            .deadline_us = deadline_us,
+            .seq = g_engine->next_seq.fetch_add(1),
+        });
+    }
+
+    g_engine->pending.fetch_add(1);
+
+    // Sleeping worker checks pending under this lock, so wakeup isn't lost
+    std::lock_guard<std::mutex> lock(g_engine->idle_lock);
+    g_engine->idle_cond.notify_one();
+}
+
+int NativeEngine::worker_count() {
+    std::call_once(g_engine_once, start);
+    return (int)g_engine->workers.size();
+}
+
+void EngineGroup::wait_idle() {
+    std::unique_lock<std::mutex> lock(m_lock);
+    m_idle_cond.wait(lock, [this]() {
+        return m_queued.load() == 0 && m_running.load() == 0;
+    });
+}
+
+// Counters are changed only under the lock, so wait_idle() can't return
+// before the worker that made the group idle has released it
+void EngineGroup::on_queued() {
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_queued.fetch_add(1);
+}
+
+void EngineGroup::on_started() {
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_running.fetch_add(1);
+    m_queued.fetch_sub(1);
+}
+
+void EngineGroup::on_finished() {
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_running.fetch_sub(1);
+
+    // Waiter can observe idle state only after this lock is released, and
+    // the group isn't touched after it
+    if (m_queued.load() == 0 && m_running.load() == 0) {
+        m_idle_cond.notify_all();
+    }
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+
+// Tasks of one stream. Engine delays tasks of a group while it already
+// occupies workers, so a single busy stream can't take the whole pool.
+class EngineGroup {
+   public:
+    explicit EngineGroup(const char *name) : m_name(name) {}
+
+    // Waits for tasks of the group that are queued or running
+    ~EngineGroup() { wait_idle(); }
+
+    EngineGroup(const EngineGroup &) = delete;
+    EngineGroup &operator=(const EngineGroup &) = delete;
+
+    void wait_idle();
+
+    const char *name() const { return m_name; }
+    int running() const { return m_running.load(std::memory_order_relaxed); }
+
+   private:
+    friend class NativeEngine;
+
+    void on_queued();
+    void on_started();
+    void on_finished();
+
+    const char *m_name;
+
+    // Changed only under m_lock, read without it for scheduling
+    std::atomic<int> m_queued = 0;
+    std::atomic<int> m_running = 0;
+
+    std::mutex m_lock;
+    std::condition_variable m_idle_cond;
+};
+
+// Process wide work-stealing pool that runs encoding work of all streams,
+// so total parallelism follows the core count rather than the amount of
+// sessions.
+//
+// Every worker has its own queue. Tasks submitted from a worker stay in its
+// queue, tasks from other threads are spread over the queues, idle workers
+// steal from the others. Worker picks the task with the earliest deadline,
+// penalized by FAIRNESS_PENALTY_US for every task of its group that is
+// already running.
+//
+// Tasks without deadline never reach the workers, they run in submission
+// order on a single thread with the Background role, so best effort work
+// (snapshots, quality measuring) can't hold a worker that encoding needs.
+//
+// Threads are started on the first submit, workers run with the Encoder
+// thread role, which is re-applied before the next task when ThreadPolicy
+// options change.
+class NativeEngine {
+   public:
+    using Task = std::function<void()>;
+
+    // Task runs on the low-priority background thread
+    static constexpr int64_t NO_DEADLINE = INT64_MAX;
+
+    static constexpr int64_t FAIRNESS_PENALTY_US = 5'000;
+    static constexpr int MAX_WORKERS = 8;
+
+    // Deadline is in av_gettime_relative units. Group must outlive the task.
+    static void submit(EngineGroup *group, int64_t deadline_us, Task task);
+
+    static int worker_count();
+
+   private:
+    static void start();
+    static void worker_loop(int index);
+    static void background_loop();
+};
@@ -15,6 +15,7 @@ enum class StreamError {
     FFmpegStreamCreationFailed = -103,
     FFmpegStreamParametersFailed = -104,
     FFmpegWriteFailed = -105,
+    FFmpegEncodeFailed = -106,
 
     // Video specific errors
     VideoInvalidFormat = -200,
@@ -22,4 +23,5 @@ enum class StreamError {
     VideoInvalidPixelFormat = -202,
     VideoInvalidPlaneCount = -203,
     VideoInvalidStride = -204,
+    VideoConversionFailed = -205,
 };
@@ -0,0 +1,199 @@
+#include "ThreadPolicy.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#define LOG_TAG "ThreadPolicy"
+#include "Log.h"
+
+constexpr int MAX_THREAD_NAME_SIZE = 16;
+
+struct CoreSets {
+    cpu_set_t big;
+    cpu_set_t little;
+    // Every core, cores that are offline now are kept for when they're back
+    cpu_set_t all;
+};
+
+struct RoleState {
+    ThreadRoleOptions options;
+    bool is_set = false;
+};
+
+static std::mutex g_lock;
+static RoleState g_roles[THREAD_ROLE_COUNT];
+static std::atomic<uint32_t> g_generation = 0;
+
+// Returns -1 when frequency isn't exposed
+static int64_t read_max_freq(int cpu) {
+    char path[128];
+    snprintf(path, sizeof(path),
+             "/sys/devices/system/cpu/cpu%d/cpufreq/cpuinfo_max_freq", cpu);
+
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        return -1;
+    }
+
+    long long freq = -1;
+    if (fscanf(file, "%lld", &freq) != 1) {
+        freq = -1;
+    }
+
+    fclose(file);
+    return freq;
+}
+
+static CoreSets detect_core_sets() {
+    CoreSets sets{};
+    CPU_ZERO(&sets.big);
+    CPU_ZERO(&sets.little);
+    CPU_ZERO(&sets.all);
+
+    int count = (int)sysconf(_SC_NPROCESSORS_CONF);
+    if (count > CPU_SETSIZE) {
+        count = CPU_SETSIZE;
+    }
+
+    int64_t freqs[CPU_SETSIZE];
+    int64_t max_freq = -1;
+    int64_t min_freq = INT64_MAX;
+
+    for (int cpu = 0; cpu < count; cpu++) {
+        freqs[cpu] = read_max_freq(cpu);
+        if (freqs[cpu] < 0) {
+            continue;
+        }
+
+        max_freq = std::max(max_freq, freqs[cpu]);
+        min_freq = std::min(min_freq, freqs[cpu]);
+    }
+
+    for (int cpu = 0; cpu < count; cpu++) {
+        CPU_SET(cpu, &sets.all);
+
+        // Without cpufreq every core belongs to both classes
+        if (max_freq < 0 || freqs[cpu] == max_freq) {
+            CPU_SET(cpu, &sets.big);
+        }
+        if (max_freq < 0 || freqs[cpu] == min_freq) {
+            CPU_SET(cpu, &sets.little);
+        }
+    }
+
+    LOG_INFO("Detected %d big and %d little cores", CPU_COUNT(&sets.big),
+             CPU_COUNT(&sets.little));
+    return sets;
+}
+
+static const CoreSets &core_sets() {
+    static const CoreSets sets = detect_core_sets();
+    return sets;
+}
+
+static const char *role_name(ThreadRole role) {
+    switch (role) {
+        case ThreadRole::Encoder: return "encoder";
+        case ThreadRole::Writer: return "writer";
+        case ThreadRole::Network: return "network";
+        case ThreadRole::Background: return "background";
+    }
+
+    return "unknown";
+}
+
+static const cpu_set_t &class_set(const CoreSets &sets, CoreClass cores) {
+    switch (cores) {
+        case CoreClass::Big: return sets.big;
+        case CoreClass::Little: return sets.little;
+        case CoreClass::Any: break;
+    }
+
+    return sets.all;
+}
+
+static void apply_affinity(ThreadRole role, CoreClass cores) {
+    // Any resets the affinity left by the previous options or role
+    const cpu_set_t &set = class_set(core_sets(), cores);
+
+    // Zero pid means the calling thread
+    if (sched_setaffinity(0, sizeof(set), &set) < 0) {
+        LOG_WARN("Unable to set affinity of %s thread: %s", role_name(role),
+                 strerror(errno));
+    }
+}
+
+static void apply_priority(ThreadRole role, const ThreadRoleOptions &options) {
+    int policy = sched_getscheduler(0);
+
+    if (options.realtime_priority > 0) {
+        sched_param param{};
+        param.sched_priority = options.realtime_priority;
+
+        if (sched_setscheduler(0, SCHED_FIFO, &param) == 0) {
+            return;
+        }
+
+        LOG_WARN("Unable to use SCHED_FIFO for %s thread: %s, using nice",
+                 role_name(role), strerror(errno));
+    } else if (policy == SCHED_FIFO || policy == SCHED_RR) {
+        // Elevation was disabled since the previous apply
+        sched_param param{};
+        if (sched_setscheduler(0, SCHED_OTHER, &param) < 0) {
+            LOG_WARN("Unable to reset scheduler of %s thread: %s",
+                     role_name(role), strerror(errno));
+        }
+    }
+
+    // On Linux nice value is per thread
+    if (setpriority(PRIO_PROCESS, gettid(), options.nice) < 0) {
+        LOG_WARN("Unable to set nice %d for %s thread: %s", options.nice,
+                 role_name(role), strerror(errno));
+    }
+}
+
+void ThreadPolicy::set_role_options(ThreadRole role,
+                                    const ThreadRoleOptions &options) {
+    LOG_INFO("Using for %s threads: cores: %d, nice: %d, realtime: %d",
+             role_name(role), (int)options.cores, options.nice,
+             options.realtime_priority);
+
+    std::lock_guard<std::mutex> lock(g_lock);
+    RoleState &state = g_roles[(int)role];
+    state.options = options;
+    state.is_set = true;
+    g_generation++;
+}
+
+void ThreadPolicy::apply(ThreadRole role, const char *name) {
+    if (name) {
+        char truncated[MAX_THREAD_NAME_SIZE];
+        snprintf(truncated, sizeof(truncated), "%s", name);
+        pthread_setname_np(pthread_self(), truncated);
+    }
+
+    RoleState state;
+    {
+        std::lock_guard<std::mutex> lock(g_lock);
+        state = g_roles[(int)role];
+    }
+
+    if (!state.is_set) {
+        return;
+    }
+
+    apply_affinity(role, state.options.cores);
+    apply_priority(role, state.options);
+}
+
+uint32_t ThreadPolicy::generation() { return g_generation; }
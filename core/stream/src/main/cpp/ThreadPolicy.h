@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+
+enum class ThreadRole {
+    // Thread that sends frames to the stream, also does pixel conversion
+    Encoder,
+    // RecordingSink disk io
+    Writer,
+    // ServerSink clients and output reconnects
+    Network,
+    // Janitors and other housekeeping
+    Background,
+};
+
+constexpr int THREAD_ROLE_COUNT = 4;
+
+enum class CoreClass {
+    Any,
+    // Cores with the highest max frequency
+    Big,
+    // Cores with the lowest max frequency
+    Little,
+};
+
+struct ThreadRoleOptions {
+    CoreClass cores = CoreClass::Any;
+
+    // Nice value of the thread, negative values raise priority
+    int nice = 0;
+
+    // SCHED_FIFO priority, zero keeps the default scheduler. Usually requires
+    // privileges, nice value is used when elevation isn't allowed.
+    int realtime_priority = 0;
+};
+
+// Placement and priority of the native threads by their role.
+//
+// Threads apply options of their role when they start, so changes take
+// effect for the threads of the next session. Encoder role is applied to the
+// caller's thread and is re-applied by the stream on the next frame, engine
+// threads re-apply their roles before the next task.
+// Roles that were never configured leave threads untouched.
+class ThreadPolicy {
+   public:
+    static void set_role_options(ThreadRole role,
+                                 const ThreadRoleOptions &options);
+
+    // Applies options of the role to the calling thread, name is set when
+    // not nullptr (truncated to 15 characters by the kernel)
+    static void apply(ThreadRole role, const char *name = nullptr);
+
+    // Incremented on every options change
+    static uint32_t generation();
+};
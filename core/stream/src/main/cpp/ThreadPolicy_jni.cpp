@@ -0,0 +1,31 @@
+#include <jni.h>
+
+#include "ThreadPolicy.h"
+
+#define LOG_TAG "ThreadPolicyJni"
+#include "Log.h"
+
+extern "C" {
+
+JNIEXPORT void JNICALL
+Java_com_rejeq_cpcam_core_stream_jni_ThreadPolicyJni_setRoleOptions(
+    JNIEnv * /* env */, jobject /* obj */, jint role, jint cores, jint nice,
+    jint realtimePriority) {
+    if (role < 0 || role >= THREAD_ROLE_COUNT) {
+        LOG_ERROR("Unknown thread role: %d", role);
+        return;
+    }
+
+    if (cores < (int)CoreClass::Any || cores > (int)CoreClass::Little) {
+        LOG_ERROR("Unknown core class: %d", cores);
+        return;
+    }
+
+    ThreadPolicy::set_role_options((ThreadRole)role,
+                                   ThreadRoleOptions{
+                                       .cores = (CoreClass)cores,
+                                       .nice = nice,
+                                       .realtime_priority = realtimePriority,
+                                   });
+}
+}
@@ -0,0 +1,325 @@
+#include "TraceLog.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+
+#define LOG_TAG "trace"
+#include "Log.h"
+
+// Must be power of two
+constexpr uint64_t TRACE_RING_SIZE = 4096;
+constexpr int TRACE_TEXT_SIZE = TRACE_MAX_ARGS * sizeof(uint64_t);
+constexpr int TRACE_LINE_SIZE = 512;
+
+struct TraceEntry {
+    // Seqlock: odd while record is written, 2 * (index + 1) when complete
+    std::atomic<uint64_t> seq;
+
+    int64_t ts_ns;
+    const char *tag;
+    // nullptr for text records
+    const char *fmt;
+
+    uint8_t arg_count;
+    TraceArgType arg_types[TRACE_MAX_ARGS];
+    // Long text is spilled over consecutive records, part index and amount
+    // of parts are stored in every one of them
+    uint8_t text_part;
+    uint8_t text_part_count;
+    union {
+        uint64_t args[TRACE_MAX_ARGS];
+        char text[TRACE_TEXT_SIZE];
+    };
+};
+
+std::atomic<bool> g_trace_enabled = false;
+
+static TraceEntry g_ring[TRACE_RING_SIZE];
+static std::atomic<uint64_t> g_head = 0;
+static std::atomic<uint64_t> g_last_dumped = 0;
+
+static int64_t now_ns() {
+    timespec ts{};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1'000'000'000LL + ts.tv_nsec;
+}
+
+void trace_set_enabled(bool enabled) {
+    g_trace_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+// Reserves count consecutive records, returns index of the first one
+static uint64_t reserve_records(int count) {
+    return g_head.fetch_add(count, std::memory_order_relaxed);
+}
+
+static TraceEntry &begin_record(uint64_t index) {
+    TraceEntry &entry = g_ring[index & (TRACE_RING_SIZE - 1)];
+
+    entry.seq.store(2 * index + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    return entry;
+}
+
+static void end_record(TraceEntry &entry, uint64_t index) {
+    entry.seq.store(2 * (index + 1), std::memory_order_release);
+}
+
+void trace_record(const char *tag, const char *fmt, const TraceArg *args,
+                  int arg_count) {
+    uint64_t index = reserve_records(1);
+    TraceEntry &entry = begin_record(index);
+
+    entry.ts_ns = now_ns();
+    entry.tag = tag;
+    entry.fmt = fmt;
+    entry.arg_count = arg_count;
+    entry.text_part = 0;
+    entry.text_part_count = 0;
+    for (int i = 0; i < arg_count; i++) {
+        entry.arg_types[i] = args[i].type;
+        entry.args[i] = args[i].value;
+    }
+
+    end_record(entry, index);
+}
+
+void trace_record_text(const char *tag, const char *fmt, va_list args) {
+    char text[TRACE_LINE_SIZE];
+    int len = vsnprintf(text, sizeof(text), fmt, args);
+    len = std::clamp(len, 0, (int)sizeof(text) - 1);
+
+    int part_count = std::max(1, (len + TRACE_TEXT_SIZE - 1) / TRACE_TEXT_SIZE);
+    int64_t ts_ns = now_ns();
+
+    uint64_t first = reserve_records(part_count);
+    for (int part = 0; part < part_count; part++) {
+        TraceEntry &entry = begin_record(first + part);
+
+        entry.ts_ns = ts_ns;
+        entry.tag = tag;
+        entry.fmt = nullptr;
+        entry.arg_count = 0;
+        entry.text_part = part;
+        entry.text_part_count = part_count;
+
+        int offset = part * TRACE_TEXT_SIZE;
+        int size = std::min(len - offset, TRACE_TEXT_SIZE);
+        memcpy(entry.text, text + offset, size);
+        memset(entry.text + size, 0, TRACE_TEXT_SIZE - size);
+
+        end_record(entry, first + part);
+    }
+}
+
+// Formats single conversion, spec is a printf specification without length
+// modifiers
+static int format_arg(char *out, size_t size, const char *spec, char conv,
+                      const TraceEntry &entry, int arg) {
+    if (arg >= entry.arg_count) {
+        return snprintf(out, size, "<missing>");
+    }
+
+    uint64_t value = entry.args[arg];
+    TraceArgType type = entry.arg_types[arg];
+
+    char full_spec[32];
+    switch (conv) {
+        case 'd':
+        case 'i':
+            snprintf(full_spec, sizeof(full_spec), "%sll%c", spec, conv);
+            return snprintf(out, size, full_spec, (long long)value);
+        case 'u':
+        case 'x':
+        case 'X':
+        case 'o':
+            snprintf(full_spec, sizeof(full_spec), "%sll%c", spec, conv);
+            return snprintf(out, size, full_spec, (unsigned long long)value);
+        case 'c':
+            snprintf(full_spec, sizeof(full_spec), "%s%c", spec, conv);
+            return snprintf(out, size, full_spec, (int)value);
+        case 'f':
+        case 'F':
+        case 'e':
+        case 'E':
+        case 'g':
+        case 'G': {
+            double v = 0;
+            if (type == TraceArgType::Double) {
+                memcpy(&v, &value, sizeof(v));
+            } else {
+                v = (double)(int64_t)value;
+            }
+
+            snprintf(full_spec, sizeof(full_spec), "%s%c", spec, conv);
+            return snprintf(out, size, full_spec, v);
+        }
+        case 'p': return snprintf(out, size, "%p", (void *)(uintptr_t)value);
+        case 's':
+            if (type != TraceArgType::Str) {
+                return snprintf(out, size, "<not a string>");
+            }
+
+            snprintf(full_spec, sizeof(full_spec), "%s%c", spec, conv);
+            return snprintf(out, size, full_spec,
+                            (const char *)(uintptr_t)value);
+        default: return snprintf(out, size, "<%c?>", conv);
+    }
+}
+
+static void format_entry(const TraceEntry &entry, char *out, size_t size) {
+    if (!entry.fmt) {
+        snprintf(out, size, "%.*s", TRACE_TEXT_SIZE, entry.text);
+        return;
+    }
+
+    const char *fmt = entry.fmt;
+    size_t pos = 0;
+    int arg = 0;
+
+    auto advance = [&](int written) {
+        if (written > 0) {
+            pos = std::min(pos + written, size - 1);
+        }
+    };
+
+    while (*fmt && pos < size - 1) {
+        if (*fmt != '%') {
+            out[pos++] = *fmt++;
+            continue;
+        }
+
+        fmt++;
+        if (*fmt == '%') {
+            out[pos++] = *fmt++;
+            continue;
+        }
+
+        char spec[24] = "%";
+        size_t spec_len = 1;
+        while (*fmt && strchr("-+ #0123456789.", *fmt)) {
+            if (spec_len < sizeof(spec) - 1) {
+                spec[spec_len++] = *fmt;
+            }
+            fmt++;
+        }
+        spec[spec_len] = '\0';
+
+        // Arguments are always stored as 64-bit values
+        while (*fmt && strchr("hlLqjzt", *fmt)) {
+            fmt++;
+        }
+
+        if (!*fmt) {
+            break;
+        }
+
+        advance(format_arg(out + pos, size - pos, spec, *fmt, entry, arg++));
+        fmt++;
+    }
+
+    out[pos] = '\0';
+}
+
+// Returns false when record isn't finished yet or already overwritten
+static bool read_record(uint64_t index, TraceEntry &entry) {
+    const TraceEntry &slot = g_ring[index & (TRACE_RING_SIZE - 1)];
+
+    uint64_t seq = slot.seq.load(std::memory_order_acquire);
+    if (seq != 2 * (index + 1)) {
+        return false;
+    }
+
+    entry.ts_ns = slot.ts_ns;
+    entry.tag = slot.tag;
+    entry.fmt = slot.fmt;
+    entry.arg_count = std::min<int>(slot.arg_count, TRACE_MAX_ARGS);
+    entry.text_part = slot.text_part;
+    entry.text_part_count = slot.text_part_count;
+    memcpy(entry.arg_types, slot.arg_types, sizeof(entry.arg_types));
+    memcpy(entry.args, slot.args, sizeof(entry.args));
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return slot.seq.load(std::memory_order_relaxed) == seq;
+}
+
+// Appends rest parts of the text record at index to the line, returns index
+// of the last appended part
+static uint64_t append_text_parts(uint64_t index, uint64_t end,
+                                  const TraceEntry &first, char *out,
+                                  size_t size) {
+    size_t pos = strlen(out);
+    for (int part = 1; part < first.text_part_count; part++) {
+        TraceEntry entry;
+        if (index + 1 >= end || !read_record(index + 1, entry) ||
+            entry.fmt || entry.text_part != part) {
+            break;
+        }
+
+        index++;
+        int written = snprintf(out + pos, size - pos, "%.*s",
+                               TRACE_TEXT_SIZE, entry.text);
+        if (written > 0) {
+            pos = std::min(pos + written, size - 1);
+        }
+    }
+
+    return index;
+}
+
+static void dump_range(uint64_t begin, uint64_t end) {
+    char line[TRACE_LINE_SIZE];
+
+    for (uint64_t index = begin; index < end; index++) {
+        TraceEntry entry;
+        if (!read_record(index, entry)) {
+            continue;
+        }
+
+        // Rest of the text whose first part is already overwritten
+        if (!entry.fmt && entry.text_part != 0) {
+            continue;
+        }
+
+        format_entry(entry, line, sizeof(line));
+        if (!entry.fmt) {
+            index = append_text_parts(index, end, entry, line, sizeof(line));
+        }
+
+        LOG_INFO("[%lld.%06lld] %s: %s",
+                 (long long)(entry.ts_ns / 1'000'000'000),
+                 (long long)(entry.ts_ns % 1'000'000'000 / 1000), entry.tag,
+                 line);
+    }
+}
+
+void trace_dump() {
+    uint64_t end = g_head.load(std::memory_order_acquire);
+    uint64_t begin = end > TRACE_RING_SIZE ? end - TRACE_RING_SIZE : 0;
+
+    LOG_INFO("Dumping trace records [%llu, %llu)", (unsigned long long)begin,
+             (unsigned long long)end);
+    dump_range(begin, end);
+    g_last_dumped.store(end, std::memory_order_relaxed);
+}
+
+void trace_dump_on_error() {
+    if (!trace_is_enabled()) {
+        return;
+    }
+
+    uint64_t end = g_head.load(std::memory_order_acquire);
+    uint64_t begin = g_last_dumped.exchange(end, std::memory_order_relaxed);
+    if (begin >= end) {
+        return;
+    }
+
+    if (end - begin > TRACE_RING_SIZE) {
+        begin = end - TRACE_RING_SIZE;
+    }
+
+    LOG_INFO("Trace before error:");
+    dump_range(begin, end);
+}
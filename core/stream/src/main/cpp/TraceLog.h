@@ -0,0 +1,94 @@
+#pragma once
+
+#include <atomic>
+#include <cstdarg>
+#include <cstdint>
+#include <type_traits>
+
+// In-memory binary trace log.
+//
+// Every record stores timestamp, tag and format pointer together with raw
+// arguments, formatting happens only when the ring is dumped. Recording is
+// lock-free and never calls into the system, so tracing can stay enabled
+// on the frame path.
+//
+// NOTE: Tag, format and string arguments are stored as pointers, so they must
+// outlive the ring (string literals or static names). Mutable char buffers
+// are rejected at compile time.
+
+constexpr int TRACE_MAX_ARGS = 7;
+
+enum class TraceArgType : uint8_t {
+    Int,
+    UInt,
+    Double,
+    Ptr,
+    Str,
+};
+
+struct TraceArg {
+    TraceArgType type;
+    uint64_t value;
+};
+
+template <typename T>
+inline TraceArg make_trace_arg(T value) {
+    static_assert(!std::is_same_v<std::decay_t<T>, char *>,
+                  "Only static strings can be traced");
+
+    if constexpr (std::is_same_v<std::decay_t<T>, const char *>) {
+        return {TraceArgType::Str, (uint64_t)(uintptr_t)value};
+    } else if constexpr (std::is_floating_point_v<T>) {
+        double v = value;
+        uint64_t bits = 0;
+        __builtin_memcpy(&bits, &v, sizeof(bits));
+        return {TraceArgType::Double, bits};
+    } else if constexpr (std::is_pointer_v<T>) {
+        return {TraceArgType::Ptr, (uint64_t)(uintptr_t)value};
+    } else if constexpr (std::is_enum_v<T>) {
+        return {TraceArgType::Int, (uint64_t)(int64_t)value};
+    } else if constexpr (std::is_signed_v<T>) {
+        return {TraceArgType::Int, (uint64_t)(int64_t)value};
+    } else {
+        static_assert(std::is_integral_v<T>, "Unsupported trace argument");
+        return {TraceArgType::UInt, (uint64_t)value};
+    }
+}
+
+extern std::atomic<bool> g_trace_enabled;
+
+// Disabled by default
+void trace_set_enabled(bool enabled);
+inline bool trace_is_enabled() {
+    return g_trace_enabled.load(std::memory_order_relaxed);
+}
+
+void trace_record(const char *tag, const char *fmt, const TraceArg *args,
+                  int arg_count);
+
+// Formats message immediately and stores it as text, used for foreign
+// messages (e.g. ffmpeg logs) which arguments can't be kept. Long messages
+// take several consecutive records and are limited by the dump line size.
+void trace_record_text(const char *tag, const char *fmt, va_list args);
+
+// Writes all records that are still in the ring into the log
+void trace_dump();
+
+// Dumps records added since the previous dump, called after errors
+void trace_dump_on_error();
+
+template <typename... Args>
+inline void trace_log(const char *tag, const char *fmt, Args... args) {
+    static_assert(sizeof...(Args) <= TRACE_MAX_ARGS, "Too many trace args");
+
+    if (!trace_is_enabled()) {
+        return;
+    }
+
+    if constexpr (sizeof...(Args) == 0) {
+        trace_record(tag, fmt, nullptr, 0);
+    } else {
+        const TraceArg trace_args[] = {make_trace_arg(args)...};
+        trace_record(tag, fmt, trace_args, sizeof...(Args));
+    }
+}
@@ -0,0 +1,23 @@
+#include <jni.h>
+
+#include "JniUtils.h"
+#include "TraceLog.h"
+
+extern "C" {
+
+JNIEXPORT void JNICALL Java_com_rejeq_cpcam_core_stream_jni_TraceLogJni_setEnabled(
+    JNIEnv * /* env */, jobject /* obj */, jboolean enabled) {
+    trace_set_enabled(enabled);
+}
+
+JNIEXPORT void JNICALL
+Java_com_rejeq_cpcam_core_stream_jni_TraceLogJni_setFfmpegLogLevel(
+    JNIEnv * /* env */, jobject /* obj */, jint level) {
+    set_ffmpeg_log_level(level);
+}
+
+JNIEXPORT void JNICALL Java_com_rejeq_cpcam_core_stream_jni_TraceLogJni_dump(
+    JNIEnv * /* env */, jobject /* obj */) {
+    trace_dump();
+}
+}
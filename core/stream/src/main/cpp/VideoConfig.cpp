@@ -1,5 +1,7 @@
 #include "VideoConfig.h"
 
+#include <cstdio>
+
 #include "JniUtils.h"
 
 // obj must be PixFmt class
@@ -43,3 +45,10 @@ VideoConfig VideoConfig::build(JNIEnv *env, jobject obj) {
         .height = height,
     };
 }
+
+std::string VideoConfig::cache_key() const {
+    char key[128];
+    snprintf(key, sizeof(key), "%s/%d/%dx%d@%d/%lld", codec_name.c_str(),
+             (int)pix_fmt, width, height, framerate, (long long)bitrate);
+    return key;
+}
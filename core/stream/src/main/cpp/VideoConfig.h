@@ -13,6 +13,9 @@ struct VideoConfig {
     // obj must be VideoConfig class
     static VideoConfig build(JNIEnv *env, jobject obj);
 
+    // Unique string for every distinct config, used as a cache key
+    std::string cache_key() const;
+
     std::string codec_name;
     PixFmt pix_fmt;
     int64_t bitrate;
@@ -0,0 +1,274 @@
+#include "CodecProbe.h"
+
+#include <algorithm>
+#include <map>
+#include <mutex>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavutil/pixdesc.h>
+#include <libavutil/time.h>
+}
+
+#include "FFmpegUtils.h"
+#include "output/FFmpegOutput.h"
+
+#define LOG_TAG "CodecProbe"
+#include "Log.h"
+
+// Enough to get past encoder warmup, while keeping probing of all encoders
+// within few seconds
+constexpr int PROBE_FRAME_COUNT = 60;
+
+// Hardware encoders may still be processing the input after flush
+constexpr int64_t PROBE_DRAIN_TIMEOUT_MS = 2000;
+
+static std::mutex g_cache_lock;
+static std::map<std::string, std::optional<CodecProbeResult>> g_cache;
+
+// Fills frame with moving pattern, so encoder can't skip the content
+static void fill_synthetic(AVFrame *frame, int index) {
+    const AVPixFmtDescriptor *desc =
+        av_pix_fmt_desc_get((AVPixelFormat)frame->format);
+    int plane_count = av_pix_fmt_count_planes((AVPixelFormat)frame->format);
+
+    for (int p = 0; p < plane_count; p++) {
+        int height = frame->height;
+        if (p > 0 && !(desc->flags & AV_PIX_FMT_FLAG_RGB)) {
+            height = (height + (1 << desc->log2_chroma_h) - 1) >>
+                     desc->log2_chroma_h;
+        }
+
+        for (int y = 0; y < height; y++) {
+            uint8_t *row = frame->data[p] + (ptrdiff_t)y * frame->linesize[p];
+            for (int x = 0; x < frame->linesize[p]; x++) {
+                row[x] = (uint8_t)(x + y + index * 3 + ((x * y) ^ index));
+            }
+        }
+    }
+}
+
+struct ProbeState {
+    int64_t send_time[PROBE_FRAME_COUNT];
+    int64_t total_latency = 0;
+    int64_t max_latency = 0;
+    int64_t total_bytes = 0;
+    int received = 0;
+};
+
+static void count_packet(AVPacket *pkt, ProbeState &state) {
+    if (pkt->pts >= 0 && pkt->pts < PROBE_FRAME_COUNT) {
+        int64_t latency = av_gettime_relative() - state.send_time[pkt->pts];
+        state.total_latency += latency;
+        state.max_latency = std::max(state.max_latency, latency);
+    }
+
+    state.total_bytes += pkt->size;
+    state.received++;
+    av_packet_unref(pkt);
+}
+
+// Returns false on encoder failure
+static bool receive_packets(AVCodecContext *cctx, AVPacket *pkt,
+                            ProbeState &state) {
+    while (true) {
+        int res = avcodec_receive_packet(cctx, pkt);
+        if (res == AVERROR(EAGAIN) || res == AVERROR_EOF) {
+            return true;
+        }
+
+        if (res < 0) {
+            LOG_ERROR("Unable to receive packet: %s",
+                      av_err_to_string(res).data());
+            return false;
+        }
+
+        count_packet(pkt, state);
+    }
+}
+
+static bool send_frame(AVCodecContext *cctx, AVFrame *frame, AVPacket *pkt,
+                       ProbeState &state) {
+    while (true) {
+        int res = avcodec_send_frame(cctx, frame);
+        if (res == AVERROR(EAGAIN)) {
+            if (!receive_packets(cctx, pkt, state)) {
+                return false;
+            }
+            continue;
+        }
+
+        if (res < 0) {
+            LOG_ERROR("Unable to send frame: %s",
+                      av_err_to_string(res).data());
+            return false;
+        }
+
+        return receive_packets(cctx, pkt, state);
+    }
+}
+
+// Receives delayed packets until EOF or timeout, returns false on encoder
+// failure
+static bool drain(AVCodecContext *cctx, AVPacket *pkt, ProbeState &state) {
+    int res = avcodec_send_frame(cctx, nullptr);
+    if (res < 0 && res != AVERROR_EOF) {
+        LOG_ERROR("Unable to start draining: %s", av_err_to_string(res).data());
+        return false;
+    }
+
+    int64_t deadline = av_gettime_relative() + PROBE_DRAIN_TIMEOUT_MS * 1000;
+    while (true) {
+        res = avcodec_receive_packet(cctx, pkt);
+        if (res == AVERROR_EOF) {
+            return true;
+        }
+
+        if (res == AVERROR(EAGAIN)) {
+            if (av_gettime_relative() > deadline) {
+                LOG_WARN("Drain timeout reached, %d of %d packets received",
+                         state.received, PROBE_FRAME_COUNT);
+                return true;
+            }
+
+            av_usleep(1000);
+            continue;
+        }
+
+        if (res < 0) {
+            LOG_ERROR("Unable to receive packet while draining: %s",
+                      av_err_to_string(res).data());
+            return false;
+        }
+
+        count_packet(pkt, state);
+    }
+}
+
+static std::optional<CodecProbeResult> run_probe(const VideoConfig &config) {
+    std::optional<CodecProbeResult> result;
+    ProbeState state{};
+    int64_t start = 0;
+    int64_t elapsed = 0;
+    bool failure = false;
+
+    AVCodecContext *cctx = make_encoder(config, 0);
+    AVFrame *frame = make_av_frame(config.width, config.height,
+                                   to_av_pix_fmt(config.pix_fmt));
+    AVPacket *pkt = av_packet_alloc();
+    if (!cctx || !frame || !pkt) {
+        goto cleanup;
+    }
+
+    start = av_gettime_relative();
+    for (int i = 0; i < PROBE_FRAME_COUNT; i++) {
+        if (av_frame_make_writable(frame) < 0) {
+            failure = true;
+            break;
+        }
+
+        fill_synthetic(frame, i);
+        frame->pts = i;
+        frame->duration = 1;
+
+        state.send_time[i] = av_gettime_relative();
+        if (!send_frame(cctx, frame, pkt, state)) {
+            failure = true;
+            break;
+        }
+    }
+
+    if (!failure && drain(cctx, pkt, state)) {
+        elapsed = av_gettime_relative() - start;
+    }
+
+    if (failure || elapsed <= 0 || state.received == 0) {
+        goto cleanup;
+    }
+
+    // Frames that didn't come out of the encoder in time aren't counted
+    result = CodecProbeResult{
+        .codec_name = config.codec_name,
+        .pix_fmt = config.pix_fmt,
+        .fps = state.received * 1'000'000.0 / (double)elapsed,
+        .avg_latency_ms =
+            (double)state.total_latency / state.received / 1000.0,
+        .max_latency_ms = (double)state.max_latency / 1000.0,
+        .bitrate = state.total_bytes * 8 * config.framerate / state.received,
+    };
+
+    LOG_INFO("%s (pix_fmt: %d): %.1f fps, latency %.2f/%.2f ms, %lld bps",
+             result->codec_name.c_str(), (int)result->pix_fmt, result->fps,
+             result->avg_latency_ms, result->max_latency_ms,
+             (long long)result->bitrate);
+
+cleanup:
+    av_packet_free(&pkt);
+    av_frame_free(&frame);
+    avcodec_free_context(&cctx);
+    return result;
+}
+
+std::optional<CodecProbeResult> CodecProbe::probe(const VideoConfig &config) {
+    std::string key = config.cache_key();
+
+    {
+        std::lock_guard<std::mutex> lock(g_cache_lock);
+        auto it = g_cache.find(key);
+        if (it != g_cache.end()) {
+            return it->second;
+        }
+    }
+
+    auto result = run_probe(config);
+
+    std::lock_guard<std::mutex> lock(g_cache_lock);
+    g_cache[key] = result;
+    return result;
+}
+
+std::vector<CodecProbeResult> CodecProbe::probe_all(int width, int height,
+                                                    int framerate,
+                                                    int64_t bitrate) {
+    std::vector<CodecProbeResult> results;
+
+    const AVCodec *codec = nullptr;
+    void *it = nullptr;
+    while ((codec = av_codec_iterate(&it))) {
+        if (!av_codec_is_encoder(codec) || codec->type != AVMEDIA_TYPE_VIDEO) {
+            continue;
+        }
+
+        auto pix_fmts = FFmpegOutput::get_supported_formats(codec->name);
+        for (PixFmt pix_fmt : pix_fmts) {
+            auto result = probe(VideoConfig{
+                .codec_name = codec->name,
+                .pix_fmt = pix_fmt,
+                .bitrate = bitrate,
+                .framerate = framerate,
+                .width = width,
+                .height = height,
+            });
+
+            if (result) {
+                results.emplace_back(std::move(*result));
+            }
+        }
+    }
+
+    std::stable_sort(results.begin(), results.end(),
+                     [framerate](const auto &a, const auto &b) {
+                         if (a.is_viable(framerate) != b.is_viable(framerate)) {
+                             return a.is_viable(framerate);
+                         }
+
+                         return a.fps > b.fps;
+                     });
+
+    return results;
+}
+
+void CodecProbe::clear_cache() {
+    std::lock_guard<std::mutex> lock(g_cache_lock);
+    g_cache.clear();
+}
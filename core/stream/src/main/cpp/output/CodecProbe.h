@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "PixFmt.h"
+#include "VideoConfig.h"
+
+struct CodecProbeResult {
+    std::string codec_name;
+    PixFmt pix_fmt;
+
+    // Encoded frames per second of wall time
+    double fps;
+    // Time between sending the frame and receiving its packet
+    double avg_latency_ms;
+    double max_latency_ms;
+    // Actual output bitrate of the synthetic clip
+    int64_t bitrate;
+
+    // Encoder is able to keep up with the requested framerate
+    bool is_viable(int framerate) const { return fps >= framerate; }
+};
+
+// Measures encoding speed of every available encoder and pixel format pair by
+// encoding a short synthetic clip. Results are cached for the process
+// lifetime, since opening MediaCodec encoders is expensive.
+//
+// NOTE: Blocks for the whole probing time, must not be called from the
+// frame path.
+class CodecProbe {
+   public:
+    // Returns results ranked from the fastest viable combination to the
+    // slowest one
+    static std::vector<CodecProbeResult> probe_all(int width, int height,
+                                                   int framerate,
+                                                   int64_t bitrate);
+
+    static std::optional<CodecProbeResult> probe(const VideoConfig &config);
+
+    static void clear_cache();
+};
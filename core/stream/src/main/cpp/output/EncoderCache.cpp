@@ -0,0 +1,224 @@
+#include "EncoderCache.h"
+
+#include <condition_variable>
+#include <list>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+extern "C" {
+#include <libavutil/imgutils.h>
+#include <libavutil/time.h>
+}
+
+#include "FFmpegUtils.h"
+#include "ThreadPolicy.h"
+
+#define LOG_TAG "EncoderCache"
+#include "Log.h"
+
+// Rough amount of frames held by the encoder (input, reference and
+// reconstructed frames). Real memory usage isn't exposed by the encoders.
+constexpr int64_t ESTIMATED_ENCODER_FRAMES = 4;
+
+struct CachedEncoder {
+    std::string key;
+    AVCodecContext *cctx;
+    int64_t released_us;
+    int64_t bytes;
+};
+
+struct EncoderCacheState {
+    std::mutex lock;
+    std::condition_variable cond;
+
+    // Ordered from the least recently released encoder
+    std::list<CachedEncoder> entries;
+    int64_t total_bytes = 0;
+
+    EncoderCacheOptions options;
+    bool is_janitor_running = false;
+};
+
+// Never destroyed, since janitor thread can outlive static destructors
+static EncoderCacheState &state() {
+    static auto *state = new EncoderCacheState();
+    return *state;
+}
+
+static std::string make_key(const VideoConfig &config, int flags) {
+    return config.cache_key() + "/" + std::to_string(flags);
+}
+
+static int64_t estimate_bytes(const AVCodecContext *cctx) {
+    int size = av_image_get_buffer_size(cctx->pix_fmt, cctx->width,
+                                        cctx->height, 1);
+    return size > 0 ? size * ESTIMATED_ENCODER_FRAMES : 0;
+}
+
+static void free_encoders(std::vector<AVCodecContext *> &encoders) {
+    for (AVCodecContext *cctx : encoders) {
+        avcodec_free_context(&cctx);
+    }
+
+    encoders.clear();
+}
+
+// Moves encoders out of the cache, until it fits into the limits. Must be
+// called with locked state
+static void evict_locked(EncoderCacheState &st, int64_t now_us,
+                         std::vector<AVCodecContext *> &evicted) {
+    int64_t timeout_us = st.options.idle_timeout_ms * 1000;
+
+    auto it = st.entries.begin();
+    while (it != st.entries.end()) {
+        bool is_expired = now_us - it->released_us >= timeout_us;
+        bool is_over_limit = st.total_bytes > st.options.max_bytes;
+        if (!is_expired && !is_over_limit) {
+            break;
+        }
+
+        LOG_INFO("Closing idle encoder '%s'", it->key.c_str());
+        st.total_bytes -= it->bytes;
+        evicted.push_back(it->cctx);
+        it = st.entries.erase(it);
+    }
+}
+
+static void run_janitor() {
+    ThreadPolicy::apply(ThreadRole::Background, "cpcam-janitor");
+
+    EncoderCacheState &st = state();
+    std::vector<AVCodecContext *> evicted;
+
+    std::unique_lock<std::mutex> lock(st.lock);
+    while (!st.entries.empty()) {
+        int64_t now = av_gettime_relative();
+        evict_locked(st, now, evicted);
+
+        if (!evicted.empty()) {
+            // Closing MediaCodec may block, so cache stays usable meanwhile
+            lock.unlock();
+            free_encoders(evicted);
+            lock.lock();
+            continue;
+        }
+
+        int64_t expire_at =
+            st.entries.front().released_us + st.options.idle_timeout_ms * 1000;
+        st.cond.wait_for(lock, std::chrono::microseconds(expire_at - now));
+    }
+
+    st.is_janitor_running = false;
+}
+
+AVCodecContext *EncoderCache::acquire(const VideoConfig &config, int flags,
+                                      bool *is_warm) {
+    EncoderCacheState &st = state();
+    std::string key = make_key(config, flags);
+
+    if (is_warm) {
+        *is_warm = false;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(st.lock);
+
+        // Most recently released encoder is the most likely to be valid
+        for (auto it = st.entries.rbegin(); it != st.entries.rend(); ++it) {
+            if (it->key != key) {
+                continue;
+            }
+
+            AVCodecContext *cctx = it->cctx;
+            st.total_bytes -= it->bytes;
+            st.entries.erase(std::next(it).base());
+
+            LOG_INFO("Reusing idle encoder '%s'", key.c_str());
+            if (is_warm) {
+                *is_warm = true;
+            }
+            return cctx;
+        }
+    }
+
+    return make_encoder(config, flags);
+}
+
+void EncoderCache::release(AVCodecContext *cctx, const VideoConfig &config,
+                           int flags, bool is_clean) {
+    if (!cctx) {
+        return;
+    }
+
+    if (!is_clean) {
+        if (!(cctx->codec->capabilities & AV_CODEC_CAP_ENCODER_FLUSH)) {
+            avcodec_free_context(&cctx);
+            return;
+        }
+
+        avcodec_flush_buffers(cctx);
+    }
+
+    EncoderCacheState &st = state();
+    std::vector<AVCodecContext *> evicted;
+
+    {
+        std::lock_guard<std::mutex> lock(st.lock);
+        if (st.options.idle_timeout_ms <= 0) {
+            evicted.push_back(cctx);
+        } else {
+            CachedEncoder entry{
+                .key = make_key(config, flags),
+                .cctx = cctx,
+                .released_us = av_gettime_relative(),
+                .bytes = estimate_bytes(cctx),
+            };
+
+            LOG_INFO("Caching idle encoder '%s'", entry.key.c_str());
+            st.total_bytes += entry.bytes;
+            st.entries.push_back(std::move(entry));
+            evict_locked(st, av_gettime_relative(), evicted);
+        }
+
+        if (!st.entries.empty() && !st.is_janitor_running) {
+            st.is_janitor_running = true;
+            std::thread(run_janitor).detach();
+        }
+    }
+
+    free_encoders(evicted);
+}
+
+void EncoderCache::set_options(const EncoderCacheOptions &options) {
+    EncoderCacheState &st = state();
+    std::vector<AVCodecContext *> evicted;
+
+    {
+        std::lock_guard<std::mutex> lock(st.lock);
+        st.options = options;
+        evict_locked(st, av_gettime_relative(), evicted);
+        st.cond.notify_all();
+    }
+
+    free_encoders(evicted);
+}
+
+void EncoderCache::clear() {
+    EncoderCacheState &st = state();
+    std::vector<AVCodecContext *> evicted;
+
+    {
+        std::lock_guard<std::mutex> lock(st.lock);
+        for (auto &entry : st.entries) {
+            evicted.push_back(entry.cctx);
+        }
+
+        st.entries.clear();
+        st.total_bytes = 0;
+        st.cond.notify_all();
+    }
+
+    free_encoders(evicted);
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+}
+
+#include "VideoConfig.h"
+
+struct EncoderCacheOptions {
+    // Idle encoders are closed after this time, zero disables caching
+    int64_t idle_timeout_ms = 30'000;
+    // Estimated memory of all idle encoders, least recently released
+    // encoders are closed first when it's exceeded
+    int64_t max_bytes = 64 * 1024 * 1024;
+};
+
+// Keeps opened encoders after their stream is destroyed, so next session
+// with the same config doesn't pay for opening the encoder again (hundreds
+// of milliseconds for MediaCodec).
+//
+// Encoders are keyed by VideoConfig together with AVCodecContext flags. Only
+// encoders that are in the initial state are cached, i.e. flushed or never
+// fed with frames.
+class EncoderCache {
+   public:
+    // Returns idle encoder or opens a new one, returns nullptr on failure.
+    // is_warm is set to true when encoder is taken from the cache.
+    static AVCodecContext *acquire(const VideoConfig &config, int flags,
+                                   bool *is_warm = nullptr);
+
+    // Takes ownership of cctx. is_clean tells that encoder wasn't fed with
+    // frames since it was opened or flushed, otherwise encoder is cached only
+    // if it can be flushed.
+    static void release(AVCodecContext *cctx, const VideoConfig &config,
+                        int flags, bool is_clean);
+
+    static void set_options(const EncoderCacheOptions &options);
+
+    // Closes all idle encoders
+    static void clear();
+};
@@ -1,19 +1,110 @@
 #include "FFmpegOutput.h"
 
+#include <algorithm>
 #include <cassert>
 #include <vector>
 
 extern "C" {
 #include <libavcodec/avcodec.h>
+#include <libavcodec/bsf.h>
+#include <libavutil/opt.h>
 #include <libavutil/time.h>
 }
 
+#include "EventChannel.h"
 #include "FFmpegUtils.h"
+#include "ThreadPolicy.h"
+#include "output/EncoderCache.h"
 
 #define LOG_TAG "FFmpegOutput"
 #include "Log.h"
 
+// Multiple of mpegts packet size, so every sink write contains only whole
+// packets
+constexpr int SINK_AVIO_BUFFER_SIZE = 188 * 256;
+
+// Same as the defaults of ffmpeg udp protocol
+constexpr int MPEGTS_DATAGRAM_SIZE = 188 * 7;
+constexpr int DEFAULT_DATAGRAM_SIZE = 1472;
+
+// Output listens for viewers instead of connecting somewhere
+constexpr char SERVER_URL_SCHEME[] = "serve://";
+
+// Fragmented mp4 written as Low-Latency HLS by LowLatencyHlsSink
+constexpr char LL_HLS_PROTOCOL[] = "llhls";
+constexpr char LL_HLS_MOVFLAGS[] =
+    "cmaf+frag_custom+empty_moov+default_base_moof+skip_trailer";
+
+// Returns path to the local file or nullptr if url must be handled by ffmpeg
+static const char *as_local_path(const std::string &url) {
+    const char *path = url.c_str();
+    if (strncmp(path, "file:", 5) == 0) {
+        return path + 5;
+    }
+
+    if (url.find("://") != std::string::npos) {
+        return nullptr;
+    }
+
+    return path;
+}
+
+// TODO: Do not hardcode
+static AVDictionary *make_muxer_options(const AVOutputFormat *fmt) {
+    AVDictionary *muxer_opts = nullptr;
+    if (strcmp(fmt->name, "hls") == 0) {
+        LOG_INFO("Setting muxer options for HLS");
+        av_dict_set(&muxer_opts, "hls_flags", "delete_segments", 0);
+    }
+
+    return muxer_opts;
+}
+
+// Errors after which the connection can't be used anymore
+static bool is_connection_error(int err) {
+    switch (err) {
+        case AVERROR(EPIPE):
+        case AVERROR(ECONNRESET):
+        case AVERROR(ECONNREFUSED):
+        case AVERROR(ECONNABORTED):
+        case AVERROR(ENOTCONN):
+        case AVERROR(ETIMEDOUT):
+        case AVERROR(EIO):
+        case AVERROR_EOF: return true;
+        default: return false;
+    }
+}
+
+// Returns "[host]:port" part of the serve:// url or nullptr for other urls
+static const char *as_server_address(const std::string &url) {
+    if (url.starts_with(SERVER_URL_SCHEME)) {
+        return url.c_str() + strlen(SERVER_URL_SCHEME);
+    }
+
+    return nullptr;
+}
+
+static std::string get_content_type(const AVOutputFormat *fmt) {
+    if (fmt->mime_type) {
+        return fmt->mime_type;
+    }
+
+    if (strcmp(fmt->name, "mjpeg") == 0) {
+        return "video/x-motion-jpeg";
+    }
+
+    return "application/octet-stream";
+}
+
 FFmpegOutput::~FFmpegOutput() {
+    stop_reconnect();
+    free_bitstream_filters();
+
+    if (m_sink) {
+        free_sink_avio(&m_octx->pb);
+        delete m_sink;
+    }
+
     avformat_free_context(m_octx);
 }
 
@@ -23,6 +114,12 @@ FFmpegOutput *FFmpegOutput::build(std::string url,
     int res = 0;
 
     const char *protocol_str = (protocol) ? protocol->c_str() : nullptr;
+
+    bool is_ll_hls = protocol && *protocol == LL_HLS_PROTOCOL;
+    if (is_ll_hls) {
+        protocol_str = "mp4";
+    }
+
     res = avformat_alloc_output_context2(&octx, nullptr, protocol_str,
                                          url.c_str());
     if (!octx || res < 0) {
@@ -32,6 +129,8 @@ FFmpegOutput *FFmpegOutput::build(std::string url,
     }
 
     auto *output = new FFmpegOutput(std::move(url), octx);
+    output->m_is_ll_hls = is_ll_hls;
+    octx->interrupt_callback = {interrupt_callback, output};
 
     return output;
 }
@@ -52,54 +151,697 @@ StreamError FFmpegOutput::open() {
     const AVOutputFormat *fmt = m_octx->oformat;
     int res = 0;
 
+    StreamError bsf_err = init_bitstream_filters();
+    if (bsf_err != StreamError::Success) {
+        return bsf_err;
+    }
+
     if (!(fmt->flags & AVFMT_NOFILE)) {
-        res = avio_open(&m_octx->pb, url, AVIO_FLAG_WRITE);
-        if (res < 0) {
-            LOG_ERROR("Unable to open '%s' url: %s\n", url,
-                      av_err_to_string(res).data());
-            return StreamError::FFmpegWriteFailed;
+        StreamError err = open_io();
+        if (err != StreamError::Success) {
+            return err;
         }
     }
 
-    // TODO: Do not hardcode
-    AVDictionary *muxer_opts = nullptr;
-    if (strcmp(fmt->name, "hls") == 0) {
-        LOG_INFO("Setting muxer options for HLS");
-        av_dict_set(&muxer_opts, "hls_flags", "delete_segments", 0);
+    AVDictionary *muxer_opts = make_muxer_options(fmt);
+    if (m_hls_sink) {
+        av_dict_set(&muxer_opts, "movflags", LL_HLS_MOVFLAGS, 0);
     }
 
     res = avformat_write_header(m_octx, &muxer_opts);
+    av_dict_free(&muxer_opts);
     if (res < 0) {
         LOG_ERROR("Unable to write header: %s", av_err_to_string(res).data());
         return StreamError::FFmpegWriteFailed;
     }
 
+    if (m_hls_sink) {
+        avio_flush(m_octx->pb);
+
+        StreamError err = m_hls_sink->finish_header();
+        if (err != StreamError::Success) {
+            return err;
+        }
+    }
+
+    update_time_bases(m_octx);
+
+    {
+        std::lock_guard<std::mutex> lock(m_io_lock);
+        m_wait_keyframe.assign(m_octx->nb_streams, false);
+    }
+
+    m_stop_reconnect = false;
+    m_is_connected = true;
     m_is_open = true;
     return StreamError::Success;
 }
 
-StreamError FFmpegOutput::close() {
+StreamError FFmpegOutput::close(int64_t timeout_ms) {
     if (!m_is_open) {
         LOG_WARN("Unable to close: Not opened");
         return StreamError::InvalidState;
     }
 
     const AVOutputFormat *fmt = m_octx->oformat;
+    int64_t deadline = av_gettime_relative() + timeout_ms * 1000;
+
+    // Write that is stuck on a dead connection holds io lock
+    m_io_deadline_us = deadline;
+    stop_reconnect();
 
-    // TODO: Add check that ensures that all streams are closed
+    {
+        // Streams that weren't stopped still may hold delayed packets
+        std::lock_guard<std::mutex> lock(m_streams_lock);
+        for (auto *stream : m_streams) {
+            stream->stop(deadline);
+        }
+    }
+
+    if (m_hls_sink) {
+        // Trailer is skipped, so the last fragment is written as a part
+        std::lock_guard<std::mutex> lock(m_io_lock);
+        flush_ll_hls_part();
+    }
 
     LOG_INFO("Writing trailer");
-    av_write_trailer(m_octx);
+    int res = av_write_trailer(m_octx);
+    if (res == AVERROR_EXIT) {
+        LOG_WARN("Writing trailer was interrupted");
+    } else if (res < 0) {
+        LOG_ERROR("Unable to write trailer: %s", av_err_to_string(res).data());
+    }
 
+    StreamError err = StreamError::Success;
     if (!(fmt->flags & AVFMT_NOFILE)) {
-        /* Close the output file. */
-        avio_closep(&m_octx->pb);
+        err = close_io();
     }
 
+    free_bitstream_filters();
+
+    m_io_deadline_us = 0;
+    m_is_aborted = false;
     m_is_open = false;
+    return err;
+}
+
+void FFmpegOutput::abort() {
+    LOG_INFO("Aborting io");
+    m_is_aborted = true;
+
+    std::lock_guard<std::mutex> lock(m_reconnect_lock);
+    m_reconnect_cond.notify_all();
+}
+
+int FFmpegOutput::interrupt_callback(void *opaque) {
+    auto *output = (FFmpegOutput *)opaque;
+    if (output->m_is_aborted.load(std::memory_order_relaxed)) {
+        return 1;
+    }
+
+    if (output->m_is_reconnecting.load(std::memory_order_relaxed) &&
+        output->m_stop_reconnect.load(std::memory_order_relaxed)) {
+        return 1;
+    }
+
+    int64_t now = av_gettime_relative();
+    int64_t deadline = output->m_io_deadline_us.load(std::memory_order_relaxed);
+    if (deadline != 0 && now > deadline) {
+        return 1;
+    }
+
+    deadline = output->m_write_deadline_us.load(std::memory_order_relaxed);
+    return deadline != 0 && now > deadline;
+}
+
+int FFmpegOutput::write_packet(AVPacket *pkt, int64_t deadline_us) {
+    std::lock_guard<std::mutex> lock(m_io_lock);
+
+    // Only this call is limited, deadline of close() is kept as is
+    m_write_deadline_us = deadline_us;
+    int res = write_locked_packet(pkt);
+    m_write_deadline_us = 0;
+    return res;
+}
+
+// Must be called with locked m_io_lock
+int FFmpegOutput::write_locked_packet(AVPacket *pkt) {
+    if (!m_is_connected) {
+        LOG_TRACE("Connection is lost, dropping packet");
+        return 0;
+    }
+
+    int idx = pkt->stream_index;
+    if (idx < (int)m_wait_keyframe.size() && m_wait_keyframe[idx]) {
+        if (!(pkt->flags & AV_PKT_FLAG_KEY)) {
+            LOG_TRACE("Waiting for keyframe, dropping packet");
+            return 0;
+        }
+
+        m_wait_keyframe[idx] = false;
+    }
+
+    if (idx < (int)m_bsfs.size() && m_bsfs[idx]) {
+        return filter_packet(m_bsfs[idx], pkt);
+    }
+
+    return mux_packet(pkt);
+}
+
+// Must be called with locked m_io_lock
+int FFmpegOutput::filter_packet(AVBSFContext *bsf, AVPacket *pkt) {
+    int res = av_bsf_send_packet(bsf, pkt);
+    if (res < 0) {
+        LOG_ERROR("Unable to send packet to bitstream filter: %s",
+                  av_err_to_string(res).data());
+        return res;
+    }
+
+    // Filter may hold the packet, so it's muxed only when something came out
+    int is_muxed = 0;
+    while (true) {
+        res = av_bsf_receive_packet(bsf, m_bsf_packet);
+        if (res == AVERROR(EAGAIN) || res == AVERROR_EOF) {
+            return is_muxed;
+        }
+
+        if (res < 0) {
+            LOG_ERROR("Unable to receive packet from bitstream filter: %s",
+                      av_err_to_string(res).data());
+            return res;
+        }
+
+        res = mux_packet(m_bsf_packet);
+        av_packet_unref(m_bsf_packet);
+
+        if (res < 0) {
+            return res;
+        }
+
+        is_muxed |= res;
+    }
+}
+
+// Must be called with locked m_io_lock
+int FFmpegOutput::mux_packet(AVPacket *pkt) {
+    if (!m_is_connected) {
+        return 0;
+    }
+
+    if (m_hls_sink) {
+        return mux_ll_hls_packet(pkt);
+    }
+
+    if (m_recording_sink && (pkt->flags & AV_PKT_FLAG_KEY) &&
+        m_recording_sink->need_rotate()) {
+        rotate_recording();
+    }
+
+    int res = av_write_frame(m_octx, pkt);
+    if (res < 0 && is_connection_error(res) && can_reconnect()) {
+        LOG_WARN("Connection lost: %s", av_err_to_string(res).data());
+        EventChannel::post(EventType::Error, this,
+                           (int32_t)StreamError::FFmpegWriteFailed, res);
+        start_reconnect();
+        return 0;
+    }
+
+    return res < 0 ? res : 1;
+}
+
+// Must be called with locked m_io_lock
+void FFmpegOutput::rotate_recording() {
+    // Packets are flushed one by one, so only the previous packet may be left
+    avio_flush(m_octx->pb);
+    m_recording_sink->rotate();
+
+    // Segment must be playable without the previous one
+    if (strcmp(m_octx->oformat->name, "mpegts") == 0) {
+        av_opt_set(m_octx->priv_data, "mpegts_flags", "+resend_headers", 0);
+    }
+}
+
+// Must be called with locked m_io_lock
+int FFmpegOutput::mux_ll_hls_packet(AVPacket *pkt) {
+    AVRational time_base = m_octx->streams[pkt->stream_index]->time_base;
+    AVRational us = {1, AV_TIME_BASE};
+    int64_t time_us = av_rescale_q(pkt->dts, time_base, us);
+    int64_t end_us = av_rescale_q(pkt->dts + pkt->duration, time_base, us);
+    bool is_keyframe = pkt->flags & AV_PKT_FLAG_KEY;
+
+    if (m_hls_sink->is_part_boundary(time_us, end_us, is_keyframe)) {
+        int res = flush_ll_hls_part();
+        if (res < 0) {
+            return res;
+        }
+    }
+
+    // Streams lock is taken before io lock when streams are stopped, so it
+    // can be only tried here. Request stays pending until streams are
+    // reached with one of the next packets.
+    if (m_hls_sink->has_keyframe_request() && m_streams_lock.try_lock()) {
+        for (auto *stream : m_streams) {
+            stream->request_keyframe();
+        }
+        m_streams_lock.unlock();
+        m_hls_sink->clear_keyframe_request();
+    }
+
+    int res = av_write_frame(m_octx, pkt);
+    if (res < 0) {
+        return res;
+    }
+
+    m_hls_sink->add_packet(time_us, end_us, is_keyframe);
+    return 1;
+}
+
+// Must be called with locked m_io_lock
+int FFmpegOutput::flush_ll_hls_part() {
+    // Muxer with frag_custom writes fragment on null packet
+    int res = av_write_frame(m_octx, nullptr);
+    if (res < 0) {
+        LOG_ERROR("Unable to flush fragment: %s", av_err_to_string(res).data());
+        return res;
+    }
+
+    avio_flush(m_octx->pb);
+    if (m_hls_sink->finish_part() != StreamError::Success) {
+        return AVERROR(EIO);
+    }
+
+    return 0;
+}
+
+void FFmpegOutput::request_keyframe() {
+    std::lock_guard<std::mutex> lock(m_streams_lock);
+    for (auto *stream : m_streams) {
+        stream->request_keyframe();
+    }
+}
+
+void FFmpegOutput::remove_stream(FFmpegVideoStream *stream) {
+    std::lock_guard<std::mutex> lock(m_streams_lock);
+    std::erase(m_streams, stream);
+}
+
+StreamError FFmpegOutput::init_bitstream_filters() {
+    // Filters left after failed open
+    free_bitstream_filters();
+
+    if (m_bsf_spec.empty()) {
+        return StreamError::Success;
+    }
+
+    LOG_INFO("Using bitstream filters: %s", m_bsf_spec.c_str());
+
+    m_bsf_packet = av_packet_alloc();
+    if (!m_bsf_packet) {
+        LOG_ERROR("Unable to allocate packet");
+        return StreamError::FFmpegAllocFailed;
+    }
+
+    std::lock_guard<std::mutex> lock(m_io_lock);
+    m_bsfs.assign(m_octx->nb_streams, nullptr);
+
+    for (unsigned i = 0; i < m_octx->nb_streams; i++) {
+        AVStream *st = m_octx->streams[i];
+
+        int res = av_bsf_list_parse_str(m_bsf_spec.c_str(), &m_bsfs[i]);
+        if (res < 0) {
+            LOG_ERROR("Unable to parse bitstream filters '%s': %s",
+                      m_bsf_spec.c_str(), av_err_to_string(res).data());
+            return StreamError::InvalidArgument;
+        }
+
+        res = avcodec_parameters_copy(m_bsfs[i]->par_in, st->codecpar);
+        if (res < 0) {
+            LOG_ERROR("Unable to copy parameters to bitstream filter: %s",
+                      av_err_to_string(res).data());
+            return StreamError::FFmpegAllocFailed;
+        }
+
+        m_bsfs[i]->time_base_in = st->time_base;
+
+        res = av_bsf_init(m_bsfs[i]);
+        if (res < 0) {
+            LOG_ERROR("Unable to init bitstream filters: %s",
+                      av_err_to_string(res).data());
+            return StreamError::InvalidArgument;
+        }
+
+        // Filters may update extradata, so muxer must get it in the header
+        res = avcodec_parameters_copy(st->codecpar, m_bsfs[i]->par_out);
+        if (res < 0) {
+            LOG_ERROR("Unable to copy parameters from bitstream filter: %s",
+                      av_err_to_string(res).data());
+            return StreamError::FFmpegAllocFailed;
+        }
+    }
+
     return StreamError::Success;
 }
 
+void FFmpegOutput::free_bitstream_filters() {
+    std::lock_guard<std::mutex> lock(m_io_lock);
+    for (AVBSFContext *&bsf : m_bsfs) {
+        av_bsf_free(&bsf);
+    }
+
+    m_bsfs.clear();
+    av_packet_free(&m_bsf_packet);
+}
+
+bool FFmpegOutput::can_reconnect() const {
+    return m_reconnect_options.initial_backoff_ms > 0 && !m_sink &&
+           as_local_path(m_url) == nullptr && !m_stop_reconnect &&
+           !m_is_aborted;
+}
+
+// Must be called with locked m_io_lock
+void FFmpegOutput::start_reconnect() {
+    m_is_connected = false;
+
+    // Previous reconnect may still be freeing the lost context, so it's
+    // joined by the new thread instead of blocking writers under the lock
+    std::thread previous = std::move(m_reconnect_thread);
+
+    m_is_reconnecting = true;
+    m_reconnect_thread =
+        std::thread(&FFmpegOutput::run_reconnect, this, std::move(previous));
+}
+
+void FFmpegOutput::stop_reconnect() {
+    {
+        // Reconnect is started under m_io_lock, so no new attempts can begin
+        // after this block
+        std::lock_guard<std::mutex> io_lock(m_io_lock);
+        std::lock_guard<std::mutex> lock(m_reconnect_lock);
+        m_stop_reconnect = true;
+        m_reconnect_cond.notify_all();
+    }
+
+    if (m_reconnect_thread.joinable()) {
+        m_reconnect_thread.join();
+    }
+}
+
+void FFmpegOutput::run_reconnect(std::thread previous) {
+    ThreadPolicy::apply(ThreadRole::Network, "cpcam-reconnect");
+
+    // Only one thread replaces m_octx at a time
+    if (previous.joinable()) {
+        previous.join();
+    }
+
+    int64_t begin = av_gettime_relative();
+    int64_t backoff_ms = m_reconnect_options.initial_backoff_ms;
+    int attempt = 0;
+
+    while (!m_stop_reconnect && !m_is_aborted) {
+        attempt++;
+
+        AVFormatContext *octx = make_reconnected_context();
+        if (octx) {
+            // Keyframe is requested before packets are accepted, so streams
+            // wait for it as short as possible
+            request_keyframe();
+
+            // Same muxer picks the same time bases, but streams must never
+            // rescale with the lost ones
+            update_time_bases(octx);
+
+            AVFormatContext *lost = nullptr;
+            {
+                std::lock_guard<std::mutex> lock(m_io_lock);
+                lost = m_octx;
+                m_octx = octx;
+                m_wait_keyframe.assign(m_octx->nb_streams, true);
+                m_is_connected = true;
+
+                // Cleared under the lock, so it never overrides the next
+                // reconnect that may start right after unlocking
+                m_is_reconnecting = false;
+            }
+
+            LOG_INFO("Reconnected after %d attempts in %lld ms", attempt,
+                     (long long)(av_gettime_relative() - begin) / 1000);
+            free_lost_context(lost);
+            return;
+        }
+
+        LOG_WARN("Reconnect attempt %d failed, retrying in %lld ms", attempt,
+                 (long long)backoff_ms);
+
+        std::unique_lock<std::mutex> lock(m_reconnect_lock);
+        m_reconnect_cond.wait_for(
+            lock, std::chrono::milliseconds(backoff_ms),
+            [this] { return m_stop_reconnect || m_is_aborted; });
+
+        backoff_ms =
+            std::min(backoff_ms * 2, m_reconnect_options.max_backoff_ms);
+    }
+
+    m_is_reconnecting = false;
+}
+
+AVFormatContext *FFmpegOutput::make_reconnected_context() {
+    const char *url = m_url.c_str();
+    AVFormatContext *octx = nullptr;
+    AVDictionary *muxer_opts = nullptr;
+
+    int res = avformat_alloc_output_context2(&octx, m_octx->oformat, nullptr,
+                                             url);
+    if (!octx || res < 0) {
+        LOG_ERROR("Unable to allocate output context: %s",
+                  av_err_to_string(res).data());
+        return nullptr;
+    }
+
+    octx->interrupt_callback = {interrupt_callback, this};
+
+    // Codec parameters (including extradata) are the same, since encoders
+    // keep running
+    for (unsigned i = 0; i < m_octx->nb_streams; i++) {
+        const AVStream *src = m_octx->streams[i];
+
+        AVStream *st = avformat_new_stream(octx, nullptr);
+        if (!st) {
+            LOG_ERROR("Could not create new stream");
+            goto error;
+        }
+
+        res = avcodec_parameters_copy(st->codecpar, src->codecpar);
+        if (res < 0) {
+            LOG_ERROR("Could not copy the stream parameters: %s",
+                      av_err_to_string(res).data());
+            goto error;
+        }
+
+        st->id = src->id;
+        st->time_base = src->time_base;
+    }
+
+    if (!(octx->oformat->flags & AVFMT_NOFILE)) {
+        res = avio_open2(&octx->pb, url, AVIO_FLAG_WRITE,
+                         &octx->interrupt_callback, nullptr);
+        if (res < 0) {
+            LOG_WARN("Unable to open '%s' url: %s", url,
+                     av_err_to_string(res).data());
+            goto error;
+        }
+    }
+
+    muxer_opts = make_muxer_options(octx->oformat);
+    res = avformat_write_header(octx, &muxer_opts);
+    av_dict_free(&muxer_opts);
+    if (res < 0) {
+        LOG_WARN("Unable to write header: %s", av_err_to_string(res).data());
+        goto error;
+    }
+
+    return octx;
+
+error:
+    if (!(octx->oformat->flags & AVFMT_NOFILE)) {
+        avio_closep(&octx->pb);
+    }
+    avformat_free_context(octx);
+    return nullptr;
+}
+
+void FFmpegOutput::free_lost_context(AVFormatContext *octx) {
+    if (octx->oformat->flags & AVFMT_NOFILE) {
+        // Muxers that manage connection by themselves (e.g. rtsp) release it
+        // only in trailer
+        av_write_trailer(octx);
+    } else {
+        avio_closep(&octx->pb);
+    }
+
+    avformat_free_context(octx);
+}
+
+OutputSink *FFmpegOutput::make_sink() {
+    const char *local_path = as_local_path(m_url);
+    if (m_is_ll_hls) {
+        if (!local_path) {
+            LOG_ERROR("Low-latency HLS requires path to the local playlist");
+            return nullptr;
+        }
+
+        AVRational framerate = m_octx->nb_streams > 0
+                                   ? m_octx->streams[0]->avg_frame_rate
+                                   : AVRational{0, 1};
+
+        LOG_INFO("Using low-latency HLS sink for '%s'", local_path);
+        m_hls_sink =
+            LowLatencyHlsSink::build(local_path, m_ll_hls_options, framerate);
+        return m_hls_sink;
+    }
+
+    if (is_recording()) {
+        LOG_INFO("Using recording sink for '%s'", local_path);
+        m_recording_sink =
+            RecordingSink::build(local_path, m_recording_options);
+        if (!m_recording_sink) {
+            return nullptr;
+        }
+
+        // Segments are cut only at packet boundaries, so every packet must
+        // reach the sink before the next one is muxed
+        m_octx->flush_packets = 1;
+        return m_recording_sink;
+    }
+
+    if (is_paced()) {
+        LOG_INFO("Using paced udp sink for '%s'", m_url.c_str());
+
+        const AVOutputFormat *fmt = m_octx->oformat;
+        int datagram_size = strcmp(fmt->name, "mpegts") == 0
+                                ? MPEGTS_DATAGRAM_SIZE
+                                : DEFAULT_DATAGRAM_SIZE;
+
+        int64_t bitrate = 0;
+        AVRational framerate = {0, 1};
+        if (m_octx->nb_streams > 0) {
+            bitrate = m_octx->streams[0]->codecpar->bit_rate;
+            framerate = m_octx->streams[0]->avg_frame_rate;
+        }
+
+        return PacedUdpSink::build(m_url, datagram_size, m_pacing_options,
+                                   bitrate, framerate);
+    }
+
+    const char *server_address = as_server_address(m_url);
+    if (server_address) {
+        LOG_INFO("Using server sink for '%s'", server_address);
+        auto *sink = ServerSink::build(server_address,
+                                       get_content_type(m_octx->oformat),
+                                       m_server_options);
+        if (!sink) {
+            return nullptr;
+        }
+
+        // Every packet is flushed, so new viewers start from packet boundary
+        m_octx->flush_packets = 1;
+        sink->set_join_callback([this] { request_keyframe(); });
+        return sink;
+    }
+
+    return nullptr;
+}
+
+bool FFmpegOutput::is_paced() const {
+    return m_pacing_options.is_enabled && PacedUdpSink::is_supported(m_url);
+}
+
+bool FFmpegOutput::is_recording() const {
+    return m_recording_options.is_enabled && as_local_path(m_url) &&
+           RecordingSink::is_supported(m_octx->oformat);
+}
+
+StreamError FFmpegOutput::open_io() {
+    const char *url = m_url.c_str();
+
+    if (m_recording_options.is_enabled && !is_recording()) {
+        LOG_WARN("Recording sink can't be used with '%s' muxer, writing '%s' "
+                 "directly",
+                 m_octx->oformat->name, url);
+    }
+
+    if (!m_is_ll_hls && !is_recording() && !as_server_address(m_url) &&
+        !is_paced()) {
+        int res = avio_open2(&m_octx->pb, url, AVIO_FLAG_WRITE,
+                             &m_octx->interrupt_callback, nullptr);
+        if (res < 0) {
+            LOG_ERROR("Unable to open '%s' url: %s\n", url,
+                      av_err_to_string(res).data());
+            return StreamError::FFmpegWriteFailed;
+        }
+
+        return StreamError::Success;
+    }
+
+    OutputSink *sink = make_sink();
+    if (!sink) {
+        return StreamError::FFmpegAllocFailed;
+    }
+
+    sink->set_event_source(this);
+
+    StreamError err = sink->open();
+    if (err != StreamError::Success) {
+        delete sink;
+        m_hls_sink = nullptr;
+        m_recording_sink = nullptr;
+        return err;
+    }
+
+    // Buffer of the packet size is written as soon as it's full, so every
+    // write is a single packet
+    int packet_size = sink->max_packet_size();
+    m_octx->pb = make_sink_avio(
+        sink, packet_size > 0 ? packet_size : SINK_AVIO_BUFFER_SIZE);
+    if (!m_octx->pb) {
+        sink->close();
+        delete sink;
+        m_hls_sink = nullptr;
+        m_recording_sink = nullptr;
+        return StreamError::FFmpegAllocFailed;
+    }
+
+    m_octx->pb->max_packet_size = packet_size;
+
+    m_octx->flags |= AVFMT_FLAG_CUSTOM_IO;
+    m_sink = sink;
+    return StreamError::Success;
+}
+
+StreamError FFmpegOutput::close_io() {
+    if (!m_sink) {
+        /* Close the output file. */
+        avio_closep(&m_octx->pb);
+        return StreamError::Success;
+    }
+
+    free_sink_avio(&m_octx->pb);
+    StreamError err = m_sink->close();
+
+    delete m_sink;
+    m_sink = nullptr;
+    m_hls_sink = nullptr;
+    m_recording_sink = nullptr;
+    return err;
+}
+
+void FFmpegOutput::update_time_bases(const AVFormatContext *octx) {
+    for (unsigned i = 0; i < octx->nb_streams; i++) {
+        m_time_bases[i].store(octx->streams[i]->time_base,
+                              std::memory_order_relaxed);
+    }
+}
+
 FFmpegVideoStream *FFmpegOutput::make_video_stream(const VideoConfig &config) {
     // TODO: Fail if output already started
 
@@ -113,47 +855,30 @@ FFmpegVideoStream *FFmpegOutput::make_video_stream(const VideoConfig &config) {
     // NOTE: Id can be changed internally by ffmpeg
     st->id = st->index;
 
-    const char *codec_name = config.codec_name.c_str();
-    const AVCodec *codec = avcodec_find_encoder_by_name(codec_name);
-    if (!codec) {
-        LOG_ERROR("Unable to find '%s' encoder", codec_name);
-        return nullptr;
-    }
-
-    AVCodecContext *cctx = avcodec_alloc_context3(codec);
-    if (!cctx) {
-        LOG_ERROR("Unable to allocate codec context\n");
-        return nullptr;
-    }
-
-    cctx->codec_id = codec->id;
-    cctx->bit_rate = config.bitrate;
-    cctx->width = config.width;
-    cctx->height = config.height;
+    st->time_base = {1, config.framerate};
+    st->avg_frame_rate = {config.framerate, 1};
 
-    AVRational time_base = {1, config.framerate};
-    st->time_base = time_base;
-    cctx->time_base = time_base;
-
-    cctx->framerate = {config.framerate, 1};
-    cctx->pix_fmt = to_av_pix_fmt(config.pix_fmt);
+    // Muxer may change it when the header is written
+    m_time_bases.emplace_back(st->time_base);
 
+    int flags = 0;
     if (m_octx->oformat->flags & AVFMT_GLOBALHEADER) {
-        cctx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+        flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
     }
 
-    AVDictionary *options = nullptr;
-    av_dict_set(&options, "preset", "veryslow", 0);
+    int64_t begin = av_gettime_relative();
+    bool is_warm = false;
 
-    int res = avcodec_open2(cctx, codec, &options);
-    if (res < 0) {
-        LOG_ERROR("Unable to open video codec: %s",
-                  av_err_to_string(res).data());
-        avcodec_free_context(&cctx);
+    AVCodecContext *cctx = EncoderCache::acquire(config, flags, &is_warm);
+    if (!cctx) {
         return nullptr;
     }
 
-    res = avcodec_parameters_from_context(st->codecpar, cctx);
+    LOG_INFO("Encoder is ready in %lld us (%s)",
+             (long long)(av_gettime_relative() - begin),
+             is_warm ? "warm" : "cold");
+
+    int res = avcodec_parameters_from_context(st->codecpar, cctx);
     if (res < 0) {
         LOG_ERROR("Could not copy the stream parameters: %s",
                   av_err_to_string(res).data());
@@ -161,16 +886,45 @@ FFmpegVideoStream *FFmpegOutput::make_video_stream(const VideoConfig &config) {
         return nullptr;
     }
 
-    auto *stream = FFmpegVideoStream::build(m_octx, cctx, st->index);
+    auto *stream =
+        FFmpegVideoStream::build(this, cctx, st->index, config, flags);
     if (!stream) {
         LOG_ERROR("Unable to allocate video stream");
         avcodec_free_context(&cctx);
         return nullptr;
     }
 
+    std::lock_guard<std::mutex> lock(m_streams_lock);
+    m_streams.push_back(stream);
+
     return stream;
 }
 
+int FFmpegOutput::add_encoded_stream(const AVCodecParameters *par,
+                                     AVRational time_base) {
+    assert((int)m_octx->nb_streams < m_octx->max_streams);
+    AVStream *st = avformat_new_stream(m_octx, nullptr);
+    if (!st) {
+        LOG_ERROR("Could not create new stream");
+        return AVERROR(ENOMEM);
+    }
+
+    st->id = st->index;
+    st->time_base = time_base;
+    m_time_bases.emplace_back(time_base);
+
+    int res = avcodec_parameters_copy(st->codecpar, par);
+    if (res < 0) {
+        LOG_ERROR("Could not copy the stream parameters: %s",
+                  av_err_to_string(res).data());
+        return res;
+    }
+
+    // Tag of the source container may be invalid for the output one
+    st->codecpar->codec_tag = 0;
+    return st->index;
+}
+
 std::vector<PixFmt> FFmpegOutput::get_supported_formats(
     const std::string &codec_name) {
     const AVCodec *codec = nullptr;
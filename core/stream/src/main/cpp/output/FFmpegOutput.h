@@ -1,15 +1,34 @@
 #pragma once
 
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
 
 extern "C" {
+#include <libavcodec/bsf.h>
 #include <libavformat/avformat.h>
 }
 
 #include "StreamError.h"
 #include "VideoConfig.h"
+#include "output/LowLatencyHlsSink.h"
+#include "output/OutputSink.h"
+#include "output/PacedUdpSink.h"
+#include "output/RecordingSink.h"
+#include "output/ServerSink.h"
 #include "stream/FFmpegVideoStream.h"
 
+struct ReconnectOptions {
+    // Delay before the second attempt, doubled after every failed attempt.
+    // Zero disables reconnecting.
+    int64_t initial_backoff_ms = 100;
+    int64_t max_backoff_ms = 5000;
+};
+
 // TODO: Better error handling
 class FFmpegOutput {
    public:
@@ -21,17 +40,164 @@ class FFmpegOutput {
                                const std::string *protocol = nullptr);
 
     StreamError open();
-    StreamError close();
+
+    // Drains started streams and writes trailer. All blocking io is aborted
+    // when timeout is reached, so close never hangs on a stuck connection.
+    StreamError close(int64_t timeout_ms = DEFAULT_CLOSE_TIMEOUT_MS);
+
+    // Interrupts current and all next blocking io until output is closed.
+    // Can be called from any thread.
+    void abort();
 
     FFmpegVideoStream *make_video_stream(const VideoConfig &config);
 
+    // Adds stream without encoder that is fed with already encoded packets
+    // through write_packet(), e.g. by ReplaySource. Returns stream index or
+    // negative AVERROR code. Must be called before open.
+    int add_encoded_stream(const AVCodecParameters *par, AVRational time_base);
+
+    // Next frame of every stream is encoded as keyframe
+    void request_keyframe();
+
+    // Bitstream filters applied to packets of every stream before muxing,
+    // in av_bsf_list_parse_str() syntax (e.g. "dump_extra=freq=keyframe").
+    // Filters must not change timestamps. Must be set before open.
+    void set_bitstream_filters(std::string filters) {
+        m_bsf_spec = std::move(filters);
+    }
+
+    // Called by streams and replay only. Returns 1 when the packet was muxed,
+    // 0 when it was dropped and negative AVERROR code on failure. While
+    // connection is lost packets are dropped, after reconnecting every stream
+    // is resumed from its next keyframe. Blocking io of this call fails with
+    // AVERROR_EXIT after deadline (in av_gettime_relative units), 0 means no
+    // deadline.
+    int write_packet(AVPacket *pkt, int64_t deadline_us = 0);
+
+    // Time base chosen by the muxer, doesn't lock, so it can be called for
+    // every frame while io is blocked
+    AVRational stream_time_base(int stream_index) const {
+        return m_time_bases[stream_index].load(std::memory_order_relaxed);
+    }
+
+    void remove_stream(FFmpegVideoStream *stream);
+
+    // Used only for serve://[host]:port urls, must be set before open
+    void set_server_options(const ServerOptions &options) {
+        m_server_options = options;
+    }
+
+    // Used only for network urls, must be set before open
+    void set_reconnect_options(const ReconnectOptions &options) {
+        m_reconnect_options = options;
+    }
+
+    // Used only for "llhls" protocol, must be set before open
+    void set_ll_hls_options(const LowLatencyHlsOptions &options) {
+        m_ll_hls_options = options;
+    }
+
+    // Used only for udp:// and rtp:// urls, must be set before open
+    void set_pacing_options(const PacingOptions &options) {
+        m_pacing_options = options;
+    }
+
+    // Used only when url points to the local file of mpegts or mjpeg
+    // format, must be set before open
+    void set_recording_options(const RecordingOptions &options) {
+        m_recording_options = options;
+    }
+
     static std::vector<PixFmt> get_supported_formats(
         const std::string &codec_name);
 
+    static constexpr int64_t DEFAULT_CLOSE_TIMEOUT_MS = 1000;
+
    private:
+    OutputSink *make_sink();
+    bool is_paced() const;
+
+    // Local file is written through RecordingSink
+    bool is_recording() const;
+    StreamError open_io();
+    StreamError close_io();
+
+    static int interrupt_callback(void *opaque);
+
+    StreamError init_bitstream_filters();
+    void free_bitstream_filters();
+
+    int write_locked_packet(AVPacket *pkt);
+    int filter_packet(AVBSFContext *bsf, AVPacket *pkt);
+    int mux_packet(AVPacket *pkt);
+
+    // Starts the next segment of m_recording_sink before the keyframe
+    void rotate_recording();
+
+    // Cut fragments into parts of m_hls_sink
+    int mux_ll_hls_packet(AVPacket *pkt);
+    int flush_ll_hls_part();
+
+    bool can_reconnect() const;
+    void start_reconnect();
+    // Joins previous reconnect thread before touching the context
+    void run_reconnect(std::thread previous);
+    void stop_reconnect();
+
+    // Opens new connection with the same streams and writes header, returns
+    // nullptr on failure
+    AVFormatContext *make_reconnected_context();
+    void free_lost_context(AVFormatContext *octx);
+
+    // Must be called after header of octx is written
+    void update_time_bases(const AVFormatContext *octx);
+
     // TODO: AVFormatContext has url field, consider using it
     std::string m_url;
 
+    // Guards writing into m_octx and its replacement after reconnect
+    mutable std::mutex m_io_lock;
     AVFormatContext *m_octx;
     bool m_is_open = false;
+
+    OutputSink *m_sink = nullptr;
+
+    // Same object as m_sink when low-latency HLS is used
+    LowLatencyHlsSink *m_hls_sink = nullptr;
+    // Same object as m_sink when recording sink is used
+    RecordingSink *m_recording_sink = nullptr;
+    LowLatencyHlsOptions m_ll_hls_options;
+    bool m_is_ll_hls = false;
+    RecordingOptions m_recording_options;
+    PacingOptions m_pacing_options;
+    ServerOptions m_server_options;
+
+    std::mutex m_streams_lock;
+    std::vector<FFmpegVideoStream *> m_streams;
+
+    // Time base of every stream by its index. Elements are added only before
+    // open, so they are never moved while streams read them.
+    std::deque<std::atomic<AVRational>> m_time_bases;
+
+    // Deadline of all blocking io, set by close()
+    std::atomic<int64_t> m_io_deadline_us = 0;
+    // Deadline of the current write_packet(), changed under m_io_lock
+    std::atomic<int64_t> m_write_deadline_us = 0;
+    std::atomic<bool> m_is_aborted = false;
+
+    ReconnectOptions m_reconnect_options;
+    std::thread m_reconnect_thread;
+    std::mutex m_reconnect_lock;
+    std::condition_variable m_reconnect_cond;
+
+    // Filters of every stream by its index, guarded by m_io_lock
+    std::string m_bsf_spec;
+    std::vector<AVBSFContext *> m_bsfs;
+    AVPacket *m_bsf_packet = nullptr;
+
+    // Streams which packets are dropped until keyframe, guarded by m_io_lock
+    std::vector<bool> m_wait_keyframe;
+    std::atomic<bool> m_is_connected = true;
+    std::atomic<bool> m_is_reconnecting = false;
+    std::atomic<bool> m_stop_reconnect = false;
 };
@@ -2,7 +2,12 @@
 
 #include <vector>
 
+#include "CodecProbe.h"
+#include "EncoderCache.h"
+#include "ReplaySource.h"
+
 #include "../JniUtils.h"
+#include "../MemoryBudget.h"
 #include "../VideoConfig.h"
 
 extern "C" {
@@ -39,9 +44,87 @@ Java_com_rejeq_cpcam_core_stream_jni_FFmpegOutputJni_open(JNIEnv * /* env */,
 
 JNIEXPORT jint JNICALL
 Java_com_rejeq_cpcam_core_stream_jni_FFmpegOutputJni_close(JNIEnv * /* env */,
+                                                           jobject /* obj */,
+                                                           jlong output,
+                                                           jlong timeoutMs) {
+    return (int)((FFmpegOutput *)output)->close(timeoutMs);
+}
+
+JNIEXPORT void JNICALL
+Java_com_rejeq_cpcam_core_stream_jni_FFmpegOutputJni_abort(JNIEnv * /* env */,
                                                            jobject /* obj */,
                                                            jlong output) {
-    return (int)((FFmpegOutput *)output)->close();
+    ((FFmpegOutput *)output)->abort();
+}
+
+JNIEXPORT void JNICALL
+Java_com_rejeq_cpcam_core_stream_jni_FFmpegOutputJni_setRecordingOptions(
+    JNIEnv * /* env */, jobject /* obj */, jlong output, jboolean isEnabled,
+    jlong segmentSize, jlong segmentDurationMs) {
+    RecordingOptions options;
+    options.is_enabled = isEnabled;
+    options.segment_size = segmentSize;
+    options.segment_duration_ms = segmentDurationMs;
+
+    ((FFmpegOutput *)output)->set_recording_options(options);
+}
+
+JNIEXPORT void JNICALL
+Java_com_rejeq_cpcam_core_stream_jni_FFmpegOutputJni_setLowLatencyHlsOptions(
+    JNIEnv * /* env */, jobject /* obj */, jlong output, jlong partTargetMs,
+    jlong segmentTargetMs, jint windowSegments) {
+    LowLatencyHlsOptions options;
+    options.part_target_ms = partTargetMs;
+    options.segment_target_ms = segmentTargetMs;
+    options.window_segments = windowSegments;
+
+    ((FFmpegOutput *)output)->set_ll_hls_options(options);
+}
+
+JNIEXPORT void JNICALL
+Java_com_rejeq_cpcam_core_stream_jni_FFmpegOutputJni_setPacingOptions(
+    JNIEnv * /* env */, jobject /* obj */, jlong output, jboolean isEnabled,
+    jfloat spread, jint queueDatagrams) {
+    PacingOptions options;
+    options.is_enabled = isEnabled;
+    options.spread = spread;
+    options.queue_datagrams = queueDatagrams;
+
+    ((FFmpegOutput *)output)->set_pacing_options(options);
+}
+
+JNIEXPORT void JNICALL
+Java_com_rejeq_cpcam_core_stream_jni_FFmpegOutputJni_setServerOptions(
+    JNIEnv * /* env */, jobject /* obj */, jlong output, jint maxClients,
+    jlong maxQueueBytes) {
+    ServerOptions options;
+    options.max_clients = maxClients;
+    options.max_queue_bytes = maxQueueBytes;
+
+    ((FFmpegOutput *)output)->set_server_options(options);
+}
+
+JNIEXPORT void JNICALL
+Java_com_rejeq_cpcam_core_stream_jni_FFmpegOutputJni_setReconnectOptions(
+    JNIEnv * /* env */, jobject /* obj */, jlong output,
+    jlong initialBackoffMs, jlong maxBackoffMs) {
+    ReconnectOptions options;
+    options.initial_backoff_ms = initialBackoffMs;
+    options.max_backoff_ms = maxBackoffMs;
+
+    ((FFmpegOutput *)output)->set_reconnect_options(options);
+}
+
+JNIEXPORT void JNICALL
+Java_com_rejeq_cpcam_core_stream_jni_FFmpegOutputJni_setBitstreamFilters(
+    JNIEnv *env, jobject /* obj */, jlong output, jstring filters) {
+    ((FFmpegOutput *)output)->set_bitstream_filters(to_string(env, filters));
+}
+
+JNIEXPORT void JNICALL
+Java_com_rejeq_cpcam_core_stream_jni_FFmpegOutputJni_requestKeyframe(
+    JNIEnv * /* env */, jobject /* obj */, jlong output) {
+    ((FFmpegOutput *)output)->request_keyframe();
 }
 
 JNIEXPORT jlong JNICALL
@@ -52,6 +135,36 @@ Java_com_rejeq_cpcam_core_stream_jni_FFmpegOutputJni_makeVideoStream(
     return (jlong)stream;
 }
 
+JNIEXPORT jobject JNICALL
+Java_com_rejeq_cpcam_core_stream_jni_FFmpegOutputJni_replay(
+    JNIEnv *env, jobject /* obj */, jlong output, jstring path,
+    jboolean isRealtime) {
+    ReplayReport report;
+    StreamError err = replay_into_output(
+        (FFmpegOutput *)output, to_string(env, path),
+        ReplayOptions{.is_realtime = (bool)isRealtime}, report);
+
+    jclass report_class =
+        env->FindClass("com/rejeq/cpcam/core/stream/jni/FFmpegReplayReport");
+    if (report_class == nullptr) {
+        return nullptr;
+    }
+
+    jmethodID report_ctor =
+        env->GetMethodID(report_class, "<init>", "(JJJJJJJJI)V");
+    if (report_ctor == nullptr) {
+        return nullptr;
+    }
+
+    // Report is returned even on failure, since replay may fail after some
+    // packets were already written
+    return env->NewObject(
+        report_class, report_ctor, (jlong)report.packets, (jlong)report.bytes,
+        (jlong)report.duration_us, (jlong)report.write_p50_us,
+        (jlong)report.write_p90_us, (jlong)report.write_p99_us,
+        (jlong)report.write_max_us, (jlong)report.failed_writes, (jint)err);
+}
+
 JNIEXPORT jintArray JNICALL
 Java_com_rejeq_cpcam_core_stream_jni_FFmpegOutputJniKt_nGetSupportedFormats(
     JNIEnv *env, jclass /* clazz */, jstring codec) {
@@ -71,4 +184,83 @@ Java_com_rejeq_cpcam_core_stream_jni_FFmpegOutputJniKt_nGetSupportedFormats(
                            (const jint *)supported_fmts.data());
     return dst_arr;
 }
+
+JNIEXPORT jobjectArray JNICALL
+Java_com_rejeq_cpcam_core_stream_jni_FFmpegOutputJniKt_nProbeCodecs(
+    JNIEnv *env, jclass /* clazz */, jint width, jint height, jint framerate,
+    jlong bitrate) {
+    auto results = CodecProbe::probe_all(width, height, framerate, bitrate);
+
+    jclass result_class =
+        env->FindClass("com/rejeq/cpcam/core/stream/jni/FFmpegCodecProbeResult");
+    if (result_class == nullptr) {
+        return nullptr;
+    }
+
+    jmethodID result_ctor =
+        env->GetMethodID(result_class, "<init>", "(Ljava/lang/String;IDDDJ)V");
+    if (result_ctor == nullptr) {
+        return nullptr;
+    }
+
+    jobjectArray dst_arr =
+        env->NewObjectArray((jsize)results.size(), result_class, nullptr);
+    if (dst_arr == nullptr) {
+        return nullptr;
+    }
+
+    for (size_t i = 0; i < results.size(); i++) {
+        const auto &result = results[i];
+
+        jstring codec_name = env->NewStringUTF(result.codec_name.c_str());
+        jobject obj = env->NewObject(
+            result_class, result_ctor, codec_name, (jint)result.pix_fmt,
+            (jdouble)result.fps, (jdouble)result.avg_latency_ms,
+            (jdouble)result.max_latency_ms, (jlong)result.bitrate);
+
+        env->SetObjectArrayElement(dst_arr, (jsize)i, obj);
+        env->DeleteLocalRef(obj);
+        env->DeleteLocalRef(codec_name);
+    }
+
+    return dst_arr;
+}
+
+JNIEXPORT void JNICALL
+Java_com_rejeq_cpcam_core_stream_jni_FFmpegOutputJniKt_nSetEncoderCacheOptions(
+    JNIEnv * /* env */, jclass /* clazz */, jlong idleTimeoutMs,
+    jlong maxBytes) {
+    EncoderCache::set_options(EncoderCacheOptions{
+        .idle_timeout_ms = idleTimeoutMs,
+        .max_bytes = maxBytes,
+    });
+}
+
+JNIEXPORT void JNICALL
+Java_com_rejeq_cpcam_core_stream_jni_FFmpegOutputJniKt_nClearEncoderCache(
+    JNIEnv * /* env */, jclass /* clazz */) {
+    EncoderCache::clear();
+}
+
+JNIEXPORT void JNICALL
+Java_com_rejeq_cpcam_core_stream_jni_FFmpegOutputJniKt_nSetMemoryBudget(
+    JNIEnv * /* env */, jclass /* clazz */, jlong softLimitBytes,
+    jlong hardLimitBytes) {
+    MemoryBudget::set_options(MemoryBudgetOptions{
+        .soft_limit_bytes = softLimitBytes,
+        .hard_limit_bytes = hardLimitBytes,
+    });
+}
+
+JNIEXPORT jlong JNICALL
+Java_com_rejeq_cpcam_core_stream_jni_FFmpegOutputJniKt_nGetNativeMemoryUsage(
+    JNIEnv * /* env */, jclass /* clazz */) {
+    return (jlong)MemoryBudget::used_bytes();
+}
+
+JNIEXPORT jlong JNICALL
+Java_com_rejeq_cpcam_core_stream_jni_FFmpegOutputJniKt_nGetNativeMemoryPeak(
+    JNIEnv * /* env */, jclass /* clazz */) {
+    return (jlong)MemoryBudget::peak_bytes();
+}
 }
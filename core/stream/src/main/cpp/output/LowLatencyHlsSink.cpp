@@ -0,0 +1,314 @@
+#include "LowLatencyHlsSink.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+#include <unistd.h>
+
+extern "C" {
+#include <libavutil/error.h>
+}
+
+#define LOG_TAG "LowLatencyHlsSink"
+#include "Log.h"
+
+constexpr char INIT_NAME[] = "init.mp4";
+
+// Used when stream doesn't have framerate
+constexpr AVRational DEFAULT_FRAME_RATE = {30, 1};
+
+// Parts are listed only for the latest segments, older segments are
+// referenced as a whole
+constexpr int PART_LISTED_SEGMENTS = 2;
+
+static std::string part_name(int64_t index) {
+    return "part" + std::to_string(index) + ".m4s";
+}
+
+static std::string segment_name(int64_t index) {
+    return "seg" + std::to_string(index) + ".m4s";
+}
+
+static bool write_file(const std::string &path, const char *mode,
+                       const uint8_t *data, size_t size) {
+    FILE *file = fopen(path.c_str(), mode);
+    if (!file) {
+        LOG_ERROR("Unable to open '%s': %s", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    bool is_written = fwrite(data, 1, size, file) == size;
+    if (!is_written) {
+        LOG_ERROR("Unable to write '%s': %s", path.c_str(), strerror(errno));
+    }
+
+    fclose(file);
+    return is_written;
+}
+
+static void remove_file(const std::string &path) {
+    if (unlink(path.c_str()) < 0 && errno != ENOENT) {
+        LOG_WARN("Unable to remove '%s': %s", path.c_str(), strerror(errno));
+    }
+}
+
+static double to_seconds(int64_t us) { return (double)us / 1'000'000.0; }
+
+LowLatencyHlsSink *LowLatencyHlsSink::build(
+    const std::string &playlist_path, const LowLatencyHlsOptions &options,
+    AVRational framerate) {
+    if (options.part_target_ms <= 0 || options.segment_target_ms <= 0 ||
+        options.window_segments <= 0) {
+        LOG_ERROR("Invalid options");
+        return nullptr;
+    }
+
+    if (framerate.num <= 0 || framerate.den <= 0) {
+        framerate = DEFAULT_FRAME_RATE;
+    }
+
+    // Parts and segments contain whole frames
+    int64_t frame_us = av_rescale(1'000'000, framerate.den, framerate.num);
+    int64_t part_frames = std::max<int64_t>(
+        1, std::llround((double)options.part_target_ms * 1000 / frame_us));
+    int64_t part_target_us = part_frames * frame_us;
+    int64_t segment_parts = std::max<int64_t>(
+        1, std::llround((double)options.segment_target_ms * 1000 /
+                        part_target_us));
+    int64_t segment_target_us = segment_parts * part_target_us;
+
+    size_t slash = playlist_path.find_last_of('/');
+    std::string dir = slash == std::string::npos
+                          ? std::string(".")
+                          : playlist_path.substr(0, slash);
+    std::string name = slash == std::string::npos
+                           ? playlist_path
+                           : playlist_path.substr(slash + 1);
+
+    LOG_INFO("Using %lld frames per part, %lld parts per segment",
+             (long long)part_frames, (long long)segment_parts);
+    return new LowLatencyHlsSink(std::move(dir), std::move(name),
+                                 part_target_us, segment_target_us,
+                                 options.window_segments);
+}
+
+StreamError LowLatencyHlsSink::open() {
+    m_pending.clear();
+    m_segments.clear();
+    m_segments.push_back(Segment{.index = 0});
+
+    m_next_part = 0;
+    m_part_start_us = AV_NOPTS_VALUE;
+    m_part_end_us = AV_NOPTS_VALUE;
+    m_segment_start_us = AV_NOPTS_VALUE;
+    m_is_segment_pending = false;
+    m_is_keyframe_requested = false;
+    m_is_keyframe_wanted = false;
+    return StreamError::Success;
+}
+
+StreamError LowLatencyHlsSink::close() {
+    if (!m_pending.empty()) {
+        LOG_WARN("Dropping %zu bytes of unfinished part", m_pending.size());
+        m_pending.clear();
+    }
+
+    if (m_segments.back().parts.empty()) {
+        m_segments.pop_back();
+    }
+
+    if (m_segments.empty()) {
+        return StreamError::Success;
+    }
+
+    return write_playlist(true);
+}
+
+int LowLatencyHlsSink::write(const uint8_t *data, int size) {
+    m_pending.insert(m_pending.end(), data, data + size);
+    return size;
+}
+
+StreamError LowLatencyHlsSink::finish_header() {
+    if (!write_file(path_of(INIT_NAME), "wb", m_pending.data(),
+                    m_pending.size())) {
+        return StreamError::FFmpegWriteFailed;
+    }
+
+    m_pending.clear();
+    return StreamError::Success;
+}
+
+bool LowLatencyHlsSink::is_part_boundary(int64_t time_us, int64_t end_us,
+                                         bool is_keyframe) {
+    if (m_part_start_us == AV_NOPTS_VALUE) {
+        return false;
+    }
+
+    int64_t segment_us = time_us - m_segment_start_us;
+    if (!m_is_keyframe_requested &&
+        segment_us >= m_segment_target_us - m_part_target_us) {
+        m_is_keyframe_requested = true;
+        m_is_keyframe_wanted = true;
+    }
+
+    if (is_keyframe && segment_us >= m_segment_target_us) {
+        m_is_segment_pending = true;
+        return true;
+    }
+
+    // Parts must not be longer than the advertised target
+    return end_us - m_part_start_us > m_part_target_us;
+}
+
+void LowLatencyHlsSink::add_packet(int64_t time_us, int64_t end_us,
+                                   bool is_keyframe) {
+    if (m_segment_start_us == AV_NOPTS_VALUE) {
+        m_segment_start_us = time_us;
+    }
+
+    if (m_part_start_us == AV_NOPTS_VALUE) {
+        m_part_start_us = time_us;
+        m_is_part_independent = is_keyframe;
+    }
+
+    m_part_end_us = std::max(m_part_end_us, end_us);
+}
+
+StreamError LowLatencyHlsSink::finish_part() {
+    if (m_part_start_us == AV_NOPTS_VALUE) {
+        return StreamError::Success;
+    }
+
+    Segment &segment = m_segments.back();
+    Part part{
+        .index = m_next_part++,
+        .duration_us = m_part_end_us - m_part_start_us,
+        .is_independent = m_is_part_independent,
+    };
+
+    // Segment file is the concatenation of its parts, file left by the
+    // previous session is overwritten by the first part
+    const char *segment_mode = segment.parts.empty() ? "wb" : "ab";
+    bool is_written =
+        write_file(path_of(part_name(part.index)), "wb", m_pending.data(),
+                   m_pending.size()) &&
+        write_file(path_of(segment_name(segment.index)), segment_mode,
+                   m_pending.data(), m_pending.size());
+    m_pending.clear();
+
+    m_part_start_us = AV_NOPTS_VALUE;
+    m_part_end_us = AV_NOPTS_VALUE;
+
+    if (!is_written) {
+        return StreamError::FFmpegWriteFailed;
+    }
+
+    segment.parts.push_back(part);
+    segment.duration_us += part.duration_us;
+
+    if (m_is_segment_pending) {
+        if (std::lround(to_seconds(segment.duration_us)) > target_duration()) {
+            LOG_WARN("Segment %lld is longer than target duration: %.3f s",
+                     (long long)segment.index,
+                     to_seconds(segment.duration_us));
+        }
+
+        m_segments.push_back(Segment{.index = segment.index + 1});
+
+        m_segment_start_us = AV_NOPTS_VALUE;
+        m_is_segment_pending = false;
+        m_is_keyframe_requested = false;
+        m_is_keyframe_wanted = false;
+        remove_old_segments();
+    }
+
+    return write_playlist(false);
+}
+
+int LowLatencyHlsSink::target_duration() const {
+    // Keyframe is requested one part before the segment target, so segment
+    // ends within one part after it
+    return (int)std::ceil(to_seconds(m_segment_target_us + m_part_target_us));
+}
+
+std::string LowLatencyHlsSink::path_of(const std::string &name) const {
+    return m_dir + "/" + name;
+}
+
+void LowLatencyHlsSink::remove_old_segments() {
+    // Segment in progress isn't counted
+    while ((int)m_segments.size() - 1 > m_window_segments) {
+        const Segment &segment = m_segments.front();
+        for (const Part &part : segment.parts) {
+            remove_file(path_of(part_name(part.index)));
+        }
+
+        remove_file(path_of(segment_name(segment.index)));
+        m_segments.pop_front();
+    }
+}
+
+StreamError LowLatencyHlsSink::write_playlist(bool is_final) {
+    std::string text;
+    char line[256];
+
+    auto append = [&](const char *fmt, auto... args) {
+        snprintf(line, sizeof(line), fmt, args...);
+        text += line;
+    };
+
+    text += "#EXTM3U\n";
+    text += "#EXT-X-VERSION:6\n";
+    append("#EXT-X-TARGETDURATION:%d\n", target_duration());
+    append("#EXT-X-PART-INF:PART-TARGET=%.3f\n", to_seconds(m_part_target_us));
+    append("#EXT-X-SERVER-CONTROL:PART-HOLD-BACK=%.3f\n",
+           to_seconds(3 * m_part_target_us));
+    append("#EXT-X-MEDIA-SEQUENCE:%lld\n", (long long)m_segments[0].index);
+    append("#EXT-X-MAP:URI=\"%s\"\n", INIT_NAME);
+
+    int count = (int)m_segments.size();
+    for (int i = 0; i < count; i++) {
+        const Segment &segment = m_segments[i];
+        bool is_current = !is_final && i == count - 1;
+
+        if (i >= count - 1 - PART_LISTED_SEGMENTS) {
+            for (const Part &part : segment.parts) {
+                append("#EXT-X-PART:DURATION=%.3f,URI=\"%s\"%s\n",
+                       to_seconds(part.duration_us),
+                       part_name(part.index).c_str(),
+                       part.is_independent ? ",INDEPENDENT=YES" : "");
+            }
+        }
+
+        if (!is_current) {
+            append("#EXTINF:%.3f,\n", to_seconds(segment.duration_us));
+            append("%s\n", segment_name(segment.index).c_str());
+        }
+    }
+
+    if (is_final) {
+        text += "#EXT-X-ENDLIST\n";
+    } else {
+        append("#EXT-X-PRELOAD-HINT:TYPE=PART,URI=\"%s\"\n",
+               part_name(m_next_part).c_str());
+    }
+
+    // Players never see partially written playlist
+    std::string path = path_of(m_playlist_name);
+    std::string tmp_path = path + ".tmp";
+    if (!write_file(tmp_path, "wb", (const uint8_t *)text.data(),
+                    text.size())) {
+        return StreamError::FFmpegWriteFailed;
+    }
+
+    if (rename(tmp_path.c_str(), path.c_str()) < 0) {
+        LOG_ERROR("Unable to replace playlist: %s", strerror(errno));
+        return StreamError::FFmpegWriteFailed;
+    }
+
+    return StreamError::Success;
+}
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include <libavutil/avutil.h>
+}
+
+#include "output/OutputSink.h"
+
+struct LowLatencyHlsOptions {
+    // Targets are rounded to whole frames of the stream
+    int64_t part_target_ms = 200;
+    int64_t segment_target_ms = 1000;
+
+    // Count of complete segments kept in the playlist, older are deleted
+    int window_segments = 6;
+};
+
+// Writes fragmented MP4 (CMAF) byte stream as Low-Latency HLS: init section,
+// partial segments, full segments and playlist with EXT-X-PART and
+// EXT-X-PRELOAD-HINT tags.
+//
+// Muxer must be configured with frag_custom, every fragment flushed by
+// FFmpegOutput becomes one part. Segments start on keyframes, keyframe is
+// requested shortly before the segment target is reached, so parts stay
+// GOP-aligned even with long encoder GOPs.
+//
+// Output url is the path of the playlist, other files are written next to
+// it. Files are expected to be served by any static HTTP server.
+class LowLatencyHlsSink : public OutputSink {
+   public:
+    LowLatencyHlsSink(std::string dir, std::string playlist_name,
+                      int64_t part_target_us, int64_t segment_target_us,
+                      int window_segments)
+        : m_dir(std::move(dir)),
+          m_playlist_name(std::move(playlist_name)),
+          m_part_target_us(part_target_us),
+          m_segment_target_us(segment_target_us),
+          m_window_segments(window_segments) {}
+    ~LowLatencyHlsSink() override = default;
+
+    // Sizes parts and segments from the framerate of the stream
+    static LowLatencyHlsSink *build(const std::string &playlist_path,
+                                    const LowLatencyHlsOptions &options,
+                                    AVRational framerate);
+
+    StreamError open() override;
+
+    // Writes final playlist, the last part must be finished before
+    StreamError close() override;
+
+    // Data is buffered until header or part is finished
+    int write(const uint8_t *data, int size) override;
+
+    // Data written so far is the init section (ftyp and moov)
+    StreamError finish_header();
+
+    // Called before every packet is muxed, returns true when the part in
+    // progress must be finished (fragment flushed) before the packet
+    bool is_part_boundary(int64_t time_us, int64_t end_us, bool is_keyframe);
+
+    // Called after packet is muxed
+    void add_packet(int64_t time_us, int64_t end_us, bool is_keyframe);
+
+    // Data written since the previous part is a complete fragment. Does
+    // nothing when part is empty.
+    StreamError finish_part();
+
+    // Keyframe should be requested from streams once per segment, so the
+    // next segment starts close to its target. Request stays pending until
+    // it's cleared after being delivered.
+    bool has_keyframe_request() const { return m_is_keyframe_wanted; }
+    void clear_keyframe_request() { m_is_keyframe_wanted = false; }
+
+   private:
+    struct Part {
+        int64_t index;
+        int64_t duration_us;
+        bool is_independent;
+    };
+
+    struct Segment {
+        int64_t index = 0;
+        int64_t duration_us = 0;
+        std::vector<Part> parts = {};
+    };
+
+    std::string path_of(const std::string &name) const;
+
+    void remove_old_segments();
+    StreamError write_playlist(bool is_final);
+
+    // EXT-X-TARGETDURATION in seconds, must not change while streaming
+    int target_duration() const;
+
+    std::string m_dir;
+    std::string m_playlist_name;
+
+    int64_t m_part_target_us;
+    int64_t m_segment_target_us;
+    int m_window_segments;
+
+    std::vector<uint8_t> m_pending;
+
+    // Complete segments and the one in progress as the last
+    std::deque<Segment> m_segments;
+    int64_t m_next_part = 0;
+
+    // Part in progress
+    int64_t m_part_start_us = AV_NOPTS_VALUE;
+    int64_t m_part_end_us = AV_NOPTS_VALUE;
+    bool m_is_part_independent = false;
+
+    int64_t m_segment_start_us = AV_NOPTS_VALUE;
+    bool m_is_segment_pending = false;
+    bool m_is_keyframe_requested = false;
+    bool m_is_keyframe_wanted = false;
+};
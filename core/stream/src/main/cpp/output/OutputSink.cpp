@@ -0,0 +1,43 @@
+#include "OutputSink.h"
+
+extern "C" {
+#include <libavutil/mem.h>
+}
+
+#define LOG_TAG "OutputSink"
+#include "Log.h"
+
+static int write_packet(void *opaque, const uint8_t *buf, int buf_size) {
+    auto *sink = (OutputSink *)opaque;
+    return sink->write(buf, buf_size);
+}
+
+AVIOContext *make_sink_avio(OutputSink *sink, int buffer_size) {
+    auto *buffer = (unsigned char *)av_malloc(buffer_size);
+    if (!buffer) {
+        LOG_ERROR("Unable to allocate avio buffer");
+        return nullptr;
+    }
+
+    AVIOContext *pb = avio_alloc_context(buffer, buffer_size, 1, sink, nullptr,
+                                         write_packet, nullptr);
+    if (!pb) {
+        LOG_ERROR("Unable to allocate avio context");
+        av_free(buffer);
+        return nullptr;
+    }
+
+    return pb;
+}
+
+void free_sink_avio(AVIOContext **pb) {
+    if (!*pb) {
+        return;
+    }
+
+    avio_flush(*pb);
+
+    // NOTE: avio_context_free does not free internal buffer
+    av_freep(&(*pb)->buffer);
+    avio_context_free(pb);
+}
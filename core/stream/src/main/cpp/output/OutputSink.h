@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdint>
+
+extern "C" {
+#include <libavformat/avio.h>
+}
+
+#include "StreamError.h"
+
+// Destination for the muxed byte stream that is handled by us instead of
+// the ffmpeg protocols. The muxer writes into it through AVIOContext created
+// by make_sink_avio().
+class OutputSink {
+   public:
+    virtual ~OutputSink() = default;
+
+    virtual StreamError open() = 0;
+    virtual StreamError close() = 0;
+
+    // Returns amount of written bytes or negative AVERROR code
+    virtual int write(const uint8_t *data, int size) = 0;
+
+    // Every write is at most this size and is sent as a whole (datagram),
+    // zero means byte stream
+    virtual int max_packet_size() const { return 0; }
+
+    // Handle that is reported as the source of posted events
+    void set_event_source(const void *source) { m_event_source = source; }
+
+   protected:
+    const void *m_event_source = nullptr;
+};
+
+// AVIOContext is not seekable, so only streaming muxers can be used with it.
+// Must be freed with free_sink_avio()
+AVIOContext *make_sink_avio(OutputSink *sink, int buffer_size);
+void free_sink_avio(AVIOContext **pb);
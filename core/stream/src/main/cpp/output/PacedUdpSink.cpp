@@ -0,0 +1,360 @@
+#include "PacedUdpSink.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+#include <netdb.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+extern "C" {
+#include <libavformat/avformat.h>
+#include <libavutil/error.h>
+#include <libavutil/time.h>
+}
+
+#include "EventChannel.h"
+#include "MemoryBudget.h"
+#include "ThreadPolicy.h"
+
+#define LOG_TAG "PacedUdpSink"
+#include "Log.h"
+
+// Datagrams that may leave the socket back to back, also the batch size of
+// sendmmsg
+constexpr int MAX_BATCH = 4;
+
+// Minimal rate relative to the stream bitrate
+constexpr double BASE_RATE_FACTOR = 1.25;
+
+// Used when stream doesn't have framerate
+constexpr AVRational DEFAULT_FRAME_RATE = {30, 1};
+
+static bool is_rtcp(const uint8_t *data, int size) {
+    // Version 2 and payload types of SR, RR, SDES, BYE, APP
+    return size >= 8 && (data[0] >> 6) == 2 && data[1] >= 200 &&
+           data[1] <= 204;
+}
+
+// Returns connected socket or -1 on failure
+static int connect_udp(const char *host, int port) {
+    char port_str[16];
+    snprintf(port_str, sizeof(port_str), "%d", port);
+
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+
+    addrinfo *addrs = nullptr;
+    int res = getaddrinfo(host, port_str, &hints, &addrs);
+    if (res != 0) {
+        LOG_ERROR("Unable to resolve '%s': %s", host, gai_strerror(res));
+        return -1;
+    }
+
+    int fd = -1;
+    for (addrinfo *addr = addrs; addr; addr = addr->ai_next) {
+        fd = socket(addr->ai_family, addr->ai_socktype | SOCK_CLOEXEC,
+                    addr->ai_protocol);
+        if (fd < 0) {
+            continue;
+        }
+
+        if (connect(fd, addr->ai_addr, addr->ai_addrlen) == 0) {
+            break;
+        }
+
+        ::close(fd);
+        fd = -1;
+    }
+
+    freeaddrinfo(addrs);
+
+    if (fd < 0) {
+        LOG_ERROR("Unable to connect to %s:%d: %s", host, port,
+                  strerror(errno));
+    }
+
+    return fd;
+}
+
+PacedUdpSink::~PacedUdpSink() {
+    if (m_is_open) {
+        close();
+    }
+
+    if (m_rtcp_fd >= 0) {
+        ::close(m_rtcp_fd);
+    }
+    ::close(m_fd);
+}
+
+bool PacedUdpSink::is_supported(const std::string &url) {
+    return url.starts_with("udp://") || url.starts_with("rtp://");
+}
+
+PacedUdpSink *PacedUdpSink::build(const std::string &url, int datagram_size,
+                                  const PacingOptions &options,
+                                  int64_t bitrate, AVRational framerate) {
+    if (options.spread <= 0 || options.spread > 1 ||
+        options.queue_datagrams <= 0) {
+        LOG_ERROR("Invalid options");
+        return nullptr;
+    }
+
+    char proto[16];
+    char host[256];
+    int port = -1;
+    av_url_split(proto, sizeof(proto), nullptr, 0, host, sizeof(host), &port,
+                 nullptr, 0, url.c_str());
+
+    if (port <= 0 || port > 65535) {
+        LOG_ERROR("Invalid port in '%s'", url.c_str());
+        return nullptr;
+    }
+
+    int fd = connect_udp(host, port);
+    if (fd < 0) {
+        return nullptr;
+    }
+
+    int rtcp_fd = -1;
+    if (strcmp(proto, "rtp") == 0) {
+        rtcp_fd = connect_udp(host, port + 1);
+        if (rtcp_fd < 0) {
+            ::close(fd);
+            return nullptr;
+        }
+    }
+
+    if (framerate.num <= 0 || framerate.den <= 0) {
+        framerate = DEFAULT_FRAME_RATE;
+    }
+
+    int64_t frame_interval_us =
+        av_rescale(1'000'000, framerate.den, framerate.num);
+    auto base_rate = (int64_t)((double)bitrate / 8 * BASE_RATE_FACTOR);
+
+    LOG_INFO("Pacing %d byte datagrams to %s:%d, base rate: %lld B/s",
+             datagram_size, host, port, (long long)base_rate);
+    return new PacedUdpSink(fd, rtcp_fd, datagram_size, options,
+                            frame_interval_us, base_rate);
+}
+
+StreamError PacedUdpSink::open() {
+    if (m_is_open) {
+        LOG_WARN("Unable to open: Already opened");
+        return StreamError::InvalidState;
+    }
+
+    auto ring_size = (int64_t)m_options.queue_datagrams * m_datagram_size;
+    if (!MemoryBudget::reserve(ring_size)) {
+        LOG_ERROR("Datagram queue doesn't fit into the memory budget");
+        return StreamError::FFmpegAllocFailed;
+    }
+
+    m_ring.resize(ring_size);
+    m_sizes.assign(m_options.queue_datagrams, 0);
+    m_head = 0;
+    m_count = 0;
+    m_backlog_bytes = 0;
+
+    m_tokens = 0;
+    m_rate = (double)m_base_rate;
+    m_refilled_at_us = av_gettime_relative();
+
+    m_sent = 0;
+    m_dropped = 0;
+    m_max_queued = 0;
+
+    m_is_stopping = false;
+    m_is_congested = false;
+    m_thread = std::thread(&PacedUdpSink::send_loop, this);
+
+    m_is_open = true;
+    return StreamError::Success;
+}
+
+StreamError PacedUdpSink::close() {
+    if (!m_is_open) {
+        LOG_WARN("Unable to close: Not opened");
+        return StreamError::InvalidState;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_is_stopping = true;
+    }
+    m_cond.notify_all();
+    m_thread.join();
+
+    LOG_INFO("Sent %lld datagrams, dropped: %lld, max queued: %d",
+             (long long)m_sent, (long long)m_dropped, m_max_queued);
+
+    MemoryBudget::release((int64_t)m_ring.size());
+    m_ring = {};
+    m_sizes = {};
+
+    m_is_open = false;
+    return StreamError::Success;
+}
+
+int PacedUdpSink::write(const uint8_t *data, int size) {
+    if (size > m_datagram_size) {
+        LOG_ERROR("Datagram is too big: %d > %d", size, m_datagram_size);
+        return AVERROR(EMSGSIZE);
+    }
+
+    if (m_rtcp_fd >= 0 && is_rtcp(data, size)) {
+        // Sender reports are small and must keep their timing
+        if (send(m_rtcp_fd, data, size, MSG_DONTWAIT) < 0) {
+            LOG_WARN("Unable to send RTCP: %s", strerror(errno));
+        }
+        return size;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+
+        int capacity = (int)m_sizes.size();
+        if (m_count == capacity) {
+            // Network keeps up with the bitrate, so queue is full only when
+            // sender is stalled. Stream is already broken, muxer isn't.
+            if (!m_is_congested) {
+                EventChannel::post(EventType::Congestion, m_event_source,
+                                   (int32_t)CongestionReason::PacerQueueFull,
+                                   m_count);
+                m_is_congested = true;
+            }
+
+            m_dropped++;
+            return size;
+        }
+
+        m_is_congested = false;
+
+        int index = (m_head + m_count) % capacity;
+        memcpy(m_ring.data() + (size_t)index * m_datagram_size, data, size);
+        m_sizes[index] = size;
+        m_count++;
+        m_backlog_bytes += size;
+        m_max_queued = std::max(m_max_queued, m_count);
+
+        // Whole backlog must leave within the spread part of the interval
+        double window_s =
+            (double)m_frame_interval_us * m_options.spread / 1'000'000.0;
+        m_rate = std::max(m_rate, (double)m_backlog_bytes / window_s);
+    }
+
+    m_cond.notify_one();
+    return size;
+}
+
+// Must be called with locked m_lock
+void PacedUdpSink::refill(int64_t now_us) {
+    double elapsed_s = (double)(now_us - m_refilled_at_us) / 1'000'000.0;
+    double bucket = (double)MAX_BATCH * m_datagram_size;
+
+    m_tokens = std::min(bucket, m_tokens + elapsed_s * m_rate);
+    m_refilled_at_us = now_us;
+}
+
+void PacedUdpSink::send_loop() {
+    ThreadPolicy::apply(ThreadRole::Network, "cpcam-pacer");
+
+    std::unique_lock<std::mutex> lock(m_lock);
+    while (true) {
+        m_cond.wait(lock, [this]() { return m_is_stopping || m_count > 0; });
+
+        if (m_count == 0) {
+            // Stopping and everything is sent
+            return;
+        }
+
+        refill(av_gettime_relative());
+
+        int capacity = (int)m_sizes.size();
+        int batch = 0;
+        double tokens = m_tokens;
+        while (batch < std::min(m_count, MAX_BATCH)) {
+            int size = m_sizes[(m_head + batch) % capacity];
+            if (tokens < size) {
+                break;
+            }
+
+            tokens -= size;
+            batch++;
+        }
+
+        if (batch == 0) {
+            // Sleeps until the front datagram can be sent, new writes may
+            // raise the rate meanwhile
+            double missing = m_sizes[m_head] - m_tokens;
+            auto wait_us = (int64_t)(missing / m_rate * 1'000'000.0) + 1;
+            m_cond.wait_for(lock, std::chrono::microseconds(wait_us));
+            continue;
+        }
+
+        // Batch never wraps around the ring, so it's contiguous for sendmmsg
+        batch = std::min(batch, capacity - m_head);
+        int index = m_head;
+
+        lock.unlock();
+        int sent = send_batch(index, batch);
+        lock.lock();
+
+        int64_t sent_bytes = 0;
+        for (int i = 0; i < batch; i++) {
+            sent_bytes += m_sizes[index + i];
+        }
+
+        m_tokens -= (double)sent_bytes;
+        m_backlog_bytes -= sent_bytes;
+        m_head = (m_head + batch) % capacity;
+        m_count -= batch;
+        m_sent += sent;
+        m_dropped += batch - sent;
+
+        if (m_count == 0) {
+            m_rate = (double)m_base_rate;
+        }
+    }
+}
+
+int PacedUdpSink::send_batch(int index, int count) {
+    mmsghdr msgs[MAX_BATCH] = {};
+    iovec iovs[MAX_BATCH] = {};
+
+    for (int i = 0; i < count; i++) {
+        size_t offset = (size_t)(index + i) * m_datagram_size;
+        iovs[i].iov_base = m_ring.data() + offset;
+        iovs[i].iov_len = m_sizes[index + i];
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    int sent = 0;
+    while (sent < count) {
+        int res = sendmmsg(m_fd, msgs + sent, count - sent, 0);
+        if (res < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            // Receiver isn't listening yet (ICMP port unreachable) or the
+            // datagram is lost, next ones are still sent
+            LOG_TRACE("Unable to send datagram, errno: %d", errno);
+            count--;
+            memmove(msgs + sent, msgs + sent + 1,
+                    (count - sent) * sizeof(mmsghdr));
+            continue;
+        }
+
+        sent += res;
+    }
+
+    return sent;
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+extern "C" {
+#include <libavutil/rational.h>
+}
+
+#include "output/OutputSink.h"
+
+struct PacingOptions {
+    bool is_enabled = false;
+
+    // Part of the frame interval over which datagrams of every frame are
+    // spread, the rest is left for the encoder jitter
+    float spread = 0.8f;
+
+    // Datagrams waiting to be sent, new datagrams are dropped on overflow
+    int queue_datagrams = 1024;
+};
+
+// Sends every write as one UDP datagram (udp:// and rtp:// urls) through a
+// token bucket, so a keyframe doesn't leave the device as a single burst.
+//
+// Bucket is refilled at least at 1.25x of the stream bitrate, and faster
+// when the backlog wouldn't be sent within the spread part of the frame
+// interval. Rate is raised only while backlog exists, so bursts are sized
+// by the biggest frame in flight. Datagrams are sent in batches with
+// sendmmsg() from a single thread, muxer thread only copies them into the
+// ring.
+//
+// RTCP packets of rtp:// urls are sent right away to the port + 1, as the
+// ffmpeg rtp protocol does.
+class PacedUdpSink : public OutputSink {
+   public:
+    PacedUdpSink(int fd, int rtcp_fd, int datagram_size,
+                 const PacingOptions &options, int64_t frame_interval_us,
+                 int64_t base_rate)
+        : m_fd(fd),
+          m_rtcp_fd(rtcp_fd),
+          m_datagram_size(datagram_size),
+          m_options(options),
+          m_frame_interval_us(frame_interval_us),
+          m_base_rate(base_rate) {}
+    ~PacedUdpSink() override;
+
+    // Returns true for urls that can be paced
+    static bool is_supported(const std::string &url);
+
+    // Connects sockets to the url destination. Bitrate is in bits per
+    // second, zero means unknown.
+    static PacedUdpSink *build(const std::string &url, int datagram_size,
+                               const PacingOptions &options, int64_t bitrate,
+                               AVRational framerate);
+
+    StreamError open() override;
+
+    // Sends everything that is queued before returning
+    StreamError close() override;
+
+    // Every write is a single datagram of at most datagram_size bytes
+    int write(const uint8_t *data, int size) override;
+    int max_packet_size() const override { return m_datagram_size; }
+
+   private:
+    void send_loop();
+
+    // Sends count datagrams from the ring starting at index, returns count
+    // of datagrams that left the socket
+    int send_batch(int index, int count);
+
+    // Must be called with locked m_lock
+    void refill(int64_t now_us);
+
+    int m_fd;
+    int m_rtcp_fd;
+    int m_datagram_size;
+    PacingOptions m_options;
+    int64_t m_frame_interval_us;
+
+    // Bytes per second
+    int64_t m_base_rate;
+
+    std::thread m_thread;
+    std::mutex m_lock;
+    std::condition_variable m_cond;
+
+    // Ring of datagrams, each slot is m_datagram_size bytes
+    std::vector<uint8_t> m_ring;
+    std::vector<int> m_sizes;
+    int m_head = 0;
+    int m_count = 0;
+    int64_t m_backlog_bytes = 0;
+
+    // Token bucket, rate is in bytes per second
+    double m_tokens = 0;
+    double m_rate = 0;
+    int64_t m_refilled_at_us = 0;
+
+    int64_t m_sent = 0;
+    int64_t m_dropped = 0;
+    int m_max_queued = 0;
+
+    bool m_is_open = false;
+    bool m_is_stopping = false;
+    // Congestion is posted only for the first drop of a full queue
+    bool m_is_congested = false;
+};
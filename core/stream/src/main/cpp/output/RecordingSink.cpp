@@ -0,0 +1,356 @@
+#include "RecordingSink.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <linux/falloc.h>
+#include <unistd.h>
+
+extern "C" {
+#include <libavformat/avformat.h>
+#include <libavutil/error.h>
+#include <libavutil/time.h>
+}
+
+#include "MemoryBudget.h"
+#include "ThreadPolicy.h"
+
+#define LOG_TAG "RecordingSink"
+#include "Log.h"
+
+// Used when segment size is not limited, but space must be preallocated
+constexpr int64_t DEFAULT_PREALLOC_SIZE = 64 * 1024 * 1024;
+constexpr size_t BUFFER_ALIGNMENT = 4096;
+
+RecordingSink::~RecordingSink() {
+    if (m_is_open) {
+        close();
+    }
+
+    free(m_buffers[0]);
+    free(m_buffers[1]);
+    MemoryBudget::release(2 * (int64_t)m_options.buffer_size);
+}
+
+RecordingSink *RecordingSink::build(std::string path,
+                                    const RecordingOptions &options) {
+    if (options.buffer_size <= 0 ||
+        options.buffer_size % BUFFER_ALIGNMENT != 0) {
+        LOG_ERROR("Invalid buffer size: %d", options.buffer_size);
+        return nullptr;
+    }
+
+    if (!MemoryBudget::reserve(2 * (int64_t)options.buffer_size)) {
+        LOG_ERROR("Write buffers don't fit into the memory budget");
+        return nullptr;
+    }
+
+    uint8_t *buffers[2] = {nullptr, nullptr};
+    for (auto &buffer : buffers) {
+        void *ptr = nullptr;
+        if (posix_memalign(&ptr, BUFFER_ALIGNMENT, options.buffer_size) != 0) {
+            LOG_ERROR("Unable to allocate write buffer");
+            free(buffers[0]);
+            MemoryBudget::release(2 * (int64_t)options.buffer_size);
+            return nullptr;
+        }
+
+        buffer = (uint8_t *)ptr;
+    }
+
+    return new RecordingSink(std::move(path), options, buffers);
+}
+
+bool RecordingSink::is_supported(const AVOutputFormat *fmt) {
+    return strcmp(fmt->name, "mpegts") == 0 || strcmp(fmt->name, "mjpeg") == 0;
+}
+
+StreamError RecordingSink::open() {
+    if (m_is_open) {
+        LOG_WARN("Unable to open: Already opened");
+        return StreamError::InvalidState;
+    }
+
+    m_segment_index = 0;
+    m_fd = open_segment(m_segment_index);
+    if (m_fd < 0) {
+        return StreamError::FFmpegWriteFailed;
+    }
+
+    m_segment_bytes = 0;
+    m_segment_start_ms = av_gettime_relative() / 1000;
+    m_io_error = 0;
+    m_is_stopping = false;
+    m_worker = std::thread(&RecordingSink::worker_loop, this);
+
+    // Next segment is always prepared in advance, so rotation never waits for
+    // the filesystem
+    if (is_rotating()) {
+        push_job(Job{.type = JobType::Prepare, .index = m_segment_index + 1});
+    }
+
+    m_is_open = true;
+    return StreamError::Success;
+}
+
+StreamError RecordingSink::close() {
+    if (!m_is_open) {
+        LOG_WARN("Unable to close: Not opened");
+        return StreamError::InvalidState;
+    }
+
+    submit_buffer();
+    push_job(Job{.type = JobType::Finalize,
+                 .fd = m_fd,
+                 .size = m_segment_bytes});
+    m_fd = -1;
+
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_is_stopping = true;
+    }
+    m_cond.notify_all();
+    m_worker.join();
+
+    if (m_next_fd >= 0) {
+        // Prepared segment was never used
+        ::close(m_next_fd);
+        m_next_fd = -1;
+        unlink(segment_path(m_segment_index + 1).c_str());
+    }
+
+    m_is_open = false;
+    return m_io_error < 0 ? StreamError::FFmpegWriteFailed
+                          : StreamError::Success;
+}
+
+int RecordingSink::write(const uint8_t *data, int size) {
+    if (m_io_error < 0) {
+        return m_io_error;
+    }
+
+    int remaining = size;
+    while (remaining > 0) {
+        int len = std::min(remaining, m_options.buffer_size - m_buffer_pos);
+        memcpy(m_buffers[m_curr_buffer] + m_buffer_pos, data, len);
+
+        m_buffer_pos += len;
+        data += len;
+        remaining -= len;
+
+        if (m_buffer_pos == m_options.buffer_size) {
+            submit_buffer();
+        }
+    }
+
+    m_segment_bytes += size;
+    return size;
+}
+
+void RecordingSink::submit_buffer() {
+    if (m_buffer_pos == 0) {
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(m_lock);
+    m_buffer_busy[m_curr_buffer] = true;
+    m_jobs.push_back(Job{.type = JobType::Write,
+                         .fd = m_fd,
+                         .buffer = m_curr_buffer,
+                         .size = m_buffer_pos});
+    m_cond.notify_all();
+
+    // Blocks only when disk can't keep up with the stream
+    m_curr_buffer = 1 - m_curr_buffer;
+    m_cond.wait(lock, [this] { return !m_buffer_busy[m_curr_buffer]; });
+    m_buffer_pos = 0;
+}
+
+void RecordingSink::rotate() {
+    submit_buffer();
+
+    std::unique_lock<std::mutex> lock(m_lock);
+    m_cond.wait(lock, [this] { return m_next_fd >= 0 || m_io_error < 0; });
+    if (m_io_error < 0) {
+        return;
+    }
+
+    LOG_INFO("Rotating segment %d (%lld bytes)", m_segment_index,
+             (long long)m_segment_bytes);
+
+    m_jobs.push_back(Job{.type = JobType::Finalize,
+                         .fd = m_fd,
+                         .size = m_segment_bytes});
+
+    m_fd = m_next_fd;
+    m_next_fd = -1;
+    m_segment_index++;
+
+    m_jobs.push_back(
+        Job{.type = JobType::Prepare, .index = m_segment_index + 1});
+    m_cond.notify_all();
+
+    m_segment_bytes = 0;
+    m_segment_start_ms = av_gettime_relative() / 1000;
+}
+
+bool RecordingSink::is_rotating() const {
+    return m_options.segment_size > 0 || m_options.segment_duration_ms > 0;
+}
+
+bool RecordingSink::need_rotate() const {
+    if (m_segment_bytes == 0) {
+        return false;
+    }
+
+    if (m_options.segment_size > 0 &&
+        m_segment_bytes >= m_options.segment_size) {
+        return true;
+    }
+
+    if (m_options.segment_duration_ms > 0) {
+        int64_t elapsed = av_gettime_relative() / 1000 - m_segment_start_ms;
+        return elapsed >= m_options.segment_duration_ms;
+    }
+
+    return false;
+}
+
+void RecordingSink::push_job(Job job) {
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_jobs.push_back(job);
+    }
+    m_cond.notify_all();
+}
+
+void RecordingSink::worker_loop() {
+    ThreadPolicy::apply(ThreadRole::Writer, "cpcam-writer");
+
+    while (true) {
+        Job job{};
+
+        {
+            std::unique_lock<std::mutex> lock(m_lock);
+            m_cond.wait(lock,
+                        [this] { return !m_jobs.empty() || m_is_stopping; });
+
+            if (m_jobs.empty()) {
+                break;
+            }
+
+            job = m_jobs.front();
+            m_jobs.pop_front();
+        }
+
+        run_job(job);
+    }
+}
+
+void RecordingSink::run_job(const Job &job) {
+    switch (job.type) {
+        case JobType::Write: {
+            const uint8_t *data = m_buffers[job.buffer];
+            int64_t remaining = job.size;
+            int err = 0;
+
+            while (remaining > 0) {
+                ssize_t res = ::write(job.fd, data, remaining);
+                if (res < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+
+                    err = AVERROR(errno);
+                    LOG_ERROR("Unable to write segment: %s", strerror(errno));
+                    break;
+                }
+
+                data += res;
+                remaining -= res;
+            }
+
+            std::lock_guard<std::mutex> lock(m_lock);
+            if (err < 0) {
+                m_io_error = err;
+            }
+            m_buffer_busy[job.buffer] = false;
+            m_cond.notify_all();
+            break;
+        }
+        case JobType::Prepare: {
+            int fd = open_segment(job.index);
+
+            std::lock_guard<std::mutex> lock(m_lock);
+            if (fd < 0) {
+                m_io_error = AVERROR(EIO);
+            } else {
+                m_next_fd = fd;
+            }
+            m_cond.notify_all();
+            break;
+        }
+        case JobType::Finalize: {
+            if (job.fd < 0) {
+                break;
+            }
+
+            fdatasync(job.fd);
+
+            // Releases space that was preallocated but not used
+            ftruncate(job.fd, job.size);
+
+            ::close(job.fd);
+            break;
+        }
+    }
+}
+
+int RecordingSink::open_segment(int index) {
+    std::string path = segment_path(index);
+
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                    0644);
+    if (fd < 0) {
+        LOG_ERROR("Unable to open segment '%s': %s", path.c_str(),
+                  strerror(errno));
+        return -1;
+    }
+
+    int64_t prealloc = m_options.segment_size > 0 ? m_options.segment_size
+                                                  : DEFAULT_PREALLOC_SIZE;
+
+    // KEEP_SIZE leaves file size equal to the written data, so the segment is
+    // valid up to the last write even after a crash
+    if (fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, prealloc) < 0) {
+        LOG_WARN("Unable to preallocate segment '%s': %s", path.c_str(),
+                 strerror(errno));
+    }
+
+    LOG_DEBUG("Opened segment: %s", path.c_str());
+    return fd;
+}
+
+std::string RecordingSink::segment_path(int index) const {
+    if (!is_rotating()) {
+        return m_path;
+    }
+
+    char suffix[16];
+    snprintf(suffix, sizeof(suffix), "_%03d", index);
+
+    size_t slash = m_path.rfind('/');
+    size_t dot = m_path.rfind('.');
+    if (dot == std::string::npos ||
+        (slash != std::string::npos && dot < slash)) {
+        return m_path + suffix;
+    }
+
+    std::string out = m_path;
+    out.insert(dot, suffix);
+    return out;
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "output/OutputSink.h"
+
+struct AVOutputFormat;
+
+struct RecordingOptions {
+    // Local files are written directly by ffmpeg when disabled
+    bool is_enabled = false;
+
+    // Segment is rotated on the first keyframe after any of limits is
+    // reached, 0 disables limit. Without limits the file is written to the
+    // path as is.
+    int64_t segment_size = 0;
+    int64_t segment_duration_ms = 0;
+
+    // Size of the single write buffer, must be multiple of 4096
+    int buffer_size = 1024 * 1024;
+};
+
+// Writes muxed stream into local segment files.
+//
+// Segment files are preallocated with fallocate (without changing file size),
+// so filesystem doesn't need to grow them piecemeal. All disk io happens on
+// the background thread through two aligned buffers, the muxer thread only
+// copies data into the free one. Finished segments are synced and trimmed in
+// background as well, so after a crash only the current segment may be
+// truncated.
+//
+// The sink can't seek, so it's used only for formats that never seek back
+// (mpegts, mjpeg). Segments are cut only by the output before a keyframe
+// packet, while every packet is flushed on its own, so each segment starts
+// with a whole keyframe and can be played without the previous one.
+// Segments are named "<name>_000.ext", "<name>_001.ext" and so on.
+class RecordingSink : public OutputSink {
+   public:
+    RecordingSink(std::string path, RecordingOptions options,
+                  uint8_t *buffers[2])
+        : m_path(std::move(path)),
+          m_options(options),
+          m_buffers{buffers[0], buffers[1]} {}
+    ~RecordingSink() override;
+
+    static RecordingSink *build(std::string path,
+                                const RecordingOptions &options);
+
+    static bool is_supported(const AVOutputFormat *fmt);
+
+    StreamError open() override;
+    StreamError close() override;
+
+    int write(const uint8_t *data, int size) override;
+
+    // Segment limit is reached, checked by the output before every keyframe
+    bool need_rotate() const;
+
+    // Everything written after this call goes into the next segment. Muxer
+    // buffer must be flushed before.
+    void rotate();
+
+   private:
+    enum class JobType {
+        Write,
+        Prepare,
+        Finalize,
+    };
+
+    struct Job {
+        JobType type;
+        int fd = -1;
+        int buffer = 0;
+        int index = 0;
+        int64_t size = 0;
+    };
+
+    void worker_loop();
+    void push_job(Job job);
+    void run_job(const Job &job);
+
+    int open_segment(int index);
+    std::string segment_path(int index) const;
+    bool is_rotating() const;
+
+    // Hands filled buffer to the worker and waits for the next free one
+    void submit_buffer();
+
+    std::string m_path;
+    RecordingOptions m_options;
+
+    std::mutex m_lock;
+    std::condition_variable m_cond;
+    std::deque<Job> m_jobs;
+    std::thread m_worker;
+
+    uint8_t *m_buffers[2];
+    bool m_buffer_busy[2] = {false, false};
+    int m_curr_buffer = 0;
+    int m_buffer_pos = 0;
+
+    int m_fd = -1;
+    int m_next_fd = -1;
+    int m_segment_index = 0;
+    int64_t m_segment_bytes = 0;
+    int64_t m_segment_start_ms = 0;
+
+    std::atomic<int> m_io_error = 0;
+    bool m_is_open = false;
+    bool m_is_stopping = false;
+};
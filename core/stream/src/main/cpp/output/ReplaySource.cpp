@@ -0,0 +1,224 @@
+#include "ReplaySource.h"
+
+#include <algorithm>
+
+extern "C" {
+#include <libavutil/time.h>
+}
+
+#include "FFmpegUtils.h"
+#include "output/FFmpegOutput.h"
+
+#define LOG_TAG "ReplaySource"
+#include "Log.h"
+
+// Used for raw streams without timestamps and framerate
+constexpr AVRational DEFAULT_FRAME_RATE = {30, 1};
+
+static int64_t percentile(const std::vector<int64_t> &sorted, double p) {
+    if (sorted.empty()) {
+        return 0;
+    }
+
+    return sorted[(size_t)(p * (double)(sorted.size() - 1))];
+}
+
+ReplaySource::~ReplaySource() { avformat_close_input(&m_ictx); }
+
+ReplaySource *ReplaySource::build(const std::string &path) {
+    AVFormatContext *ictx = nullptr;
+
+    int res = avformat_open_input(&ictx, path.c_str(), nullptr, nullptr);
+    if (res < 0) {
+        LOG_ERROR("Unable to open '%s': %s", path.c_str(),
+                  av_err_to_string(res).data());
+        return nullptr;
+    }
+
+    res = avformat_find_stream_info(ictx, nullptr);
+    if (res < 0) {
+        LOG_ERROR("Unable to find stream info: %s",
+                  av_err_to_string(res).data());
+        avformat_close_input(&ictx);
+        return nullptr;
+    }
+
+    av_dump_format(ictx, 0, path.c_str(), 0);
+    return new ReplaySource(ictx);
+}
+
+StreamError ReplaySource::attach(FFmpegOutput *output) {
+    m_stream_map.assign(m_ictx->nb_streams, -1);
+    m_next_dts.assign(m_ictx->nb_streams, 0);
+
+    int attached = 0;
+    for (unsigned i = 0; i < m_ictx->nb_streams; i++) {
+        AVStream *ist = m_ictx->streams[i];
+        if (ist->codecpar->codec_type != AVMEDIA_TYPE_VIDEO) {
+            continue;
+        }
+
+        int index = output->add_encoded_stream(ist->codecpar, ist->time_base);
+        if (index < 0) {
+            return StreamError::FFmpegStreamCreationFailed;
+        }
+
+        m_stream_map[i] = index;
+        attached++;
+    }
+
+    if (attached == 0) {
+        LOG_ERROR("File doesn't have video streams");
+        return StreamError::InvalidArgument;
+    }
+
+    m_output = output;
+    return StreamError::Success;
+}
+
+StreamError ReplaySource::run(const ReplayOptions &options,
+                              ReplayReport &report) {
+    if (!m_output) {
+        LOG_ERROR("Unable to run: Not attached");
+        return StreamError::InvalidState;
+    }
+
+    AVPacket *pkt = av_packet_alloc();
+    if (!pkt) {
+        LOG_ERROR("Unable to allocate packet");
+        return StreamError::FFmpegAllocFailed;
+    }
+
+    std::vector<int64_t> write_us;
+    report = ReplayReport{};
+
+    StreamError err = StreamError::Success;
+    int64_t begin = av_gettime_relative();
+    int64_t first_dts_us = AV_NOPTS_VALUE;
+
+    while (true) {
+        int res = av_read_frame(m_ictx, pkt);
+        if (res == AVERROR_EOF) {
+            break;
+        }
+
+        if (res < 0) {
+            LOG_ERROR("Unable to read packet: %s",
+                      av_err_to_string(res).data());
+            err = StreamError::Unknown;
+            break;
+        }
+
+        // Streams that appeared after attach() (e.g. in MPEG-TS) aren't
+        // mapped, so they are skipped as well
+        int in_index = pkt->stream_index;
+        if (in_index >= (int)m_stream_map.size() ||
+            m_stream_map[in_index] < 0) {
+            av_packet_unref(pkt);
+            continue;
+        }
+
+        fix_timestamps(pkt);
+
+        AVRational in_tb = m_ictx->streams[in_index]->time_base;
+        if (options.is_realtime) {
+            int64_t dts_us = av_rescale_q(pkt->dts, in_tb,
+                                          AVRational{1, AV_TIME_BASE});
+            if (first_dts_us == AV_NOPTS_VALUE) {
+                first_dts_us = dts_us;
+            }
+
+            int64_t wait = begin + (dts_us - first_dts_us) -
+                           av_gettime_relative();
+            if (wait > 0) {
+                av_usleep((unsigned)wait);
+            }
+        }
+
+        int out_index = m_stream_map[in_index];
+        AVRational out_tb = m_output->stream_time_base(out_index);
+        av_packet_rescale_ts(pkt, in_tb, out_tb);
+        pkt->stream_index = out_index;
+
+        int size = pkt->size;
+        int64_t write_begin = av_gettime_relative();
+        res = m_output->write_packet(pkt);
+        write_us.push_back(av_gettime_relative() - write_begin);
+        av_packet_unref(pkt);
+
+        if (res < 0) {
+            LOG_ERROR("Unable to write packet: %s",
+                      av_err_to_string(res).data());
+            report.failed_writes++;
+            err = StreamError::FFmpegWriteFailed;
+            break;
+        }
+
+        report.packets++;
+        report.bytes += size;
+    }
+
+    av_packet_free(&pkt);
+
+    report.duration_us = av_gettime_relative() - begin;
+
+    std::sort(write_us.begin(), write_us.end());
+    report.write_p50_us = percentile(write_us, 0.5);
+    report.write_p90_us = percentile(write_us, 0.9);
+    report.write_p99_us = percentile(write_us, 0.99);
+    report.write_max_us = write_us.empty() ? 0 : write_us.back();
+
+    LOG_INFO("Replayed %lld packets, %lld bytes in %lld us, write p50: %lld "
+             "p99: %lld max: %lld us",
+             (long long)report.packets, (long long)report.bytes,
+             (long long)report.duration_us, (long long)report.write_p50_us,
+             (long long)report.write_p99_us, (long long)report.write_max_us);
+
+    return err;
+}
+
+void ReplaySource::fix_timestamps(AVPacket *pkt) {
+    AVStream *ist = m_ictx->streams[pkt->stream_index];
+    int64_t &next_dts = m_next_dts[pkt->stream_index];
+
+    if (pkt->dts == AV_NOPTS_VALUE) {
+        pkt->dts = pkt->pts != AV_NOPTS_VALUE ? pkt->pts : next_dts;
+    }
+    if (pkt->pts == AV_NOPTS_VALUE) {
+        pkt->pts = pkt->dts;
+    }
+
+    if (pkt->duration <= 0) {
+        AVRational rate = ist->avg_frame_rate.num > 0 ? ist->avg_frame_rate
+                                                      : DEFAULT_FRAME_RATE;
+        pkt->duration = av_rescale_q(1, av_inv_q(rate), ist->time_base);
+    }
+
+    next_dts = pkt->dts + pkt->duration;
+}
+
+StreamError replay_into_output(FFmpegOutput *output, const std::string &path,
+                               const ReplayOptions &options,
+                               ReplayReport &report) {
+    ReplaySource *source = ReplaySource::build(path);
+    if (!source) {
+        return StreamError::InvalidArgument;
+    }
+
+    StreamError err = source->attach(output);
+    if (err == StreamError::Success) {
+        err = output->open();
+    }
+
+    if (err == StreamError::Success) {
+        err = source->run(options, report);
+
+        StreamError close_err = output->close();
+        if (err == StreamError::Success) {
+            err = close_err;
+        }
+    }
+
+    delete source;
+    return err;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include <libavformat/avformat.h>
+}
+
+#include "StreamError.h"
+
+class FFmpegOutput;
+
+struct ReplayOptions {
+    // Packets are written at the rate of their timestamps, otherwise as fast
+    // as output accepts them
+    bool is_realtime = true;
+};
+
+// NOTE: Keep sync with jni FFmpegReplayReport
+struct ReplayReport {
+    int64_t packets = 0;
+    int64_t bytes = 0;
+    int64_t duration_us = 0;
+
+    // Time spent in FFmpegOutput::write_packet() per packet
+    int64_t write_p50_us = 0;
+    int64_t write_p90_us = 0;
+    int64_t write_p99_us = 0;
+    int64_t write_max_us = 0;
+
+    int64_t failed_writes = 0;
+};
+
+// Feeds packets of an already encoded file (MPEG-TS, H.264/HEVC Annex B or
+// MJPEG) into FFmpegOutput, so muxers and sinks can be measured without the
+// camera and encoders in the loop.
+class ReplaySource {
+   public:
+    explicit ReplaySource(AVFormatContext *ictx) : m_ictx(ictx) {}
+    ~ReplaySource();
+
+    static ReplaySource *build(const std::string &path);
+
+    // Adds video streams of the file to the output, must be called before
+    // the output is opened
+    StreamError attach(FFmpegOutput *output);
+
+    // Writes every packet into the attached and opened output. Stops on the
+    // first failed write, so FFmpegOutput::abort() also stops the replay.
+    StreamError run(const ReplayOptions &options, ReplayReport &report);
+
+   private:
+    // Fills missing timestamps of raw elementary streams
+    void fix_timestamps(AVPacket *pkt);
+
+    AVFormatContext *m_ictx;
+    FFmpegOutput *m_output = nullptr;
+
+    // Output stream index by the input stream index, -1 for skipped streams.
+    // Covers only streams known at attach().
+    std::vector<int> m_stream_map;
+    std::vector<int64_t> m_next_dts;
+};
+
+// Attaches file to the output, opens output, replays file and closes output
+StreamError replay_into_output(FFmpegOutput *output, const std::string &path,
+                               const ReplayOptions &options,
+                               ReplayReport &report);
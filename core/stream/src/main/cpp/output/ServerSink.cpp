@@ -0,0 +1,438 @@
+#include "ServerSink.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+extern "C" {
+#include <libavutil/error.h>
+}
+
+#include "BufferPool.h"
+#include "EventChannel.h"
+#include "MemoryBudget.h"
+#include "ThreadPolicy.h"
+
+#define LOG_TAG "ServerSink"
+#include "Log.h"
+
+constexpr int LISTEN_BACKLOG = 8;
+constexpr size_t MAX_REQUEST_SIZE = 4096;
+
+static AVBufferRef *make_buffer(const void *data, int size) {
+    AVBufferRef *buf = pooled_buffer_alloc(size);
+    if (buf) {
+        memcpy(buf->data, data, size);
+    }
+
+    return buf;
+}
+
+ServerSink::~ServerSink() {
+    if (m_is_open) {
+        close();
+    }
+}
+
+ServerSink *ServerSink::build(const std::string &address,
+                              std::string content_type,
+                              const ServerOptions &options) {
+    size_t colon = address.rfind(':');
+    if (colon == std::string::npos) {
+        LOG_ERROR("Port is not specified in '%s'", address.c_str());
+        return nullptr;
+    }
+
+    std::string host = address.substr(0, colon);
+    int port = atoi(address.c_str() + colon + 1);
+    if (port <= 0 || port > 65535) {
+        LOG_ERROR("Invalid port in '%s'", address.c_str());
+        return nullptr;
+    }
+
+    return new ServerSink(std::move(host), port, std::move(content_type),
+                          options);
+}
+
+StreamError ServerSink::open() {
+    if (m_is_open) {
+        LOG_WARN("Unable to open: Already opened");
+        return StreamError::InvalidState;
+    }
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(m_port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+    if (!m_host.empty() &&
+        inet_pton(AF_INET, m_host.c_str(), &addr.sin_addr) != 1) {
+        LOG_ERROR("Invalid listen address: %s", m_host.c_str());
+        return StreamError::InvalidArgument;
+    }
+
+    m_listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                         0);
+    if (m_listen_fd < 0) {
+        LOG_ERROR("Unable to create socket: %s", strerror(errno));
+        return StreamError::FFmpegWriteFailed;
+    }
+
+    int reuse = 1;
+    setsockopt(m_listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    if (bind(m_listen_fd, (sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(m_listen_fd, LISTEN_BACKLOG) < 0) {
+        LOG_ERROR("Unable to listen on %s:%d: %s", m_host.c_str(), m_port,
+                  strerror(errno));
+        ::close(m_listen_fd);
+        m_listen_fd = -1;
+        return StreamError::FFmpegWriteFailed;
+    }
+
+    m_wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_wake_fd < 0) {
+        LOG_ERROR("Unable to create eventfd: %s", strerror(errno));
+        ::close(m_listen_fd);
+        m_listen_fd = -1;
+        return StreamError::FFmpegWriteFailed;
+    }
+
+    LOG_INFO("Listening on %s:%d", m_host.c_str(), m_port);
+
+    m_is_stopping = false;
+    m_thread = std::thread(&ServerSink::serve_loop, this);
+
+    m_is_open = true;
+    return StreamError::Success;
+}
+
+StreamError ServerSink::close() {
+    if (!m_is_open) {
+        LOG_WARN("Unable to close: Not opened");
+        return StreamError::InvalidState;
+    }
+
+    m_is_stopping = true;
+    wake();
+    m_thread.join();
+
+    for (auto &client : m_clients) {
+        free_client(client);
+    }
+    m_clients.clear();
+
+    ::close(m_wake_fd);
+    ::close(m_listen_fd);
+    m_wake_fd = -1;
+    m_listen_fd = -1;
+
+    m_is_open = false;
+    return StreamError::Success;
+}
+
+int ServerSink::write(const uint8_t *data, int size) {
+    AVBufferRef *buf = nullptr;
+
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+
+        for (auto &client : m_clients) {
+            if (!client.is_streaming || client.is_dead) {
+                continue;
+            }
+
+            if (!buf) {
+                buf = make_buffer(data, size);
+                if (!buf) {
+                    LOG_ERROR("Unable to allocate buffer");
+                    return AVERROR(ENOMEM);
+                }
+            }
+
+            enqueue(client, buf);
+        }
+    }
+
+    if (buf) {
+        av_buffer_unref(&buf);
+        wake();
+    }
+
+    // Data is never kept when no one is watching
+    return size;
+}
+
+void ServerSink::wake() {
+    uint64_t value = 1;
+    if (::write(m_wake_fd, &value, sizeof(value)) < 0 && errno != EAGAIN) {
+        LOG_WARN("Unable to wake server thread: %s", strerror(errno));
+    }
+}
+
+// Must be called with locked m_lock
+void ServerSink::enqueue(Client &client, AVBufferRef *buf) {
+    // Slow clients are dropped earlier under memory pressure, so their queued
+    // chunks are freed
+    int64_t max_queue_bytes = m_options.max_queue_bytes;
+    if (MemoryBudget::pressure() != MemoryPressure::None) {
+        max_queue_bytes /= 2;
+    }
+
+    if (client.queued_bytes + (int64_t)buf->size > max_queue_bytes) {
+        EventChannel::post(EventType::Congestion, m_event_source,
+                           (int32_t)CongestionReason::ClientQueueFull,
+                           client.queued_bytes);
+        drop_client(client, "send queue is full");
+        return;
+    }
+
+    AVBufferRef *ref = av_buffer_ref(buf);
+    if (!ref) {
+        drop_client(client, "out of memory");
+        return;
+    }
+
+    client.queue.push_back(ref);
+    client.queued_bytes += ref->size;
+}
+
+// Must be called with locked m_lock. Client is removed by the server thread
+void ServerSink::drop_client(Client &client, const char *reason) {
+    if (client.is_dead) {
+        return;
+    }
+
+    LOG_INFO("Dropping client %d: %s", client.fd, reason);
+    client.is_dead = true;
+    shutdown(client.fd, SHUT_RDWR);
+}
+
+void ServerSink::free_client(Client &client) {
+    for (AVBufferRef *buf : client.queue) {
+        av_buffer_unref(&buf);
+    }
+
+    client.queue.clear();
+    client.queued_bytes = 0;
+
+    if (client.fd >= 0) {
+        ::close(client.fd);
+        client.fd = -1;
+    }
+}
+
+void ServerSink::serve_loop() {
+    ThreadPolicy::apply(ThreadRole::Network, "cpcam-server");
+
+    std::vector<pollfd> fds;
+
+    while (!m_is_stopping) {
+        fds.clear();
+        fds.push_back({m_listen_fd, POLLIN, 0});
+        fds.push_back({m_wake_fd, POLLIN, 0});
+
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            for (auto &client : m_clients) {
+                short events = POLLIN;
+                if (!client.queue.empty()) {
+                    events |= POLLOUT;
+                }
+
+                fds.push_back({client.fd, events, 0});
+            }
+        }
+
+        if (poll(fds.data(), fds.size(), -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            LOG_ERROR("Poll failed: %s", strerror(errno));
+            break;
+        }
+
+        if (fds[1].revents & POLLIN) {
+            uint64_t value = 0;
+            (void)::read(m_wake_fd, &value, sizeof(value));
+        }
+
+        int joined = 0;
+
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+
+            // Clients are added and removed only by this thread, so polled
+            // ones keep their indices
+            for (size_t i = 2; i < fds.size(); i++) {
+                Client &client = m_clients[i - 2];
+                short revents = fds[i].revents;
+
+                if (client.is_dead) {
+                    continue;
+                }
+
+                if (revents & (POLLERR | POLLNVAL)) {
+                    drop_client(client, "socket error");
+                    continue;
+                }
+
+                if (revents & (POLLIN | POLLHUP)) {
+                    joined += read_request(client);
+                }
+
+                if (!client.is_dead && (revents & POLLOUT)) {
+                    send_queued(client);
+                }
+            }
+
+            for (auto &client : m_clients) {
+                if (client.is_dead) {
+                    free_client(client);
+                }
+            }
+
+            std::erase_if(m_clients,
+                          [](const Client &client) { return client.is_dead; });
+        }
+
+        if (fds[0].revents & POLLIN) {
+            accept_clients();
+        }
+
+        if (joined > 0 && m_on_join) {
+            m_on_join();
+        }
+    }
+}
+
+void ServerSink::accept_clients() {
+    while (true) {
+        int fd = accept4(m_listen_fd, nullptr, nullptr,
+                         SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                LOG_WARN("Unable to accept client: %s", strerror(errno));
+            }
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(m_lock);
+        if ((int)m_clients.size() >= m_options.max_clients) {
+            static const char BUSY[] =
+                "HTTP/1.0 503 Service Unavailable\r\n\r\n";
+            (void)send(fd, BUSY, sizeof(BUSY) - 1, MSG_NOSIGNAL);
+            ::close(fd);
+
+            LOG_WARN("Rejecting client: Too many clients");
+            continue;
+        }
+
+        int nodelay = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
+        LOG_INFO("Client %d connected", fd);
+        Client client;
+        client.fd = fd;
+        m_clients.push_back(std::move(client));
+    }
+}
+
+// Must be called with locked m_lock
+bool ServerSink::read_request(Client &client) {
+    char buf[1024];
+
+    while (true) {
+        ssize_t len = recv(client.fd, buf, sizeof(buf), 0);
+        if (len == 0) {
+            drop_client(client, "disconnected");
+            return false;
+        }
+
+        if (len < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+
+            drop_client(client, strerror(errno));
+            return false;
+        }
+
+        // Anything after the request is ignored
+        if (!client.is_streaming) {
+            client.request.append(buf, len);
+        }
+    }
+
+    if (client.is_streaming) {
+        return false;
+    }
+
+    if (client.request.find("\r\n\r\n") == std::string::npos) {
+        if (client.request.size() > MAX_REQUEST_SIZE) {
+            drop_client(client, "request is too large");
+        }
+        return false;
+    }
+
+    char header[256];
+    int len = snprintf(header, sizeof(header),
+                       "HTTP/1.0 200 OK\r\n"
+                       "Content-Type: %s\r\n"
+                       "Cache-Control: no-cache\r\n"
+                       "Connection: close\r\n"
+                       "\r\n",
+                       m_content_type.c_str());
+
+    AVBufferRef *response = make_buffer(header, len);
+    if (!response) {
+        drop_client(client, "out of memory");
+        return false;
+    }
+
+    enqueue(client, response);
+    av_buffer_unref(&response);
+
+    client.request.clear();
+    client.is_streaming = true;
+    return true;
+}
+
+// Must be called with locked m_lock
+void ServerSink::send_queued(Client &client) {
+    while (!client.queue.empty()) {
+        AVBufferRef *buf = client.queue.front();
+
+        ssize_t len = send(client.fd, buf->data + client.offset,
+                           buf->size - client.offset, MSG_NOSIGNAL);
+        if (len < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                drop_client(client, strerror(errno));
+            }
+            return;
+        }
+
+        client.offset += (int)len;
+        if (client.offset < (int)buf->size) {
+            // Socket buffer is full
+            return;
+        }
+
+        client.queued_bytes -= buf->size;
+        client.offset = 0;
+        client.queue.pop_front();
+        av_buffer_unref(&buf);
+    }
+}
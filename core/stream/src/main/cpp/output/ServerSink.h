@@ -0,0 +1,102 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+extern "C" {
+#include <libavutil/buffer.h>
+}
+
+#include "output/OutputSink.h"
+
+struct ServerOptions {
+    int max_clients = 8;
+
+    // Client is disconnected when data waiting to be sent to it exceeds this
+    // limit, so slow client never holds memory or blocks the others
+    int64_t max_queue_bytes = 4 * 1024 * 1024;
+};
+
+// Serves muxed stream to every connected HTTP client.
+//
+// Every write is copied once into refcounted buffer, which is shared between
+// queues of all clients. Sockets are non-blocking and served by single poll
+// thread, so muxer thread never waits for the network.
+//
+// New clients receive stream from the next write, so output should flush
+// after every packet and be self-synchronizing (mpegts, mjpeg).
+class ServerSink : public OutputSink {
+   public:
+    ServerSink(std::string host, int port, std::string content_type,
+               ServerOptions options)
+        : m_host(std::move(host)),
+          m_port(port),
+          m_content_type(std::move(content_type)),
+          m_options(options) {}
+    ~ServerSink() override;
+
+    // address is "[host]:port", empty host listens on all interfaces
+    static ServerSink *build(const std::string &address,
+                             std::string content_type,
+                             const ServerOptions &options);
+
+    StreamError open() override;
+    StreamError close() override;
+
+    int write(const uint8_t *data, int size) override;
+
+    // Called from the server thread when client starts receiving stream,
+    // e.g. to request keyframe
+    void set_join_callback(std::function<void()> callback) {
+        m_on_join = std::move(callback);
+    }
+
+   private:
+    struct Client {
+        int fd = -1;
+        std::string request;
+
+        std::deque<AVBufferRef *> queue;
+        // Amount of bytes already sent from the front buffer
+        int offset = 0;
+        int64_t queued_bytes = 0;
+
+        bool is_streaming = false;
+        bool is_dead = false;
+    };
+
+    void serve_loop();
+    void wake();
+
+    void accept_clients();
+    // Returns true when client has just started streaming
+    bool read_request(Client &client);
+    void send_queued(Client &client);
+
+    void enqueue(Client &client, AVBufferRef *buf);
+    void drop_client(Client &client, const char *reason);
+    static void free_client(Client &client);
+
+    std::string m_host;
+    int m_port;
+    std::string m_content_type;
+    ServerOptions m_options;
+
+    std::function<void()> m_on_join;
+
+    int m_listen_fd = -1;
+    int m_wake_fd = -1;
+
+    std::mutex m_lock;
+    std::vector<Client> m_clients;
+
+    std::thread m_thread;
+    std::atomic<bool> m_is_stopping = false;
+    bool m_is_open = false;
+};
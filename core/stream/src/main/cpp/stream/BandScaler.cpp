@@ -0,0 +1,182 @@
+#include "BandScaler.h"
+
+#include <algorithm>
+#include <cstddef>
+
+extern "C" {
+#include <libavutil/pixdesc.h>
+#include <libswscale/swscale.h>
+}
+
+#define LOG_TAG "BandScaler"
+#include "Log.h"
+
+// Band borders are aligned to this amount of rows, so they never split
+// subsampled chroma rows
+constexpr int BAND_ALIGN = 16;
+
+// Vertical subsampling of the plane as log2
+static int plane_shift(int format, int plane) {
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get((AVPixelFormat)format);
+    if (!desc || (desc->flags & AV_PIX_FMT_FLAG_RGB)) {
+        return 0;
+    }
+
+    // Luma and alpha are never subsampled
+    for (int i = 1; i <= 2 && i < desc->nb_components; i++) {
+        if (desc->comp[i].plane == plane && plane != 0) {
+            return desc->log2_chroma_h;
+        }
+    }
+
+    return 0;
+}
+
+BandScaler::~BandScaler() { reset(); }
+
+void BandScaler::reset() {
+    for (Band &band : m_bands) {
+        sws_freeContext(band.ctx);
+    }
+
+    m_bands.clear();
+    m_in_format = AV_PIX_FMT_NONE;
+    m_out_format = AV_PIX_FMT_NONE;
+}
+
+bool BandScaler::scale(const AVFrame *input, AVFrame *output,
+                       int64_t deadline_us) {
+    if (!require_bands(input, output)) {
+        return false;
+    }
+
+    int count = (int)m_bands.size();
+    uint64_t seq = 0;
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        seq = ++m_seq;
+        for (int i = 0; i < count; i++) {
+            m_band_seq[i] = seq;
+        }
+    }
+
+    for (int i = 1; i < count; i++) {
+        NativeEngine::submit(
+            m_group, deadline_us, [this, i, seq, input, output]() {
+                // Band may be already converted by the calling thread, then
+                // the frame may be gone as well
+                if (!claim_band(i, seq)) {
+                    return;
+                }
+
+                scale_band(m_bands[i], input, output);
+
+                // Notified under the lock, scale() returns only after it
+                std::lock_guard<std::mutex> lock(m_lock);
+                if (--m_running == 0) {
+                    m_done_cond.notify_all();
+                }
+            });
+    }
+
+    // Bands that workers haven't started yet are converted here, so the
+    // caller never waits for tasks queued behind encoding
+    for (int i = 0; i < count; i++) {
+        if (claim_band(i, seq)) {
+            scale_band(m_bands[i], input, output);
+            std::lock_guard<std::mutex> lock(m_lock);
+            m_running--;
+        }
+    }
+
+    std::unique_lock<std::mutex> lock(m_lock);
+    m_done_cond.wait(lock, [this]() { return m_running == 0; });
+    return true;
+}
+
+bool BandScaler::claim_band(int index, uint64_t seq) {
+    std::lock_guard<std::mutex> lock(m_lock);
+    if (m_band_seq[index] != seq) {
+        return false;
+    }
+
+    m_band_seq[index] = 0;
+    m_running++;
+    return true;
+}
+
+bool BandScaler::require_bands(const AVFrame *input, const AVFrame *output) {
+    if (!m_bands.empty() && m_in_width == input->width &&
+        m_in_height == input->height && m_in_format == input->format &&
+        m_out_width == output->width && m_out_height == output->height &&
+        m_out_format == output->format) {
+        return true;
+    }
+
+    reset();
+
+    bool is_same_height = input->height == output->height;
+    int count = 1;
+    if (is_same_height) {
+        count = std::clamp(input->height / MIN_BAND_ROWS, 1,
+                           NativeEngine::worker_count());
+    }
+
+    int rows = (input->height + count - 1) / count;
+    rows = (rows + BAND_ALIGN - 1) / BAND_ALIGN * BAND_ALIGN;
+
+    for (int y = 0; y < input->height; y += rows) {
+        Band band;
+        band.y = y;
+        band.height = std::min(rows, input->height - y);
+
+        // Single band keeps the real output height, so it may scale
+        int out_height = is_same_height ? band.height : output->height;
+        band.ctx = sws_getContext(
+            input->width, band.height, (AVPixelFormat)input->format,
+            output->width, out_height, (AVPixelFormat)output->format,
+            SWS_FAST_BILINEAR, nullptr, nullptr, nullptr);
+        if (!band.ctx) {
+            LOG_ERROR("Unable to initialize the sws context");
+            reset();
+            return false;
+        }
+
+        m_bands.push_back(band);
+        if (!is_same_height) {
+            break;
+        }
+    }
+
+    m_in_width = input->width;
+    m_in_height = input->height;
+    m_in_format = input->format;
+    m_out_width = output->width;
+    m_out_height = output->height;
+    m_out_format = output->format;
+
+    LOG_INFO("Converting (%d, %d) frames in %d bands", input->width,
+             input->height, (int)m_bands.size());
+    return true;
+}
+
+void BandScaler::scale_band(const Band &band, const AVFrame *input,
+                            AVFrame *output) {
+    const uint8_t *src[AV_NUM_DATA_POINTERS] = {};
+    uint8_t *dst[AV_NUM_DATA_POINTERS] = {};
+
+    for (int i = 0; i < AV_NUM_DATA_POINTERS; i++) {
+        if (input->data[i]) {
+            int row = band.y >> plane_shift(input->format, i);
+            src[i] = input->data[i] + (ptrdiff_t)row * input->linesize[i];
+        }
+
+        if (output->data[i]) {
+            int row = band.y >> plane_shift(output->format, i);
+            dst[i] = output->data[i] + (ptrdiff_t)row * output->linesize[i];
+        }
+    }
+
+    sws_scale(band.ctx, src, input->linesize, 0, band.height, dst,
+              output->linesize);
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+extern "C" {
+#include <libavutil/frame.h>
+#include <libavutil/pixfmt.h>
+}
+
+#include "NativeEngine.h"
+
+struct SwsContext;
+
+// Converts frames with sws split into horizontal bands, every band has its
+// own sws context and is converted as a NativeEngine task, so conversion
+// of one frame spreads over the cores.
+//
+// Bands are used only when the height isn't changed, then every output row
+// depends only on the same input row. Otherwise the frame is converted as
+// a single band. Calling thread converts every band that no worker has
+// started yet and returns when all bands are done, so it never waits for
+// busy workers and the input may be released right after.
+class BandScaler {
+   public:
+    // Group must outlive the scaler
+    explicit BandScaler(EngineGroup *group) : m_group(group) {}
+    ~BandScaler();
+
+    BandScaler(const BandScaler &) = delete;
+    BandScaler &operator=(const BandScaler &) = delete;
+
+    // Output must be allocated, returns false when sws can't be initialized.
+    // Deadline is in av_gettime_relative units.
+    bool scale(const AVFrame *input, AVFrame *output, int64_t deadline_us);
+
+    // Contexts are created again on the next scale
+    void reset();
+
+    // Bands are at least this high, so sws setup stays negligible
+    static constexpr int MIN_BAND_ROWS = 64;
+
+   private:
+    struct Band {
+        SwsContext *ctx = nullptr;
+        int y = 0;
+        int height = 0;
+    };
+
+    bool require_bands(const AVFrame *input, const AVFrame *output);
+
+    // Returns false when the band of the frame is already taken
+    bool claim_band(int index, uint64_t seq);
+    void scale_band(const Band &band, const AVFrame *input, AVFrame *output);
+
+    EngineGroup *m_group;
+    std::vector<Band> m_bands;
+    // Band contexts are made for this input and output
+    int m_in_width = 0;
+    int m_in_height = 0;
+    int m_in_format = AV_PIX_FMT_NONE;
+    int m_out_width = 0;
+    int m_out_height = 0;
+    int m_out_format = AV_PIX_FMT_NONE;
+
+    std::mutex m_lock;
+    std::condition_variable m_done_cond;
+    // Frame number of every band that isn't taken yet, 0 when taken
+    uint64_t m_seq = 0;
+    uint64_t m_band_seq[NativeEngine::MAX_WORKERS] = {};
+    // Bands that are being converted
+    int m_running = 0;
+};
@@ -1,31 +1,74 @@
 #include "FFmpegVideoStream.h"
 
 #include <cassert>
+#include <ctime>
+
+#include <unistd.h>
 
 extern "C" {
 #include <libavutil/pixdesc.h>
-#include <libswscale/swscale.h>
+#include <libavutil/time.h>
 }
 
+#include "EventChannel.h"
 #include "FFmpegUtils.h"
+#include "LatencyEmbed.h"
+#include "MemoryBudget.h"
+#include "ThreadPolicy.h"
+#include "output/EncoderCache.h"
+#include "output/FFmpegOutput.h"
 
 #undef LOG_TAG
 #define LOG_TAG "FFmpegVideoStream"
 #include "Log.h"
 
+static int64_t clock_ns(clockid_t clock) {
+    timespec ts{};
+    clock_gettime(clock, &ts);
+    return ts.tv_sec * 1'000'000'000LL + ts.tv_nsec;
+}
+
+// Camera timestamps are in CLOCK_BOOTTIME or CLOCK_MONOTONIC depending on the
+// device, so the clock that gives the smallest age is assumed
+static int64_t estimate_capture_age(int64_t capture_ts) {
+    int64_t best = -1;
+    for (clockid_t clock : {CLOCK_BOOTTIME, CLOCK_MONOTONIC}) {
+        int64_t age = clock_ns(clock) - capture_ts;
+        if (age >= 0 && (best < 0 || age < best)) {
+            best = age;
+        }
+    }
+
+    return best < 0 ? 0 : best;
+}
+
 FFmpegVideoStream::~FFmpegVideoStream() {
-    av_frame_free(&m_sws_frame);
-    sws_freeContext(m_sws_ctx);
+    m_output->remove_stream(this);
+
+    // Tasks reference the stream
+    m_engine_group.wait_idle();
 
+    delete m_parallel;
+
+    for (QueuedFrame &queued : m_queue) {
+        av_frame_free(&queued.frame);
+    }
+
+    av_frame_free(&m_encoding_frame);
+    av_frame_free(&m_encoder_frame);
     av_frame_free(&m_frame);
     av_packet_free(&m_packet);
 
-    avcodec_free_context(&m_cctx);
+    // Encoder is kept opened for the next session with the same config
+    EncoderCache::release(m_cctx, m_config, m_encoder_flags,
+                          m_is_encoder_clean);
 }
 
-FFmpegVideoStream *FFmpegVideoStream::build(AVFormatContext *octx,
+FFmpegVideoStream *FFmpegVideoStream::build(FFmpegOutput *output,
                                             AVCodecContext *cctx,
-                                            int stream_index) {
+                                            int stream_index,
+                                            const VideoConfig &config,
+                                            int encoder_flags) {
     LOG_DEBUG("Building stream with size: (%d, %d)", cctx->width, cctx->height);
 
     AVPacket *packet = av_packet_alloc();
@@ -35,18 +78,48 @@ FFmpegVideoStream *FFmpegVideoStream::build(AVFormatContext *octx,
     }
 
     AVFrame *frame = av_frame_alloc();
-    if (!frame) {
+    AVFrame *encoder_frame = av_frame_alloc();
+    AVFrame *encoding_frame = av_frame_alloc();
+    if (!frame || !encoder_frame || !encoding_frame) {
         LOG_ERROR("Unable to allocate frame");
+        av_frame_free(&frame);
+        av_frame_free(&encoder_frame);
+        av_frame_free(&encoding_frame);
         av_packet_free(&packet);
         return nullptr;
     }
 
-    auto *stream = new FFmpegVideoStream(octx, cctx, packet, frame, stream_index);
+    auto *stream = new FFmpegVideoStream(output, cctx, packet, frame,
+                                         encoder_frame, encoding_frame,
+                                         stream_index, config, encoder_flags);
+    if (cctx->framerate.num > 0 && cctx->framerate.den > 0) {
+        int64_t interval_ns = av_rescale(1'000'000'000, cctx->framerate.den,
+                                         cctx->framerate.num);
+        stream->m_timestamps.set_frame_interval(interval_ns);
+        stream->m_frame_interval_us = interval_ns / 1000;
+    }
     stream->set_frame_size(cctx->width, cctx->height);
     return stream;
 }
 
 void FFmpegVideoStream::send_frame(const FrameData &data) {
+    send(data, nullptr);
+}
+
+void FFmpegVideoStream::send_ring_frame(FrameRing *ring, int index,
+                                        int64_t ts) {
+    if (!ring->commit(index)) {
+        return;
+    }
+
+    if (!m_ingest || m_ingest->pix_fmt != ring->pix_fmt()) {
+        set_pixel_format(ring->pix_fmt());
+    }
+
+    send(ring->frame_data(index, ts), ring->buffer(index));
+}
+
+void FFmpegVideoStream::send(const FrameData &data, AVBufferRef *buffer) {
     if (!m_is_started) {
         LOG_TRACE("Stream is not started, does nothing");
         return;
@@ -59,22 +132,155 @@ void FFmpegVideoStream::send_frame(const FrameData &data) {
 
     std::lock_guard<std::mutex> lock(m_sending_lock);
 
+    apply_thread_policy();
     as_av_frame(data, m_frame);
+    if (m_frame->pts == AV_NOPTS_VALUE) {
+        LOG_TRACE("Frame came too early, merging it into the previous");
+        return;
+    }
+
+    // Static frames are still wanted as snapshots
+    m_snapshot.offer(m_frame, data.ts);
+
+    if (m_ingest->has_luma &&
+        m_scene_filter.should_skip(m_frame->data[0], m_frame->linesize[0],
+                                   data.width, data.height, data.ts)) {
+        return;
+    }
+
+    // Halves the framerate until buffered data is drained below the limit
+    MemoryPressure pressure = MemoryBudget::pressure();
+    if (pressure != MemoryPressure::None && !m_is_shedding) {
+        EventChannel::post(EventType::Congestion, this,
+                           (int32_t)CongestionReason::MemoryPressure,
+                           (int64_t)pressure);
+    }
+
+    m_is_shedding = pressure != MemoryPressure::None;
+    if (m_is_shedding && (m_shed_counter++ & 1) != 0) {
+        LOG_TRACE("Shedding frame due to memory pressure");
+        return;
+    }
+
+    LatencyStamp stamp = {};
+    if (m_is_latency_stamps_enabled) {
+        stamp = make_latency_stamp(data.ts);
+    }
 
-    if (!m_is_sws_required) {
-        write_to_encoder(m_frame);
+    // Encoder keeps reference to the input, so it can't be the camera
+    // buffer that is reused after this call
+    bool is_ready = false;
+    if (m_is_sws_required) {
+        is_ready = make_sws_scale(m_frame, m_encoder_frame);
+    } else if (buffer) {
+        is_ready = make_ref(m_frame, buffer, m_encoder_frame);
     } else {
-        make_sws_scale(m_frame, m_sws_frame);
-        write_to_encoder(m_sws_frame);
+        is_ready = make_copy(m_frame, m_encoder_frame);
+    }
+
+    if (!is_ready) {
+        return;
+    }
+
+    const LatencyStamp *stamp_ptr =
+        m_is_latency_stamps_enabled ? &stamp : nullptr;
+    if (m_parallel) {
+        std::lock_guard<std::mutex> encoding_lock(m_encoding_lock);
+        encode_frame(m_encoder_frame, stamp_ptr);
+        return;
     }
+
+    queue_frame(m_encoder_frame, stamp_ptr);
+}
+
+void FFmpegVideoStream::queue_frame(AVFrame *frame,
+                                    const LatencyStamp *stamp) {
+    std::lock_guard<std::mutex> lock(m_queue_lock);
+    if (m_queue_count == MAX_QUEUED_FRAMES) {
+        LOG_TRACE("Encoder doesn't keep up, dropping frame");
+        m_queue_dropped++;
+        av_frame_unref(frame);
+        return;
+    }
+
+    QueuedFrame &queued =
+        m_queue[(m_queue_head + m_queue_count) % MAX_QUEUED_FRAMES];
+    if (!queued.frame) {
+        queued.frame = av_frame_alloc();
+        if (!queued.frame) {
+            LOG_ERROR("Unable to allocate frame");
+            av_frame_unref(frame);
+            return;
+        }
+    }
+
+    av_frame_move_ref(queued.frame, frame);
+    queued.has_stamp = stamp != nullptr;
+    if (stamp) {
+        queued.stamp = *stamp;
+    }
+
+    m_queue_count++;
+    if (m_is_encode_scheduled) {
+        return;
+    }
+
+    m_is_encode_scheduled = true;
+    NativeEngine::submit(&m_engine_group,
+                         av_gettime_relative() + m_frame_interval_us,
+                         [this]() { run_encode(); });
+}
+
+void FFmpegVideoStream::run_encode() {
+    std::lock_guard<std::mutex> lock(m_encoding_lock);
+    encode_queued();
+}
+
+void FFmpegVideoStream::encode_queued() {
+    while (true) {
+        LatencyStamp stamp;
+        bool has_stamp = false;
+        {
+            std::lock_guard<std::mutex> lock(m_queue_lock);
+            if (m_queue_count == 0) {
+                // Next queued frame schedules the task again
+                m_is_encode_scheduled = false;
+                return;
+            }
+
+            QueuedFrame &queued = m_queue[m_queue_head];
+            m_queue_head = (m_queue_head + 1) % MAX_QUEUED_FRAMES;
+            m_queue_count--;
+
+            av_frame_move_ref(m_encoding_frame, queued.frame);
+            stamp = queued.stamp;
+            has_stamp = queued.has_stamp;
+        }
+
+        encode_frame(m_encoding_frame, has_stamp ? &stamp : nullptr);
+    }
+}
+
+void FFmpegVideoStream::encode_frame(AVFrame *frame,
+                                     const LatencyStamp *stamp) {
+    if (stamp) {
+        record_latency_stamp(frame->pts, *stamp);
+    }
+
+    m_quality.offer_frame(frame);
+    write_to_encoder(frame);
+
+    // Ring slot is recycled as soon as the encoder drops its reference
+    av_frame_unref(frame);
 }
 
 void FFmpegVideoStream::set_pixel_format(PixFmt pix_fmt) {
     std::lock_guard<std::mutex> lock(m_sending_lock);
 
     m_pix_fmt = to_av_pix_fmt(pix_fmt);
+    m_ingest = get_frame_ingest_ops(pix_fmt);
+    assert(m_ingest != nullptr);
 
-    m_pix_fmt_plane_count = av_pix_fmt_count_planes(m_pix_fmt);
     if (m_pix_fmt == m_cctx->pix_fmt) {
         return;
     }
@@ -97,58 +303,425 @@ void FFmpegVideoStream::set_frame_size(int width, int height) {
     m_frame_height = height;
 }
 
+void FFmpegVideoStream::set_latency_stamps(bool enabled) {
+    std::lock_guard<std::mutex> lock(m_sending_lock);
+    std::lock_guard<std::mutex> encoding_lock(m_encoding_lock);
+
+    if (enabled && !is_latency_stamp_supported(m_cctx->codec_id)) {
+        LOG_WARN("Latency stamps aren't supported by '%s' encoder",
+                 m_cctx->codec->name);
+        return;
+    }
+
+    m_is_latency_stamps_enabled = enabled;
+}
+
+void FFmpegVideoStream::set_static_scene_options(float threshold,
+                                                 int64_t max_skip_ms) {
+    std::lock_guard<std::mutex> lock(m_sending_lock);
+    m_scene_filter.set_options(threshold, max_skip_ms);
+}
+
+void FFmpegVideoStream::set_encoder_workers(int count) {
+    std::lock_guard<std::mutex> lock(m_sending_lock);
+    std::lock_guard<std::mutex> encoding_lock(m_encoding_lock);
+
+    int current = m_parallel ? m_parallel->worker_count() : 1;
+    if (count == current) {
+        return;
+    }
+
+    if (count > 1 && !ParallelEncoder::is_supported(m_cctx->codec)) {
+        LOG_WARN("Encoder '%s' can't be parallelized", m_cctx->codec->name);
+        return;
+    }
+
+    ParallelEncoder *parallel = nullptr;
+    if (count > 1) {
+        parallel = ParallelEncoder::build(&m_engine_group, m_config,
+                                          m_encoder_flags, count);
+        if (!parallel) {
+            LOG_ERROR("Unable to use %d encoder workers", count);
+            return;
+        }
+    }
+
+    // Packets of the frames that are in flight are written before switching
+    encode_queued();
+    if (m_parallel) {
+        drain_parallel(av_gettime_relative() + DEFAULT_DRAIN_TIMEOUT_MS * 1000);
+        delete m_parallel;
+    }
+
+    m_parallel = parallel;
+}
+
+void FFmpegVideoStream::set_snapshot_options(const SnapshotOptions &options) {
+    std::lock_guard<std::mutex> lock(m_sending_lock);
+    m_snapshot.set_options(options);
+}
+
+bool FFmpegVideoStream::set_quality_options(const QualityOptions &options) {
+    std::lock_guard<std::mutex> lock(m_encoding_lock);
+
+    if (options.interval_frames > 0 &&
+        !QualityMonitor::is_supported(m_cctx->codec)) {
+        LOG_WARN("Quality of '%s' encoder can't be measured",
+                 m_cctx->codec->name);
+        return false;
+    }
+
+    m_quality.set_options(options, m_cctx->codec);
+    return true;
+}
+
 void FFmpegVideoStream::start() {
     std::lock_guard<std::mutex> lock(m_sending_lock);
+    std::lock_guard<std::mutex> encoding_lock(m_encoding_lock);
+    m_scene_filter.reset();
+    m_started_at_us = av_gettime_relative();
+    m_tick_started_us = 0;
+    m_tick_packets = 0;
+    m_tick_bytes = 0;
+    m_time_to_first_packet_us = -1;
     m_is_started = true;
 }
 
 void FFmpegVideoStream::stop() {
+    stop(av_gettime_relative() + DEFAULT_DRAIN_TIMEOUT_MS * 1000);
+}
+
+void FFmpegVideoStream::stop(int64_t deadline_us) {
     std::lock_guard<std::mutex> lock(m_sending_lock);
+    if (!m_is_started) {
+        return;
+    }
+
     m_is_started = false;
+
+    std::lock_guard<std::mutex> encoding_lock(m_encoding_lock);
+
+    // Queued frames are encoded before the encoder is drained
+    encode_queued();
+
+    drain(deadline_us);
+
+    {
+        std::lock_guard<std::mutex> queue_lock(m_queue_lock);
+        if (m_queue_dropped > 0) {
+            LOG_WARN("Dropped %lld frames, encoder didn't keep up",
+                     (long long)m_queue_dropped);
+            m_queue_dropped = 0;
+        }
+    }
+
+    TimestampStats stats = timestamp_stats();
+    LOG_INFO("Timestamps of %lld frames, jitter: %lld us (max %lld us), "
+             "gaps: %lld, non-monotonic: %lld",
+             (long long)stats.frames, (long long)stats.jitter_us,
+             (long long)stats.max_jitter_us, (long long)stats.gaps,
+             (long long)stats.non_monotonic);
+}
+
+TimestampStats FFmpegVideoStream::timestamp_stats() {
+    std::lock_guard<std::mutex> lock(m_timestamps_lock);
+    return m_timestamps.stats();
 }
 
 void FFmpegVideoStream::write_to_encoder(AVFrame *frame) {
     LOG_TRACE("Writing frame to the encoder");
-    bool wantAgain = false;
 
-    do {
-        wantAgain = false;
+    // Frames are reused, so picture type must be reset for the next ones
+    frame->pict_type = AV_PICTURE_TYPE_NONE;
+    if (m_is_keyframe_requested.exchange(false)) {
+        LOG_INFO("Forcing keyframe");
+        frame->pict_type = AV_PICTURE_TYPE_I;
+    }
 
-        int res = avcodec_send_frame(m_cctx, frame);
-        if (res < 0) {
-            if (res == AVERROR(EAGAIN)) {
-                wantAgain = true;
-            } else {
-                LOG_ERROR("Error sending a frame to the encoder: %s(%d)",
-                          av_err_to_string(res).data(), res);
-                break;
+    while (true) {
+        int res = send_to_encoder(frame);
+        if (res == AVERROR(EAGAIN)) {
+            // EAGAIN cannot be returned from send_frame and receive_packet at
+            // the same time.
+            if (!write_packets()) {
+                return;
             }
+            continue;
         }
 
-        res = avcodec_receive_packet(m_cctx, m_packet);
         if (res < 0) {
-            // EAGAIN cannot be returned from send_frame and receive_packet at
-            // the same time.
-            if (res != AVERROR(EAGAIN)) {
-                LOG_ERROR("Error receive packet from the encoder: %s(%d)",
-                          av_err_to_string(res).data(), res);
-            }
+            LOG_ERROR("Error sending a frame to the encoder: %s(%d)",
+                      av_err_to_string(res).data(), res);
+            EventChannel::post(EventType::Error, this,
+                               (int32_t)StreamError::FFmpegEncodeFailed, res);
+            return;
+        }
+
+        break;
+    }
+
+    if (!m_parallel) {
+        m_is_encoder_clean = false;
+    }
+    write_packets();
+}
+
+int FFmpegVideoStream::send_to_encoder(AVFrame *frame) {
+    if (m_parallel) {
+        return m_parallel->send_frame(frame);
+    }
+
+    return avcodec_send_frame(m_cctx, frame);
+}
+
+int FFmpegVideoStream::receive_from_encoder(AVPacket *packet) {
+    if (m_parallel) {
+        return m_parallel->receive_packet(packet);
+    }
+
+    return avcodec_receive_packet(m_cctx, packet);
+}
+
+bool FFmpegVideoStream::write_packets() {
+    while (true) {
+        int res = receive_from_encoder(m_packet);
+        if (res == AVERROR(EAGAIN) || res == AVERROR_EOF) {
+            return true;
+        }
+
+        if (res < 0) {
+            LOG_ERROR("Error receive packet from the encoder: %s(%d)",
+                      av_err_to_string(res).data(), res);
+            EventChannel::post(EventType::Error, this,
+                               (int32_t)StreamError::FFmpegEncodeFailed, res);
+            return false;
+        }
+
+        write_packet(m_packet);
+    }
+}
+
+void FFmpegVideoStream::write_packet(AVPacket *packet, int64_t deadline_us) {
+    AVRational time_base = m_output->stream_time_base(m_stream_index);
+    packet->stream_index = m_stream_index;
+
+    {
+        std::lock_guard<std::mutex> lock(m_timestamps_lock);
+        if (packet->duration == 0) {
+            packet->duration = m_timestamps.frame_duration(time_base);
+        }
+
+        // Encoder reopened after draining may restart dts below the last one
+        m_timestamps.order_packet(packet);
+    }
+
+    if (m_time_to_first_packet_us < 0 && m_started_at_us != 0) {
+        m_time_to_first_packet_us = av_gettime_relative() - m_started_at_us;
+        LOG_INFO("Time to first packet: %lld us",
+                 (long long)m_time_to_first_packet_us.load());
+    }
+
+    if (m_is_latency_stamps_enabled) {
+        embed_latency_stamp(packet);
+    }
+
+    bool is_keyframe = packet->flags & AV_PKT_FLAG_KEY;
+    AVRational us = {1, AV_TIME_BASE};
+    int64_t pts_us = av_rescale_q(packet->pts, time_base, us);
+    int size = packet->size;
+
+    m_quality.offer_packet(packet);
+
+    LOG_PACKET_INFO(time_base, packet);
+    int res = m_output->write_packet(packet, deadline_us);
+    av_packet_unref(packet);
+
+    if (res < 0) {
+        LOG_ERROR("Error while writing output packet: %s(%d)",
+                  av_err_to_string(res).data(), res);
+        EventChannel::post(EventType::Error, this,
+                           (int32_t)StreamError::FFmpegWriteFailed, res);
+        return;
+    }
+
+    // Dropped while reconnecting or waiting for keyframe
+    if (res == 0) {
+        return;
+    }
+
+    if (is_keyframe) {
+        EventChannel::post(EventType::KeyframeSent, this, 0, pts_us);
+    }
+
+    post_stats_tick(size);
+}
+
+void FFmpegVideoStream::post_stats_tick(int packet_size) {
+    m_tick_packets++;
+    m_tick_bytes += packet_size;
+
+    int64_t now = av_gettime_relative();
+    if (m_tick_started_us == 0) {
+        m_tick_started_us = now;
+    }
+
+    if (now - m_tick_started_us < EventChannel::STATS_TICK_US) {
+        return;
+    }
+
+    EventChannel::post(EventType::StatsTick, this, m_tick_packets,
+                       m_tick_bytes);
+    m_tick_started_us = now;
+    m_tick_packets = 0;
+    m_tick_bytes = 0;
+}
+
+void FFmpegVideoStream::apply_thread_policy() {
+    pid_t tid = gettid();
+    uint32_t generation = ThreadPolicy::generation();
+    if (tid == m_policy_tid && generation == m_policy_generation) {
+        return;
+    }
+
+    // Thread is owned by the caller, so it's not renamed
+    ThreadPolicy::apply(ThreadRole::Encoder);
+    m_policy_tid = tid;
+    m_policy_generation = generation;
+}
+
+LatencyStamp FFmpegVideoStream::make_latency_stamp(int64_t capture_ts) {
+    int64_t ingest_wall = clock_ns(CLOCK_REALTIME);
+
+    return LatencyStamp{
+        .capture_ts = capture_ts,
+        .capture_wall_ns = ingest_wall - estimate_capture_age(capture_ts),
+        .ingest_wall_ns = ingest_wall,
+        .encoded_wall_ns = 0,
+    };
+}
+
+void FFmpegVideoStream::record_latency_stamp(int64_t pts,
+                                             const LatencyStamp &stamp) {
+    PendingStamp &pending = m_pending_stamps[m_next_pending_stamp];
+    m_next_pending_stamp = (m_next_pending_stamp + 1) % MAX_PENDING_STAMPS;
+
+    pending.pts = pts;
+    pending.stamp = stamp;
+}
+
+void FFmpegVideoStream::embed_latency_stamp(AVPacket *packet) {
+    for (PendingStamp &pending : m_pending_stamps) {
+        if (pending.pts != packet->pts) {
+            continue;
+        }
 
+        pending.stamp.encoded_wall_ns = clock_ns(CLOCK_REALTIME);
+        if (!::embed_latency_stamp(m_cctx->codec_id, packet, pending.stamp)) {
+            LOG_TRACE("Unable to embed latency stamp, pts: %lld",
+                      (long long)packet->pts);
+        }
+
+        pending.pts = AV_NOPTS_VALUE;
+        return;
+    }
+}
+
+void FFmpegVideoStream::drain(int64_t deadline_us) {
+    if (m_parallel) {
+        drain_parallel(deadline_us);
+        return;
+    }
+
+    // Encoders without delay never hold packets
+    if (!(m_cctx->codec->capabilities & AV_CODEC_CAP_DELAY)) {
+        return;
+    }
+
+    LOG_INFO("Draining encoder");
+
+    int res = avcodec_send_frame(m_cctx, nullptr);
+    if (res < 0 && res != AVERROR_EOF) {
+        LOG_ERROR("Unable to start draining: %s", av_err_to_string(res).data());
+        reset_encoder();
+        return;
+    }
+
+    int drained = 0;
+    while (true) {
+        if (av_gettime_relative() > deadline_us) {
+            LOG_WARN("Drain deadline reached, dropping delayed packets");
             break;
         }
 
-        m_packet->duration = frame->duration;
+        res = avcodec_receive_packet(m_cctx, m_packet);
+        if (res == AVERROR_EOF) {
+            break;
+        }
 
-        LOG_PACKET_INFO(m_octx, m_packet);
-        res = av_write_frame(m_octx, m_packet);
-        av_packet_unref(m_packet);
+        if (res == AVERROR(EAGAIN)) {
+            // Hardware encoders may still be processing the input
+            av_usleep(1000);
+            continue;
+        }
 
         if (res < 0) {
-            LOG_ERROR("Error while writing output packet: %s(%d)",
-                      av_err_to_string(res).data(), res);
-            return;
+            LOG_ERROR("Error receive packet while draining: %s",
+                      av_err_to_string(res).data());
+            break;
         }
-    } while (wantAgain);
+
+        write_packet(m_packet, deadline_us);
+        drained++;
+    }
+
+    LOG_INFO("Drained %d packets", drained);
+    reset_encoder();
+}
+
+void FFmpegVideoStream::drain_parallel(int64_t deadline_us) {
+    int drained = 0;
+    while (true) {
+        int res = m_parallel->receive_packet(m_packet, deadline_us);
+        if (res == AVERROR_EOF) {
+            break;
+        }
+
+        if (res == AVERROR(EAGAIN)) {
+            LOG_WARN("Drain deadline reached, dropping encoding frames");
+            break;
+        }
+
+        if (res < 0) {
+            // Failed frame is skipped, next ones may still be encoded
+            continue;
+        }
+
+        write_packet(m_packet, deadline_us);
+        drained++;
+    }
+
+    LOG_INFO("Drained %d packets from parallel encoder", drained);
+    m_parallel->flush();
+}
+
+void FFmpegVideoStream::reset_encoder() {
+    if (m_cctx->codec->capabilities & AV_CODEC_CAP_ENCODER_FLUSH) {
+        avcodec_flush_buffers(m_cctx);
+        m_is_encoder_clean = true;
+        return;
+    }
+
+    // Encoder is unusable after draining, so it must be opened again to
+    // accept frames after restart
+    AVCodecContext *cctx = EncoderCache::acquire(m_config, m_encoder_flags);
+    if (!cctx) {
+        LOG_ERROR("Unable to reopen encoder after draining");
+        return;
+    }
+
+    avcodec_free_context(&m_cctx);
+    m_cctx = cctx;
+    m_is_encoder_clean = true;
 }
 
 void FFmpegVideoStream::as_av_frame(const FrameData &data, AVFrame *out) {
@@ -157,71 +730,86 @@ void FFmpegVideoStream::as_av_frame(const FrameData &data, AVFrame *out) {
     out->height = data.height;
     out->format = m_pix_fmt;
 
-    assert(m_pix_fmt_plane_count <= AV_NUM_DATA_POINTERS);
-    for (int i = 0; i < m_pix_fmt_plane_count; i++) {
+#ifndef NDEBUG
+    for (int i = 0; i < m_ingest->plane_count; i++) {
         // all planes for current pix_fmt must be valid
         assert(data.buff[i] != nullptr);
         assert(data.buff_stride[i] > 0);
-
-        out->data[i] = data.buff[i];
-        out->linesize[i] = data.buff_stride[i];
     }
+#endif
 
-    if (m_start_pts == -1) {
-        m_start_pts = data.ts;
-    }
-
-    int64_t time_diff = data.ts - m_start_pts;
-    out->pts = av_rescale_q(time_diff,
-                            AVRational{1, 1'000'000'000},  // from nanoseconds
-                            m_octx->streams[m_stream_index]->time_base);
+    m_ingest->map_planes(data, out->data, out->linesize);
 
-    // 1 frame to stream time base
-    out->duration = av_rescale_q(1, AVRational{1, m_cctx->framerate.num},
-                                 m_octx->streams[m_stream_index]->time_base);
+    AVRational time_base = m_output->stream_time_base(m_stream_index);
+    std::lock_guard<std::mutex> lock(m_timestamps_lock);
+    out->pts = m_timestamps.normalize(data.ts, time_base);
+    out->duration = m_timestamps.frame_duration(time_base);
 }
 
-void FFmpegVideoStream::make_sws_scale(AVFrame *input, AVFrame *output) {
+bool FFmpegVideoStream::make_sws_scale(AVFrame *input, AVFrame *output) {
     assert(m_is_sws_required == true);
 
-    if (av_frame_make_writable(output) < 0) {
-        LOG_ERROR("Unable to make frame writeable");
-        return;
+    // Previous buffer may still be referenced by the encoder
+    if (!m_frame_pool.get(output, m_cctx->width, m_cctx->height,
+                          m_cctx->pix_fmt)) {
+        return false;
     }
 
-    if (m_is_sws_invalid) {
-        sws_freeContext(m_sws_ctx);
-        m_sws_ctx = nullptr;
-        m_is_sws_invalid = false;
+    // NOTE: Contexts are made on the first frame, because actual pixel
+    // format can be determined right before send_frame
+    int64_t deadline_us = av_gettime_relative() + m_frame_interval_us;
+    if (!m_scaler.scale(input, output, deadline_us)) {
+        EventChannel::post(EventType::Error, this,
+                           (int32_t)StreamError::VideoConversionFailed);
+        av_frame_unref(output);
+        return false;
     }
 
-    // NOTE: Allocation placed here, because actual pixel format can be
-    // determined right before send_frame
-    if (!m_sws_ctx) {
-        m_sws_ctx = sws_getContext(
-            input->width, input->height, (AVPixelFormat)input->format,
-            output->width, output->height, (AVPixelFormat)output->format,
-            SWS_FAST_BILINEAR, nullptr, nullptr, nullptr);
-    }
+    av_frame_copy_props(output, input);
+    return true;
+}
 
-    if (!m_sws_ctx) {
-        LOG_ERROR("Unable to initialize the sws context");
-        return;
+bool FFmpegVideoStream::make_copy(AVFrame *input, AVFrame *output) {
+    if (!m_frame_pool.get(output, input->width, input->height,
+                          (AVPixelFormat)input->format)) {
+        return false;
     }
 
-    sws_scale(m_sws_ctx, input->data, input->linesize, 0, input->height,
-              output->data, output->linesize);
+    int res = av_frame_copy(output, input);
+    if (res < 0) {
+        LOG_ERROR("Unable to copy frame: %s", av_err_to_string(res).data());
+        return false;
+    }
 
     av_frame_copy_props(output, input);
+    return true;
 }
 
-void FFmpegVideoStream::require_sws() {
-    // FIXME: Data leak when called multiple times
-    m_sws_frame = make_av_frame(m_cctx->width, m_cctx->height, m_cctx->pix_fmt);
+bool FFmpegVideoStream::make_ref(AVFrame *input, AVBufferRef *buffer,
+                                 AVFrame *output) {
+    av_frame_unref(output);
+
+    output->buf[0] = av_buffer_ref(buffer);
+    if (!output->buf[0]) {
+        LOG_ERROR("Unable to reference frame buffer");
+        return false;
+    }
 
-    if (m_sws_ctx) {
-        m_is_sws_invalid = true;
+    for (int i = 0; i < AV_NUM_DATA_POINTERS; i++) {
+        output->data[i] = input->data[i];
+        output->linesize[i] = input->linesize[i];
     }
 
+    output->extended_data = output->data;
+    output->width = input->width;
+    output->height = input->height;
+    output->format = input->format;
+
+    av_frame_copy_props(output, input);
+    return true;
+}
+
+void FFmpegVideoStream::require_sws() {
+    m_scaler.reset();
     m_is_sws_required = true;
 }
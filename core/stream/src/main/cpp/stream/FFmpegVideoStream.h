@@ -1,7 +1,10 @@
 #pragma once
 
+#include <atomic>
 #include <mutex>
 
+#include <sys/types.h>
+
 extern "C" {
 #include "libavcodec/avcodec.h"
 #include "libavcodec/packet.h"
@@ -9,36 +12,119 @@ extern "C" {
 #include "libavutil/frame.h"
 }
 
+#include "BandScaler.h"
 #include "FrameData.h"
+#include "FrameIngest.h"
+#include "FramePool.h"
+#include "FrameRing.h"
+#include "LatencyStamp.h"
+#include "ParallelEncoder.h"
+#include "QualityMonitor.h"
+#include "SnapshotEncoder.h"
+#include "StaticSceneFilter.h"
+#include "TimestampNormalizer.h"
+#include "VideoConfig.h"
+
+class FFmpegOutput;
 
+// Sending thread converts frames and queues them, encoding and muxing run as
+// NativeEngine tasks with the deadline of the next frame. When the encoder
+// doesn't keep up the queue is full and new frames are dropped.
+//
+// ParallelEncoder already spreads encoding over the engine, so with it
+// frames are encoded on the sending thread.
 class FFmpegVideoStream {
    public:
-    FFmpegVideoStream(AVFormatContext *octx, AVCodecContext *cctx,
-                      AVPacket *packet, AVFrame *frame, int stream_index)
-        : m_octx(octx),
+    FFmpegVideoStream(FFmpegOutput *output, AVCodecContext *cctx,
+                      AVPacket *packet, AVFrame *frame, AVFrame *encoder_frame,
+                      AVFrame *encoding_frame, int stream_index,
+                      VideoConfig config, int encoder_flags)
+        : m_output(output),
           m_cctx(cctx),
           m_packet(packet),
           m_frame(frame),
-          m_stream_index(stream_index) {}
+          m_encoder_frame(encoder_frame),
+          m_encoding_frame(encoding_frame),
+          m_config(std::move(config)),
+          m_stream_index(stream_index),
+          m_encoder_flags(encoder_flags) {}
     ~FFmpegVideoStream();
 
-    static FFmpegVideoStream *build(AVFormatContext *octx, AVCodecContext *cctx,
-                                    int stream_index);
+    // Config and encoder_flags are used to reopen encoder that can't be
+    // flushed after draining
+    static FFmpegVideoStream *build(FFmpegOutput *output, AVCodecContext *cctx,
+                                    int stream_index, const VideoConfig &config,
+                                    int encoder_flags);
 
     void send_frame(const FrameData &data);
+
+    // Sends committed slot of the ring, slot is referenced by the encoder
+    // instead of being copied when no conversion is required. Pixel format
+    // of the stream follows the ring.
+    void send_ring_frame(FrameRing *ring, int index, int64_t ts);
     void set_pixel_format(PixFmt pix_fmt);
     void set_frame_size(int width, int height);
 
     bool has_pixel_format() const { return m_pix_fmt != AV_PIX_FMT_NONE; }
     AVPixelFormat pixel_format() const { return m_pix_fmt; }
-    int plane_count() const { return m_pix_fmt_plane_count; }
+    int plane_count() const { return m_ingest ? m_ingest->plane_count : 0; }
+
+    // Valid only after pixel format is set
+    const FrameIngestOps *ingest_ops() const { return m_ingest; }
+
+    // Embeds capture and per-stage timestamps into every encoded frame, see
+    // LatencyEmbed.h
+    void set_latency_stamps(bool enabled);
+
+    // Drops frames with static content before they reach the encoder, see
+    // StaticSceneFilter
+    void set_static_scene_options(float threshold, int64_t max_skip_ms);
+
+    // Encodes frames on count encoders at once when encoder is intra-only,
+    // see ParallelEncoder. Count of 1 returns to the single encoder.
+    void set_encoder_workers(int count);
+
+    // Keeps low-resolution JPEG of every Nth frame, see SnapshotEncoder
+    void set_snapshot_options(const SnapshotOptions &options);
+
+    // Copies the latest snapshot, returns false when there is none. Can be
+    // called from any thread.
+    bool read_snapshot(std::vector<uint8_t> &out, int64_t *ts) {
+        return m_snapshot.read_latest(out, ts);
+    }
+
+    // Measures PSNR/SSIM of every Nth encoded frame, see QualityMonitor.
+    // Returns false when encoder isn't supported.
+    bool set_quality_options(const QualityOptions &options);
+
+    // Statistics of the measured frames since the options were set
+    QualityStats quality_stats() { return m_quality.stats(); }
+
+    // Statistics of camera timestamps since the stream was built
+    TimestampStats timestamp_stats();
 
     int get_width() const { return m_frame_width; }
     int get_height() const { return m_frame_height; }
 
     void start();
+
+    // Next frame sent to the encoder is encoded as keyframe. Can be called
+    // from any thread.
+    void request_keyframe() { m_is_keyframe_requested = true; }
+
+    // Time between the latest start() and the first packet written after it,
+    // -1 until the first packet is written
+    int64_t time_to_first_packet_us() const {
+        return m_time_to_first_packet_us;
+    }
+
+    // Stops accepting frames and writes packets delayed by encoder until
+    // deadline (in av_gettime_relative units), the rest is dropped
+    void stop(int64_t deadline_us);
     void stop();
 
+    static constexpr int64_t DEFAULT_DRAIN_TIMEOUT_MS = 500;
+
     // TODO:
     // Looks like it's good idea to create object that can control optimal pixel
     // formats for sources and streams. Source and Stream must provide
@@ -52,34 +138,146 @@ class FFmpegVideoStream {
     // }
 
    private:
+    // Buffer owns the planes of data when it's not nullptr
+    void send(const FrameData &data, AVBufferRef *buffer);
+
+    // Queues converted frame for the encode task, frame is moved
+    void queue_frame(AVFrame *frame, const LatencyStamp *stamp);
+
+    // Encode task, encodes queued frames until the queue is empty
+    void run_encode();
+
+    // Must be called with locked m_encoding_lock
+    void encode_queued();
+    void encode_frame(AVFrame *frame, const LatencyStamp *stamp);
+
     void write_to_encoder(AVFrame *frame);
 
+    // Route to m_parallel when it's used, otherwise to m_cctx
+    int send_to_encoder(AVFrame *frame);
+    int receive_from_encoder(AVPacket *packet);
+
+    // Writes all packets that encoder has ready, returns false on failure
+    bool write_packets();
+    // Deadline limits blocking io of the output, 0 means no deadline
+    void write_packet(AVPacket *packet, int64_t deadline_us = 0);
+
+    // Counts written packet and posts StatsTick once per interval
+    void post_stats_tick(int packet_size);
+
+    // Applies encoder thread options when the sending thread or the options
+    // change
+    void apply_thread_policy();
+
+    static LatencyStamp make_latency_stamp(int64_t capture_ts);
+    void record_latency_stamp(int64_t pts, const LatencyStamp &stamp);
+    void embed_latency_stamp(AVPacket *packet);
+
+    void drain(int64_t deadline_us);
+    void drain_parallel(int64_t deadline_us);
+    void reset_encoder();
+
     // Represent FrameData as AVFrame. In this case AVFrame is not refcounted
     // and considered as read-only
     void as_av_frame(const FrameData &data, AVFrame *out);
 
-    void make_sws_scale(AVFrame *input, AVFrame *output);
+    // Both write input into the pooled output frame, return false on failure
+    bool make_sws_scale(AVFrame *input, AVFrame *output);
+    bool make_copy(AVFrame *input, AVFrame *output);
+
+    // References input planes that are owned by buffer, returns false on
+    // failure
+    bool make_ref(AVFrame *input, AVBufferRef *buffer, AVFrame *output);
+
     void require_sws();
 
+    // Locked in this order when both are needed
     std::mutex m_sending_lock;
+    // Guards the encoder and everything after it: m_packet, stamps, quality
+    // and stats. m_cctx and m_parallel are replaced only under both locks.
+    std::mutex m_encoding_lock;
 
-    AVFormatContext *m_octx;
+    FFmpegOutput *m_output;
     AVCodecContext *m_cctx;
 
+    // Used instead of m_cctx for encoding when set, m_cctx still describes
+    // the stream
+    ParallelEncoder *m_parallel = nullptr;
+
     AVPacket *m_packet;
     AVFrame *m_frame;
 
-    struct SwsContext *m_sws_ctx = nullptr;
-    AVFrame *m_sws_frame = nullptr;
+    // Refcounted copy of m_frame that is sent to the encoder, buffers are
+    // taken from m_frame_pool
+    AVFrame *m_encoder_frame;
+    FramePool m_frame_pool;
+
+    // Frame taken from the queue by the encode task
+    AVFrame *m_encoding_frame;
+
+    VideoConfig m_config;
+
+    StaticSceneFilter m_scene_filter;
+
+    // Tasks of this stream in NativeEngine, declared before their owners
+    EngineGroup m_engine_group{"video"};
+    SnapshotEncoder m_snapshot{&m_engine_group};
+    QualityMonitor m_quality{&m_engine_group, this};
+    BandScaler m_scaler{&m_engine_group};
+
+    struct QueuedFrame {
+        AVFrame *frame = nullptr;
+        LatencyStamp stamp = {};
+        bool has_stamp = false;
+    };
+
+    // Frames waiting for the encode task, guarded by m_queue_lock
+    static constexpr int MAX_QUEUED_FRAMES = 4;
+    std::mutex m_queue_lock;
+    QueuedFrame m_queue[MAX_QUEUED_FRAMES];
+    int m_queue_head = 0;
+    int m_queue_count = 0;
+    int64_t m_queue_dropped = 0;
+    bool m_is_encode_scheduled = false;
+
+    struct PendingStamp {
+        int64_t pts = AV_NOPTS_VALUE;
+        LatencyStamp stamp = {};
+    };
+
+    // Frames that are inside the encoder, indexed by the sending order
+    static constexpr int MAX_PENDING_STAMPS = 32;
+    PendingStamp m_pending_stamps[MAX_PENDING_STAMPS];
+    int m_next_pending_stamp = 0;
+
+    // Normalized by the sending thread, used for packets by the encoder
+    std::mutex m_timestamps_lock;
+    TimestampNormalizer m_timestamps;
+    // Encode task of a frame is due before the next frame arrives
+    int64_t m_frame_interval_us =
+        TimestampNormalizer::DEFAULT_FRAME_INTERVAL_NS / 1000;
 
-    int64_t m_start_pts = -1;
+    int64_t m_started_at_us = 0;
+    std::atomic<int64_t> m_time_to_first_packet_us = -1;
+    std::atomic<bool> m_is_keyframe_requested = false;
 
     AVPixelFormat m_pix_fmt = AV_PIX_FMT_NONE;
+    const FrameIngestOps *m_ingest = nullptr;
     int m_stream_index = 0;
+    int m_encoder_flags = 0;
     int m_frame_width = 0;
     int m_frame_height = 0;
-    int m_pix_fmt_plane_count = 0;
+    unsigned m_shed_counter = 0;
+    int32_t m_tick_packets = 0;
+    int64_t m_tick_bytes = 0;
+    int64_t m_tick_started_us = 0;
+    pid_t m_policy_tid = 0;
+    uint32_t m_policy_generation = 0;
     bool m_is_sws_required = false;
-    bool m_is_sws_invalid = false;
     bool m_is_started = false;
+    bool m_is_latency_stamps_enabled = false;
+    // Congestion is posted only when shedding starts
+    bool m_is_shedding = false;
+    // Encoder wasn't fed since it was opened or flushed
+    bool m_is_encoder_clean = true;
 };
@@ -103,18 +103,23 @@ Java_com_rejeq_cpcam_core_stream_jni_FFmpegVideoStreamJni_send(
         .buff_stride = {},
     };
 
-    if (setupFrameData(data, env, buffers, strides, planeCount)) {
-        return;
-    }
+    const FrameIngestOps *ops = stream->ingest_ops();
+    FrameData src = {};
+
+    if (!ops) {
+        // Pixel format is detected only once, all next frames are handled by
+        // ops that specialized for it
+        if (setupFrameData(src, env, buffers, strides, planeCount)) {
+            return;
+        }
 
-    if (!stream->has_pixel_format()) {
         int *pixel_strides = env->GetIntArrayElements(pixelStrides, nullptr);
         if (!pixel_strides) {
             LOG_ERROR("Failed to get pixel stride array");
             return;
         }
 
-        auto pix_fmt = get_image_format(data, format, pixel_strides);
+        auto pix_fmt = get_image_format(src, format, pixel_strides);
         env->ReleaseIntArrayElements(pixelStrides, pixel_strides, JNI_ABORT);
 
         if (!pix_fmt) {
@@ -123,16 +128,13 @@ Java_com_rejeq_cpcam_core_stream_jni_FFmpegVideoStreamJni_send(
         }
 
         stream->set_pixel_format(*pix_fmt);
+        ops = stream->ingest_ops();
+    } else if (setupFrameData(src, env, buffers, strides,
+                              ops->source_plane_count)) {
+        return;
     }
 
-    auto stream_fmt = stream->pixel_format();
-    if (stream_fmt == AV_PIX_FMT_NV21) {
-        // NV12/NV21 has only 2 planes (Y and U/V)
-        // In case of NV21 we need to set V plane as second
-        // In case of NV12 we already have correct order
-        data.buff[1] = data.buff[2];
-        data.buff_stride[1] = data.buff_stride[2];
-    }
+    ops->reorder_planes(src.buff, src.buff_stride, data);
 
     stream->send_frame(data);
 }
@@ -154,6 +156,139 @@ Java_com_rejeq_cpcam_core_stream_jni_FFmpegVideoStreamJni_setResolution(
     stream->set_frame_size(width, height);
 }
 
+JNIEXPORT void JNICALL
+Java_com_rejeq_cpcam_core_stream_jni_FFmpegVideoStreamJni_setStaticSceneOptions(
+    JNIEnv * /* env */, jobject /* obj */, jlong rawStream, jfloat threshold,
+    jlong maxSkipMs) {
+    auto *stream = (FFmpegVideoStream *)rawStream;
+
+    stream->set_static_scene_options(threshold, maxSkipMs);
+}
+
+JNIEXPORT void JNICALL
+Java_com_rejeq_cpcam_core_stream_jni_FFmpegVideoStreamJni_setEncoderWorkers(
+    JNIEnv * /* env */, jobject /* obj */, jlong rawStream, jint count) {
+    auto *stream = (FFmpegVideoStream *)rawStream;
+
+    stream->set_encoder_workers(count);
+}
+
+JNIEXPORT void JNICALL
+Java_com_rejeq_cpcam_core_stream_jni_FFmpegVideoStreamJni_setSnapshotOptions(
+    JNIEnv * /* env */, jobject /* obj */, jlong rawStream,
+    jint intervalFrames, jint maxWidth, jint quality) {
+    auto *stream = (FFmpegVideoStream *)rawStream;
+
+    stream->set_snapshot_options(SnapshotOptions{
+        .interval_frames = intervalFrames,
+        .max_width = maxWidth,
+        .quality = quality,
+    });
+}
+
+JNIEXPORT jbyteArray JNICALL
+Java_com_rejeq_cpcam_core_stream_jni_FFmpegVideoStreamJni_getSnapshot(
+    JNIEnv *env, jobject /* obj */, jlong rawStream) {
+    auto *stream = (FFmpegVideoStream *)rawStream;
+
+    std::vector<uint8_t> jpeg;
+    if (!stream->read_snapshot(jpeg, nullptr)) {
+        return nullptr;
+    }
+
+    jbyteArray out = env->NewByteArray((jsize)jpeg.size());
+    if (!out) {
+        LOG_ERROR("Unable to allocate snapshot array");
+        return nullptr;
+    }
+
+    env->SetByteArrayRegion(out, 0, (jsize)jpeg.size(),
+                            (const jbyte *)jpeg.data());
+    return out;
+}
+
+JNIEXPORT jboolean JNICALL
+Java_com_rejeq_cpcam_core_stream_jni_FFmpegVideoStreamJni_setQualityOptions(
+    JNIEnv * /* env */, jobject /* obj */, jlong rawStream,
+    jint intervalFrames, jint maxCpuPercent) {
+    auto *stream = (FFmpegVideoStream *)rawStream;
+
+    return stream->set_quality_options(QualityOptions{
+        .interval_frames = intervalFrames,
+        .max_cpu_percent = maxCpuPercent,
+    });
+}
+
+JNIEXPORT jobject JNICALL
+Java_com_rejeq_cpcam_core_stream_jni_FFmpegVideoStreamJni_getQualityStats(
+    JNIEnv *env, jobject /* obj */, jlong rawStream) {
+    auto *stream = (FFmpegVideoStream *)rawStream;
+
+    QualityStats stats = stream->quality_stats();
+
+    jclass stats_class = env->FindClass(
+        "com/rejeq/cpcam/core/stream/jni/FFmpegQualityStats");
+    if (stats_class == nullptr) {
+        return nullptr;
+    }
+
+    jmethodID stats_ctor =
+        env->GetMethodID(stats_class, "<init>", "(JJDDDDDDJ)V");
+    if (stats_ctor == nullptr) {
+        return nullptr;
+    }
+
+    return env->NewObject(
+        stats_class, stats_ctor, (jlong)stats.samples, (jlong)stats.skipped,
+        (jdouble)stats.last_psnr, (jdouble)stats.avg_psnr,
+        (jdouble)stats.min_psnr, (jdouble)stats.last_ssim,
+        (jdouble)stats.avg_ssim, (jdouble)stats.min_ssim,
+        (jlong)stats.avg_cost_us);
+}
+
+JNIEXPORT void JNICALL
+Java_com_rejeq_cpcam_core_stream_jni_FFmpegVideoStreamJni_setLatencyStamps(
+    JNIEnv * /* env */, jobject /* obj */, jlong rawStream, jboolean enabled) {
+    auto *stream = (FFmpegVideoStream *)rawStream;
+
+    stream->set_latency_stamps(enabled);
+}
+
+JNIEXPORT jlong JNICALL
+Java_com_rejeq_cpcam_core_stream_jni_FFmpegVideoStreamJni_getTimeToFirstPacketUs(
+    JNIEnv * /* env */, jobject /* obj */, jlong rawStream) {
+    auto *stream = (FFmpegVideoStream *)rawStream;
+
+    return stream->time_to_first_packet_us();
+}
+
+JNIEXPORT jobject JNICALL
+Java_com_rejeq_cpcam_core_stream_jni_FFmpegVideoStreamJni_getTimestampStats(
+    JNIEnv *env, jobject /* obj */, jlong rawStream) {
+    auto *stream = (FFmpegVideoStream *)rawStream;
+
+    TimestampStats stats = stream->timestamp_stats();
+
+    jclass stats_class = env->FindClass(
+        "com/rejeq/cpcam/core/stream/jni/FFmpegTimestampStats");
+    if (stats_class == nullptr) {
+        return nullptr;
+    }
+
+    jmethodID stats_ctor =
+        env->GetMethodID(stats_class, "<init>", "(JJJJJJJJJJ)V");
+    if (stats_ctor == nullptr) {
+        return nullptr;
+    }
+
+    return env->NewObject(
+        stats_class, stats_ctor, (jlong)stats.frames, (jlong)stats.jitter_us,
+        (jlong)stats.max_jitter_us, (jlong)stats.interval_us,
+        (jlong)stats.drift_us, (jlong)stats.gaps, (jlong)stats.merged,
+        (jlong)stats.non_monotonic, (jlong)stats.discontinuities,
+        (jlong)stats.reordered_packets);
+}
+
 JNIEXPORT jint JNICALL
 Java_com_rejeq_cpcam_core_stream_jni_FFmpegVideoStreamJni_getWidth(
         JNIEnv * /* env */, jobject /* obj */, jlong rawStream) {
@@ -178,6 +313,14 @@ Java_com_rejeq_cpcam_core_stream_jni_FFmpegVideoStreamJni_start(
     stream->start();
 }
 
+JNIEXPORT void JNICALL
+Java_com_rejeq_cpcam_core_stream_jni_FFmpegVideoStreamJni_requestKeyframe(
+    JNIEnv * /* env */, jobject /* obj */, jlong rawStream) {
+    auto *stream = (FFmpegVideoStream *)rawStream;
+
+    stream->request_keyframe();
+}
+
 JNIEXPORT void JNICALL
 Java_com_rejeq_cpcam_core_stream_jni_FFmpegVideoStreamJni_stop(
     JNIEnv * /* env */, jobject /* obj */, jlong rawStream) {
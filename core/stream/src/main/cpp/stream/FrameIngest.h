@@ -0,0 +1,216 @@
+#pragma once
+
+#include <cstdint>
+
+#include "PixFmt.h"
+#include "stream/FrameData.h"
+
+// Compile-time description of how FrameData planes are laid out for every
+// supported PixFmt. Source planes are the planes of android Image in their
+// original order (Y, U, V for YUV_420_888). Interleaved chroma also tells
+// whether V comes first.
+template <PixFmt F>
+struct PixFmtTraits;
+
+template <>
+struct PixFmtTraits<PixFmt::YUV420P> {
+    static constexpr bool has_luma = true;
+    static constexpr int plane_count = 3;
+    static constexpr int log2_chroma_w = 1;
+    static constexpr int log2_chroma_h = 1;
+    static constexpr bool interleaved_chroma = false;
+    static constexpr int source_plane[] = {0, 1, 2};
+};
+
+template <>
+struct PixFmtTraits<PixFmt::YUV444P> {
+    static constexpr bool has_luma = true;
+    static constexpr int plane_count = 3;
+    static constexpr int log2_chroma_w = 0;
+    static constexpr int log2_chroma_h = 0;
+    static constexpr bool interleaved_chroma = false;
+    static constexpr int source_plane[] = {0, 1, 2};
+};
+
+template <>
+struct PixFmtTraits<PixFmt::NV12> {
+    static constexpr bool has_luma = true;
+    static constexpr int plane_count = 2;
+    static constexpr int log2_chroma_w = 1;
+    static constexpr int log2_chroma_h = 1;
+    static constexpr bool interleaved_chroma = true;
+    static constexpr bool is_v_first = false;
+    // Interleaved UV plane starts at U
+    static constexpr int source_plane[] = {0, 1};
+};
+
+template <>
+struct PixFmtTraits<PixFmt::NV21> {
+    static constexpr bool has_luma = true;
+    static constexpr int plane_count = 2;
+    static constexpr int log2_chroma_w = 1;
+    static constexpr int log2_chroma_h = 1;
+    static constexpr bool interleaved_chroma = true;
+    static constexpr bool is_v_first = true;
+    // Interleaved VU plane starts at V, so it must be taken from third plane
+    static constexpr int source_plane[] = {0, 2};
+};
+
+template <>
+struct PixFmtTraits<PixFmt::RGBA> {
+    static constexpr bool has_luma = false;
+    static constexpr int plane_count = 1;
+    static constexpr int log2_chroma_w = 0;
+    static constexpr int log2_chroma_h = 0;
+    static constexpr bool interleaved_chroma = false;
+    static constexpr int source_plane[] = {0};
+};
+
+template <>
+struct PixFmtTraits<PixFmt::RGB24> {
+    static constexpr bool has_luma = false;
+    static constexpr int plane_count = 1;
+    static constexpr int log2_chroma_w = 0;
+    static constexpr int log2_chroma_h = 0;
+    static constexpr bool interleaved_chroma = false;
+    static constexpr int source_plane[] = {0};
+};
+
+// Copies plane pointers of already reordered FrameData into the frame arrays
+using MapPlanesFn = void (*)(const FrameData &data, uint8_t **dst,
+                             int *dst_stride);
+
+template <PixFmt F>
+inline void map_planes(const FrameData &data, uint8_t **dst, int *dst_stride) {
+    static_assert(PixFmtTraits<F>::plane_count <= 4);
+
+    for (int i = 0; i < PixFmtTraits<F>::plane_count; i++) {
+        dst[i] = data.buff[i];
+        dst_stride[i] = data.buff_stride[i];
+    }
+}
+
+// Stores source planes into FrameData in the order required by PixFmt.
+// Source arrays must contain at least PixFmtTraits<F>::source_plane + 1
+// elements.
+using ReorderPlanesFn = void (*)(uint8_t *const *src, const int32_t *src_stride,
+                                 FrameData &data);
+
+template <PixFmt F>
+inline void reorder_planes(uint8_t *const *src, const int32_t *src_stride,
+                           FrameData &data) {
+    for (int i = 0; i < PixFmtTraits<F>::plane_count; i++) {
+        int idx = PixFmtTraits<F>::source_plane[i];
+
+        data.buff[i] = src[idx];
+        data.buff_stride[i] = src_stride[idx];
+    }
+}
+
+template <PixFmt F>
+constexpr int max_source_plane() {
+    int out = 0;
+    for (int idx : PixFmtTraits<F>::source_plane) {
+        out = idx > out ? idx : out;
+    }
+
+    return out;
+}
+
+// One chroma component of the mapped frame
+struct ChromaSource {
+    int plane = 0;
+    // Distance between samples in bytes
+    int step = 0;
+    // Offset of the first sample in bytes
+    int offset = 0;
+};
+
+// Where U and V samples are in the mapped frame, for kernels that read
+// chroma directly. Empty for formats without luma.
+struct ChromaLayout {
+    ChromaSource u;
+    ChromaSource v;
+    int log2_chroma_w = 0;
+    int log2_chroma_h = 0;
+};
+
+template <PixFmt F>
+constexpr ChromaLayout make_chroma_layout() {
+    using Traits = PixFmtTraits<F>;
+    if constexpr (!Traits::has_luma) {
+        return ChromaLayout{};
+    } else if constexpr (Traits::interleaved_chroma) {
+        int u_offset = Traits::is_v_first ? 1 : 0;
+        return ChromaLayout{
+            .u = {.plane = 1, .step = 2, .offset = u_offset},
+            .v = {.plane = 1, .step = 2, .offset = 1 - u_offset},
+            .log2_chroma_w = Traits::log2_chroma_w,
+            .log2_chroma_h = Traits::log2_chroma_h,
+        };
+    } else {
+        return ChromaLayout{
+            .u = {.plane = 1, .step = 1, .offset = 0},
+            .v = {.plane = 2, .step = 1, .offset = 0},
+            .log2_chroma_w = Traits::log2_chroma_w,
+            .log2_chroma_h = Traits::log2_chroma_h,
+        };
+    }
+}
+
+// Per-format entry points, selected once when the pixel format becomes known
+struct FrameIngestOps {
+    PixFmt pix_fmt;
+    int plane_count;
+    // Amount of source planes that must be read to fill FrameData
+    int source_plane_count;
+    // First plane is luma (Y)
+    bool has_luma;
+    ChromaLayout chroma;
+
+    MapPlanesFn map_planes;
+    ReorderPlanesFn reorder_planes;
+};
+
+template <PixFmt F>
+constexpr FrameIngestOps make_frame_ingest_ops() {
+    return FrameIngestOps{
+        .pix_fmt = F,
+        .plane_count = PixFmtTraits<F>::plane_count,
+        .source_plane_count = max_source_plane<F>() + 1,
+        .has_luma = PixFmtTraits<F>::has_luma,
+        .chroma = make_chroma_layout<F>(),
+        .map_planes = map_planes<F>,
+        .reorder_planes = reorder_planes<F>,
+    };
+}
+
+// Returns nullptr for PixFmt::Unknown
+inline const FrameIngestOps *get_frame_ingest_ops(PixFmt pix_fmt) {
+    static constexpr FrameIngestOps OPS[] = {
+        make_frame_ingest_ops<PixFmt::YUV420P>(),
+        make_frame_ingest_ops<PixFmt::YUV444P>(),
+        make_frame_ingest_ops<PixFmt::NV12>(),
+        make_frame_ingest_ops<PixFmt::NV21>(),
+        make_frame_ingest_ops<PixFmt::RGBA>(),
+        make_frame_ingest_ops<PixFmt::RGB24>(),
+    };
+
+    static_assert(
+        [] {
+            for (int i = 0; i < (int)(sizeof(OPS) / sizeof(*OPS)); i++) {
+                if ((int)OPS[i].pix_fmt != i) {
+                    return false;
+                }
+            }
+            return true;
+        }(),
+        "Ingest ops must be ordered by PixFmt");
+
+    int idx = (int)pix_fmt;
+    if (idx < 0 || idx >= (int)(sizeof(OPS) / sizeof(*OPS))) {
+        return nullptr;
+    }
+
+    return &OPS[idx];
+}
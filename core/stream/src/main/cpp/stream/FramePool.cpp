@@ -0,0 +1,68 @@
+#include "FramePool.h"
+
+#include "FFmpegUtils.h"
+#include "MemoryBudget.h"
+
+#define LOG_TAG "FramePool"
+#include "Log.h"
+
+FramePool::~FramePool() { av_buffer_pool_uninit(&m_pool); }
+
+bool FramePool::get(AVFrame *frame, int width, int height,
+                    AVPixelFormat format) {
+    av_frame_unref(frame);
+
+    // Idle buffers are accounted, so they are given back once pressure is
+    // reached. Buffers that are still in use are freed when released.
+    bool is_pressure = MemoryBudget::pressure() != MemoryPressure::None;
+    bool need_trim = is_pressure && !m_is_trimmed;
+    m_is_trimmed = is_pressure;
+
+    if (!m_pool || m_width != width || m_height != height ||
+        m_format != format || need_trim) {
+        if (!reset(width, height, format)) {
+            return false;
+        }
+    }
+
+    AVBufferRef *buf = av_buffer_pool_get(m_pool);
+    if (!buf) {
+        // Refusal is already reported by the budget
+        if (MemoryBudget::pressure() != MemoryPressure::Hard) {
+            LOG_ERROR("Unable to get frame buffer");
+        }
+        return false;
+    }
+
+    if (!attach_frame_buffer(frame, buf, width, height, format)) {
+        av_buffer_unref(&buf);
+        return false;
+    }
+
+    return true;
+}
+
+bool FramePool::reset(int width, int height, AVPixelFormat format) {
+    av_buffer_pool_uninit(&m_pool);
+
+    int size = frame_buffer_size(width, height, format);
+    if (size < 0) {
+        LOG_ERROR("Invalid frame geometry: (%d, %d), format: %d", width,
+                  height, format);
+        return false;
+    }
+
+    LOG_DEBUG("Creating frame pool with size: (%d, %d), bytes: %d", width,
+              height, size);
+
+    m_pool = av_buffer_pool_init(size, budget_buffer_alloc);
+    if (!m_pool) {
+        LOG_ERROR("Unable to create frame pool");
+        return false;
+    }
+
+    m_width = width;
+    m_height = height;
+    m_format = format;
+    return true;
+}
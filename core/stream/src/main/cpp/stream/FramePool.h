@@ -0,0 +1,37 @@
+#pragma once
+
+extern "C" {
+#include <libavutil/buffer.h>
+#include <libavutil/frame.h>
+#include <libavutil/pixfmt.h>
+}
+
+// Recycles picture buffers of the frames sent to the encoder. Encoder keeps
+// reference to the input until it's encoded, so without pool every frame
+// costs a picture sized allocation. Buffers are accounted in MemoryBudget
+// as long as the pool holds them.
+class FramePool {
+   public:
+    FramePool() = default;
+    ~FramePool();
+
+    FramePool(const FramePool &) = delete;
+    FramePool &operator=(const FramePool &) = delete;
+
+    // Unreferences frame and attaches pooled buffer of the given geometry.
+    // Pool is recreated when geometry changes, buffers that are still in use
+    // are freed when released. Returns false on failure.
+    bool get(AVFrame *frame, int width, int height, AVPixelFormat format);
+
+   private:
+    bool reset(int width, int height, AVPixelFormat format);
+
+    AVBufferPool *m_pool = nullptr;
+
+    int m_width = 0;
+    int m_height = 0;
+    AVPixelFormat m_format = AV_PIX_FMT_NONE;
+
+    // Pool was recreated since memory pressure was reached
+    bool m_is_trimmed = false;
+};
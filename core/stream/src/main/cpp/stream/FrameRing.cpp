@@ -0,0 +1,158 @@
+#include "FrameRing.h"
+
+extern "C" {
+#include <libavutil/frame.h>
+}
+
+#include "FFmpegUtils.h"
+#include "MemoryBudget.h"
+
+#define LOG_TAG "FrameRing"
+#include "Log.h"
+
+FrameRing::FrameRing(AVBufferRef **buffers, int slot_count, int width,
+                     int height, PixFmt pix_fmt)
+    : m_slot_count(slot_count),
+      m_width(width),
+      m_height(height),
+      m_pix_fmt(pix_fmt) {
+    for (int i = 0; i < slot_count; i++) {
+        m_buffers[i] = buffers[i];
+    }
+}
+
+FrameRing::~FrameRing() {
+    // Buffers that are still referenced by the encoder are freed with the
+    // last reference
+    for (int i = 0; i < m_slot_count; i++) {
+        av_buffer_unref(&m_buffers[i]);
+    }
+}
+
+FrameRing *FrameRing::build(int slot_count, int width, int height,
+                            PixFmt pix_fmt) {
+    if (slot_count < 1 || slot_count > MAX_SLOTS) {
+        LOG_ERROR("Invalid slot count: %d", slot_count);
+        return nullptr;
+    }
+
+    if (pix_fmt == PixFmt::Unknown) {
+        LOG_ERROR("Unknown pixel format");
+        return nullptr;
+    }
+
+    AVPixelFormat format = to_av_pix_fmt(pix_fmt);
+    int size = frame_buffer_size(width, height, format);
+    if (width <= 0 || height <= 0 || size < 0) {
+        LOG_ERROR("Invalid frame geometry: (%d, %d)", width, height);
+        return nullptr;
+    }
+
+    AVBufferRef *buffers[MAX_SLOTS] = {};
+    for (int i = 0; i < slot_count; i++) {
+        buffers[i] = budget_buffer_alloc(size);
+        if (!buffers[i]) {
+            LOG_ERROR("Unable to allocate %d slots of %d bytes", slot_count,
+                      size);
+            for (int j = 0; j < i; j++) {
+                av_buffer_unref(&buffers[j]);
+            }
+            return nullptr;
+        }
+    }
+
+    // Planes are laid out exactly as in pooled encoder frames
+    AVFrame *layout = av_frame_alloc();
+    AVBufferRef *layout_buf = av_buffer_ref(buffers[0]);
+    if (!layout || !layout_buf ||
+        !attach_frame_buffer(layout, layout_buf, width, height, format)) {
+        LOG_ERROR("Unable to compute plane layout");
+        av_buffer_unref(&layout_buf);
+        av_frame_free(&layout);
+        for (int i = 0; i < slot_count; i++) {
+            av_buffer_unref(&buffers[i]);
+        }
+        return nullptr;
+    }
+
+    auto *ring = new FrameRing(buffers, slot_count, width, height, pix_fmt);
+    ring->m_buffer_size = size;
+    for (int i = 0; i < 4 && layout->data[i]; i++) {
+        ring->m_offsets[i] = (int)(layout->data[i] - buffers[0]->data);
+        ring->m_strides[i] = layout->linesize[i];
+        ring->m_plane_count = i + 1;
+    }
+
+    av_frame_free(&layout);
+
+    LOG_INFO("Created %d slots with size: (%d, %d), bytes: %d", slot_count,
+             width, height, size);
+    return ring;
+}
+
+int FrameRing::acquire() {
+    for (int i = 0; i < m_slot_count; i++) {
+        int index = (m_next_slot + i) % m_slot_count;
+
+        int state = m_states[index].load();
+        bool is_released = av_buffer_get_ref_count(m_buffers[index]) == 1;
+        if (state == Sent && is_released) {
+            state = Free;
+            m_states[index] = Free;
+        }
+
+        if (state == Free) {
+            m_states[index] = Writing;
+            m_next_slot = (index + 1) % m_slot_count;
+            return index;
+        }
+    }
+
+    LOG_TRACE("All slots are in use");
+    return -1;
+}
+
+void FrameRing::cancel(int index) {
+    if (index >= 0 && index < m_slot_count && m_states[index] == Writing) {
+        m_states[index] = Free;
+    }
+}
+
+bool FrameRing::commit(int index) {
+    if (index < 0 || index >= m_slot_count || m_states[index] != Writing) {
+        LOG_ERROR("Slot %d wasn't acquired", index);
+        return false;
+    }
+
+    m_states[index] = Sent;
+    return true;
+}
+
+FrameData FrameRing::frame_data(int index, int64_t ts) const {
+    FrameData data = {
+        .ts = ts,
+        .width = m_width,
+        .height = m_height,
+        .buff = {},
+        .buff_stride = {},
+    };
+
+    for (int i = 0; i < m_plane_count; i++) {
+        data.buff[i] = plane_data(index, i);
+        data.buff_stride[i] = m_strides[i];
+    }
+
+    return data;
+}
+
+uint8_t *FrameRing::plane_data(int index, int plane) const {
+    return m_buffers[index]->data + m_offsets[plane];
+}
+
+int FrameRing::plane_size(int plane) const {
+    if (plane + 1 < m_plane_count) {
+        return m_offsets[plane + 1] - m_offsets[plane];
+    }
+
+    return m_buffer_size - m_offsets[plane];
+}
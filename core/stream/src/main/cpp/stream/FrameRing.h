@@ -0,0 +1,89 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+extern "C" {
+#include <libavutil/buffer.h>
+#include <libavutil/pixfmt.h>
+}
+
+#include "PixFmt.h"
+#include "stream/FrameData.h"
+
+// Native-owned frame slots for producers other than the camera (e.g. GL
+// readback or frames generated in kotlin).
+//
+// Slot storage is allocated once and exposed to the producer as direct
+// buffers, one per plane. Producer acquires a slot, writes the picture and
+// commits the slot by index. Stream sends committed slot to the encoder
+// without copying when no conversion is required, and the slot becomes
+// free again once the encoder drops its reference.
+//
+// Acquire and commit must be called from a single producer thread.
+class FrameRing {
+   public:
+    FrameRing(AVBufferRef **buffers, int slot_count, int width, int height,
+              PixFmt pix_fmt);
+    ~FrameRing();
+
+    FrameRing(const FrameRing &) = delete;
+    FrameRing &operator=(const FrameRing &) = delete;
+
+    static constexpr int MAX_SLOTS = 16;
+
+    // Slot buffers are accounted in MemoryBudget, returns nullptr on
+    // failure
+    static FrameRing *build(int slot_count, int width, int height,
+                            PixFmt pix_fmt);
+
+    // Returns index of a slot that can be written or -1 when all slots are
+    // written or still referenced by the encoder
+    int acquire();
+
+    // Returns slot to the ring without sending it
+    void cancel(int index);
+
+    // Marks written slot as sent, returns false when slot wasn't acquired.
+    // Buffer is still valid for the caller until it drops its reference.
+    bool commit(int index);
+
+    // Planes of the slot in the order of pix_fmt
+    FrameData frame_data(int index, int64_t ts) const;
+
+    // Whole picture buffer of the slot, owned by the ring
+    AVBufferRef *buffer(int index) const { return m_buffers[index]; }
+
+    uint8_t *plane_data(int index, int plane) const;
+    int plane_size(int plane) const;
+
+    int slot_count() const { return m_slot_count; }
+    int plane_count() const { return m_plane_count; }
+    int plane_stride(int plane) const { return m_strides[plane]; }
+
+    int width() const { return m_width; }
+    int height() const { return m_height; }
+    PixFmt pix_fmt() const { return m_pix_fmt; }
+
+   private:
+    enum SlotState : int {
+        Free,
+        Writing,
+        // Sent to the stream, free once the encoder drops its reference
+        Sent,
+    };
+
+    AVBufferRef *m_buffers[MAX_SLOTS] = {};
+    std::atomic<int> m_states[MAX_SLOTS] = {};
+    int m_slot_count;
+    int m_next_slot = 0;
+
+    int m_width;
+    int m_height;
+    PixFmt m_pix_fmt;
+
+    int m_plane_count = 0;
+    int m_offsets[4] = {};
+    int m_strides[4] = {};
+    int m_buffer_size = 0;
+};
@@ -0,0 +1,110 @@
+#include <jni.h>
+
+#include "stream/FFmpegVideoStream.h"
+#include "stream/FrameRing.h"
+
+#define LOG_TAG "FrameRingJni"
+#include "Log.h"
+
+extern "C" {
+
+JNIEXPORT jlong JNICALL
+Java_com_rejeq_cpcam_core_stream_jni_FFmpegFrameRingJniKt_nCreateFrameRing(
+    JNIEnv * /* env */, jclass /* clazz */, jint slotCount, jint width,
+    jint height, jint format) {
+    if (format < (int)PixFmt::YUV420P || format > (int)PixFmt::RGB24) {
+        LOG_ERROR("Unknown pixel format: %d", format);
+        return 0;
+    }
+
+    return (jlong)FrameRing::build(slotCount, width, height, (PixFmt)format);
+}
+
+JNIEXPORT void JNICALL
+Java_com_rejeq_cpcam_core_stream_jni_FFmpegFrameRingJni_destroy(
+    JNIEnv * /* env */, jobject /* obj */, jlong rawRing) {
+    auto *ring = (FrameRing *)rawRing;
+
+    delete ring;
+}
+
+JNIEXPORT jobjectArray JNICALL
+Java_com_rejeq_cpcam_core_stream_jni_FFmpegFrameRingJni_getPlanes(
+    JNIEnv *env, jobject /* obj */, jlong rawRing, jint slot) {
+    auto *ring = (FrameRing *)rawRing;
+    if (slot < 0 || slot >= ring->slot_count()) {
+        LOG_ERROR("Invalid slot: %d", slot);
+        return nullptr;
+    }
+
+    jclass buffer_class = env->FindClass("java/nio/ByteBuffer");
+    if (buffer_class == nullptr) {
+        return nullptr;
+    }
+
+    jobjectArray planes =
+        env->NewObjectArray(ring->plane_count(), buffer_class, nullptr);
+    if (planes == nullptr) {
+        return nullptr;
+    }
+
+    for (int i = 0; i < ring->plane_count(); i++) {
+        jobject buffer = env->NewDirectByteBuffer(ring->plane_data(slot, i),
+                                                  ring->plane_size(i));
+        if (buffer == nullptr) {
+            LOG_ERROR("Unable to create buffer of plane %d", i);
+            return nullptr;
+        }
+
+        env->SetObjectArrayElement(planes, i, buffer);
+        env->DeleteLocalRef(buffer);
+    }
+
+    return planes;
+}
+
+JNIEXPORT jintArray JNICALL
+Java_com_rejeq_cpcam_core_stream_jni_FFmpegFrameRingJni_getStrides(
+    JNIEnv *env, jobject /* obj */, jlong rawRing) {
+    auto *ring = (FrameRing *)rawRing;
+
+    jint strides[4] = {};
+    for (int i = 0; i < ring->plane_count(); i++) {
+        strides[i] = ring->plane_stride(i);
+    }
+
+    jintArray out = env->NewIntArray(ring->plane_count());
+    if (out == nullptr) {
+        return nullptr;
+    }
+
+    env->SetIntArrayRegion(out, 0, ring->plane_count(), strides);
+    return out;
+}
+
+JNIEXPORT jint JNICALL
+Java_com_rejeq_cpcam_core_stream_jni_FFmpegFrameRingJni_acquire(
+    JNIEnv * /* env */, jobject /* obj */, jlong rawRing) {
+    auto *ring = (FrameRing *)rawRing;
+
+    return ring->acquire();
+}
+
+JNIEXPORT void JNICALL
+Java_com_rejeq_cpcam_core_stream_jni_FFmpegFrameRingJni_cancel(
+    JNIEnv * /* env */, jobject /* obj */, jlong rawRing, jint slot) {
+    auto *ring = (FrameRing *)rawRing;
+
+    ring->cancel(slot);
+}
+
+JNIEXPORT void JNICALL
+Java_com_rejeq_cpcam_core_stream_jni_FFmpegFrameRingJni_commit(
+    JNIEnv * /* env */, jobject /* obj */, jlong rawRing, jlong rawStream,
+    jint slot, jlong ts) {
+    auto *ring = (FrameRing *)rawRing;
+    auto *stream = (FFmpegVideoStream *)rawStream;
+
+    stream->send_ring_frame(ring, slot, ts);
+}
+}
@@ -0,0 +1,116 @@
+#include "LatencyEmbed.h"
+
+#include <cstring>
+
+#define LOG_TAG "LatencyEmbed"
+#include "Log.h"
+
+// Start code + NAL header (up to 2 bytes) + payload type + payload size +
+// stamp + rbsp trailing bits
+constexpr int MAX_SEI_SIZE = 4 + 2 + 1 + 1 + LATENCY_STAMP_SIZE + 1;
+// Marker + length + stamp
+constexpr int COM_SEGMENT_SIZE = 2 + 2 + LATENCY_STAMP_SIZE;
+
+constexpr uint8_t SEI_USER_DATA_UNREGISTERED = 5;
+
+static_assert(LATENCY_STAMP_SIZE < 255, "SEI payload size must fit in a byte");
+
+bool is_latency_stamp_supported(AVCodecID codec_id) {
+    return codec_id == AV_CODEC_ID_H264 || codec_id == AV_CODEC_ID_HEVC ||
+           codec_id == AV_CODEC_ID_MJPEG;
+}
+
+// Returns offset of the start code of the first VCL NAL unit or -1
+static int find_first_vcl(AVCodecID codec_id, const uint8_t *data, int size) {
+    for (int i = 0; i + 3 < size; i++) {
+        if (data[i] != 0 || data[i + 1] != 0 || data[i + 2] != 1) {
+            continue;
+        }
+
+        uint8_t header = data[i + 3];
+        bool is_vcl = codec_id == AV_CODEC_ID_H264
+                          ? (header & 0x1f) >= 1 && (header & 0x1f) <= 5
+                          : ((header >> 1) & 0x3f) < 32;
+
+        if (is_vcl) {
+            // Include leading zero of 4-byte start code
+            return (i > 0 && data[i - 1] == 0) ? i - 1 : i;
+        }
+
+        i += 2;
+    }
+
+    return -1;
+}
+
+static int make_sei(AVCodecID codec_id, const LatencyStamp &stamp,
+                    uint8_t *out) {
+    int pos = 0;
+    out[pos++] = 0;
+    out[pos++] = 0;
+    out[pos++] = 0;
+    out[pos++] = 1;
+
+    if (codec_id == AV_CODEC_ID_H264) {
+        out[pos++] = 6;  // nal_unit_type: SEI
+    } else {
+        out[pos++] = 39 << 1;  // nal_unit_type: PREFIX_SEI
+        out[pos++] = 1;        // nuh_temporal_id_plus1
+    }
+
+    out[pos++] = SEI_USER_DATA_UNREGISTERED;
+    out[pos++] = LATENCY_STAMP_SIZE;
+
+    write_latency_stamp(stamp, out + pos);
+    pos += LATENCY_STAMP_SIZE;
+
+    out[pos++] = 0x80;  // rbsp_trailing_bits
+    return pos;
+}
+
+static bool insert_bytes(AVPacket *pkt, int offset, const uint8_t *data,
+                         int size) {
+    int old_size = pkt->size;
+    if (av_grow_packet(pkt, size) < 0) {
+        LOG_ERROR("Unable to grow packet");
+        return false;
+    }
+
+    memmove(pkt->data + offset + size, pkt->data + offset, old_size - offset);
+    memcpy(pkt->data + offset, data, size);
+    return true;
+}
+
+bool embed_latency_stamp(AVCodecID codec_id, AVPacket *pkt,
+                         const LatencyStamp &stamp) {
+    if (codec_id == AV_CODEC_ID_MJPEG) {
+        // Comment segment right after SOI marker
+        if (pkt->size < 2 || pkt->data[0] != 0xff || pkt->data[1] != 0xd8) {
+            return false;
+        }
+
+        uint8_t segment[COM_SEGMENT_SIZE];
+        segment[0] = 0xff;
+        segment[1] = 0xfe;
+        segment[2] = (COM_SEGMENT_SIZE - 2) >> 8;
+        segment[3] = (COM_SEGMENT_SIZE - 2) & 0xff;
+        write_latency_stamp(stamp, segment + 4);
+
+        return insert_bytes(pkt, 2, segment, sizeof(segment));
+    }
+
+    if (codec_id != AV_CODEC_ID_H264 && codec_id != AV_CODEC_ID_HEVC) {
+        return false;
+    }
+
+    // SEI must precede the first slice of the access unit
+    int offset = find_first_vcl(codec_id, pkt->data, pkt->size);
+    if (offset < 0) {
+        return false;
+    }
+
+    uint8_t sei[MAX_SEI_SIZE];
+    int sei_size = make_sei(codec_id, stamp, sei);
+
+    return insert_bytes(pkt, offset, sei, sei_size);
+}
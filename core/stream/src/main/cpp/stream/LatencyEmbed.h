@@ -0,0 +1,16 @@
+#pragma once
+
+extern "C" {
+#include <libavcodec/codec_id.h>
+#include <libavcodec/packet.h>
+}
+
+#include "stream/LatencyStamp.h"
+
+bool is_latency_stamp_supported(AVCodecID codec_id);
+
+// Inserts stamp into encoded packet: as user data unregistered SEI for
+// H.264/HEVC (Annex B packets) and as comment segment for MJPEG. Returns false
+// when stamp can't be inserted, packet is left untouched in this case.
+bool embed_latency_stamp(AVCodecID codec_id, AVPacket *pkt,
+                         const LatencyStamp &stamp);
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+// Capture and per-stage timestamps of a single frame, embedded into encoded
+// stream, so latency can be measured on the receiving side.
+//
+// NOTE: Shared with host tools, so it must not depend on ffmpeg or android.
+
+struct LatencyStamp {
+    // Raw FrameData::ts
+    int64_t capture_ts;
+
+    // CLOCK_REALTIME in nanoseconds. Capture time is estimated from the
+    // capture timestamp age at ingest.
+    int64_t capture_wall_ns;
+    int64_t ingest_wall_ns;
+    int64_t encoded_wall_ns;
+};
+
+// Identifies stamp in SEI user data or JPEG comment, also used as version
+constexpr uint8_t LATENCY_STAMP_UUID[16] = {
+    'c', 'p', 'c', 'a', 'm', '-', 'l', 'a',
+    't', 'e', 'n', 'c', 'y', '-', 'v', '1',
+};
+
+constexpr int LATENCY_STAMP_FIELD_COUNT = 4;
+// Values are stored as hex text, so payload never contains zero bytes and
+// doesn't need emulation prevention
+constexpr int LATENCY_STAMP_VALUES_SIZE = LATENCY_STAMP_FIELD_COUNT * 16;
+constexpr int LATENCY_STAMP_SIZE =
+    sizeof(LATENCY_STAMP_UUID) + LATENCY_STAMP_VALUES_SIZE;
+
+// out must have at least LATENCY_STAMP_SIZE bytes
+inline void write_latency_stamp(const LatencyStamp &stamp, uint8_t *out) {
+    const int64_t values[LATENCY_STAMP_FIELD_COUNT] = {
+        stamp.capture_ts,
+        stamp.capture_wall_ns,
+        stamp.ingest_wall_ns,
+        stamp.encoded_wall_ns,
+    };
+
+    memcpy(out, LATENCY_STAMP_UUID, sizeof(LATENCY_STAMP_UUID));
+    out += sizeof(LATENCY_STAMP_UUID);
+
+    char hex[17];
+    for (int64_t value : values) {
+        snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)value);
+        memcpy(out, hex, 16);
+        out += 16;
+    }
+}
+
+// data points right after the uuid and must have at least
+// LATENCY_STAMP_VALUES_SIZE bytes
+inline bool read_latency_stamp(const uint8_t *data, LatencyStamp &out) {
+    int64_t values[LATENCY_STAMP_FIELD_COUNT];
+
+    for (int i = 0; i < LATENCY_STAMP_FIELD_COUNT; i++) {
+        uint64_t value = 0;
+        for (int j = 0; j < 16; j++) {
+            uint8_t c = data[i * 16 + j];
+            int digit = 0;
+            if (c >= '0' && c <= '9') {
+                digit = c - '0';
+            } else if (c >= 'a' && c <= 'f') {
+                digit = c - 'a' + 10;
+            } else {
+                return false;
+            }
+
+            value = (value << 4) | digit;
+        }
+
+        values[i] = (int64_t)value;
+    }
+
+    out = LatencyStamp{
+        .capture_ts = values[0],
+        .capture_wall_ns = values[1],
+        .ingest_wall_ns = values[2],
+        .encoded_wall_ns = values[3],
+    };
+    return true;
+}
@@ -0,0 +1,264 @@
+#include "ParallelEncoder.h"
+
+#include <chrono>
+
+extern "C" {
+#include <libavutil/time.h>
+}
+
+#include "FFmpegUtils.h"
+
+#define LOG_TAG "ParallelEncoder"
+#include "Log.h"
+
+// Lets workers pick up next frames while the oldest packet is waiting to be
+// received
+constexpr int SLOTS_PER_WORKER = 2;
+
+ParallelEncoder::ParallelEncoder(EngineGroup *group,
+                                 std::vector<AVCodecContext *> contexts,
+                                 std::vector<AVFrame *> frames,
+                                 std::vector<AVPacket *> packets,
+                                 int64_t frame_interval_us)
+    : m_group(group),
+      m_contexts(std::move(contexts)),
+      m_frame_interval_us(frame_interval_us) {
+    m_slots.resize(frames.size());
+    for (size_t i = 0; i < m_slots.size(); i++) {
+        m_slots[i].frame = frames[i];
+        m_slots[i].packet = packets[i];
+    }
+
+    m_free_contexts = m_contexts;
+}
+
+ParallelEncoder::~ParallelEncoder() {
+    {
+        // Queued frames are never submitted after this, submitted ones must
+        // finish before their contexts are freed
+        std::unique_lock<std::mutex> lock(m_lock);
+        m_is_stopping = true;
+        m_done_cond.wait(lock, [&]() {
+            return m_free_contexts.size() == m_contexts.size();
+        });
+    }
+
+    for (Slot &slot : m_slots) {
+        av_frame_free(&slot.frame);
+        av_packet_free(&slot.packet);
+    }
+
+    for (AVCodecContext *cctx : m_contexts) {
+        avcodec_free_context(&cctx);
+    }
+}
+
+bool ParallelEncoder::is_supported(const AVCodec *codec) {
+    const AVCodecDescriptor *desc = avcodec_descriptor_get(codec->id);
+    if (!desc || !(desc->props & AV_CODEC_PROP_INTRA_ONLY)) {
+        return false;
+    }
+
+    return !(codec->capabilities & AV_CODEC_CAP_DELAY);
+}
+
+ParallelEncoder *ParallelEncoder::build(EngineGroup *group,
+                                        const VideoConfig &config, int flags,
+                                        int worker_count) {
+    if (worker_count < 1 || worker_count > MAX_WORKERS) {
+        LOG_ERROR("Invalid worker count: %d", worker_count);
+        return nullptr;
+    }
+
+    std::vector<AVCodecContext *> contexts;
+    std::vector<AVFrame *> frames;
+    std::vector<AVPacket *> packets;
+
+    auto cleanup = [&]() {
+        for (AVCodecContext *cctx : contexts) {
+            avcodec_free_context(&cctx);
+        }
+        for (AVFrame *frame : frames) {
+            av_frame_free(&frame);
+        }
+        for (AVPacket *packet : packets) {
+            av_packet_free(&packet);
+        }
+    };
+
+    for (int i = 0; i < worker_count; i++) {
+        AVCodecContext *cctx = make_encoder(config, flags);
+        if (!cctx) {
+            cleanup();
+            return nullptr;
+        }
+
+        contexts.push_back(cctx);
+    }
+
+    if (!is_supported(contexts[0]->codec)) {
+        LOG_ERROR("Encoder '%s' can't encode frames independently",
+                  contexts[0]->codec->name);
+        cleanup();
+        return nullptr;
+    }
+
+    for (int i = 0; i < worker_count * SLOTS_PER_WORKER; i++) {
+        AVFrame *frame = av_frame_alloc();
+        AVPacket *packet = av_packet_alloc();
+        if (frame) {
+            frames.push_back(frame);
+        }
+        if (packet) {
+            packets.push_back(packet);
+        }
+
+        if (!frame || !packet) {
+            LOG_ERROR("Unable to allocate slot");
+            cleanup();
+            return nullptr;
+        }
+    }
+
+    int64_t frame_interval_us =
+        config.framerate > 0 ? 1'000'000 / config.framerate : 0;
+
+    LOG_INFO("Using %d '%s' encoders on %d engine workers", worker_count,
+             config.codec_name.c_str(), NativeEngine::worker_count());
+    return new ParallelEncoder(group, std::move(contexts), std::move(frames),
+                               std::move(packets), frame_interval_us);
+}
+
+int ParallelEncoder::send_frame(const AVFrame *frame) {
+    std::unique_lock<std::mutex> lock(m_lock);
+    Slot &slot = slot_at(m_next_submit);
+
+    m_done_cond.wait(lock, [&]() {
+        return slot.state == SlotState::Free || slot.state == SlotState::Done;
+    });
+
+    if (slot.state == SlotState::Done) {
+        return AVERROR(EAGAIN);
+    }
+
+    int res = av_frame_ref(slot.frame, frame);
+    if (res < 0) {
+        return res;
+    }
+
+    slot.state = SlotState::Queued;
+    m_next_submit++;
+
+    schedule();
+    return 0;
+}
+
+int ParallelEncoder::receive_packet(AVPacket *pkt, int64_t deadline_us) {
+    std::unique_lock<std::mutex> lock(m_lock);
+    if (m_next_receive == m_next_submit) {
+        return AVERROR_EOF;
+    }
+
+    Slot &slot = slot_at(m_next_receive);
+    while (slot.state != SlotState::Done) {
+        int64_t wait_us = deadline_us - av_gettime_relative();
+        if (wait_us <= 0) {
+            return AVERROR(EAGAIN);
+        }
+
+        m_done_cond.wait_for(lock, std::chrono::microseconds(wait_us));
+    }
+
+    int res = slot.result;
+    if (res >= 0) {
+        av_packet_move_ref(pkt, slot.packet);
+    }
+
+    av_packet_unref(slot.packet);
+    slot.state = SlotState::Free;
+    m_next_receive++;
+
+    lock.unlock();
+    m_done_cond.notify_all();
+    return res;
+}
+
+void ParallelEncoder::flush() {
+    std::unique_lock<std::mutex> lock(m_lock);
+
+    // Queued frames are dropped before workers take them
+    for (uint64_t seq = m_next_job; seq < m_next_submit; seq++) {
+        Slot &slot = slot_at(seq);
+        av_frame_unref(slot.frame);
+        slot.state = SlotState::Free;
+    }
+    m_next_submit = m_next_job;
+
+    m_done_cond.wait(lock, [&]() {
+        for (const Slot &slot : m_slots) {
+            if (slot.state == SlotState::Encoding) {
+                return false;
+            }
+        }
+        return true;
+    });
+
+    for (Slot &slot : m_slots) {
+        av_packet_unref(slot.packet);
+        slot.state = SlotState::Free;
+    }
+    m_next_receive = m_next_submit;
+
+    lock.unlock();
+    m_done_cond.notify_all();
+}
+
+void ParallelEncoder::schedule() {
+    while (!m_is_stopping && !m_free_contexts.empty() &&
+           m_next_job < m_next_submit) {
+        AVCodecContext *cctx = m_free_contexts.back();
+        m_free_contexts.pop_back();
+
+        Slot &slot = slot_at(m_next_job);
+        m_next_job++;
+        slot.state = SlotState::Encoding;
+
+        // Frame must be encoded before the next one arrives to keep up
+        int64_t deadline_us = av_gettime_relative() + m_frame_interval_us;
+        NativeEngine::submit(m_group, deadline_us,
+                             [this, cctx, &slot]() { run(cctx, slot); });
+    }
+}
+
+void ParallelEncoder::run(AVCodecContext *cctx, Slot &slot) {
+    int res = encode(cctx, slot);
+
+    // Notified under the lock, encoder may be destroyed once it's released
+    std::lock_guard<std::mutex> lock(m_lock);
+    slot.result = res;
+    slot.state = SlotState::Done;
+    m_free_contexts.push_back(cctx);
+
+    schedule();
+    m_done_cond.notify_all();
+}
+
+int ParallelEncoder::encode(AVCodecContext *cctx, Slot &slot) {
+    int res = avcodec_send_frame(cctx, slot.frame);
+    av_frame_unref(slot.frame);
+
+    if (res < 0) {
+        LOG_ERROR("Error sending a frame to the encoder: %s",
+                  av_err_to_string(res).data());
+        return res;
+    }
+
+    // Intra-only encoders without delay return packet for every frame
+    res = avcodec_receive_packet(cctx, slot.packet);
+    if (res < 0) {
+        LOG_ERROR("Error receive packet from the encoder: %s",
+                  av_err_to_string(res).data());
+    }
+
+    return res;
+}
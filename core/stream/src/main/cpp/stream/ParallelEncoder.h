@@ -0,0 +1,103 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavutil/frame.h>
+}
+
+#include "NativeEngine.h"
+#include "VideoConfig.h"
+
+// Encodes frames of an intra-only encoder (mjpeg) on several encoder
+// contexts at once. Every frame is independent, so frames are submitted to
+// NativeEngine as they arrive, each with a free context and a deadline of
+// one frame interval. Packets are returned in the submission order.
+//
+// Follows avcodec_send_frame()/avcodec_receive_packet() semantics, so it can
+// replace a single encoder context in the sending loop.
+class ParallelEncoder {
+   public:
+    ParallelEncoder(EngineGroup *group, std::vector<AVCodecContext *> contexts,
+                    std::vector<AVFrame *> frames,
+                    std::vector<AVPacket *> packets,
+                    int64_t frame_interval_us);
+    ~ParallelEncoder();
+
+    ParallelEncoder(const ParallelEncoder &) = delete;
+    ParallelEncoder &operator=(const ParallelEncoder &) = delete;
+
+    static constexpr int MAX_WORKERS = 8;
+
+    // Encoder must be intra-only and must not delay packets
+    static bool is_supported(const AVCodec *codec);
+
+    // Opens worker_count encoders with the given config and flags, returns
+    // nullptr on failure. Frames are encoded as tasks of the group.
+    static ParallelEncoder *build(EngineGroup *group, const VideoConfig &config,
+                                  int flags, int worker_count);
+
+    // Takes a new reference to frame. Blocks while the slot of the frame is
+    // being encoded, returns AVERROR(EAGAIN) when the oldest packet must be
+    // received first.
+    int send_frame(const AVFrame *frame);
+
+    // Moves the next packet in the submission order into pkt. Waits for it
+    // until deadline (in av_gettime_relative units), zero deadline doesn't
+    // wait. Returns AVERROR(EAGAIN) when packet isn't encoded yet and
+    // AVERROR_EOF when there is nothing in flight. Failed frames return
+    // their encoding error and are skipped.
+    int receive_packet(AVPacket *pkt, int64_t deadline_us = 0);
+
+    // Drops frames that weren't received, waits for frames that are being
+    // encoded
+    void flush();
+
+    int worker_count() const { return (int)m_contexts.size(); }
+
+   private:
+    enum class SlotState {
+        Free,
+        Queued,
+        Encoding,
+        Done,
+    };
+
+    struct Slot {
+        AVFrame *frame;
+        AVPacket *packet;
+        SlotState state = SlotState::Free;
+        int result = 0;
+    };
+
+    // Submits queued frames while there are free contexts, must be called
+    // with locked m_lock
+    void schedule();
+
+    void run(AVCodecContext *cctx, Slot &slot);
+    int encode(AVCodecContext *cctx, Slot &slot);
+
+    Slot &slot_at(uint64_t seq) { return m_slots[seq % m_slots.size()]; }
+
+    EngineGroup *m_group;
+    std::vector<AVCodecContext *> m_contexts;
+    std::vector<Slot> m_slots;
+    int64_t m_frame_interval_us;
+
+    std::mutex m_lock;
+    std::condition_variable m_done_cond;
+
+    // Contexts that aren't encoding
+    std::vector<AVCodecContext *> m_free_contexts;
+
+    // Sequence numbers of the next submitted, started and received frames
+    uint64_t m_next_submit = 0;
+    uint64_t m_next_job = 0;
+    uint64_t m_next_receive = 0;
+
+    bool m_is_stopping = false;
+};
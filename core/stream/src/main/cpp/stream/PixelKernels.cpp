@@ -0,0 +1,331 @@
+#include "PixelKernels.h"
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+static uint64_t sad_row_scalar(const uint8_t *a, const uint8_t *b, int width) {
+    uint64_t sum = 0;
+    for (int x = 0; x < width; x++) {
+        sum += abs(a[x] - b[x]);
+    }
+
+    return sum;
+}
+
+#if defined(__ARM_NEON)
+
+static uint64_t sad_row(const uint8_t *a, const uint8_t *b, int width) {
+    // Every u16 lane grows by at most 2 * 255 per iteration, so partial sums
+    // are widened before they can overflow
+    constexpr int BLOCK_ITERATIONS = 64;
+
+    uint32x4_t sum32 = vdupq_n_u32(0);
+    int x = 0;
+
+    while (x + 16 <= width) {
+        uint16x8_t sum16 = vdupq_n_u16(0);
+
+        for (int i = 0; i < BLOCK_ITERATIONS && x + 16 <= width; i++, x += 16) {
+            uint8x16_t diff = vabdq_u8(vld1q_u8(a + x), vld1q_u8(b + x));
+            sum16 = vpadalq_u8(sum16, diff);
+        }
+
+        sum32 = vpadalq_u16(sum32, sum16);
+    }
+
+    uint64x2_t sum64 = vpaddlq_u32(sum32);
+    uint64_t sum = vgetq_lane_u64(sum64, 0) + vgetq_lane_u64(sum64, 1);
+
+    return sum + sad_row_scalar(a + x, b + x, width - x);
+}
+
+#elif defined(__SSE2__)
+
+static uint64_t sad_row(const uint8_t *a, const uint8_t *b, int width) {
+    __m128i sum = _mm_setzero_si128();
+    int x = 0;
+
+    for (; x + 16 <= width; x += 16) {
+        __m128i va = _mm_loadu_si128((const __m128i *)(a + x));
+        __m128i vb = _mm_loadu_si128((const __m128i *)(b + x));
+        sum = _mm_add_epi64(sum, _mm_sad_epu8(va, vb));
+    }
+
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i *)lanes, sum);
+
+    return lanes[0] + lanes[1] + sad_row_scalar(a + x, b + x, width - x);
+}
+
+#else
+
+static uint64_t sad_row(const uint8_t *a, const uint8_t *b, int width) {
+    return sad_row_scalar(a, b, width);
+}
+
+#endif
+
+uint64_t sad_u8(const uint8_t *a, int a_stride, const uint8_t *b, int b_stride,
+                int width, int rows) {
+    uint64_t sum = 0;
+
+    for (int y = 0; y < rows; y++) {
+        sum += sad_row(a + (ptrdiff_t)y * a_stride, b + (ptrdiff_t)y * b_stride,
+                       width);
+    }
+
+    return sum;
+}
+
+static uint64_t sse_row_scalar(const uint8_t *a, const uint8_t *b, int width) {
+    uint64_t sum = 0;
+    for (int x = 0; x < width; x++) {
+        int diff = a[x] - b[x];
+        sum += (uint64_t)(diff * diff);
+    }
+
+    return sum;
+}
+
+// Sums of one 8x8 block, used for SSIM
+struct BlockSums {
+    uint32_t a;
+    uint32_t b;
+    uint32_t aa;
+    uint32_t bb;
+    uint32_t ab;
+};
+
+constexpr int SSIM_BLOCK = 8;
+
+#if defined(__ARM_NEON)
+
+static uint32_t sum_lanes(uint32x4_t v) {
+    uint64x2_t sum = vpaddlq_u32(v);
+    return (uint32_t)(vgetq_lane_u64(sum, 0) + vgetq_lane_u64(sum, 1));
+}
+
+static uint64_t sse_row(const uint8_t *a, const uint8_t *b, int width) {
+    // Every u32 lane grows by at most 4 * 255^2 per iteration, so rows up to
+    // 256K samples can't overflow it
+    uint32x4_t sum32 = vdupq_n_u32(0);
+    int x = 0;
+
+    for (; x + 16 <= width; x += 16) {
+        uint8x16_t diff = vabdq_u8(vld1q_u8(a + x), vld1q_u8(b + x));
+        uint8x8_t lo = vget_low_u8(diff);
+        uint8x8_t hi = vget_high_u8(diff);
+
+        sum32 = vpadalq_u16(sum32, vmull_u8(lo, lo));
+        sum32 = vpadalq_u16(sum32, vmull_u8(hi, hi));
+    }
+
+    uint64x2_t sum64 = vpaddlq_u32(sum32);
+    uint64_t sum = vgetq_lane_u64(sum64, 0) + vgetq_lane_u64(sum64, 1);
+
+    return sum + sse_row_scalar(a + x, b + x, width - x);
+}
+
+static BlockSums block_sums(const uint8_t *a, int a_stride, const uint8_t *b,
+                            int b_stride) {
+    uint16x8_t sum_a = vdupq_n_u16(0);
+    uint16x8_t sum_b = vdupq_n_u16(0);
+    uint32x4_t sum_aa = vdupq_n_u32(0);
+    uint32x4_t sum_bb = vdupq_n_u32(0);
+    uint32x4_t sum_ab = vdupq_n_u32(0);
+
+    for (int y = 0; y < SSIM_BLOCK; y++) {
+        uint8x8_t va = vld1_u8(a + (ptrdiff_t)y * a_stride);
+        uint8x8_t vb = vld1_u8(b + (ptrdiff_t)y * b_stride);
+
+        sum_a = vaddw_u8(sum_a, va);
+        sum_b = vaddw_u8(sum_b, vb);
+        sum_aa = vpadalq_u16(sum_aa, vmull_u8(va, va));
+        sum_bb = vpadalq_u16(sum_bb, vmull_u8(vb, vb));
+        sum_ab = vpadalq_u16(sum_ab, vmull_u8(va, vb));
+    }
+
+    return {
+        .a = sum_lanes(vpaddlq_u16(sum_a)),
+        .b = sum_lanes(vpaddlq_u16(sum_b)),
+        .aa = sum_lanes(sum_aa),
+        .bb = sum_lanes(sum_bb),
+        .ab = sum_lanes(sum_ab),
+    };
+}
+
+#elif defined(__SSE2__)
+
+static uint32_t sum_lanes(__m128i v) {
+    uint32_t lanes[4];
+    _mm_storeu_si128((__m128i *)lanes, v);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+
+static uint64_t sse_row(const uint8_t *a, const uint8_t *b, int width) {
+    // Every i32 lane grows by at most 4 * 255^2 per iteration, so rows up to
+    // 128K samples can't overflow it
+    __m128i zero = _mm_setzero_si128();
+    __m128i sum = zero;
+    int x = 0;
+
+    for (; x + 16 <= width; x += 16) {
+        __m128i va = _mm_loadu_si128((const __m128i *)(a + x));
+        __m128i vb = _mm_loadu_si128((const __m128i *)(b + x));
+        __m128i diff =
+            _mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va));
+        __m128i lo = _mm_unpacklo_epi8(diff, zero);
+        __m128i hi = _mm_unpackhi_epi8(diff, zero);
+
+        sum = _mm_add_epi32(sum, _mm_madd_epi16(lo, lo));
+        sum = _mm_add_epi32(sum, _mm_madd_epi16(hi, hi));
+    }
+
+    return sum_lanes(sum) + sse_row_scalar(a + x, b + x, width - x);
+}
+
+static BlockSums block_sums(const uint8_t *a, int a_stride, const uint8_t *b,
+                            int b_stride) {
+    __m128i zero = _mm_setzero_si128();
+    __m128i sum_a = zero;
+    __m128i sum_b = zero;
+    __m128i sum_aa = zero;
+    __m128i sum_bb = zero;
+    __m128i sum_ab = zero;
+
+    for (int y = 0; y < SSIM_BLOCK; y++) {
+        __m128i va = _mm_unpacklo_epi8(
+            _mm_loadl_epi64((const __m128i *)(a + (ptrdiff_t)y * a_stride)),
+            zero);
+        __m128i vb = _mm_unpacklo_epi8(
+            _mm_loadl_epi64((const __m128i *)(b + (ptrdiff_t)y * b_stride)),
+            zero);
+
+        sum_a = _mm_add_epi16(sum_a, va);
+        sum_b = _mm_add_epi16(sum_b, vb);
+        sum_aa = _mm_add_epi32(sum_aa, _mm_madd_epi16(va, va));
+        sum_bb = _mm_add_epi32(sum_bb, _mm_madd_epi16(vb, vb));
+        sum_ab = _mm_add_epi32(sum_ab, _mm_madd_epi16(va, vb));
+    }
+
+    __m128i ones = _mm_set1_epi16(1);
+    return {
+        .a = sum_lanes(_mm_madd_epi16(sum_a, ones)),
+        .b = sum_lanes(_mm_madd_epi16(sum_b, ones)),
+        .aa = sum_lanes(sum_aa),
+        .bb = sum_lanes(sum_bb),
+        .ab = sum_lanes(sum_ab),
+    };
+}
+
+#else
+
+static uint64_t sse_row(const uint8_t *a, const uint8_t *b, int width) {
+    return sse_row_scalar(a, b, width);
+}
+
+static BlockSums block_sums(const uint8_t *a, int a_stride, const uint8_t *b,
+                            int b_stride) {
+    BlockSums sums = {};
+    for (int y = 0; y < SSIM_BLOCK; y++) {
+        const uint8_t *row_a = a + (ptrdiff_t)y * a_stride;
+        const uint8_t *row_b = b + (ptrdiff_t)y * b_stride;
+
+        for (int x = 0; x < SSIM_BLOCK; x++) {
+            sums.a += row_a[x];
+            sums.b += row_b[x];
+            sums.aa += row_a[x] * row_a[x];
+            sums.bb += row_b[x] * row_b[x];
+            sums.ab += row_a[x] * row_b[x];
+        }
+    }
+
+    return sums;
+}
+
+#endif
+
+uint64_t sse_u8(const uint8_t *a, int a_stride, const uint8_t *b, int b_stride,
+                int width, int rows) {
+    uint64_t sum = 0;
+
+    for (int y = 0; y < rows; y++) {
+        sum += sse_row(a + (ptrdiff_t)y * a_stride, b + (ptrdiff_t)y * b_stride,
+                       width);
+    }
+
+    return sum;
+}
+
+double ssim_u8(const uint8_t *a, int a_stride, const uint8_t *b, int b_stride,
+               int width, int rows) {
+    // Stabilizing constants of 8-bit samples: (0.01 * 255)^2, (0.03 * 255)^2
+    constexpr double C1 = 6.5025;
+    constexpr double C2 = 58.5225;
+    constexpr double N = SSIM_BLOCK * SSIM_BLOCK;
+
+    double total = 0;
+    int64_t count = 0;
+
+    for (int y = 0; y + SSIM_BLOCK <= rows; y += SSIM_BLOCK) {
+        const uint8_t *row_a = a + (ptrdiff_t)y * a_stride;
+        const uint8_t *row_b = b + (ptrdiff_t)y * b_stride;
+
+        for (int x = 0; x + SSIM_BLOCK <= width; x += SSIM_BLOCK) {
+            BlockSums sums =
+                block_sums(row_a + x, a_stride, row_b + x, b_stride);
+
+            double mean_a = sums.a / N;
+            double mean_b = sums.b / N;
+            double var_a = sums.aa / N - mean_a * mean_a;
+            double var_b = sums.bb / N - mean_b * mean_b;
+            double cov = sums.ab / N - mean_a * mean_b;
+
+            total += ((2 * mean_a * mean_b + C1) * (2 * cov + C2)) /
+                     ((mean_a * mean_a + mean_b * mean_b + C1) *
+                      (var_a + var_b + C2));
+            count++;
+        }
+    }
+
+    return count > 0 ? total / count : 1.0;
+}
+
+void copy_rows_u8(uint8_t *dst, int dst_stride, const uint8_t *src,
+                  int src_stride, int width, int rows) {
+    for (int y = 0; y < rows; y++) {
+        memcpy(dst + (ptrdiff_t)y * dst_stride, src + (ptrdiff_t)y * src_stride,
+               width);
+    }
+}
+
+void box_downscale_u8(uint8_t *dst, int dst_stride, const uint8_t *src,
+                      int src_stride, int src_step, int factor, int dst_width,
+                      int dst_height) {
+    uint32_t area = (uint32_t)factor * factor;
+    int block_step = factor * src_step;
+
+    for (int y = 0; y < dst_height; y++) {
+        const uint8_t *block = src + (ptrdiff_t)y * factor * src_stride;
+        uint8_t *out = dst + (ptrdiff_t)y * dst_stride;
+
+        for (int x = 0; x < dst_width; x++, block += block_step) {
+            uint32_t sum = 0;
+            for (int by = 0; by < factor; by++) {
+                const uint8_t *row = block + (ptrdiff_t)by * src_stride;
+                for (int bx = 0; bx < block_step; bx += src_step) {
+                    sum += row[bx];
+                }
+            }
+
+            out[x] = (uint8_t)((sum + area / 2) / area);
+        }
+    }
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdint>
+
+// Per-pixel kernels used on the frame path. Vector implementation is selected
+// at compile time: NEON on arm, SSE2 on x86_64, scalar otherwise.
+
+// Sum of absolute differences between two 8-bit planes of width x rows size.
+// Strides may be multiple of the real plane stride to compare only part of
+// the rows.
+uint64_t sad_u8(const uint8_t *a, int a_stride, const uint8_t *b, int b_stride,
+                int width, int rows);
+
+// Sum of squared differences between two 8-bit planes of width x rows size
+uint64_t sse_u8(const uint8_t *a, int a_stride, const uint8_t *b, int b_stride,
+                int width, int rows);
+
+// Mean SSIM of the non-overlapping 8x8 blocks that fit into the planes,
+// 1 when no block fits
+double ssim_u8(const uint8_t *a, int a_stride, const uint8_t *b, int b_stride,
+               int width, int rows);
+
+void copy_rows_u8(uint8_t *dst, int dst_stride, const uint8_t *src,
+                  int src_stride, int width, int rows);
+
+// Averages factor x factor blocks of the source into every destination
+// sample. Neighbouring source samples are src_step bytes apart, so a single
+// component of interleaved chroma can be read. Source must contain at least
+// dst_width x dst_height whole blocks.
+void box_downscale_u8(uint8_t *dst, int dst_stride, const uint8_t *src,
+                      int src_stride, int src_step, int factor, int dst_width,
+                      int dst_height);
@@ -0,0 +1,267 @@
+#include "QualityMonitor.h"
+
+#include <algorithm>
+#include <cmath>
+
+extern "C" {
+#include <libavutil/pixdesc.h>
+#include <libavutil/time.h>
+}
+
+#include "EventChannel.h"
+#include "FFmpegUtils.h"
+#include "PixelKernels.h"
+
+#define LOG_TAG "QualityMonitor"
+#include "Log.h"
+
+// Luma is the first plane with 8-bit samples
+static bool has_luma_plane(int format) {
+    const AVPixFmtDescriptor *desc =
+        av_pix_fmt_desc_get((AVPixelFormat)format);
+
+    return desc && !(desc->flags & AV_PIX_FMT_FLAG_RGB) &&
+           desc->comp[0].plane == 0 && desc->comp[0].step == 1 &&
+           desc->comp[0].depth == 8;
+}
+
+static double to_psnr(uint64_t sse, int width, int height) {
+    if (sse == 0) {
+        return QualityMonitor::MAX_PSNR;
+    }
+
+    double mse = (double)sse / ((double)width * height);
+    return std::min(10.0 * log10(255.0 * 255.0 / mse),
+                    QualityMonitor::MAX_PSNR);
+}
+
+QualityMonitor::~QualityMonitor() {
+    {
+        std::unique_lock<std::mutex> lock(m_lock);
+        m_idle_cond.wait(lock, [this]() { return m_state != State::Busy; });
+    }
+
+    av_packet_free(&m_packet);
+    avcodec_free_context(&m_dctx);
+    av_frame_free(&m_decoded);
+}
+
+bool QualityMonitor::is_supported(const AVCodec *codec) {
+    const AVCodecDescriptor *desc = avcodec_descriptor_get(codec->id);
+    if (!desc || !(desc->props & AV_CODEC_PROP_INTRA_ONLY)) {
+        return false;
+    }
+
+    return avcodec_find_decoder(codec->id) != nullptr;
+}
+
+void QualityMonitor::set_options(const QualityOptions &options,
+                                 const AVCodec *codec) {
+    LOG_INFO("Quality interval: %d frames, max cpu: %d%%",
+             options.interval_frames, options.max_cpu_percent);
+
+    // Options and stats are shared with the measuring task
+    std::unique_lock<std::mutex> lock(m_lock);
+    m_idle_cond.wait(lock, [this]() { return m_state != State::Busy; });
+
+    m_options = options;
+    m_options.max_cpu_percent = std::clamp(options.max_cpu_percent, 1, 100);
+    m_codec = codec;
+    m_frame_counter = 0;
+
+    m_state = State::Idle;
+    m_next_sample_us = 0;
+
+    m_stats = {};
+    m_psnr_sum = 0;
+    m_ssim_sum = 0;
+    m_cost_sum_us = 0;
+}
+
+void QualityMonitor::offer_frame(const AVFrame *frame) {
+    if (!is_enabled() || m_frame_counter++ % m_options.interval_frames != 0) {
+        return;
+    }
+
+    // Packet of the previous reference never came, e.g. encoder dropped it
+    if (m_state == State::WaitingPacket) {
+        m_state = State::Idle;
+    }
+
+    if (m_state != State::Idle ||
+        av_gettime_relative() < m_next_sample_us.load()) {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_stats.skipped++;
+        return;
+    }
+
+    if (!has_luma_plane(frame->format) || frame->pts == AV_NOPTS_VALUE) {
+        LOG_TRACE("Unable to measure frame with format: %d", frame->format);
+        return;
+    }
+
+    m_width = frame->width;
+    m_height = frame->height;
+    m_reference.resize((size_t)m_width * m_height);
+    copy_rows_u8(m_reference.data(), m_width, frame->data[0],
+                 frame->linesize[0], m_width, m_height);
+
+    m_reference_pts = frame->pts;
+    m_state = State::WaitingPacket;
+}
+
+void QualityMonitor::offer_packet(const AVPacket *packet) {
+    if (m_state != State::WaitingPacket || packet->pts != m_reference_pts) {
+        return;
+    }
+
+    if (!m_packet) {
+        m_packet = av_packet_alloc();
+    }
+
+    // Payload is shared with the muxer, only the reference is taken
+    if (!m_packet || av_packet_ref(m_packet, packet) < 0) {
+        LOG_ERROR("Unable to reference sampled packet");
+        m_state = State::Idle;
+        return;
+    }
+
+    m_state = State::Busy;
+    NativeEngine::submit(m_group, NativeEngine::NO_DEADLINE,
+                         [this]() { run(); });
+}
+
+QualityStats QualityMonitor::stats() {
+    std::lock_guard<std::mutex> lock(m_lock);
+    return m_stats;
+}
+
+void QualityMonitor::run() {
+    int64_t begin = av_gettime_relative();
+
+    double psnr;
+    double ssim;
+    bool is_measured = measure(&psnr, &ssim);
+    av_packet_unref(m_packet);
+
+    // Next sample waits until this one fits into the cpu share
+    int64_t cost = av_gettime_relative() - begin;
+    m_next_sample_us = begin + cost * 100 / m_options.max_cpu_percent;
+
+    if (is_measured) {
+        add_sample(psnr, ssim, cost);
+    }
+
+    // Notified under the lock, monitor may be destroyed once it's released
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_state = State::Idle;
+    m_idle_cond.notify_all();
+}
+
+bool QualityMonitor::measure(double *psnr, double *ssim) {
+    if (!require_decoder()) {
+        return false;
+    }
+
+    int res = avcodec_send_packet(m_dctx, m_packet);
+    if (res < 0) {
+        LOG_ERROR("Unable to send sampled packet: %s",
+                  av_err_to_string(res).data());
+        return false;
+    }
+
+    res = avcodec_receive_frame(m_dctx, m_decoded);
+    if (res < 0) {
+        LOG_ERROR("Unable to decode sampled packet: %s",
+                  av_err_to_string(res).data());
+        return false;
+    }
+
+    if (m_decoded->width != m_width || m_decoded->height != m_height ||
+        !has_luma_plane(m_decoded->format)) {
+        LOG_WARN("Decoded frame doesn't match the reference");
+        av_frame_unref(m_decoded);
+        return false;
+    }
+
+    const uint8_t *luma = m_decoded->data[0];
+    int stride = m_decoded->linesize[0];
+
+    uint64_t sse = sse_u8(m_reference.data(), m_width, luma, stride, m_width,
+                          m_height);
+    *psnr = to_psnr(sse, m_width, m_height);
+    *ssim = ssim_u8(m_reference.data(), m_width, luma, stride, m_width,
+                    m_height);
+
+    av_frame_unref(m_decoded);
+    return true;
+}
+
+bool QualityMonitor::require_decoder() {
+    if (m_dctx && m_dctx->codec_id == m_codec->id) {
+        return true;
+    }
+
+    avcodec_free_context(&m_dctx);
+
+    const AVCodec *decoder = avcodec_find_decoder(m_codec->id);
+    if (!decoder) {
+        LOG_ERROR("Unable to find '%s' decoder", m_codec->name);
+        return false;
+    }
+
+    m_dctx = avcodec_alloc_context3(decoder);
+    if (!m_dctx) {
+        LOG_ERROR("Unable to allocate codec context");
+        return false;
+    }
+
+    m_dctx->thread_count = 1;
+
+    int res = avcodec_open2(m_dctx, decoder, nullptr);
+    if (res < 0) {
+        LOG_ERROR("Unable to open quality decoder: %s",
+                  av_err_to_string(res).data());
+        avcodec_free_context(&m_dctx);
+        return false;
+    }
+
+    if (!m_decoded) {
+        m_decoded = av_frame_alloc();
+    }
+
+    if (!m_decoded) {
+        LOG_ERROR("Unable to allocate frame");
+        avcodec_free_context(&m_dctx);
+        return false;
+    }
+
+    LOG_INFO("Measuring quality with '%s' decoder", decoder->name);
+    return true;
+}
+
+void QualityMonitor::add_sample(double psnr, double ssim, int64_t cost_us) {
+    // Stats surface of the stream: SSIM in 1/10000, PSNR in millidecibels
+    EventChannel::post(EventType::QualitySample, m_event_source,
+                       (int32_t)std::lround(ssim * 10'000),
+                       std::llround(psnr * 1000));
+
+    std::lock_guard<std::mutex> lock(m_lock);
+    QualityStats &stats = m_stats;
+
+    bool is_first = stats.samples == 0;
+    stats.samples++;
+
+    stats.last_psnr = psnr;
+    stats.min_psnr = is_first ? psnr : std::min(stats.min_psnr, psnr);
+    m_psnr_sum += psnr;
+    stats.avg_psnr = m_psnr_sum / stats.samples;
+
+    stats.last_ssim = ssim;
+    stats.min_ssim = is_first ? ssim : std::min(stats.min_ssim, ssim);
+    m_ssim_sum += ssim;
+    stats.avg_ssim = m_ssim_sum / stats.samples;
+
+    m_cost_sum_us += cost_us;
+    stats.avg_cost_us = m_cost_sum_us / stats.samples;
+}
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavutil/frame.h>
+}
+
+#include "NativeEngine.h"
+
+struct QualityOptions {
+    // Every Nth encoded frame is measured, zero disables the monitor
+    int interval_frames = 0;
+
+    // Average share of one core that measurements may take, in percent
+    int max_cpu_percent = 5;
+};
+
+struct QualityStats {
+    int64_t samples = 0;
+    // Due frames that weren't measured because of the cpu budget or a
+    // measurement still running
+    int64_t skipped = 0;
+
+    // Luma PSNR in dB, identical planes are reported as MAX_PSNR
+    double last_psnr = 0;
+    double avg_psnr = 0;
+    double min_psnr = 0;
+
+    // Luma SSIM, 1 for identical planes
+    double last_ssim = 0;
+    double avg_ssim = 0;
+    double min_ssim = 0;
+
+    // Average time of decoding and measuring one sample
+    int64_t avg_cost_us = 0;
+};
+
+// Measures what the encoder outputs by decoding sampled packets and
+// comparing them with the frames that were given to the encoder.
+//
+// Encoding side copies luma of every Nth encoder input and references the
+// packet with the same pts once it's encoded. Decoding and PSNR/SSIM run
+// as a NativeEngine task without deadline, on the low-priority background
+// thread.
+// Only one sample is in flight, and the next one isn't taken until the
+// cost of the previous one fits into max_cpu_percent, so the monitor costs
+// skipped samples rather than frames.
+//
+// Packets are decoded independently, so only intra-only codecs (MJPEG) with
+// a software decoder are supported.
+class QualityMonitor {
+   public:
+    // Group must outlive the monitor, samples are posted as events of the
+    // event_source
+    QualityMonitor(EngineGroup *group, const void *event_source)
+        : m_group(group), m_event_source(event_source) {}
+    ~QualityMonitor();
+
+    QualityMonitor(const QualityMonitor &) = delete;
+    QualityMonitor &operator=(const QualityMonitor &) = delete;
+
+    static bool is_supported(const AVCodec *codec);
+
+    // Must be called with locked encoder of the stream. Stats are reset.
+    void set_options(const QualityOptions &options, const AVCodec *codec);
+
+    bool is_enabled() const { return m_options.interval_frames > 0; }
+
+    // Called by the encoding side with every frame given to the encoder
+    void offer_frame(const AVFrame *frame);
+
+    // Called by the encoding side with every encoded packet
+    void offer_packet(const AVPacket *packet);
+
+    QualityStats stats();
+
+    static constexpr double MAX_PSNR = 100.0;
+
+   private:
+    enum class State {
+        Idle,
+        // Reference is kept, waiting for its packet
+        WaitingPacket,
+        // Owned by the measuring task
+        Busy,
+    };
+
+    void run();
+
+    // Returns false when the sampled packet can't be compared
+    bool measure(double *psnr, double *ssim);
+
+    // Reopens decoder when codec is changed
+    bool require_decoder();
+
+    void add_sample(double psnr, double ssim, int64_t cost_us);
+
+    EngineGroup *m_group;
+    const void *m_event_source;
+    QualityOptions m_options;
+    const AVCodec *m_codec = nullptr;
+    unsigned m_frame_counter = 0;
+
+    std::atomic<State> m_state = State::Idle;
+    std::atomic<int64_t> m_next_sample_us = 0;
+
+    // Luma of the encoder input, owned by the task while it's busy
+    std::vector<uint8_t> m_reference;
+    int m_width = 0;
+    int m_height = 0;
+    int64_t m_reference_pts = AV_NOPTS_VALUE;
+    AVPacket *m_packet = nullptr;
+
+    // Used only by the measuring task
+    AVCodecContext *m_dctx = nullptr;
+    AVFrame *m_decoded = nullptr;
+
+    std::mutex m_lock;
+    std::condition_variable m_idle_cond;
+    QualityStats m_stats;
+    double m_psnr_sum = 0;
+    double m_ssim_sum = 0;
+    int64_t m_cost_sum_us = 0;
+};
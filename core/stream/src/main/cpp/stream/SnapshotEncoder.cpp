@@ -0,0 +1,255 @@
+#include "SnapshotEncoder.h"
+
+#include <algorithm>
+#include <utility>
+
+extern "C" {
+#include <libavutil/avutil.h>
+}
+
+#include "FFmpegUtils.h"
+#include "FrameIngest.h"
+#include "PixelKernels.h"
+
+#define LOG_TAG "SnapshotEncoder"
+#include "Log.h"
+
+// Returns nullptr for formats that can't be downscaled
+static const ChromaLayout *get_chroma_layout(AVPixelFormat format) {
+    const FrameIngestOps *ops = get_frame_ingest_ops(from_av_pix_fmt(format));
+    if (!ops || !ops->has_luma ||
+        ops->chroma.log2_chroma_w != ops->chroma.log2_chroma_h) {
+        return nullptr;
+    }
+
+    return &ops->chroma;
+}
+
+SnapshotEncoder::~SnapshotEncoder() {
+    {
+        std::unique_lock<std::mutex> lock(m_lock);
+        m_idle_cond.wait(lock, [this]() { return !m_is_busy; });
+    }
+
+    if (m_dropped > 0) {
+        LOG_INFO("Dropped %lld snapshots while they were read",
+                 (long long)m_dropped);
+    }
+
+    av_frame_free(&m_staging);
+    avcodec_free_context(&m_cctx);
+    av_packet_free(&m_packet);
+}
+
+void SnapshotEncoder::set_options(const SnapshotOptions &options) {
+    LOG_INFO("Snapshot interval: %d frames, max width: %d, quality: %d",
+             options.interval_frames, options.max_width, options.quality);
+
+    m_options = options;
+    m_options.max_width = std::max(options.max_width, 2);
+    m_options.quality = std::clamp(options.quality, 2, 31);
+    m_frame_counter = 0;
+}
+
+void SnapshotEncoder::offer(const AVFrame *frame, int64_t ts) {
+    if (!is_enabled() || m_frame_counter++ % m_options.interval_frames != 0) {
+        return;
+    }
+
+    // Previous snapshot is still being encoded
+    if (m_is_busy.load(std::memory_order_acquire)) {
+        LOG_TRACE("Skipping snapshot, encoder is busy");
+        return;
+    }
+
+    if (!downscale(frame)) {
+        return;
+    }
+
+    m_staging_ts = ts;
+    m_staging_quality = m_options.quality;
+
+    m_is_busy.store(true, std::memory_order_release);
+    NativeEngine::submit(m_group, NativeEngine::NO_DEADLINE,
+                         [this]() { run(); });
+}
+
+bool SnapshotEncoder::read_latest(std::vector<uint8_t> &out, int64_t *ts) {
+    while (true) {
+        int index = m_published.load();
+        if (index < 0) {
+            return false;
+        }
+
+        // Worker may have republished between the load and the mark, then
+        // the slot may already be rewritten
+        m_readers[index]++;
+        if (m_published.load() != index) {
+            m_readers[index]--;
+            continue;
+        }
+
+        const Slot &slot = m_slots[index];
+        out.assign(slot.data.begin(), slot.data.end());
+        if (ts) {
+            *ts = slot.ts;
+        }
+
+        m_readers[index]--;
+        return true;
+    }
+}
+
+bool SnapshotEncoder::downscale(const AVFrame *frame) {
+    const ChromaLayout *chroma =
+        get_chroma_layout((AVPixelFormat)frame->format);
+    if (!chroma) {
+        LOG_TRACE("Unable to make snapshot from format: %d", frame->format);
+        return false;
+    }
+
+    int factor = (frame->width + m_options.max_width - 1) / m_options.max_width;
+    // Output is 4:2:0, so luma is kept even
+    int width = (frame->width / factor) & ~1;
+    int height = (frame->height / factor) & ~1;
+    if (width <= 0 || height <= 0) {
+        return false;
+    }
+
+    if (!m_staging || m_staging->width != width ||
+        m_staging->height != height) {
+        av_frame_free(&m_staging);
+        m_staging = av_frame_alloc();
+        if (!m_staging) {
+            LOG_ERROR("Unable to allocate staging frame");
+            return false;
+        }
+
+        m_staging->width = width;
+        m_staging->height = height;
+        m_staging->format = AV_PIX_FMT_YUVJ420P;
+
+        int res = av_frame_get_buffer(m_staging, 0);
+        if (res < 0) {
+            LOG_ERROR("Unable to allocate staging buffer: %s",
+                      av_err_to_string(res).data());
+            av_frame_free(&m_staging);
+            return false;
+        }
+    }
+
+    box_downscale_u8(m_staging->data[0], m_staging->linesize[0],
+                     frame->data[0], frame->linesize[0], 1, factor, width,
+                     height);
+
+    // Chroma of 4:4:4 source is averaged over twice larger blocks
+    int chroma_factor = factor << (1 - chroma->log2_chroma_h);
+    for (auto [plane, source] :
+         {std::pair{1, chroma->u}, std::pair{2, chroma->v}}) {
+        box_downscale_u8(m_staging->data[plane], m_staging->linesize[plane],
+                         frame->data[source.plane] + source.offset,
+                         frame->linesize[source.plane], source.step,
+                         chroma_factor, width / 2, height / 2);
+    }
+
+    return true;
+}
+
+void SnapshotEncoder::run() {
+    encode_staging();
+
+    // Notified under the lock, encoder may be destroyed once it's released
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_is_busy.store(false, std::memory_order_release);
+    m_idle_cond.notify_all();
+}
+
+void SnapshotEncoder::encode_staging() {
+    if (!require_encoder()) {
+        return;
+    }
+
+    m_staging->pict_type = AV_PICTURE_TYPE_I;
+    m_staging->quality = FF_QP2LAMBDA * m_staging_quality;
+
+    int res = avcodec_send_frame(m_cctx, m_staging);
+    if (res < 0) {
+        LOG_ERROR("Unable to send snapshot: %s", av_err_to_string(res).data());
+        return;
+    }
+
+    res = avcodec_receive_packet(m_cctx, m_packet);
+    if (res < 0) {
+        LOG_ERROR("Unable to receive snapshot: %s",
+                  av_err_to_string(res).data());
+        return;
+    }
+
+    publish(m_packet, m_staging_ts);
+    av_packet_unref(m_packet);
+}
+
+bool SnapshotEncoder::require_encoder() {
+    if (m_cctx && m_cctx->width == m_staging->width &&
+        m_cctx->height == m_staging->height) {
+        return true;
+    }
+
+    avcodec_free_context(&m_cctx);
+
+    const AVCodec *codec = avcodec_find_encoder(AV_CODEC_ID_MJPEG);
+    if (!codec) {
+        LOG_ERROR("Unable to find mjpeg encoder");
+        return false;
+    }
+
+    m_cctx = avcodec_alloc_context3(codec);
+    if (!m_cctx) {
+        LOG_ERROR("Unable to allocate codec context");
+        return false;
+    }
+
+    m_cctx->width = m_staging->width;
+    m_cctx->height = m_staging->height;
+    m_cctx->pix_fmt = AV_PIX_FMT_YUVJ420P;
+    m_cctx->time_base = {1, 1};
+    m_cctx->flags |= AV_CODEC_FLAG_QSCALE;
+    m_cctx->thread_count = 1;
+
+    int res = avcodec_open2(m_cctx, codec, nullptr);
+    if (res < 0) {
+        LOG_ERROR("Unable to open snapshot encoder: %s",
+                  av_err_to_string(res).data());
+        avcodec_free_context(&m_cctx);
+        return false;
+    }
+
+    if (!m_packet) {
+        m_packet = av_packet_alloc();
+    }
+
+    if (!m_packet) {
+        LOG_ERROR("Unable to allocate packet");
+        avcodec_free_context(&m_cctx);
+        return false;
+    }
+
+    LOG_INFO("Encoding snapshots with size: (%d, %d)", m_cctx->width,
+             m_cctx->height);
+    return true;
+}
+
+void SnapshotEncoder::publish(const AVPacket *packet, int64_t ts) {
+    int index = m_published.load() == 0 ? 1 : 0;
+    if (m_readers[index].load() > 0) {
+        // Reader is still copying the snapshot before the latest
+        m_dropped++;
+        return;
+    }
+
+    Slot &slot = m_slots[index];
+    slot.data.assign(packet->data, packet->data + packet->size);
+    slot.ts = ts;
+
+    m_published.store(index);
+}
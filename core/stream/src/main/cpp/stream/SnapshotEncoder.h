@@ -0,0 +1,99 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavutil/frame.h>
+}
+
+#include "NativeEngine.h"
+
+struct SnapshotOptions {
+    // Every Nth incoming frame is offered, zero disables snapshots
+    int interval_frames = 0;
+
+    // Snapshot is box-downscaled by the smallest integer factor that fits
+    // the width
+    int max_width = 320;
+
+    // MJPEG qscale, 2 (best) to 31 (smallest)
+    int quality = 8;
+};
+
+// Keeps the latest low-resolution JPEG of the stream for thumbnails.
+//
+// Sending thread only downscales the planes that are already mapped into
+// the stream frame into a small staging frame, and only when the previous
+// snapshot is encoded, so a slow encode costs snapshots rather than frames.
+// Staging frame is encoded with MJPEG as a NativeEngine task without
+// deadline, so it runs on the low-priority background thread of the engine.
+//
+// Encoded JPEGs are published into two slots. Readers mark the slot they
+// copy from, the encoding task never writes into a marked slot and drops
+// that snapshot instead, so neither side ever waits for the other.
+class SnapshotEncoder {
+   public:
+    // Group must outlive the encoder
+    explicit SnapshotEncoder(EngineGroup *group) : m_group(group) {}
+    ~SnapshotEncoder();
+
+    SnapshotEncoder(const SnapshotEncoder &) = delete;
+    SnapshotEncoder &operator=(const SnapshotEncoder &) = delete;
+
+    // Must be called from the sending thread
+    void set_options(const SnapshotOptions &options);
+
+    bool is_enabled() const { return m_options.interval_frames > 0; }
+
+    // Called from the sending thread for every frame, ts is in nanoseconds.
+    // Planar and semi-planar YUV frames are supported, others are ignored.
+    void offer(const AVFrame *frame, int64_t ts);
+
+    // Copies the latest JPEG into out, returns false when nothing was
+    // encoded yet. Can be called from any thread.
+    bool read_latest(std::vector<uint8_t> &out, int64_t *ts);
+
+   private:
+    struct Slot {
+        std::vector<uint8_t> data;
+        int64_t ts = 0;
+    };
+
+    // Returns false when frame format can't be downscaled
+    bool downscale(const AVFrame *frame);
+
+    void run();
+    void encode_staging();
+
+    // Reopens encoder when staging size is changed
+    bool require_encoder();
+
+    void publish(const AVPacket *packet, int64_t ts);
+
+    EngineGroup *m_group;
+    SnapshotOptions m_options;
+    unsigned m_frame_counter = 0;
+
+    // Staging frame is owned by the encoding task while it's set
+    std::atomic<bool> m_is_busy = false;
+    std::mutex m_lock;
+    std::condition_variable m_idle_cond;
+    AVFrame *m_staging = nullptr;
+    int64_t m_staging_ts = 0;
+    int m_staging_quality = 0;
+
+    // Used only by the encoding task
+    AVCodecContext *m_cctx = nullptr;
+    AVPacket *m_packet = nullptr;
+
+    Slot m_slots[2];
+    std::atomic<int> m_published = -1;
+    std::atomic<int> m_readers[2] = {0, 0};
+
+    int64_t m_dropped = 0;
+};
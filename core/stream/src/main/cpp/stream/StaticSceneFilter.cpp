@@ -0,0 +1,79 @@
+#include "StaticSceneFilter.h"
+
+#include <cstdlib>
+
+#include "PixelKernels.h"
+
+#define LOG_TAG "StaticSceneFilter"
+#include "Log.h"
+
+StaticSceneFilter::~StaticSceneFilter() { free(m_reference); }
+
+void StaticSceneFilter::set_options(float threshold, int64_t max_skip_ms) {
+    LOG_INFO("Static scene threshold: %.2f, max skip: %lld ms", threshold,
+             (long long)max_skip_ms);
+
+    m_threshold = threshold > 0 ? threshold : 0;
+    m_max_skip_ns = max_skip_ms * 1'000'000;
+    reset();
+}
+
+void StaticSceneFilter::reset() {
+    m_last_passed_ts = -1;
+    m_skipped = 0;
+}
+
+bool StaticSceneFilter::should_skip(const uint8_t *luma, int stride, int width,
+                                    int height, int64_t ts) {
+    int rows = height / ROW_STEP;
+    if (!is_enabled() || width <= 0 || rows <= 0) {
+        return false;
+    }
+
+    bool is_same_size = width == m_reference_width && rows == m_reference_rows;
+
+    if (m_last_passed_ts < 0 || !is_same_size ||
+        ts - m_last_passed_ts >= m_max_skip_ns) {
+        update_reference(luma, stride, width, rows);
+        m_last_passed_ts = ts;
+        return false;
+    }
+
+    uint64_t sad = sad_u8(luma, stride * ROW_STEP, m_reference,
+                          m_reference_width, width, rows);
+    uint64_t limit = (uint64_t)(m_threshold * (float)width * (float)rows);
+
+    if (sad < limit) {
+        m_skipped++;
+        LOG_TRACE("Skipping static frame, sad: %llu, limit: %llu",
+                  (unsigned long long)sad, (unsigned long long)limit);
+        return true;
+    }
+
+    if (m_skipped > 0) {
+        LOG_TRACE("Scene changed after %d skipped frames", m_skipped);
+        m_skipped = 0;
+    }
+
+    update_reference(luma, stride, width, rows);
+    m_last_passed_ts = ts;
+    return false;
+}
+
+void StaticSceneFilter::update_reference(const uint8_t *luma, int stride,
+                                         int width, int rows) {
+    if (width != m_reference_width || rows != m_reference_rows) {
+        free(m_reference);
+        m_reference = (uint8_t *)malloc((size_t)width * rows);
+        m_reference_width = m_reference ? width : 0;
+        m_reference_rows = m_reference ? rows : 0;
+
+        if (!m_reference) {
+            LOG_ERROR("Unable to allocate reference frame");
+            return;
+        }
+    }
+
+    copy_rows_u8(m_reference, m_reference_width, luma, stride * ROW_STEP,
+                 m_reference_width, m_reference_rows);
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+
+// Detects frames that barely differ from the last passed frame, so they can
+// be dropped before conversion and encoding.
+//
+// Only every ROW_STEP-th row of the luma plane is compared, which is enough to
+// catch any real motion, while keeping the check much cheaper than the
+// encoder. Frames are compared against the last passed frame rather than the
+// previous one, so slow changes still accumulate until they cross the
+// threshold.
+class StaticSceneFilter {
+   public:
+    StaticSceneFilter() = default;
+    ~StaticSceneFilter();
+
+    StaticSceneFilter(const StaticSceneFilter &) = delete;
+    StaticSceneFilter &operator=(const StaticSceneFilter &) = delete;
+
+    // threshold is mean absolute luma difference per compared pixel, zero
+    // disables filtering. At least one frame per max_skip_ms is always
+    // passed, so viewers keep receiving frames on a static scene
+    void set_options(float threshold, int64_t max_skip_ms);
+
+    bool is_enabled() const { return m_threshold > 0; }
+
+    // ts is in nanoseconds. Returns true when frame should be dropped
+    bool should_skip(const uint8_t *luma, int stride, int width, int height,
+                     int64_t ts);
+
+    // Next frame always passes
+    void reset();
+
+    static constexpr int ROW_STEP = 4;
+    static constexpr int64_t DEFAULT_MAX_SKIP_MS = 1000;
+
+   private:
+    void update_reference(const uint8_t *luma, int stride, int width,
+                          int rows);
+
+    uint8_t *m_reference = nullptr;
+    int m_reference_width = 0;
+    int m_reference_rows = 0;
+
+    float m_threshold = 0;
+    int64_t m_max_skip_ns = DEFAULT_MAX_SKIP_MS * 1'000'000;
+
+    int64_t m_last_passed_ts = -1;
+    int m_skipped = 0;
+};
@@ -0,0 +1,137 @@
+#include "TimestampNormalizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+extern "C" {
+#include <libavutil/mathematics.h>
+}
+
+#define LOG_TAG "TimestampNormalizer"
+#include "Log.h"
+
+// Part of the frame interval by which output may move towards the camera
+// clock on every frame
+constexpr int64_t MAX_CORRECTION_DIVISOR = 16;
+
+// Camera clock going back by more than this is a discontinuity rather than
+// a late frame
+constexpr int64_t DISCONTINUITY_NS = 1'000'000'000;
+
+// Weight of the newest value in smoothed interval and jitter is 1 / N
+constexpr int64_t INTERVAL_SMOOTHING = 8;
+constexpr int64_t JITTER_SMOOTHING = 16;
+
+constexpr AVRational NS_TIME_BASE = {1, 1'000'000'000};
+
+void TimestampNormalizer::set_frame_interval(int64_t interval_ns) {
+    if (interval_ns <= 0) {
+        LOG_WARN("Invalid frame interval: %lld, using default",
+                 (long long)interval_ns);
+        interval_ns = DEFAULT_FRAME_INTERVAL_NS;
+    }
+
+    m_interval_ns = interval_ns;
+    m_avg_interval_ns = interval_ns;
+}
+
+int64_t TimestampNormalizer::normalize(int64_t ts, AVRational time_base) {
+    m_stats.frames++;
+
+    int64_t pts_ns = 0;
+    if (m_last_raw_ns == AV_NOPTS_VALUE) {
+        // Timeline starts at zero
+        m_offset_ns = -ts;
+        m_last_raw_ns = 0;
+    } else {
+        int64_t raw = ts + m_offset_ns;
+        if (raw <= m_last_raw_ns) {
+            m_stats.non_monotonic++;
+        }
+
+        if (m_last_raw_ns - raw > DISCONTINUITY_NS) {
+            LOG_WARN("Camera clock jumped back by %lld ms, rebasing",
+                     (long long)((m_last_raw_ns - raw) / 1'000'000));
+            m_stats.discontinuities++;
+
+            m_offset_ns += m_last_pts_ns + m_interval_ns - raw;
+            raw = m_last_pts_ns + m_interval_ns;
+        }
+
+        int64_t raw_interval = raw - m_last_raw_ns;
+        m_last_raw_ns = raw;
+
+        // Placing it on the next grid step would move output ahead of the
+        // camera, and repeating that makes the drift unbounded
+        if (raw - m_last_pts_ns < m_interval_ns / 2) {
+            m_stats.merged++;
+            return AV_NOPTS_VALUE;
+        }
+
+        // Frames dropped by the camera keep their grid steps
+        int64_t steps = std::max<int64_t>(
+            1, std::llround((double)(raw - m_last_pts_ns) / m_interval_ns));
+        if (steps > 1) {
+            m_stats.gaps++;
+        }
+
+        int64_t snapped = m_last_pts_ns + steps * m_interval_ns;
+        int64_t max_correction = m_interval_ns / MAX_CORRECTION_DIVISOR;
+        pts_ns = snapped + std::clamp(raw - snapped, -max_correction,
+                                      max_correction);
+
+        int64_t interval = pts_ns - m_last_pts_ns;
+        m_avg_interval_ns += (interval - m_avg_interval_ns) /
+                             INTERVAL_SMOOTHING;
+
+        int64_t jitter = std::abs(raw_interval - interval);
+        m_jitter_ns += (jitter - m_jitter_ns) / JITTER_SMOOTHING;
+        m_stats.max_jitter_us =
+            std::max(m_stats.max_jitter_us, jitter / 1000);
+        m_stats.drift_us = (pts_ns - raw) / 1000;
+    }
+
+    m_last_pts_ns = pts_ns;
+
+    // Rescaling into a coarse time base may round two frames to the same
+    // value
+    int64_t pts = av_rescale_q(pts_ns, NS_TIME_BASE, time_base);
+    if (m_last_pts != AV_NOPTS_VALUE && pts <= m_last_pts) {
+        pts = m_last_pts + 1;
+    }
+
+    m_last_pts = pts;
+    return pts;
+}
+
+int64_t TimestampNormalizer::frame_duration(AVRational time_base) const {
+    return std::max<int64_t>(
+        1, av_rescale_q(m_avg_interval_ns, NS_TIME_BASE, time_base));
+}
+
+void TimestampNormalizer::order_packet(AVPacket *packet) {
+    if (packet->dts == AV_NOPTS_VALUE) {
+        return;
+    }
+
+    if (m_last_dts != AV_NOPTS_VALUE && packet->dts <= m_last_dts) {
+        LOG_TRACE("Moving packet dts forward: %lld -> %lld",
+                  (long long)packet->dts, (long long)(m_last_dts + 1));
+        m_stats.reordered_packets++;
+
+        packet->dts = m_last_dts + 1;
+        if (packet->pts != AV_NOPTS_VALUE && packet->pts < packet->dts) {
+            packet->pts = packet->dts;
+        }
+    }
+
+    m_last_dts = packet->dts;
+}
+
+TimestampStats TimestampNormalizer::stats() const {
+    TimestampStats out = m_stats;
+    out.jitter_us = m_jitter_ns / 1000;
+    out.interval_us = m_avg_interval_ns / 1000;
+    return out;
+}
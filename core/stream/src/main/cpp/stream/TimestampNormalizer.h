@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstdint>
+
+extern "C" {
+#include <libavcodec/packet.h>
+#include <libavutil/avutil.h>
+#include <libavutil/rational.h>
+}
+
+struct TimestampStats {
+    int64_t frames = 0;
+
+    // Smoothed and max difference between camera and output frame intervals
+    int64_t jitter_us = 0;
+    int64_t max_jitter_us = 0;
+
+    // Smoothed output frame interval, used as the frame duration
+    int64_t interval_us = 0;
+
+    // Output minus camera time, at most half of the interval
+    int64_t drift_us = 0;
+
+    // Frames placed more than one frame interval after the previous
+    int64_t gaps = 0;
+
+    // Frames dropped since they came less than half of the interval after
+    // the previous one
+    int64_t merged = 0;
+
+    // Camera timestamps that weren't increasing
+    int64_t non_monotonic = 0;
+
+    // Camera clock jumped back, timeline was rebased
+    int64_t discontinuities = 0;
+
+    // Encoded packets which dts had to be moved forward
+    int64_t reordered_packets = 0;
+};
+
+// Turns camera timestamps into strictly increasing frame pts.
+//
+// Every frame is placed on the frame interval grid after the previous one,
+// skipping as many grid steps as the camera did, so capture jitter doesn't
+// reach the muxer. Difference from the camera clock is corrected by at most
+// 1/16 of the interval per frame, so real clock drift is followed without
+// visible steps. Frames that come faster than the interval and land within
+// half of the grid step after the previous one are merged into it (dropped),
+// so output never runs ahead of the camera by more than half of the
+// interval. Frame duration is the smoothed output interval, which follows
+// the real camera rate (e.g. in low light) instead of the nominal.
+class TimestampNormalizer {
+   public:
+    // Nominal interval, timeline isn't reset
+    void set_frame_interval(int64_t interval_ns);
+
+    // Returns pts of the frame captured at ts (in nanoseconds) in time_base,
+    // always greater than the previous one, or AV_NOPTS_VALUE when the frame
+    // must be dropped
+    int64_t normalize(int64_t ts, AVRational time_base);
+
+    // Duration of the latest normalized frame in time_base, at least 1
+    int64_t frame_duration(AVRational time_base) const;
+
+    // Keeps dts of encoded packets strictly increasing
+    void order_packet(AVPacket *packet);
+
+    TimestampStats stats() const;
+
+    static constexpr int64_t DEFAULT_FRAME_INTERVAL_NS = 1'000'000'000 / 30;
+
+   private:
+    int64_t m_interval_ns = DEFAULT_FRAME_INTERVAL_NS;
+
+    // Added to camera timestamps, changed on discontinuities
+    int64_t m_offset_ns = 0;
+
+    int64_t m_last_raw_ns = AV_NOPTS_VALUE;
+    int64_t m_last_pts_ns = 0;
+    int64_t m_last_pts = AV_NOPTS_VALUE;
+    int64_t m_last_dts = AV_NOPTS_VALUE;
+
+    int64_t m_avg_interval_ns = DEFAULT_FRAME_INTERVAL_NS;
+    int64_t m_jitter_ns = 0;
+
+    TimestampStats m_stats;
+};
@@ -5,7 +5,9 @@ import com.github.michaelbull.result.Ok
 import com.github.michaelbull.result.Result
 import com.github.michaelbull.result.onFailure
 import com.rejeq.cpcam.core.data.model.PixFmt
+import com.rejeq.cpcam.core.data.model.Resolution
 import com.rejeq.cpcam.core.data.model.VideoCodec
+import com.rejeq.cpcam.core.data.model.VideoConfig
 import com.rejeq.cpcam.core.stream.output.FFmpegOutput
 import com.rejeq.cpcam.core.stream.output.StreamOutput
 import com.rejeq.cpcam.core.stream.target.TargetState
@@ -73,6 +75,9 @@ class SessionRunner internal constructor(
     }
 
     fun destroy() {
+        // Makes stuck network writes return immediately, so stopping
+        // streams doesn't wait for tcp timeouts
+        output.abort()
         scope?.cancel()
 
         for (stream in streams) {
@@ -130,5 +135,12 @@ class SessionRunner internal constructor(
 
         fun getSupportedFormats(codec: VideoCodec): List<PixFmt> =
             FFmpegOutput.getSupportedFormats(codec)
+
+        fun pickFastestConfig(
+            resolution: Resolution,
+            framerate: Int,
+            bitrate: Int,
+        ): VideoConfig? =
+            FFmpegOutput.pickFastestConfig(resolution, framerate, bitrate)
     }
 }
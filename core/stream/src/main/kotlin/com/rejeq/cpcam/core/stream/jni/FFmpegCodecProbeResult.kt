@@ -0,0 +1,13 @@
+package com.rejeq.cpcam.core.stream.jni
+
+// NOTE: Keep sync with jni CodecProbeResult
+class FFmpegCodecProbeResult(
+    val codecName: String,
+    val pixFmt: Int,
+    val fps: Double,
+    val avgLatencyMs: Double,
+    val maxLatencyMs: Double,
+    val bitrate: Long,
+) {
+    fun isViable(framerate: Int): Boolean = fps >= framerate
+}
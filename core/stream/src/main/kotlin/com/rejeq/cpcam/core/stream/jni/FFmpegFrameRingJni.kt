@@ -0,0 +1,81 @@
+package com.rejeq.cpcam.core.stream.jni
+
+import java.nio.ByteBuffer
+
+/**
+ * Native frame slots for producers other than the camera, e.g. GL readback.
+ *
+ * Producer gets a free slot with [acquire], writes the picture into
+ * [planes] of that slot and sends it with [commit]. Slot is encoded in
+ * place when stream doesn't need conversion, and can be acquired again once
+ * the encoder is done with it. All calls must be made from one thread.
+ *
+ * NOTE: Buffers must not be used after [destroy].
+ */
+internal class FFmpegFrameRingJni private constructor(
+    private val handle: Long,
+    val slotCount: Int,
+    val width: Int,
+    val height: Int,
+    val format: FFmpegPixFmt,
+) {
+    /** Planes of every slot in the order of [format] */
+    val planes: Array<Array<ByteBuffer>> =
+        Array(slotCount) { slot -> getPlanes(handle, slot) }
+
+    /** Row stride of every plane in bytes, same for all slots */
+    val strides: IntArray = getStrides(handle)
+
+    /** Returns index of a free slot or -1 when all slots are in use */
+    fun acquire(): Int = acquire(handle)
+
+    /** Returns acquired slot without sending it */
+    fun cancel(slot: Int) = cancel(handle, slot)
+
+    /** Sends acquired [slot] captured at [ts] (in nanoseconds) to stream */
+    fun commit(stream: FFmpegVideoStreamJni, slot: Int, ts: Long) =
+        commit(handle, stream.handle, slot, ts)
+
+    fun destroy() = destroy(handle)
+
+    private external fun getPlanes(handle: Long, slot: Int): Array<ByteBuffer>
+    private external fun getStrides(handle: Long): IntArray
+    private external fun acquire(handle: Long): Int
+    private external fun cancel(handle: Long, slot: Int)
+    private external fun commit(
+        handle: Long,
+        stream: Long,
+        slot: Int,
+        ts: Long,
+    )
+    private external fun destroy(handle: Long)
+
+    companion object {
+        init {
+            System.loadLibrary("cpcam_jni")
+        }
+
+        /** Returns null when slots can't be allocated */
+        fun create(
+            slotCount: Int,
+            width: Int,
+            height: Int,
+            format: FFmpegPixFmt,
+        ): FFmpegFrameRingJni? {
+            val handle =
+                nCreateFrameRing(slotCount, width, height, format.ordinal)
+            if (handle == 0L) {
+                return null
+            }
+
+            return FFmpegFrameRingJni(handle, slotCount, width, height, format)
+        }
+    }
+}
+
+private external fun nCreateFrameRing(
+    slotCount: Int,
+    width: Int,
+    height: Int,
+    format: Int,
+): Long
@@ -5,7 +5,7 @@ import com.github.michaelbull.result.Ok
 import com.github.michaelbull.result.Result
 
 internal class FFmpegOutputJni(protocol: String, host: String) {
-    private val handle: Long = create(host, protocol)
+    val handle: Long = create(host, protocol)
 
     fun open(): Result<Unit, StreamError> {
         val res = open(handle)
@@ -17,8 +17,12 @@ internal class FFmpegOutputJni(protocol: String, host: String) {
         }
     }
 
-    fun close(): Result<Unit, StreamError> {
-        val res = close(handle)
+    /**
+     * Drains encoders and writes trailer. Blocking io is aborted after
+     * [timeoutMs], so it never waits for network timeouts.
+     */
+    fun close(timeoutMs: Long = CLOSE_TIMEOUT_MS): Result<Unit, StreamError> {
+        val res = close(handle, timeoutMs)
 
         return if (res >= 0) {
             Ok(Unit)
@@ -27,8 +31,82 @@ internal class FFmpegOutputJni(protocol: String, host: String) {
         }
     }
 
+    /** Interrupts blocking io, can be called from any thread */
+    fun abort() = abort(handle)
+
     fun destroy() = destroy(handle)
 
+    /**
+     * Writes local mpegts or mjpeg file through the background writer, other
+     * formats are written directly. Segments are rotated when any limit is
+     * reached, zero disables corresponding limit. Without limits the file is
+     * written to the url as is. Must be called before [open].
+     */
+    fun setRecordingOptions(
+        isEnabled: Boolean,
+        segmentSize: Long,
+        segmentDurationMs: Long,
+    ) = setRecordingOptions(handle, isEnabled, segmentSize, segmentDurationMs)
+
+    /**
+     * Configures "llhls" protocol, where output url is the path of the local
+     * playlist. Targets are rounded to whole frames, [windowSegments]
+     * complete segments are kept in the playlist. Must be called before
+     * [open].
+     */
+    fun setLowLatencyHlsOptions(
+        partTargetMs: Long,
+        segmentTargetMs: Long,
+        windowSegments: Int,
+    ) = setLowLatencyHlsOptions(
+        handle,
+        partTargetMs,
+        segmentTargetMs,
+        windowSegments,
+    )
+
+    /**
+     * Configures pacing of udp:// and rtp:// outputs. Datagrams of every
+     * frame are spread over [spread] part of the frame interval instead of
+     * leaving as a single burst. At most [queueDatagrams] are waiting to be
+     * sent. Must be called before [open].
+     */
+    fun setPacingOptions(
+        isEnabled: Boolean,
+        spread: Float = DEFAULT_PACING_SPREAD,
+        queueDatagrams: Int = DEFAULT_PACING_QUEUE,
+    ) = setPacingOptions(handle, isEnabled, spread, queueDatagrams)
+
+    /**
+     * Configures serving of the stream when output url is
+     * "serve://[host]:port". Client is disconnected when more than
+     * [maxQueueBytes] are waiting to be sent to it. Must be called before
+     * [open].
+     */
+    fun setServerOptions(maxClients: Int, maxQueueBytes: Long) =
+        setServerOptions(handle, maxClients, maxQueueBytes)
+
+    /**
+     * Configures reconnecting of network outputs. Encoders keep running while
+     * connection is lost, streams are resumed from the next keyframe. Delay
+     * between attempts starts from [initialBackoffMs] and is doubled up to
+     * [maxBackoffMs]. Zero [initialBackoffMs] disables reconnecting.
+     * Must be called before [open].
+     */
+    fun setReconnectOptions(initialBackoffMs: Long, maxBackoffMs: Long) =
+        setReconnectOptions(handle, initialBackoffMs, maxBackoffMs)
+
+    /**
+     * Sets bitstream filters applied to every stream before muxing, e.g.
+     * "dump_extra=freq=keyframe" repeats parameter sets on every keyframe.
+     * Must be called before [open].
+     */
+    fun setBitstreamFilters(filters: String) =
+        setBitstreamFilters(handle, filters)
+
+    /** Next frame of every stream is encoded as keyframe */
+    fun requestKeyframe() = requestKeyframe(handle)
+
     fun makeVideoStream(
         config: FFmpegVideoConfig,
     ): Result<FFmpegVideoStreamJni, StreamError> {
@@ -44,13 +122,72 @@ internal class FFmpegOutputJni(protocol: String, host: String) {
     external fun destroy(handle: Long)
 
     private external fun open(handle: Long): Int
-    private external fun close(handle: Long): Int
+    private external fun close(handle: Long, timeoutMs: Long): Int
+    private external fun abort(handle: Long)
+
+    private external fun setRecordingOptions(
+        handle: Long,
+        isEnabled: Boolean,
+        segmentSize: Long,
+        segmentDurationMs: Long,
+    )
+
+    private external fun setPacingOptions(
+        handle: Long,
+        isEnabled: Boolean,
+        spread: Float,
+        queueDatagrams: Int,
+    )
+
+    private external fun setLowLatencyHlsOptions(
+        handle: Long,
+        partTargetMs: Long,
+        segmentTargetMs: Long,
+        windowSegments: Int,
+    )
+
+    /**
+     * Writes packets of the encoded file at [path] (MPEG-TS, H.264/HEVC
+     * Annex B or MJPEG) into this output without encoders, so muxers and
+     * sinks can be benchmarked in isolation. Output is opened and closed by
+     * the call and must not have other streams.
+     *
+     * Packets are written at the rate of their timestamps when [isRealtime]
+     * is set, otherwise as fast as possible. Report is returned even when
+     * replay fails after some packets were written, see
+     * [FFmpegReplayReport.error].
+     *
+     * NOTE: Blocks until the whole file is written.
+     */
+    fun replay(path: String, isRealtime: Boolean): FFmpegReplayReport? =
+        replay(handle, path, isRealtime)
+
+    private external fun setServerOptions(
+        handle: Long,
+        maxClients: Int,
+        maxQueueBytes: Long,
+    )
+
+    private external fun setReconnectOptions(
+        handle: Long,
+        initialBackoffMs: Long,
+        maxBackoffMs: Long,
+    )
+
+    private external fun setBitstreamFilters(handle: Long, filters: String)
+    private external fun requestKeyframe(handle: Long)
 
     private external fun makeVideoStream(
         handle: Long,
         config: FFmpegVideoConfig,
     ): Long
 
+    private external fun replay(
+        handle: Long,
+        path: String,
+        isRealtime: Boolean,
+    ): FFmpegReplayReport?
+
     companion object {
         init {
             System.loadLibrary("cpcam_jni")
@@ -58,7 +195,76 @@ internal class FFmpegOutputJni(protocol: String, host: String) {
 
         fun getSupportedFormats(codec: String): IntArray =
             nGetSupportedFormats(codec)
+
+        /**
+         * Encodes short synthetic clip with every available encoder and pixel
+         * format. Results are ranked from the fastest viable combination and
+         * cached by the native side.
+         *
+         * NOTE: Takes a few seconds on the first call, must not be called
+         * from the main thread.
+         */
+        fun probeCodecs(
+            width: Int,
+            height: Int,
+            framerate: Int,
+            bitrate: Long,
+        ): Array<FFmpegCodecProbeResult> =
+            nProbeCodecs(width, height, framerate, bitrate) ?: emptyArray()
+
+        /**
+         * Encoders of destroyed streams are kept opened for [idleTimeoutMs],
+         * while their estimated memory fits into [maxBytes]. Zero timeout
+         * disables caching.
+         */
+        fun setEncoderCacheOptions(idleTimeoutMs: Long, maxBytes: Long) =
+            nSetEncoderCacheOptions(idleTimeoutMs, maxBytes)
+
+        /** Closes all idle encoders, e.g. when memory is low */
+        fun clearEncoderCache() = nClearEncoderCache()
+
+        /**
+         * Limits native frame and packet buffers of all streams. Above
+         * [softLimitBytes] streams drop every second frame and slow viewers
+         * are disconnected earlier, above [hardLimitBytes] new buffers are
+         * refused. Zero disables the limit.
+         */
+        fun setMemoryBudget(softLimitBytes: Long, hardLimitBytes: Long) =
+            nSetMemoryBudget(softLimitBytes, hardLimitBytes)
+
+        /** Bytes of native buffers that are currently allocated */
+        fun getNativeMemoryUsage(): Long = nGetNativeMemoryUsage()
+
+        /** Highest value of [getNativeMemoryUsage] since the process start */
+        fun getNativeMemoryPeak(): Long = nGetNativeMemoryPeak()
     }
 }
 
+private const val CLOSE_TIMEOUT_MS = 1000L
+private const val DEFAULT_PACING_SPREAD = 0.8f
+private const val DEFAULT_PACING_QUEUE = 1024
+
 private external fun nGetSupportedFormats(codec: String): IntArray
+
+private external fun nProbeCodecs(
+    width: Int,
+    height: Int,
+    framerate: Int,
+    bitrate: Long,
+): Array<FFmpegCodecProbeResult>?
+
+private external fun nSetEncoderCacheOptions(
+    idleTimeoutMs: Long,
+    maxBytes: Long,
+)
+
+private external fun nClearEncoderCache()
+
+private external fun nSetMemoryBudget(
+    softLimitBytes: Long,
+    hardLimitBytes: Long,
+)
+
+private external fun nGetNativeMemoryUsage(): Long
+
+private external fun nGetNativeMemoryPeak(): Long
@@ -0,0 +1,18 @@
+package com.rejeq.cpcam.core.stream.jni
+
+// NOTE: Keep sync with jni QualityStats
+class FFmpegQualityStats(
+    val samples: Long,
+    /** Frames that weren't measured to keep the cpu budget */
+    val skipped: Long,
+    /** Luma PSNR in dB, identical frames are reported as 100 */
+    val lastPsnr: Double,
+    val avgPsnr: Double,
+    val minPsnr: Double,
+    /** Luma SSIM, 1 for identical frames */
+    val lastSsim: Double,
+    val avgSsim: Double,
+    val minSsim: Double,
+    /** Average time of decoding and measuring one frame */
+    val avgCostUs: Long,
+)
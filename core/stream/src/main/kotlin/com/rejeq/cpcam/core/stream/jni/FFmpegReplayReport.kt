@@ -0,0 +1,21 @@
+package com.rejeq.cpcam.core.stream.jni
+
+// NOTE: Keep sync with jni ReplayReport
+class FFmpegReplayReport(
+    val packets: Long,
+    val bytes: Long,
+    val durationUs: Long,
+    val writeP50Us: Long,
+    val writeP90Us: Long,
+    val writeP99Us: Long,
+    val writeMaxUs: Long,
+    val failedWrites: Long,
+    val errorCode: Int,
+) {
+    val throughputMbps: Double
+        get() = if (durationUs > 0) bytes * 8.0 / durationUs else 0.0
+
+    /** Error that stopped the replay, null when the whole file was written */
+    val error: StreamError?
+        get() = StreamError.fromCode(errorCode)
+}
@@ -0,0 +1,23 @@
+package com.rejeq.cpcam.core.stream.jni
+
+// NOTE: Keep sync with jni TimestampStats
+class FFmpegTimestampStats(
+    val frames: Long,
+    /** Smoothed difference between camera and output frame intervals */
+    val jitterUs: Long,
+    val maxJitterUs: Long,
+    /** Smoothed output frame interval, used as frame duration */
+    val intervalUs: Long,
+    /** Output time minus camera time, at most half of the frame interval */
+    val driftUs: Long,
+    /** Frames placed after skipped frame intervals */
+    val gaps: Long,
+    /** Frames dropped as they came within half of the frame interval */
+    val merged: Long,
+    /** Camera timestamps that weren't increasing */
+    val nonMonotonic: Long,
+    /** Times camera clock jumped back and timeline was rebased */
+    val discontinuities: Long,
+    /** Encoded packets which dts was moved forward */
+    val reorderedPackets: Long,
+)
@@ -41,6 +41,9 @@ fun VideoCodec.toFFmpegCodecName() = when (this) {
     VideoCodec.MJPEG -> "mjpeg"
 }
 
+fun String.toVideoCodec(): VideoCodec? =
+    VideoCodec.entries.find { it.toFFmpegCodecName() == this }
+
 fun StreamProtocol.toFFmpegString() = when (this) {
     StreamProtocol.MPEGTS -> "mpegts"
     StreamProtocol.MJPEG -> "mjpeg"
@@ -49,4 +52,5 @@ fun StreamProtocol.toFFmpegString() = when (this) {
     StreamProtocol.RTP -> "rtp"
     StreamProtocol.RTP_MPEGTS -> "rtp_mpegts"
     StreamProtocol.HLS -> "hls"
+    StreamProtocol.LL_HLS -> "llhls"
 }
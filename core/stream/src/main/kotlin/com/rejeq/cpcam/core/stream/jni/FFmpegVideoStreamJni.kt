@@ -35,6 +35,68 @@ internal class FFmpegVideoStreamJni(val handle: Long) {
     fun setResolution(width: Int, height: Int) =
         setResolution(handle, width, height)
 
+    /**
+     * Drops frames which mean luma difference from the last sent frame is
+     * below [threshold], but still sends one frame per [maxSkipMs].
+     * Zero threshold disables dropping.
+     */
+    fun setStaticSceneOptions(threshold: Float, maxSkipMs: Long) =
+        setStaticSceneOptions(handle, threshold, maxSkipMs)
+
+    /**
+     * Encodes frames on [count] encoders in parallel when codec is
+     * intra-only (MJPEG), packets keep their order. Ignored for other codecs.
+     */
+    fun setEncoderWorkers(count: Int) = setEncoderWorkers(handle, count)
+
+    /**
+     * Keeps a JPEG of every [intervalFrames]-th frame downscaled to at most
+     * [maxWidth], for thumbnails. Encoded on a low-priority thread, so
+     * snapshots are skipped rather than delaying the stream. Zero interval
+     * disables snapshots.
+     */
+    fun setSnapshotOptions(
+        intervalFrames: Int,
+        maxWidth: Int = DEFAULT_SNAPSHOT_WIDTH,
+        quality: Int = DEFAULT_SNAPSHOT_QUALITY,
+    ) = setSnapshotOptions(handle, intervalFrames, maxWidth, quality)
+
+    /** Returns the latest snapshot JPEG or null when there is none yet */
+    fun getSnapshot(): ByteArray? = getSnapshot(handle)
+
+    /**
+     * Decodes every [intervalFrames]-th encoded frame and measures its
+     * PSNR/SSIM against the encoder input. Measurements take at most
+     * [maxCpuPercent] of one core on average, samples are skipped beyond it.
+     * Results are posted as [NativeEventType.QualitySample] and summed up in
+     * [getQualityStats]. Zero interval disables the monitor.
+     *
+     * @return false when the encoder is not intra-only (MJPEG)
+     */
+    fun setQualityOptions(
+        intervalFrames: Int,
+        maxCpuPercent: Int = DEFAULT_QUALITY_CPU_PERCENT,
+    ): Boolean = setQualityOptions(handle, intervalFrames, maxCpuPercent)
+
+    fun getQualityStats(): FFmpegQualityStats? = getQualityStats(handle)
+
+    /**
+     * Embeds capture and encoding timestamps into every encoded frame (SEI
+     * for H.264/HEVC, comment segment for MJPEG), so latency can be measured
+     * by the receiver.
+     */
+    fun setLatencyStamps(enabled: Boolean) = setLatencyStamps(handle, enabled)
+
+    /** Returns -1 until the first packet is written after [start] */
+    fun getTimeToFirstPacketUs(): Long = getTimeToFirstPacketUs(handle)
+
+    /**
+     * Jitter, gaps and corrections of camera timestamps, see
+     * [FFmpegTimestampStats]
+     */
+    fun getTimestampStats(): FFmpegTimestampStats? =
+        getTimestampStats(handle)
+
     fun getWidth(): Int = getWidth(handle)
 
     fun getHeight(): Int = getHeight(handle)
@@ -43,6 +105,9 @@ internal class FFmpegVideoStreamJni(val handle: Long) {
 
     fun stop() = stop(handle)
 
+    /** Next frame is encoded as keyframe, so new viewers can join quickly */
+    fun requestKeyframe() = requestKeyframe(handle)
+
     private external fun send(
         handle: Long,
         ts: Long,
@@ -58,9 +123,38 @@ internal class FFmpegVideoStreamJni(val handle: Long) {
     private external fun destroy(handle: Long)
 
     private external fun setResolution(handle: Long, width: Int, height: Int)
+    private external fun setStaticSceneOptions(
+        handle: Long,
+        threshold: Float,
+        maxSkipMs: Long,
+    )
+    private external fun setEncoderWorkers(handle: Long, count: Int)
+    private external fun setSnapshotOptions(
+        handle: Long,
+        intervalFrames: Int,
+        maxWidth: Int,
+        quality: Int,
+    )
+    private external fun getSnapshot(handle: Long): ByteArray?
+    private external fun setQualityOptions(
+        handle: Long,
+        intervalFrames: Int,
+        maxCpuPercent: Int,
+    ): Boolean
+    private external fun getQualityStats(handle: Long): FFmpegQualityStats?
+    private external fun setLatencyStamps(handle: Long, enabled: Boolean)
+    private external fun getTimeToFirstPacketUs(handle: Long): Long
+    private external fun getTimestampStats(
+        handle: Long,
+    ): FFmpegTimestampStats?
     private external fun getWidth(handle: Long): Int
     private external fun getHeight(handle: Long): Int
 
     private external fun start(handle: Long)
     private external fun stop(handle: Long)
+    private external fun requestKeyframe(handle: Long)
 }
+
+private const val DEFAULT_SNAPSHOT_WIDTH = 320
+private const val DEFAULT_SNAPSHOT_QUALITY = 8
+private const val DEFAULT_QUALITY_CPU_PERCENT = 5
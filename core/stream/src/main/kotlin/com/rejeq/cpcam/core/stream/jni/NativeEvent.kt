@@ -0,0 +1,62 @@
+package com.rejeq.cpcam.core.stream.jni
+
+// NOTE: Keep sync with jni EventType
+enum class NativeEventType(val code: Int) {
+    /** [NativeEvent.code] is [StreamError], value is AVERROR code or zero */
+    Error(0),
+
+    /** [NativeEvent.code] is [NativeCongestionReason] */
+    Congestion(1),
+
+    /** [NativeEvent.value] is pts of the keyframe in microseconds */
+    KeyframeSent(2),
+
+    /**
+     * [NativeEvent.code] is packets and [NativeEvent.value] is bytes written
+     * since the previous tick
+     */
+    StatsTick(3),
+
+    /** [NativeEvent.value] events were dropped, queue was full */
+    EventsLost(4),
+
+    /**
+     * [NativeEvent.code] is luma SSIM in 1/10000 and [NativeEvent.value] is
+     * luma PSNR in millidecibels of a sampled frame
+     */
+    QualitySample(5),
+    ;
+
+    companion object {
+        fun fromCode(code: Int): NativeEventType? =
+            entries.find { it.code == code }
+    }
+}
+
+// NOTE: Keep sync with jni CongestionReason
+enum class NativeCongestionReason(val code: Int) {
+    /** Stream sheds frames, value is memory pressure level */
+    MemoryPressure(0),
+
+    /** Paced udp sender queue is full, value is queued datagrams */
+    PacerQueueFull(1),
+
+    /** Server client was dropped, value is its queued bytes */
+    ClientQueueFull(2),
+    ;
+
+    companion object {
+        fun fromCode(code: Int): NativeCongestionReason? =
+            entries.find { it.code == code }
+    }
+}
+
+class NativeEvent(
+    val type: NativeEventType,
+    /** Handle of the stream or output that posted the event, or zero */
+    val source: Long,
+    val code: Int,
+    val value: Long,
+    /** Monotonic posting time in microseconds */
+    val timeUs: Long,
+)
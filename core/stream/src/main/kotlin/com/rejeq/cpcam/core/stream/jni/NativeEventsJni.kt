@@ -0,0 +1,55 @@
+package com.rejeq.cpcam.core.stream.jni
+
+import kotlinx.coroutines.Dispatchers
+import kotlinx.coroutines.currentCoroutineContext
+import kotlinx.coroutines.flow.Flow
+import kotlinx.coroutines.flow.flow
+import kotlinx.coroutines.flow.flowOn
+import kotlinx.coroutines.isActive
+
+/**
+ * Events pushed by native streams and outputs: runtime errors, congestion,
+ * sent keyframes and periodic stats.
+ *
+ * Events are queued natively and taken in batches, a batch is delivered
+ * as soon as the first event of it is posted. Queue is process wide, so
+ * [events] must have a single collector.
+ */
+object NativeEventsJni {
+    init {
+        System.loadLibrary("cpcam_jni")
+    }
+
+    // NOTE: Keep sync with jni EVENT_FIELDS
+    private const val EVENT_FIELDS = 5
+
+    // Bounds the time cancelled collector stays blocked in native
+    private const val POLL_TIMEOUT_MS = 500
+
+    val events: Flow<List<NativeEvent>> = flow {
+        while (currentCoroutineContext().isActive) {
+            val batch = decode(poll(POLL_TIMEOUT_MS) ?: continue)
+            if (batch.isNotEmpty()) {
+                emit(batch)
+            }
+        }
+    }.flowOn(Dispatchers.IO)
+
+    private fun decode(fields: LongArray): List<NativeEvent> =
+        (0 until fields.size / EVENT_FIELDS).mapNotNull { i ->
+            val base = i * EVENT_FIELDS
+            val type = NativeEventType.fromCode(fields[base].toInt())
+                ?: return@mapNotNull null
+
+            NativeEvent(
+                type = type,
+                source = fields[base + 1],
+                code = fields[base + 2].toInt(),
+                value = fields[base + 3],
+                timeUs = fields[base + 4],
+            )
+        }
+
+    /** Returns events as [EVENT_FIELDS] longs each, empty on timeout */
+    private external fun poll(timeoutMs: Int): LongArray?
+}
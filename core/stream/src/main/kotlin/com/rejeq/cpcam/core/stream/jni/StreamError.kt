@@ -16,6 +16,7 @@ enum class StreamError(val code: Int) {
     FFmpegStreamCreationFailed(-103),
     FFmpegStreamParametersFailed(-104),
     FFmpegWriteFailed(-105),
+    FFmpegEncodeFailed(-106),
 
     // Video specific errors
     VideoInvalidFormat(-200),
@@ -23,6 +24,7 @@ enum class StreamError(val code: Int) {
     VideoInvalidPixelFormat(-202),
     VideoInvalidPlaneCount(-203),
     VideoInvalidStride(-204),
+    VideoConversionFailed(-205),
     ;
 
     fun toStreamError(): StreamErrorKind = StreamErrorKind.FFmpegError(this)
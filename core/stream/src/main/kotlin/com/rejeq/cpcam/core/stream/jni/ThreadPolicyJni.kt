@@ -0,0 +1,37 @@
+package com.rejeq.cpcam.core.stream.jni
+
+/**
+ * Controls placement and priority of the native pipeline threads by their
+ * role. Threads of the running session keep their options, except the
+ * encoder role that is applied to the thread calling
+ * [FFmpegVideoStreamJni.send] on the next frame.
+ *
+ * Applied options can be checked with `taskset -p <tid>` and
+ * `/proc/<pid>/task/<tid>/{comm,stat,sched}`.
+ */
+object ThreadPolicyJni {
+    init {
+        System.loadLibrary("cpcam_jni")
+    }
+
+    const val ROLE_ENCODER = 0
+    const val ROLE_WRITER = 1
+    const val ROLE_NETWORK = 2
+    const val ROLE_BACKGROUND = 3
+
+    const val CORES_ANY = 0
+    const val CORES_BIG = 1
+    const val CORES_LITTLE = 2
+
+    /**
+     * @param nice Nice value of the threads, negative values raise priority
+     * @param realtimePriority SCHED_FIFO priority, zero keeps the default
+     * scheduler. Falls back to [nice] when elevation isn't allowed.
+     */
+    external fun setRoleOptions(
+        role: Int,
+        cores: Int,
+        nice: Int,
+        realtimePriority: Int,
+    )
+}
@@ -0,0 +1,23 @@
+package com.rejeq.cpcam.core.stream.jni
+
+/**
+ * Controls native in-memory trace log. Records are kept in a ring buffer and
+ * written into logcat only on [dump] or after native error. Tracing is
+ * disabled by default.
+ */
+object TraceLogJni {
+    init {
+        System.loadLibrary("cpcam_jni")
+    }
+
+    external fun setEnabled(enabled: Boolean)
+
+    /**
+     * Ffmpeg messages above [level] (AV_LOG_* value, AV_LOG_VERBOSE by
+     * default) are dropped before formatting. Messages above AV_LOG_INFO
+     * are kept only in the trace log.
+     */
+    external fun setFfmpegLogLevel(level: Int)
+
+    external fun dump()
+}
@@ -6,6 +6,7 @@ import com.github.michaelbull.result.Result
 import com.github.michaelbull.result.map
 import com.github.michaelbull.result.mapError
 import com.rejeq.cpcam.core.data.model.PixFmt
+import com.rejeq.cpcam.core.data.model.Resolution
 import com.rejeq.cpcam.core.data.model.StreamProtocol
 import com.rejeq.cpcam.core.data.model.VideoCodec
 import com.rejeq.cpcam.core.data.model.VideoConfig
@@ -17,6 +18,7 @@ import com.rejeq.cpcam.core.stream.jni.toFFmpegCodecName
 import com.rejeq.cpcam.core.stream.jni.toFFmpegConfig
 import com.rejeq.cpcam.core.stream.jni.toFFmpegString
 import com.rejeq.cpcam.core.stream.jni.toPixFmt
+import com.rejeq.cpcam.core.stream.jni.toVideoCodec
 import com.rejeq.cpcam.core.stream.relay.FFmpegVideoRelay
 import com.rejeq.cpcam.core.stream.relay.VideoRelay
 
@@ -25,6 +27,16 @@ internal class FFmpegOutput(val protocol: StreamProtocol, host: String) :
     private var detail: FFmpegOutputJni? =
         FFmpegOutputJni(protocol.toFFmpegString(), host)
 
+    init {
+        // Viewers may join transport stream at any point, so parameter sets
+        // must be repeated in-band instead of being sent only once
+        if (protocol == StreamProtocol.MPEGTS ||
+            protocol == StreamProtocol.RTP_MPEGTS
+        ) {
+            detail?.setBitstreamFilters(REPEAT_HEADERS_FILTER)
+        }
+    }
+
     override fun makeVideoRelay(
         config: VideoConfig,
     ): Result<VideoRelay, StreamError> {
@@ -53,6 +65,10 @@ internal class FFmpegOutput(val protocol: StreamProtocol, host: String) :
         return detail.close().mapError { it.toStreamError() }
     }
 
+    override fun abort() {
+        detail?.abort()
+    }
+
     override fun destroy() {
         detail?.destroy()
         detail = null
@@ -64,7 +80,39 @@ internal class FFmpegOutput(val protocol: StreamProtocol, host: String) :
             FFmpegOutputJni.getSupportedFormats(codec.toFFmpegCodecName()).map {
                 FFmpegPixFmt.entries[it].toPixFmt()
             }
+
+        /**
+         * Returns config with the fastest encoder and pixel format that can
+         * keep up with [framerate] on this device, or null if there is none.
+         */
+        fun pickFastestConfig(
+            resolution: Resolution,
+            framerate: Int,
+            bitrate: Int,
+        ): VideoConfig? {
+            val results = FFmpegOutputJni.probeCodecs(
+                resolution.width,
+                resolution.height,
+                framerate,
+                bitrate.toLong(),
+            )
+
+            val best = results.firstOrNull { res ->
+                res.isViable(framerate) && res.codecName.toVideoCodec() != null
+            } ?: return null
+
+            Log.i(TAG, "Fastest encoder: ${best.codecName} (${best.fps} fps)")
+
+            return VideoConfig(
+                codecName = best.codecName.toVideoCodec(),
+                pixFmt = FFmpegPixFmt.entries[best.pixFmt].toPixFmt(),
+                bitrate = bitrate,
+                framerate = framerate,
+                resolution = resolution,
+            )
+        }
     }
 }
 
 private const val TAG = "FFmpegOutput"
+private const val REPEAT_HEADERS_FILTER = "dump_extra=freq=keyframe"
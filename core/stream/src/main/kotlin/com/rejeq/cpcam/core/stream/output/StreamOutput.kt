@@ -13,5 +13,8 @@ interface StreamOutput {
     fun open(): Result<Unit, StreamErrorKind>
     fun close(): Result<Unit, StreamErrorKind>
 
+    /** Interrupts blocking io of the output, can be called from any thread */
+    fun abort()
+
     fun destroy()
 }
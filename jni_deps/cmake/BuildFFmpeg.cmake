@@ -81,6 +81,9 @@ set(CONFIGURE_COMMAND ${FFMPEG_SOURCE_DIR}/src/ffmpeg/configure
     --enable-bsf=hevc_metadata
 
     --enable-encoder=mjpeg
+    --enable-decoder=mjpeg
+
+    --enable-bsf=dump_extra
 
     --enable-muxer=mpegts
     --enable-muxer=mjpeg
@@ -89,6 +92,16 @@ set(CONFIGURE_COMMAND ${FFMPEG_SOURCE_DIR}/src/ffmpeg/configure
     --enable-muxer=rtp
     --enable-muxer=rtp_mpegts
     --enable-muxer=hls
+    --enable-muxer=mp4
+    --enable-muxer=flv
+
+    --enable-demuxer=mpegts
+    --enable-demuxer=h264
+    --enable-demuxer=hevc
+    --enable-demuxer=mjpeg
+    --enable-parser=h264
+    --enable-parser=hevc
+    --enable-parser=mjpeg
 
     --enable-mbedtls
 